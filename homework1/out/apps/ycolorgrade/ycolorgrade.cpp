@@ -26,17 +26,239 @@
 // POSSIBILITY OF SUCH DAMAGE.
 //
 
+#include <yocto/ext/stb_image.h>
+#include <yocto/ext/tinyexr.h>
 #include <yocto/yocto_commonio.h>
 #include <yocto/yocto_image.h>
 #include <yocto/yocto_math.h>
+#include <yocto/yocto_parallel.h>
 #include <yocto_colorgrade/yocto_colorgrade.h>
 using namespace yocto;
 
+#include <algorithm>
+#include <condition_variable>
+#include <filesystem>
+#include <unordered_map>
+
+// check if a file can be loaded as an image
+static bool is_image_filename(const string& filename) {
+  auto ext = path_extension(filename);
+  std::transform(ext.begin(), ext.end(), ext.begin(),
+      [](char c) { return (char)std::tolower(c); });
+  return ext == ".hdr" || ext == ".exr" || ext == ".pfm" || ext == ".png" ||
+         ext == ".jpg" || ext == ".jpeg" || ext == ".tga" || ext == ".bmp";
+}
+
+// read the image size from the file header, without decoding the pixels
+static bool load_image_size(const string& filename, vec2i& size) {
+  auto ext = path_extension(filename);
+  std::transform(ext.begin(), ext.end(), ext.begin(),
+      [](char c) { return (char)std::tolower(c); });
+  if (ext == ".exr") {
+    auto version = EXRVersion{};
+    if (ParseEXRVersionFromFile(&version, filename.c_str()) != 0) return false;
+    auto header = EXRHeader{};
+    InitEXRHeader(&header);
+    if (ParseEXRHeaderFromFile(
+            &header, &version, filename.c_str(), nullptr) != 0)
+      return false;
+    size = {header.data_window.max_x - header.data_window.min_x + 1,
+        header.data_window.max_y - header.data_window.min_y + 1};
+    FreeEXRHeader(&header);
+    return true;
+  } else if (ext == ".pfm") {
+    auto fs = open_file(filename, "rb");
+    if (!fs) return false;
+    auto buffer = array<char, 4096>{};
+    if (!read_line(fs, buffer) || !read_line(fs, buffer)) return false;
+    return sscanf(buffer.data(), "%d %d", &size.x, &size.y) == 2;
+  } else {
+    auto ncomp = 0;
+    return stbi_info(filename.c_str(), &size.x, &size.y, &ncomp) != 0;
+  }
+}
+
+// get the images to grade from a directory or from a list file with one
+// filename per line; empty lines and lines starting with # are skipped
+static bool load_batch_filenames(const string& filename,
+    vector<string>& filenames, bool& from_directory, string& error) {
+  filenames.clear();
+  from_directory = path_isdir(filename);
+  if (from_directory) {
+    for (auto& entry : list_directory(filename)) {
+      if (path_isfile(entry) && is_image_filename(entry))
+        filenames.push_back(entry);
+    }
+    std::sort(filenames.begin(), filenames.end());
+  } else {
+    auto text = ""s;
+    if (!load_text(filename, text, error)) return false;
+    for (auto pos = (size_t)0; pos < text.size();) {
+      auto end  = std::min(text.find('\n', pos), text.size());
+      auto line = text.substr(pos, end - pos);
+      pos       = end + 1;
+      auto beg  = line.find_first_not_of(" \t\r");
+      if (beg == string::npos || line[beg] == '#') continue;
+      auto last = line.find_last_not_of(" \t\r");
+      filenames.push_back(line.substr(beg, last + 1 - beg));
+    }
+  }
+  if (filenames.empty()) {
+    error = filename + ": no images to grade";
+    return false;
+  }
+  return true;
+}
+
+// get the output filenames of the graded images; relative entries of list
+// files keep their path, so that images with the same name in different
+// directories are saved apart; two images that would still be saved to the
+// same file are an error
+static bool make_batch_outnames(const vector<string>& filenames,
+    bool from_directory, const string& outdir, const string& outext,
+    vector<string>& outnames, string& error) {
+  outnames.clear();
+  auto inputs = std::unordered_map<string, string>{};
+  for (auto& filename : filenames) {
+    auto path = std::filesystem::u8path(filename).lexically_normal();
+    auto keep = !from_directory && path.is_relative() &&
+                !path.empty() && *path.begin() != "..";
+    auto name    = keep ? path.generic_u8string() : path_filename(filename);
+    auto outname = path_join(outdir, replace_extension(name, outext));
+    auto [it, inserted] = inputs.insert({outname, filename});
+    if (!inserted) {
+      error = it->second + " and " + filename + " are both saved to " +
+              outname;
+      return false;
+    }
+    outnames.push_back(outname);
+  }
+  return true;
+}
+
+// bytes of image data that may be alive at the same time in the pipeline;
+// reserve() waits until the image fits, but always lets one image through
+struct memory_budget {
+  memory_budget(size_t limit) : limit{limit} {}
+
+  void reserve(size_t bytes) {
+    auto lock = std::unique_lock<std::mutex>{mutex};
+    released.wait(lock, [&] { return used == 0 || used + bytes <= limit; });
+    used += bytes;
+  }
+  void release(size_t bytes) {
+    auto lock = std::unique_lock<std::mutex>{mutex};
+    used -= bytes;
+    released.notify_all();
+  }
+
+ private:
+  std::mutex              mutex;
+  std::condition_variable released;
+  size_t                  used  = 0;
+  size_t                  limit = 0;
+};
+
+// an image moving through the batch pipeline
+struct batch_image {
+  string       filename = "";
+  string       outname  = "";
+  image<vec4f> img      = {};
+  size_t       bytes    = 0;
+  string       error    = "";
+};
+
+// grade all images in a directory or list file and save them in outdir;
+// loading of the next image, grading of the current one and saving of the
+// previous one run concurrently, connected by bounded queues
+static bool grade_batch(const string& filename, const string& outdir,
+    const string& outext, const grade_params& params, size_t memory,
+    string& error) {
+  // images to grade
+  auto filenames      = vector<string>{};
+  auto outnames       = vector<string>{};
+  auto from_directory = false;
+  if (!load_batch_filenames(filename, filenames, from_directory, error))
+    return false;
+  if (!make_batch_outnames(
+          filenames, from_directory, outdir, outext, outnames, error))
+    return false;
+  for (auto& outname : outnames) {
+    if (!make_directory(path_dirname(outname), error)) return false;
+  }
+
+  // pipeline state
+  auto budget  = memory_budget{memory};
+  auto loaded  = bounded_queue<batch_image>{2};
+  auto graded  = bounded_queue<batch_image>{2};
+  auto nerrors = atomic<int>{0};
+
+  // load images; an image accounts for its float pixels, the graded copy
+  // and the byte pixels decoded or written out, and its memory is reserved
+  // from the header size before decoding
+  auto loader = run_async([&]() {
+    for (auto idx = (size_t)0; idx < filenames.size(); idx++) {
+      auto item = batch_image{filenames[idx], outnames[idx]};
+      auto size = zero2i;
+      if (load_image_size(item.filename, size)) {
+        item.bytes = (size_t)max(size.x, 0) * (size_t)max(size.y, 0) *
+                     (2 * sizeof(vec4f) + sizeof(vec4b));
+        budget.reserve(item.bytes);
+      }
+      load_image(item.filename, item.img, item.error);
+      if (!loaded.push(std::move(item))) break;
+    }
+    loaded.close();
+  });
+
+  // save images; failed images are reported here, so that progress and
+  // errors are printed from a single thread
+  auto saver = run_async([&]() {
+    auto item  = batch_image{};
+    auto count = 0;
+    print_progress("grade images", count, (int)filenames.size());
+    while (graded.pop(item)) {
+      if (item.error.empty())
+        save_image(item.outname, float_to_byte(item.img), item.error);
+      if (!item.error.empty()) {
+        print_info(item.error);
+        nerrors++;
+      }
+      item.img = {};
+      budget.release(item.bytes);
+      print_progress("grade images", ++count, (int)filenames.size());
+    }
+  });
+
+  // grade images
+  auto item = batch_image{};
+  while (loaded.pop(item)) {
+    if (item.error.empty()) item.img = grade_image(item.img, params);
+    graded.push(std::move(item));
+  }
+  graded.close();
+
+  // wait for the other stages
+  loader.get();
+  saver.get();
+
+  // done
+  if (nerrors != 0) {
+    error = std::to_string((int)nerrors) + " of " +
+            std::to_string(filenames.size()) + " images failed";
+    return false;
+  }
+  return true;
+}
+
 int main(int argc, const char* argv[]) {
   // command line parameters
   auto params   = grade_params{};
   auto output   = "out.png"s;
   auto filename = "img.hdr"s;
+  auto batch    = false;
+  auto outext   = ".png"s;
+  auto memory   = 1024;
 
   // parse command line
   auto cli = make_cli("yimgproc", "Transform images");
@@ -61,13 +283,28 @@ int main(int argc, const char* argv[]) {
   add_option(cli, "--puntinismo,-pn", params.pn, "Puntinismo");
   // add_option(cli, "--stippling,-st", params.stippling, "stiplling");
 
-  add_option(cli, "--outimage,-o", output, "Output image filename", true);
-  add_option(cli, "image", filename, "Input image filename", true);
+  add_option(cli, "--batch/--no-batch,-b", batch,
+      "Grade all images in a directory or list file");
+  add_option(cli, "--outext", outext, "Output image extension in batch mode");
+  add_option(cli, "--memory", memory, "Memory budget in batch mode (MB)");
+
+  add_option(cli, "--outimage,-o", output,
+      "Output image filename, or directory in batch mode", true);
+  add_option(cli, "image", filename,
+      "Input image filename, or directory or list file in batch mode", true);
   parse_cli(cli, argc, argv);
 
   // error buffer
   auto ioerror = ""s;
 
+  // batch
+  if (batch) {
+    if (!grade_batch(filename, output, outext, params,
+            (size_t)max(memory, 1) << 20, ioerror))
+      print_fatal(ioerror);
+    return 0;
+  }
+
   // load
   auto img = image<vec4f>{};
   if (!load_image(filename, img, ioerror)) print_fatal(ioerror);
@@ -43,6 +43,12 @@
 #include "yocto_commonio.h"
 #include "yocto_noise.h"
 #include "yocto_parallel.h"
+#include "yocto_simd.h"
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <immintrin.h>
+#include <intrin.h>
+#endif
 
 // -----------------------------------------------------------------------------
 // IMPLEMENTATION FOR COLOR UTILITIES
@@ -493,6 +499,119 @@ vec3f eval_image(const image<vec3b>& img, const vec2f& uv, bool as_linear,
 
 }  // namespace yocto
 
+// -----------------------------------------------------------------------------
+// IMPLEMENTATION FOR PIXEL KERNELS
+// -----------------------------------------------------------------------------
+namespace yocto {
+
+// Check whether both the cpu and the os support AVX2.
+static bool cpu_supports_avx2() {
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+  int info[4];
+  __cpuid(info, 0);
+  if (info[0] < 7) return false;
+  __cpuid(info, 1);
+  auto osxsave = (info[2] & (1 << 27)) != 0;
+  auto avx     = (info[2] & (1 << 28)) != 0;
+  if (!osxsave || !avx || (_xgetbv(0) & 6) != 6) return false;
+  __cpuidex(info, 7, 0);
+  return (info[1] & (1 << 5)) != 0;
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+  return __builtin_cpu_supports("avx2");
+#else
+  return false;
+#endif
+}
+
+// Pixel kernels for an instruction set, or for the best supported one if
+// that is not available.
+static pixel_kernels make_pixel_kernels(image_simd_type type) {
+  auto kernels = pixel_kernels{};
+  if ((type == image_simd_type::automatic || type == image_simd_type::avx2) &&
+      cpu_supports_avx2() && get_avx2_pixel_kernels(kernels))
+    return kernels;
+#ifdef YOCTO_SSE2
+  if (type != image_simd_type::scalar)
+    return make_pixel_kernels<vfloat4>(simd_type::sse2);
+#endif
+  return make_pixel_kernels<vfloat1>(simd_type::scalar);
+}
+
+// Kernels used by the image functions.
+static pixel_kernels& get_pixel_kernels() {
+  static auto kernels = make_pixel_kernels(image_simd_type::automatic);
+  return kernels;
+}
+
+// Set the instruction set used for image conversions.
+image_simd_type set_image_simd(image_simd_type type) {
+  auto& kernels = get_pixel_kernels();
+  kernels       = make_pixel_kernels(type);
+  switch (kernels.type) {
+    case simd_type::scalar: return image_simd_type::scalar;
+    case simd_type::sse2: return image_simd_type::sse2;
+    case simd_type::avx2: return image_simd_type::avx2;
+    default: return image_simd_type::scalar;
+  }
+}
+
+// Kernel parameters.
+static tonemap_kernel_params make_tonemap_kernel_params(
+    float exposure, bool filmic, bool srgb) {
+  auto kparams   = tonemap_kernel_params{};
+  kparams.scale  = exposure != 0 ? exp2(exposure) : 1;
+  kparams.filmic = filmic;
+  kparams.srgb   = srgb;
+  return kparams;
+}
+static colorgrade_kernel_params make_colorgrade_kernel_params(
+    bool linear, const colorgrade_params& params) {
+  auto kparams           = colorgrade_kernel_params{};
+  kparams.exposure       = params.exposure != 0;
+  kparams.scale          = exp2(params.exposure);
+  kparams.tint           = params.tint != vec3f{1, 1, 1};
+  kparams.tint_rgb[0]    = params.tint.x;
+  kparams.tint_rgb[1]    = params.tint.y;
+  kparams.tint_rgb[2]    = params.tint.z;
+  kparams.grey           = linear ? 0.18f : 0.5f;
+  kparams.lincontrast    = params.lincontrast != 0.5f;
+  kparams.lincontrast2   = params.lincontrast * 2;
+  kparams.logcontrast    = params.logcontrast != 0.5f;
+  kparams.logcontrast2   = params.logcontrast * 2;
+  kparams.log_grey       = log2(kparams.grey);
+  kparams.linsaturation  = params.linsaturation != 0.5f;
+  kparams.linsaturation2 = params.linsaturation * 2;
+  kparams.filmic         = params.filmic;
+  kparams.srgb           = linear && params.srgb;
+  kparams.contrast       = params.contrast != 0.5f;
+  kparams.contrast_gain  = 1 - params.contrast;
+  kparams.saturation     = params.saturation != 0.5f;
+  kparams.saturation2    = params.saturation * 2;
+  kparams.lgg = params.shadows != 0.5f || params.midtones != 0.5f ||
+                params.highlights != 0.5f ||
+                params.shadows_color != vec3f{1, 1, 1} ||
+                params.midtones_color != vec3f{1, 1, 1} ||
+                params.highlights_color != vec3f{1, 1, 1};
+  if (kparams.lgg) {
+    auto lift  = params.shadows_color;
+    auto gamma = params.midtones_color;
+    auto gain  = params.highlights_color;
+
+    lift      = lift - mean(lift) + params.shadows - (float)0.5;
+    gain      = gain - mean(gain) + params.highlights + (float)0.5;
+    auto grey = gamma - mean(gamma) + params.midtones;
+    gamma     = log(((float)0.5 - lift) / (gain - lift)) / log(grey);
+    for (auto k = 0; k < 3; k++) {
+      kparams.lift[k]      = lift[k];
+      kparams.gain[k]      = gain[k];
+      kparams.inv_gamma[k] = 1 / gamma[k];
+    }
+  }
+  return kparams;
+}
+
+}  // namespace yocto
+
 // -----------------------------------------------------------------------------
 // IMPLEMENTATION FOR IMAGE UTILITIES
 // -----------------------------------------------------------------------------
@@ -523,12 +642,12 @@ inline void get_region(image<T>& clipped, const image<T>& img,
 // Conversion from/to floats.
 image<vec4f> byte_to_float(const image<vec4b>& bt) {
   auto fl = image<vec4f>{bt.imsize()};
-  for (auto i = 0ull; i < fl.count(); i++) fl[i] = byte_to_float(bt[i]);
+  get_pixel_kernels().byte_to_float(&fl.data()->x, &bt.data()->x, fl.count());
   return fl;
 }
 image<vec4b> float_to_byte(const image<vec4f>& fl) {
   auto bt = image<vec4b>{fl.imsize()};
-  for (auto i = 0ull; i < bt.count(); i++) bt[i] = float_to_byte(fl[i]);
+  get_pixel_kernels().float_to_byte(&bt.data()->x, &fl.data()->x, bt.count());
   return bt;
 }
 
@@ -571,24 +690,26 @@ image<vec4s> float_to_ushort(const image<vec4f>& fl) {
 // Conversion between linear and gamma-encoded images.
 image<vec4f> srgb_to_rgb(const image<vec4f>& srgb) {
   auto rgb = image<vec4f>{srgb.imsize()};
-  for (auto i = 0ull; i < rgb.count(); i++) rgb[i] = srgb_to_rgb(srgb[i]);
+  get_pixel_kernels().srgb_to_rgb(
+      &rgb.data()->x, &srgb.data()->x, rgb.count());
   return rgb;
 }
 image<vec4f> rgb_to_srgb(const image<vec4f>& rgb) {
   auto srgb = image<vec4f>{rgb.imsize()};
-  for (auto i = 0ull; i < srgb.count(); i++) srgb[i] = rgb_to_srgb(rgb[i]);
+  get_pixel_kernels().rgb_to_srgb(
+      &srgb.data()->x, &rgb.data()->x, srgb.count());
   return srgb;
 }
 image<vec4f> srgb_to_rgb(const image<vec4b>& srgb) {
   auto rgb = image<vec4f>{srgb.imsize()};
-  for (auto i = 0ull; i < rgb.count(); i++)
-    rgb[i] = srgb_to_rgb(byte_to_float(srgb[i]));
+  get_pixel_kernels().srgbb_to_rgb(
+      &rgb.data()->x, &srgb.data()->x, rgb.count());
   return rgb;
 }
 image<vec4b> rgb_to_srgbb(const image<vec4f>& rgb) {
   auto srgb = image<vec4b>{rgb.imsize()};
-  for (auto i = 0ull; i < srgb.count(); i++)
-    srgb[i] = float_to_byte(rgb_to_srgb(rgb[i]));
+  get_pixel_kernels().rgb_to_srgbb(
+      &srgb.data()->x, &rgb.data()->x, srgb.count());
   return srgb;
 }
 
@@ -705,23 +826,29 @@ image<byte> rgba_to_gray(const image<vec4b>& rgba) {
 // Apply exposure and filmic tone mapping
 image<vec4f> tonemap_image(
     const image<vec4f>& hdr, float exposure, bool filmic, bool srgb) {
-  auto ldr = image<vec4f>{hdr.imsize()};
-  for (auto i = 0ull; i < hdr.count(); i++)
-    ldr[i] = tonemap(hdr[i], exposure, filmic, srgb);
+  auto ldr     = image<vec4f>{hdr.imsize()};
+  auto kparams = make_tonemap_kernel_params(exposure, filmic, srgb);
+  get_pixel_kernels().tonemap(
+      &ldr.data()->x, &hdr.data()->x, hdr.count(), kparams);
   return ldr;
 }
 image<vec4b> tonemap_imageb(
     const image<vec4f>& hdr, float exposure, bool filmic, bool srgb) {
-  auto ldr = image<vec4b>{hdr.imsize()};
-  for (auto i = 0ull; i < hdr.count(); i++)
-    ldr[i] = float_to_byte(tonemap(hdr[i], exposure, filmic, srgb));
+  auto ldr     = image<vec4b>{hdr.imsize()};
+  auto kparams = make_tonemap_kernel_params(exposure, filmic, srgb);
+  get_pixel_kernels().tonemapb(
+      &ldr.data()->x, &hdr.data()->x, hdr.count(), kparams);
   return ldr;
 }
 
 void tonemap_image_mt(image<vec4f>& ldr, const image<vec4f>& hdr,
     float exposure, bool filmic, bool srgb) {
-  parallel_for(hdr.width(), hdr.height(), [&](int i, int j) {
-    ldr[{i, j}] = tonemap(hdr[{i, j}], exposure, filmic, srgb);
+  auto& kernels = get_pixel_kernels();
+  auto  kparams = make_tonemap_kernel_params(exposure, filmic, srgb);
+  parallel_for(hdr.height(), [&](int j) {
+    auto offset = (size_t)j * (size_t)hdr.width() * 4;
+    kernels.tonemap(&ldr.data()->x + offset, &hdr.data()->x + offset,
+        hdr.width(), kparams);
   });
 }
 vec3f colorgrade(
@@ -767,16 +894,21 @@ vec4f colorgrade(
 image<vec4f> colorgrade_image(
     const image<vec4f>& img, bool linear, const colorgrade_params& params) {
   auto corrected = image<vec4f>{img.imsize()};
-  for (auto i = 0ull; i < img.count(); i++)
-    corrected[i] = colorgrade(img[i], linear, params);
+  auto kparams   = make_colorgrade_kernel_params(linear, params);
+  get_pixel_kernels().colorgrade(
+      &corrected.data()->x, &img.data()->x, img.count(), kparams);
   return corrected;
 }
 
 // Apply exposure and filmic tone mapping
 void colorgrade_image_mt(image<vec4f>& corrected, const image<vec4f>& img,
     bool linear, const colorgrade_params& params) {
-  parallel_for(img.width(), img.height(), [&](int i, int j) {
-    corrected[{i, j}] = colorgrade(img[{i, j}], linear, params);
+  auto& kernels = get_pixel_kernels();
+  auto  kparams = make_colorgrade_kernel_params(linear, params);
+  parallel_for(img.height(), [&](int j) {
+    auto offset = (size_t)j * (size_t)img.width() * 4;
+    kernels.colorgrade(&corrected.data()->x + offset, &img.data()->x + offset,
+        img.width(), kparams);
   });
 }
 
@@ -1912,7 +2044,8 @@ bool load_image(const string& filename, image<vec4b>& img, string& error) {
     if (ncomp != 4) pixels = convert_components(pixels, ncomp, 4);
     img = image{{width, height}, (const vec4b*)pixels.data()};
     return true;
-  } else if (ext == ".jpg" || ext == ".JPG") {
+  } else if (ext == ".jpg" || ext == ".JPG" || ext == ".jpeg" ||
+             ext == ".JPEG") {
     auto width = 0, height = 0, ncomp = 0;
     auto pixels = vector<byte>{};
     if (!load_jpg(filename, width, height, ncomp, pixels, error)) return false;
@@ -1963,7 +2096,8 @@ bool save_image(
     return save_png(filename, img.width(), img.height(), 4,
         {(const byte*)img.data(), (const byte*)img.data() + img.count() * 4},
         error);
-  } else if (ext == ".jpg" || ext == ".JPG") {
+  } else if (ext == ".jpg" || ext == ".JPG" || ext == ".jpeg" ||
+             ext == ".JPEG") {
     return save_jpg(filename, img.width(), img.height(), 4,
         {(const byte*)img.data(), (const byte*)img.data() + img.count() * 4},
         error);
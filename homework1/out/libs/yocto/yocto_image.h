@@ -184,6 +184,15 @@ image<float> rgba_to_gray(const image<vec4f>& rgba);
 image<vec4b> gray_to_rgba(const image<byte>& gray);
 image<byte>  rgba_to_gray(const image<vec4b>& rgba);
 
+// Instruction sets used by the image conversions, tone mapping and color
+// grading above and below. All of them give the same results, bit for bit.
+enum struct image_simd_type { automatic, scalar, sse2, avx2 };
+
+// Set the instruction set of the image conversions. Unsupported sets fall
+// back to the best supported one, which is returned. `automatic`, the
+// default, picks the fastest set of the cpu. Not thread safe.
+image_simd_type set_image_simd(image_simd_type type);
+
 // Apply tone mapping
 image<vec4f> tonemap_image(const image<vec4f>& hdr, float exposure,
     bool filmic = false, bool srgb = true);
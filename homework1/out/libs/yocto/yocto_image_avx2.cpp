@@ -0,0 +1,53 @@
+//
+// Implementation for Yocto/Image pixel kernels using AVX2.
+// This file is compiled with AVX2 enabled and its kernels are only called
+// after checking that the cpu supports them.
+//
+
+//
+// LICENSE:
+//
+// Copyright (c) 2016 -- 2020 Fabio Pellacini
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+// -----------------------------------------------------------------------------
+// INCLUDES
+// -----------------------------------------------------------------------------
+
+// Only the internal header is included, so that no inline function of the
+// library is compiled with AVX2 instructions.
+#include "yocto_simd.h"
+
+// -----------------------------------------------------------------------------
+// IMPLEMENTATION OF AVX2 PIXEL KERNELS
+// -----------------------------------------------------------------------------
+namespace yocto {
+
+bool get_avx2_pixel_kernels(pixel_kernels& kernels) {
+#ifdef YOCTO_AVX2
+  kernels = make_pixel_kernels<vfloat8>(simd_type::avx2);
+  return true;
+#else
+  return false;
+#endif
+}
+
+}  // namespace yocto
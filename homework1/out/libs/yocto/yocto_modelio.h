@@ -39,6 +39,7 @@
 
 #include <algorithm>
 #include <array>
+#include <functional>
 #include <memory>
 #include <string>
 #include <vector>
@@ -52,6 +53,7 @@ namespace yocto {
 
 // using directives
 using std::array;
+using std::function;
 using std::string;
 using std::vector;
 
@@ -65,38 +67,35 @@ namespace yocto {
 // Ply type
 enum struct ply_type { i8, i16, i32, i64, u8, u16, u32, u64, f32, f64 };
 
-// Ply property
+// Ply property. Values that are not lists are stored in the records of
+// their element, at byte `offset`. Lists have no fixed size, so their values
+// are stored contiguously in `data`, with the list lengths in `ldata_u8`.
+// Values are stored as bytes of the C++ type that matches `type`.
 struct ply_property {
   // description
   string   name    = "";
   bool     is_list = false;
   ply_type type    = ply_type::f32;
 
-  // data
-  vector<int8_t>   data_i8  = {};
-  vector<int16_t>  data_i16 = {};
-  vector<int32_t>  data_i32 = {};
-  vector<int64_t>  data_i64 = {};
-  vector<uint8_t>  data_u8  = {};
-  vector<uint16_t> data_u16 = {};
-  vector<uint32_t> data_u32 = {};
-  vector<uint64_t> data_u64 = {};
-  vector<float>    data_f32 = {};
-  vector<double>   data_f64 = {};
-
-  // list length
+  // offset in element records
+  size_t offset = 0;
+
+  // list values and lengths
+  vector<byte>    data     = {};
   vector<uint8_t> ldata_u8 = {};
 };
 
-// Ply elements
+// Ply elements. The values that are not lists are stored in a single buffer
+// of records of `stride` bytes, laid out as in binary files.
 struct ply_element {
   // element content
-  string                name       = "";
-  size_t                count      = 0;
-  vector<ply_property*> properties = {};
+  string               name       = "";
+  size_t               count      = 0;
+  vector<ply_property> properties = {};
 
-  // cleanup
-  ~ply_element();
+  // element records
+  size_t       stride = 0;
+  vector<byte> data   = {};
 };
 
 // Ply format
@@ -105,18 +104,27 @@ enum struct ply_format { ascii, binary_little_endian, binary_big_endian };
 // Ply model
 struct ply_model {
   // ply content
-  ply_format           format   = ply_format::binary_little_endian;
-  vector<string>       comments = {};
-  vector<ply_element*> elements = {};
-
-  // cleanup
-  ~ply_model();
+  ply_format          format   = ply_format::binary_little_endian;
+  vector<string>      comments = {};
+  vector<ply_element> elements = {};
 };
 
 // Load and save ply
 bool load_ply(const string& filename, ply_model* ply, string& error);
 bool save_ply(const string& filename, ply_model* ply, string& error);
 
+// Stream ply. Reads the header into `ply`, then calls `element_cb` for
+// consecutive blocks of at most `block_size` records of each element.
+// During a call, the element properties hold only the values of the block
+// that starts at record `start`, so the get_xxx() functions return that
+// block. Values are released after each call, so memory is bounded by one
+// block. Returning false from the callback stops reading.
+using ply_element_callback =
+    function<bool(ply_model* ply, ply_element* element, size_t start)>;
+bool stream_ply(const string& filename, ply_model* ply,
+    const ply_element_callback& element_cb, string& error,
+    size_t block_size = 65536);
+
 // Get ply properties
 bool has_property(
     ply_model* ply, const string& element, const string& property);
@@ -346,6 +354,21 @@ bool load_obj(const string& filename, obj_scene* obj, string& error,
     bool split_materials = false);
 bool save_obj(const string& filename, obj_scene* obj, string& error);
 
+// Stream obj geometry. Reads the file in blocks of whole lines of about
+// `block_size` bytes and calls `block_cb` with a shape that holds the vertex
+// data and elements of each block, and the number of positions, texcoords
+// and normals in the previous blocks. Element vertices index the whole file
+// starting from 1, as in obj, with relative indices resolved. Block vertices
+// list all face vertices, then all line vertices, then all point vertices,
+// so lines start after the vertices of all faces and points after those of
+// all lines. Since indices are not local to the block, the obj getters do not
+// apply to blocks. Names and materials are not reported. Returning false from
+// the callback stops reading.
+using obj_block_callback =
+    function<bool(const obj_shape* block, const obj_vertex& offset)>;
+bool stream_obj(const string& filename, const obj_block_callback& block_cb,
+    string& error, size_t block_size = 1 << 24);
+
 // Get obj shape. Obj is a facevarying format, so vertices might be duplicated.
 // to ensure that no duplication occurs, either use the facevarying interface,
 // or set `no_vertex_duplication`. In the latter case, the code will fallback
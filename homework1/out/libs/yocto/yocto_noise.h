@@ -37,6 +37,7 @@
 // -----------------------------------------------------------------------------
 
 #include <array>
+#include <cstring>
 
 #include "yocto_math.h"
 
@@ -78,6 +79,26 @@ inline float perlin_turbulence(const vec3f& p, float lacunarity = 2,
 
 }  // namespace yocto
 
+// -----------------------------------------------------------------------------
+// HASH NOISE FUNCTIONS
+// -----------------------------------------------------------------------------
+namespace yocto {
+
+// Counter-based random numbers, computed by hashing a seed together with an
+// integer coordinate. Unlike `rng_state` sequences, values do not depend on
+// the order they are drawn in, so they are reproducible when computed in
+// parallel or in any traversal order.
+inline uint32_t hash_noise(uint32_t seed, int i);
+inline uint32_t hash_noise(uint32_t seed, const vec2i& ij);
+inline uint32_t hash_noise(uint32_t seed, const vec3i& ijk);
+
+// Uniform random numbers in [0,1) from a seed and an integer coordinate.
+inline float hash_noise1f(uint32_t seed, const vec2i& ij);
+inline vec2f hash_noise2f(uint32_t seed, const vec2i& ij);
+inline float hash_noise1f(uint32_t seed, const vec3i& ijk);
+
+}  // namespace yocto
+
 // -----------------------------------------------------------------------------
 //
 //
@@ -374,4 +395,53 @@ inline float perlin_turbulence(const vec3f& p, float lacunarity, float gain,
 
 }  // namespace yocto
 
+// -----------------------------------------------------------------------------
+// IMPLEMENTATION FOR HASH NOISE
+// -----------------------------------------------------------------------------
+namespace yocto {
+
+// Integer hash with full avalanche, from
+// https://nullprogram.com/blog/2018/07/31/
+inline uint32_t _hash_uint(uint32_t x) {
+  x ^= x >> 16;
+  x *= 0x7feb352du;
+  x ^= x >> 15;
+  x *= 0x846ca68bu;
+  x ^= x >> 16;
+  return x;
+}
+
+// Float in [0,1) from the high bits of a hash, as `rand1f()`.
+inline float _hash_to_float(uint32_t hash) {
+  auto bits  = (hash >> 9) | 0x3f800000u;
+  auto value = 0.0f;
+  memcpy(&value, &bits, sizeof(value));
+  return value - 1.0f;
+}
+
+// Hash of a seed and an integer coordinate.
+inline uint32_t hash_noise(uint32_t seed, int i) {
+  return _hash_uint((uint32_t)i + _hash_uint(seed));
+}
+inline uint32_t hash_noise(uint32_t seed, const vec2i& ij) {
+  return hash_noise(hash_noise(seed, ij.y), ij.x);
+}
+inline uint32_t hash_noise(uint32_t seed, const vec3i& ijk) {
+  return hash_noise(hash_noise(hash_noise(seed, ijk.z), ijk.y), ijk.x);
+}
+
+// Uniform random numbers in [0,1) from a seed and an integer coordinate.
+inline float hash_noise1f(uint32_t seed, const vec2i& ij) {
+  return _hash_to_float(hash_noise(seed, ij));
+}
+inline vec2f hash_noise2f(uint32_t seed, const vec2i& ij) {
+  auto hash = hash_noise(seed, ij);
+  return {_hash_to_float(hash), _hash_to_float(_hash_uint(hash))};
+}
+inline float hash_noise1f(uint32_t seed, const vec3i& ijk) {
+  return _hash_to_float(hash_noise(seed, ijk));
+}
+
+}  // namespace yocto
+
 #endif
@@ -37,9 +37,14 @@
 // INCLUDES
 // -----------------------------------------------------------------------------
 
+#include <algorithm>
 #include <atomic>
+#include <condition_variable>
+#include <cstdint>
 #include <deque>
+#include <exception>
 #include <future>
+#include <memory>
 #include <mutex>
 #include <thread>
 #include <utility>
@@ -80,6 +85,28 @@ struct concurrent_queue {
   deque<T>   queue;
 };
 
+// a concurrent queue that holds at most `capacity` values, used to connect
+// the stages of a pipeline; push() waits while the queue is full and pop()
+// waits until a value is available or the queue is closed
+template <typename T>
+struct bounded_queue {
+  bounded_queue(size_t capacity = 1) : capacity{capacity} {}
+  bounded_queue(const bounded_queue& other) = delete;
+  bounded_queue& operator=(const bounded_queue& other) = delete;
+
+  bool push(T&& value);  // returns false if the queue is closed
+  bool pop(T& value);    // returns false if the queue is closed and empty
+  void close();          // wakes up all waiting threads
+
+ private:
+  std::mutex              mutex;
+  std::condition_variable not_empty;
+  std::condition_variable not_full;
+  deque<T>                queue;
+  size_t                  capacity = 1;
+  bool                    closed   = false;
+};
+
 // Run a task asynchronously
 template <typename Func, typename... Args>
 inline auto run_async(Func&& func, Args&&... args);
@@ -89,17 +116,35 @@ inline bool is_valid(const future<void>& result);
 inline bool is_running(const future<void>& result);
 inline bool is_ready(const future<void>& result);
 
-// Simple parallel for used since our target platforms do not yet support
-// parallel algorithms. `Func` takes the integer index.
+// Number of threads used by parallel loops, including the calling thread.
+// Loops run on a persistent pool of workers, started by the first loop.
+// Zero uses the hardware concurrency. Setting the number of threads restarts
+// the pool and should not be done while loops are running.
+inline void set_parallel_threads(int num_threads);
+inline int  get_parallel_threads();
+
+// Parallel for over a persistent thread pool. Ranges are split in halves
+// down to the grain size, and idle threads steal the largest pending halves.
+// The calling thread takes part in the loop, and runs pending work while
+// waiting, so loops can be nested. Exceptions thrown by `Func` are rethrown
+// in the calling thread. `Func` takes the integer index.
 template <typename T, typename Func>
 inline void parallel_for(T num, Func&& func);
-// Simple parallel for used since our target platforms do not yet support
-// parallel algorithms. `Func` takes the two integer indices.
+// Parallel for with an explicit grain size, that is the number of indices
+// run together.
+template <typename T, typename Func>
+inline void parallel_for_batch(T num, T grain, Func&& func);
+// Parallel for over a 2D range, that is split in tiles. `Func` takes the two
+// integer indices. The default tile size gives a few tiles per thread.
 template <typename T, typename Func>
 inline void parallel_for(T num1, T num2, Func&& func);
+// Parallel for over a 2D range with an explicit tile size.
+template <typename T, typename Func>
+inline void parallel_for_batch(
+    T num1, T num2, T grain1, T grain2, Func&& func);
 
-// Simple parallel for used since our target platforms do not yet support
-// parallel algorithms. `Func` takes a reference to a `T`.
+// Parallel for over the elements of a vector. `Func` takes a reference to
+// a `T`.
 template <typename T, typename Func>
 inline void parallel_foreach(vector<T>& values, Func&& func);
 template <typename T, typename Func>
@@ -145,6 +190,34 @@ bool concurrent_queue<T>::try_pop(T& value) {
   return true;
 }
 
+// a concurrent queue that holds at most `capacity` values
+template <typename T>
+bool bounded_queue<T>::push(T&& value) {
+  std::unique_lock<std::mutex> lock(mutex);
+  not_full.wait(lock, [this] { return closed || queue.size() < capacity; });
+  if (closed) return false;
+  queue.push_back(std::move(value));
+  not_empty.notify_one();
+  return true;
+}
+template <typename T>
+bool bounded_queue<T>::pop(T& value) {
+  std::unique_lock<std::mutex> lock(mutex);
+  not_empty.wait(lock, [this] { return closed || !queue.empty(); });
+  if (queue.empty()) return false;
+  value = std::move(queue.front());
+  queue.pop_front();
+  not_full.notify_one();
+  return true;
+}
+template <typename T>
+void bounded_queue<T>::close() {
+  std::lock_guard<std::mutex> lock(mutex);
+  closed = true;
+  not_empty.notify_all();
+  not_full.notify_all();
+}
+
 // Run a task asynchronously
 template <typename Func, typename... Args>
 inline auto run_async(Func&& func, Args&&... args) {
@@ -162,57 +235,263 @@ inline bool is_ready(const future<void>& result) {
                                std::future_status::ready;
 }
 
-// Simple parallel for used since our target platforms do not yet support
-// parallel algorithms. `Func` takes the integer index.
+// A range of a parallel loop, waiting to be run by a thread of the pool.
+struct parallel_job;
+struct parallel_task {
+  parallel_job* job   = nullptr;
+  int64_t       start = 0;
+  int64_t       end   = 0;
+};
+
+// A parallel loop, with its type-erased body that runs a range of indices.
+struct parallel_job {
+  void (*run)(const void* func, int64_t start, int64_t end) = nullptr;
+  const void*        func    = nullptr;
+  int64_t            grain   = 1;
+  atomic<int64_t>    pending = 0;
+  atomic<bool>       failed  = false;
+  std::mutex         mutex   = {};
+  std::exception_ptr error   = nullptr;
+};
+
+// Task deque of a thread. The owner pushes and pops at the back, while
+// thieves take from the front, where the largest ranges are.
+struct parallel_deque {
+  std::mutex           mutex = {};
+  deque<parallel_task> tasks = {};
+};
+
+// Persistent thread pool. The last deque is shared by the threads that are
+// not in the pool.
+struct parallel_pool {
+  vector<std::thread>                     threads     = {};
+  vector<std::unique_ptr<parallel_deque>> deques      = {};
+  atomic<int64_t>                         queued      = 0;
+  atomic<int>                             sleeping    = 0;
+  bool                                    stop        = false;
+  bool                                    started     = false;
+  int                                     num_threads = 0;
+  std::mutex                              mutex       = {};
+  std::condition_variable                 wakeup      = {};
+
+  ~parallel_pool();
+};
+
+// Pool singleton
+inline parallel_pool& get_parallel_pool() {
+  static auto pool = parallel_pool{};
+  return pool;
+}
+
+// Deque of the current thread
+inline thread_local int parallel_thread_id = -1;
+inline int              get_parallel_deque(parallel_pool& pool) {
+  return parallel_thread_id >= 0 ? parallel_thread_id
+                                 : (int)pool.deques.size() - 1;
+}
+
+// Push a task to the deque of the current thread and wake up a worker.
+inline void push_parallel_task(parallel_pool& pool, const parallel_task& task) {
+  {
+    auto&                       queue = *pool.deques[get_parallel_deque(pool)];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    queue.tasks.push_back(task);
+  }
+  pool.queued += 1;
+  if (pool.sleeping > 0) {
+    std::lock_guard<std::mutex> lock(pool.mutex);
+    pool.wakeup.notify_one();
+  }
+}
+
+// Pop a task from the deque of the current thread, or steal one from the
+// others.
+inline bool pop_parallel_task(parallel_pool& pool, parallel_task& task) {
+  if (pool.queued == 0) return false;
+  auto self = get_parallel_deque(pool);
+  auto num  = (int)pool.deques.size();
+  for (auto offset = 0; offset < num; offset++) {
+    auto                        idx   = (self + offset) % num;
+    auto&                       queue = *pool.deques[idx];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (queue.tasks.empty()) continue;
+    if (idx == self) {
+      task = queue.tasks.back();
+      queue.tasks.pop_back();
+    } else {
+      task = queue.tasks.front();
+      queue.tasks.pop_front();
+    }
+    pool.queued -= 1;
+    return true;
+  }
+  return false;
+}
+
+// Run a task, splitting it in halves until it is not larger than the grain.
+inline void run_parallel_task(parallel_pool& pool, parallel_task task) {
+  auto job = task.job;
+  while (task.end - task.start > job->grain) {
+    auto mid = task.start + (task.end - task.start) / 2;
+    push_parallel_task(pool, {job, mid, task.end});
+    task.end = mid;
+  }
+  if (!job->failed) {
+    try {
+      job->run(job->func, task.start, task.end);
+    } catch (...) {
+      std::lock_guard<std::mutex> lock(job->mutex);
+      if (!job->failed) job->error = std::current_exception();
+      job->failed = true;
+    }
+  }
+  job->pending -= task.end - task.start;
+}
+
+// Worker loop, that sleeps when there is no work
+inline void run_parallel_worker(parallel_pool& pool, int thread_id) {
+  parallel_thread_id = thread_id;
+  auto task          = parallel_task{};
+  while (true) {
+    if (pop_parallel_task(pool, task)) {
+      run_parallel_task(pool, task);
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(pool.mutex);
+    pool.sleeping += 1;
+    pool.wakeup.wait(lock, [&pool] { return pool.stop || pool.queued > 0; });
+    pool.sleeping -= 1;
+    if (pool.stop) break;
+  }
+}
+
+// Start and stop the pool
+inline void start_parallel_pool(parallel_pool& pool) {
+  auto num_threads = get_parallel_threads();
+  pool.stop        = false;
+  pool.deques.clear();
+  for (auto idx = 0; idx < num_threads; idx++)
+    pool.deques.push_back(std::make_unique<parallel_deque>());
+  for (auto idx = 0; idx < num_threads - 1; idx++)
+    pool.threads.emplace_back(run_parallel_worker, std::ref(pool), idx);
+  pool.started = true;
+}
+inline void stop_parallel_pool(parallel_pool& pool) {
+  {
+    std::lock_guard<std::mutex> lock(pool.mutex);
+    pool.stop = true;
+    pool.wakeup.notify_all();
+  }
+  for (auto& thread : pool.threads) thread.join();
+  pool.threads.clear();
+  pool.started = false;
+}
+inline parallel_pool::~parallel_pool() { stop_parallel_pool(*this); }
+
+// Run a parallel loop over `num` indices and wait for it. The loop body
+// `run` takes a range of indices.
+template <typename Run>
+inline void run_parallel_job(int64_t num, int64_t grain, const Run& run) {
+  if (num <= 0) return;
+  auto& pool = get_parallel_pool();
+  {
+    static auto                 start_mutex = std::mutex{};
+    std::lock_guard<std::mutex> lock(start_mutex);
+    if (!pool.started) start_parallel_pool(pool);
+  }
+  auto job  = parallel_job{};
+  job.run   = [](const void* func, int64_t start, int64_t end) {
+    (*(const Run*)func)(start, end);
+  };
+  job.func    = &run;
+  job.grain   = std::max(grain, (int64_t)1);
+  job.pending = num;
+  run_parallel_task(pool, {&job, 0, num});
+  auto task = parallel_task{};
+  while (job.pending > 0) {
+    if (pop_parallel_task(pool, task)) {
+      run_parallel_task(pool, task);
+    } else {
+      std::this_thread::yield();
+    }
+  }
+  if (job.error) std::rethrow_exception(job.error);
+}
+
+// Default grain, that gives a few tasks per thread
+inline int64_t get_parallel_grain(int64_t num) {
+  return std::max(num / (get_parallel_threads() * 8), (int64_t)1);
+}
+
+// Number of threads used by parallel loops
+inline void set_parallel_threads(int num_threads) {
+  auto& pool = get_parallel_pool();
+  if (pool.num_threads == num_threads) return;
+  if (pool.started) stop_parallel_pool(pool);
+  pool.num_threads = num_threads;
+}
+inline int get_parallel_threads() {
+  auto& pool = get_parallel_pool();
+  return pool.num_threads > 0
+             ? pool.num_threads
+             : std::max((int)std::thread::hardware_concurrency(), 1);
+}
+
+// Parallel for over a persistent thread pool with work stealing.
 template <typename T, typename Func>
 inline void parallel_for(T num, Func&& func) {
-  auto      futures  = vector<future<void>>{};
-  auto      nthreads = std::thread::hardware_concurrency();
-  atomic<T> next_idx(0);
-  for (auto thread_id = 0; thread_id < nthreads; thread_id++) {
-    futures.emplace_back(
-        std::async(std::launch::async, [&func, &next_idx, num]() {
-          while (true) {
-            auto idx = next_idx.fetch_add(1);
-            if (idx >= num) break;
-            func(idx);
-          }
-        }));
-  }
-  for (auto& f : futures) f.get();
+  parallel_for_batch(num, (T)get_parallel_grain((int64_t)num), func);
+}
+
+// Parallel for with an explicit grain size.
+template <typename T, typename Func>
+inline void parallel_for_batch(T num, T grain, Func&& func) {
+  run_parallel_job(
+      (int64_t)num, (int64_t)grain, [&func](int64_t start, int64_t end) {
+        for (auto idx = start; idx < end; idx++) func((T)idx);
+      });
 }
 
-// Simple parallel for used since our target platforms do not yet support
-// parallel algorithms. `Func` takes the two integer indices.
+// Parallel for over a 2D range, split in tiles. Tiles are at least 8 wide,
+// so that rows of images are read in order.
 template <typename T, typename Func>
 inline void parallel_for(T num1, T num2, Func&& func) {
-  auto      futures  = vector<future<void>>{};
-  auto      nthreads = std::thread::hardware_concurrency();
-  atomic<T> next_idx(0);
-  for (auto thread_id = 0; thread_id < nthreads; thread_id++) {
-    futures.emplace_back(
-        std::async(std::launch::async, [&func, &next_idx, num1, num2]() {
-          while (true) {
-            auto j = next_idx.fetch_add(1);
-            if (j >= num2) break;
-            for (auto i = (T)0; i < num1; i++) func(i, j);
-          }
-        }));
-  }
-  for (auto& f : futures) f.get();
+  if (num1 <= 0 || num2 <= 0) return;
+  auto area   = get_parallel_grain((int64_t)num1 * (int64_t)num2);
+  auto grain1 = std::min((int64_t)num1, std::max(area / num2, (int64_t)8));
+  auto grain2 = std::min((int64_t)num2, std::max(area / grain1, (int64_t)1));
+  parallel_for_batch(num1, num2, (T)grain1, (T)grain2, func);
+}
+
+// Parallel for over a 2D range with an explicit tile size.
+template <typename T, typename Func>
+inline void parallel_for_batch(
+    T num1, T num2, T grain1, T grain2, Func&& func) {
+  if (num1 <= 0 || num2 <= 0) return;
+  grain1      = std::max(grain1, (T)1);
+  grain2      = std::max(grain2, (T)1);
+  auto tiles1 = (int64_t)((num1 + grain1 - 1) / grain1);
+  auto tiles2 = (int64_t)((num2 + grain2 - 1) / grain2);
+  run_parallel_job(tiles1 * tiles2, 1, [&](int64_t start, int64_t end) {
+    for (auto tile = start; tile < end; tile++) {
+      auto i1 = (T)(tile % tiles1) * grain1, i2 = std::min(i1 + grain1, num1);
+      auto j1 = (T)(tile / tiles1) * grain2, j2 = std::min(j1 + grain2, num2);
+      for (auto j = j1; j < j2; j++)
+        for (auto i = i1; i < i2; i++) func(i, j);
+    }
+  });
 }
 
-// Simple parallel for used since our target platforms do not yet support
-// parallel algorithms. `Func` takes a reference to a `T`.
+// Parallel for over the elements of a vector.
 template <typename T, typename Func>
 inline void parallel_foreach(vector<T>& values, Func&& func) {
   parallel_for(
-      0, (int)values.size(), [&func, &values](int idx) { func(values[idx]); });
+      (int)values.size(), [&func, &values](int idx) { func(values[idx]); });
 }
 template <typename T, typename Func>
 inline void parallel_foreach(const vector<T>& values, Func&& func) {
   parallel_for(
-      0, (int)values.size(), [&func, &values](int idx) { func(values[idx]); });
+      (int)values.size(), [&func, &values](int idx) { func(values[idx]); });
 }
 
 }  // namespace yocto
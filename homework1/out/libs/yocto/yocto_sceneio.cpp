@@ -29,12 +29,14 @@
 #include "yocto_sceneio.h"
 
 #include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <cctype>
 #include <climits>
 #include <cstdlib>
 #include <cstring>
 #include <memory>
+#include <mutex>
 #include <stdexcept>
 #include <unordered_map>
 
@@ -1139,6 +1141,44 @@ bool save_instance(const string& filename, const vector<frame3f>& frames,
   }
 }
 
+// Asset loader, that reads one file of a scene into its element.
+struct sceneio_loader {
+  string                        message = "";
+  function<bool(string& error)> load    = {};
+};
+
+// Run asset loaders concurrently, one task per asset, unless disabled.
+// Concurrency is bounded by the parallel pool, and each asset is decoded
+// directly into its element. Once a loader fails, the ones after it are
+// skipped, while the ones before it still run, so the reported error is
+// the one of the first failed asset, as in a serial load. Progress is
+// reported in completion order.
+static bool load_assets(const vector<sceneio_loader>& loaders, string& error,
+    const progress_callback& progress_cb, vec2i& progress, bool noparallel) {
+  auto errors         = vector<string>(loaders.size());
+  auto first_failed   = std::atomic<int>{(int)loaders.size()};
+  auto progress_mutex = std::mutex{};
+  auto load_asset     = [&](int idx) {
+    if (idx > first_failed.load()) return;
+    if (progress_cb) {
+      auto lock = std::lock_guard{progress_mutex};
+      progress_cb(loaders[idx].message, progress.x++, progress.y);
+    }
+    if (loaders[idx].load(errors[idx])) return;
+    auto failed = first_failed.load();
+    while (idx < failed && !first_failed.compare_exchange_weak(failed, idx)) {
+    }
+  };
+  if (noparallel) {
+    for (auto idx = 0; idx < (int)loaders.size(); idx++) load_asset(idx);
+  } else {
+    parallel_for_batch((int)loaders.size(), 1, load_asset);
+  }
+  if (first_failed.load() == (int)loaders.size()) return true;
+  error = errors[first_failed.load()];
+  return false;
+}
+
 }  // namespace yocto
 
 // -----------------------------------------------------------------------------
@@ -1497,45 +1537,59 @@ static bool load_json_scene(const string& filename, sceneio_scene* scene,
     return path_join(path_dirname(filename), group, name + extensions.front());
   };
 
+  // shapes, textures and instances do not depend on each other, so they
+  // are loaded together before instances are applied
+  auto loaders = vector<sceneio_loader>{};
+
   // load shapes
   shape_map.erase("");
   for (auto [name, shape] : shape_map) {
-    if (progress_cb) progress_cb("load shape", progress.x++, progress.y);
     auto path = make_filename(name, "shapes", {".ply", ".obj"});
-    if (!load_shape(path, shape->points, shape->lines, shape->triangles,
-            shape->quads, shape->quadspos, shape->quadsnorm,
-            shape->quadstexcoord, shape->positions, shape->normals,
-            shape->texcoords, shape->colors, shape->radius, error,
-            shape->catmullclark && shape->subdivisions > 0))
-      return dependent_error();
+    loaders.push_back({"load shape", [path, shape = shape](string& error) {
+                         return load_shape(path, shape->points, shape->lines,
+                             shape->triangles, shape->quads, shape->quadspos,
+                             shape->quadsnorm, shape->quadstexcoord,
+                             shape->positions, shape->normals,
+                             shape->texcoords, shape->colors, shape->radius,
+                             error,
+                             shape->catmullclark && shape->subdivisions > 0);
+                       }});
   }
   // load textures
   ctexture_map.erase("");
   for (auto [name, texture] : ctexture_map) {
-    if (progress_cb) progress_cb("load texture", progress.x++, progress.y);
     auto path = make_filename(
         name, "textures", {".hdr", ".exr", ".png", ".jpg"});
-    if (!load_image(path, texture->hdr, texture->ldr, error))
-      return dependent_error();
+    loaders.push_back(
+        {"load texture", [path, texture = texture](string& error) {
+           return load_image(path, texture->hdr, texture->ldr, error);
+         }});
   }
   // load textures
   stexture_map.erase("");
   for (auto [name, texture] : stexture_map) {
-    if (progress_cb) progress_cb("load texture", progress.x++, progress.y);
     auto path = make_filename(
         name, "textures", {".hdr", ".exr", ".png", ".jpg"});
-    if (!load_image(path, texture->hdr, texture->ldr, error))
-      return dependent_error();
+    loaders.push_back(
+        {"load texture", [path, texture = texture](string& error) {
+           return load_image(path, texture->hdr, texture->ldr, error);
+         }});
   }
 
   // load instances
   ply_instance_map.erase("");
   for (auto [name, instance] : ply_instance_map) {
-    if (progress_cb) progress_cb("load instance", progress.x++, progress.y);
     auto path = make_filename(name, "instances", {".ply"});
-    if (!load_instance(path, instance->frames, error)) return dependent_error();
+    loaders.push_back(
+        {"load instance", [path, instance = instance](string& error) {
+           return load_instance(path, instance->frames, error);
+         }});
   }
 
+  // load assets
+  if (!load_assets(loaders, error, progress_cb, progress, noparallel))
+    return dependent_error();
+
   // apply instances
   if (!ply_instances.empty()) {
     if (progress_cb)
@@ -3533,32 +3533,69 @@ bool load_shape(const string& filename, vector<int>& points,
 
   auto ext = path_extension(filename);
   if (ext == ".ply" || ext == ".PLY") {
-    // open ply
-    auto ply_guard = std::make_unique<ply_model>();
-    auto ply       = ply_guard.get();
-    if (!load_ply(filename, ply, error)) return false;
-
-    if (!facevarying) {
-      // gets vertex
-      get_positions(ply, positions);
-      get_normals(ply, normals);
-      get_texcoords(ply, texcoords, flip_texcoord);
-      get_colors(ply, colors);
-      get_radius(ply, radius);
-
-      // get faces
-      if (has_quads(ply)) {
-        get_quads(ply, quads);
-      } else {
-        get_triangles(ply, triangles);
+    // stream ply, appending each block to the shape arrays
+    auto ply_guard  = std::make_unique<ply_model>();
+    auto ply        = ply_guard.get();
+    auto has_quads_ = false;
+    auto element_cb = [&](ply_model* ply, ply_element* element, size_t) {
+      auto append = [](auto& values, auto& block) {
+        if (values.empty()) {
+          std::swap(values, block);
+        } else {
+          values.insert(values.end(), block.begin(), block.end());
+        }
+      };
+      if (element->name == "vertex") {
+        auto positions_ = vector<vec3f>{}, normals_ = vector<vec3f>{};
+        auto texcoords_ = vector<vec2f>{};
+        get_positions(ply, positions_);
+        get_normals(ply, normals_);
+        get_texcoords(ply, texcoords_, flip_texcoord);
+        append(positions, positions_);
+        append(normals, normals_);
+        append(texcoords, texcoords_);
+        if (!facevarying) {
+          auto colors_ = vector<vec4f>{};
+          auto radius_ = vector<float>{};
+          get_colors(ply, colors_);
+          get_radius(ply, radius_);
+          append(colors, colors_);
+          append(radius, radius_);
+        }
+      } else if (element->name == "face" && !facevarying) {
+        // faces are read as triangles until the first quad, then as quads
+        if (!has_quads_ && has_quads(ply)) {
+          has_quads_ = true;
+          quads.reserve(triangles.size());
+          for (auto& t : triangles) quads.push_back({t.x, t.y, t.z, t.z});
+          triangles = {};
+        }
+        if (has_quads_) {
+          auto quads_ = vector<vec4i>{};
+          get_quads(ply, quads_);
+          append(quads, quads_);
+        } else {
+          auto triangles_ = vector<vec3i>{};
+          get_triangles(ply, triangles_);
+          append(triangles, triangles_);
+        }
+      } else if (element->name == "face" && facevarying) {
+        auto quads_ = vector<vec4i>{};
+        get_quads(ply, quads_);
+        append(quadspos, quads_);
+      } else if (element->name == "line" && !facevarying) {
+        auto lines_ = vector<vec2i>{};
+        get_lines(ply, lines_);
+        append(lines, lines_);
+      } else if (element->name == "point" && !facevarying) {
+        auto points_ = vector<int>{};
+        get_points(ply, points_);
+        append(points, points_);
       }
-      get_lines(ply, lines);
-      get_points(ply, points);
-    } else {
-      get_positions(ply, positions);
-      get_normals(ply, normals);
-      get_texcoords(ply, texcoords, flip_texcoord);
-      get_quads(ply, quadspos);
+      return true;
+    };
+    if (!stream_ply(filename, ply, element_cb, error)) return false;
+    if (facevarying) {
       if (!normals.empty()) quadsnorm = quadspos;
       if (!texcoords.empty()) quadstexcoord = quadspos;
     }
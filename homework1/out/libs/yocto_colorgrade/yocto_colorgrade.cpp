@@ -33,28 +33,24 @@
 #include "yocto_colorgrade.h"
 
 #include <yocto/yocto_color.h>
-#include <yocto/yocto_sampling.h>
+#include <yocto/yocto_noise.h>
+#include <yocto/yocto_parallel.h>
 
 // -----------------------------------------------------------------------------
 // COLOR GRADING FUNCTIONS
 // -----------------------------------------------------------------------------
 namespace yocto {
+// Seeds of the random numbers used in grading.
+static const uint32_t grain_seed     = 1102104;
+static const uint32_t stippling_seed = 8423424;
+
 double fract(double x) { return x - trunc(x); }
-vec3f  stepnoise(vec3f p, float size) {
+// Random offsets, constant over the cells of a grid of the given size.
+vec3f stepnoise(vec3f p, float size) {
   p += 10.0;
-  float x = floor(p.x / size) * size;
-  float y = floor(p.y / size) * size;
-
-  x = fract(x * 0.1) + 1.0 + x * 0.0002;
-  y = fract(y * 0.1) + 1.0 + y * 0.0003;
-
-  float a = fract(1.0 / (0.000001 * x * y + 0.00001));
-  a       = fract(1.0 / (0.000001234 * a + 0.00001));
-
-  float b = fract(1.0 / (0.000002 * (x * y + x) + 0.00001));
-  b       = fract(1.0 / (0.0000235 * b + 0.00001));
-
-  return vec3f{a, b};
+  auto cell = vec2i{(int)floor(p.x / size), (int)floor(p.y / size)};
+  auto r    = hash_noise2f(stippling_seed, cell);
+  return vec3f{r.x, r.y};
 }
 float tent(float f) { return 1.0 - abs((float)(fract(f) - 0.5)) * 2.0; }
 
@@ -75,256 +71,201 @@ float mask(vec3f p) {
   return f;
 }
 
-image<vec4f> grade_image(const image<vec4f>& img, const grade_params& params) {
-  // PUT YOUR CODE HERE
-  auto graded = img;
-  // tone mapping
-  for (auto i = 0; i < img.imsize()[0]; i++) {
-    for (auto j = 0; j < img.imsize()[1]; j++) {
-      auto c = xyz(graded[{i, j}]);
-      // exposure compensation
-      c = c * pow(2, params.exposure);
-      // filmic correction
-      if (params.filmic) {
-        c *= 0.6;
-        c = (pow(c, 2) * 2.51 + c * 0.03) /
-            (pow(c, 2) * 2.43 + c * 0.510 + 0.14);
-      }
-      // srgb color space
-      if (params.srgb) c = pow(c, 1 / 2.2);
-      // clamp result
-      c              = clamp(c, 0.0, 1.0);
-      graded[{i, j}] = vec4f{c.x, c.y, c.z, graded[{i, j}].w};
+// Tile size of the grading passes. A tile of pixels stays in cache while all
+// the fused stages run over it.
+static const int grade_tile_size = 32;
+
+// Runs `func(ij)` over all pixels of an image of size `size`, splitting it in
+// tiles that are graded in parallel.
+template <typename Func>
+static void grade_tiles(const vec2i& size, Func&& func) {
+  auto tiles = (size + grade_tile_size - 1) / grade_tile_size;
+  parallel_for(tiles.x * tiles.y, [&](int tile) {
+    auto start = vec2i{tile % tiles.x, tile / tiles.x} * grade_tile_size;
+    auto end   = min(start + grade_tile_size, size);
+    for (auto j = start.y; j < end.y; j++) {
+      for (auto i = start.x; i < end.x; i++) func(vec2i{i, j});
     }
+  });
+}
+
+// Grading stages that come before the mosaic. All of them read only the
+// pixel they write, so they are fused in a single kernel.
+static vec4f grade_tonemap(const vec4f& pixel, const vec2i& ij,
+    const vec2i& size, const grade_params& params, float scale) {
+  auto [i, j] = ij;
+  auto c      = xyz(pixel);
+  // exposure compensation
+  c = c * scale;
+  // filmic correction
+  if (params.filmic) {
+    c *= 0.6;
+    c = (pow(c, 2) * 2.51 + c * 0.03) / (pow(c, 2) * 2.43 + c * 0.510 + 0.14);
   }
+  // srgb color space
+  if (params.srgb) c = pow(c, 1 / 2.2);
+  // clamp result
+  c = clamp(c, 0.0, 1.0);
   // color tint
-  for (auto i = 0; i < img.imsize()[0]; i++) {
-    for (auto j = 0; j < img.imsize()[1]; j++) {
-      auto c         = xyz(graded[{i, j}]);
-      c              =  operator*(c, params.tint);
-      graded[{i, j}] = vec4f{c.x, c.y, c.z, graded[{i, j}].w};
-    }
-  }
-
+  c = c * params.tint;
   // saturation
-  if (params.saturation || params.saturation == 0) {
-    for (auto i = 0; i < img.imsize()[0]; i++) {
-      for (auto j = 0; j < img.imsize()[1]; j++) {
-        auto c         = xyz(graded[{i, j}]);
-        auto g         = (c.x + c.y + c.z) / 3;
-        c              = g + (c - g) * (params.saturation * 2);
-        graded[{i, j}] = vec4f{c.x, c.y, c.z, graded[{i, j}].w};
-      }
-    }
-  }
+  auto g = (c.x + c.y + c.z) / 3;
+  c      = g + (c - g) * (params.saturation * 2);
   // contrast
-  if (params.contrast) {
-    for (auto i = 0; i < img.imsize()[0]; i++) {
-      for (auto j = 0; j < img.imsize()[1]; j++) {
-        auto c         = xyz(graded[{i, j}]);
-        c              = gain(c, 1 - params.contrast);
-        graded[{i, j}] = vec4f{c.x, c.y, c.z, graded[{i, j}].w};
-      }
-    }
-  }
+  if (params.contrast) c = gain(c, 1 - params.contrast);
   // vignette
   if (params.vignette) {
-    for (auto i = 0; i < img.imsize()[0]; i++) {
-      for (auto j = 0; j < img.imsize()[1]; j++) {
-        auto  c    = xyz(graded[{i, j}]);
-        auto  vr   = 1 - params.vignette;
-        vec2f ij   = {i, j};
-        vec2f imgf = {img.imsize()[0], img.imsize()[1]};
-        auto  r    = length(operator-(ij, operator/(imgf, 2))) /
-                 length(operator/(imgf, 2));
-        c              = c * (1 - smoothstep(vr, 2 * vr, r));
-        graded[{i, j}] = vec4f{c.x, c.y, c.z, graded[{i, j}].w};
-      }
-    }
+    auto  vr   = 1 - params.vignette;
+    auto  pos  = vec2f{(float)i, (float)j};
+    auto  imgf = vec2f{(float)size.x, (float)size.y};
+    auto  r    = length(pos - imgf / 2) / length(imgf / 2);
+    c          = c * (1 - smoothstep(vr, 2 * vr, r));
   }
   // film grain
-  if (params.grain) {
-    rng_state r = make_rng(1102104);
-    for (auto i = 0; i < img.imsize()[0]; i++) {
-      for (auto j = 0; j < img.imsize()[1]; j++) {
-        auto c         = xyz(graded[{i, j}]);
-        c              = c + (rand1f(r) - 0.5) * params.grain;
-        graded[{i, j}] = vec4f{c.x, c.y, c.z, graded[{i, j}].w};
-      }
-    }
-  }
-  // mosaic effect
-  if (params.mosaic) {
-    for (auto i = 0; i < img.imsize()[0]; i++) {
-      for (auto j = 0; j < img.imsize()[1]; j++) {
-        auto c = xyz(graded[{i - i % params.mosaic, j - j % params.mosaic}]);
-        auto d = xyz(graded[{i, j}]);
-        d      = c;
-        graded[{i, j}] = vec4f{d.x, d.y, d.z, graded[{i, j}].w};
-      }
-    }
-  }
+  if (params.grain)
+    c = c + (hash_noise1f(grain_seed, ij) - 0.5) * params.grain;
+  return {c.x, c.y, c.z, pixel.w};
+}
 
-  // grid effect
-  if (params.grid) {
-    for (auto i = 0; i < img.imsize()[0]; i++) {
-      for (auto j = 0; j < img.imsize()[1]; j++) {
-        auto c = xyz(graded[{i, j}]);
-        c      = (i % params.grid == 0 || 0 == j % params.grid) ? 0.5 * c : c;
-        graded[{i, j}] = vec4f{c.x, c.y, c.z, graded[{i, j}].w};
-      }
-    }
-  }
-  // fumetto
-  if (params.pn) {
-    for (auto i = 0; i < img.imsize()[0]; i = i + 15) {
-      for (auto j = 0; j < img.imsize()[1]; j = j + 15) {
-        int in = j;
+// Grid effect, applied after the mosaic.
+static vec4f grade_grid(const vec4f& pixel, const vec2i& ij, int grid) {
+  auto [i, j] = ij;
+  auto c      = xyz(pixel);
+  c           = (i % grid == 0 || 0 == j % grid) ? 0.5 * c : c;
+  return {c.x, c.y, c.z, pixel.w};
+}
 
-        for (auto k = i + 1; k < i + 4; k++) {
-          auto c          = xyz(graded[{k, in}]);
-          graded[{k, in}] = {1 - c.x, 1 - c.y, 1 - c.z, graded[{i, j}].w};
-        }
-        in++;
-        for (auto k = i; k < i + 5; k++) {
-          auto c          = xyz(graded[{k, in}]);
-          graded[{k, in}] = {1 - c.x, 1 - c.y, 1 - c.z, graded[{i, j}].w};
-        }
-        in++;
-        for (auto k = i - 1; k < i + 6; k++) {
-          auto c          = xyz(graded[{k, in}]);
-          graded[{k, in}] = {1 - c.x, 1 - c.y, 1 - c.z, graded[{i, j}].w};
-        }
-        in++;
-        for (auto k = i - 1; k < i + 6; k++) {
-          auto c          = xyz(graded[{k, in}]);
-          graded[{k, in}] = {1 - c.x, 1 - c.y, 1 - c.z, graded[{i, j}].w};
-        }
-        in++;
-        for (auto k = i; k < i + 5; k++) {
-          auto c          = xyz(graded[{k, in}]);
-          graded[{k, in}] = {1 - c.x, 1 - c.y, 1 - c.z, graded[{i, j}].w};
-        }
-        in++;
-        for (auto k = i + 1; k < i + 4; k++) {
-          auto c          = xyz(graded[{k, in}]);
-          graded[{k, in}] = {1 - c.x, 1 - c.y, 1 - c.z, graded[{i, j}].w};
-        }
+// Comic pattern. It writes small disks of inverted colors around a sparse
+// set of pixels, so it runs as its own pass over the graded image. Pattern
+// pixels that fall outside the image are skipped.
+static void grade_pn(image<vec4f>& graded) {
+  auto invert = [&graded](int i, int j, int k, int in) {
+    if (k < 0 || k >= graded.width() || in < 0 || in >= graded.height())
+      return;
+    auto idx = (size_t)in * graded.width() + k;
+    auto c       = xyz(graded[idx]);
+    graded[idx] = {1 - c.x, 1 - c.y, 1 - c.z, graded[{i, j}].w};
+  };
+  // column ranges of the disk rows, relative to the pattern origin
+  const int disk[6][2] = {{1, 4}, {0, 5}, {-1, 6}, {-1, 6}, {0, 5}, {1, 4}};
+  for (auto i = 0; i < graded.width(); i = i + 15) {
+    for (auto j = 0; j < graded.height(); j = j + 15) {
+      for (auto row = 0; row < 6; row++) {
+        for (auto k = i + disk[row][0]; k < i + disk[row][1]; k++)
+          invert(i, j, k, j + row);
       }
     }
   }
+}
+
+// Grading stages that come after the comic pattern. All of them read only the
+// pixel they write, so they are fused in a single kernel.
+static vec4f grade_effects(const vec4f& pixel, const vec2i& ij,
+    const vec2i& size, const grade_params& params) {
+  auto [i, j] = ij;
+  auto c      = xyz(pixel);
+  auto alpha  = pixel.w;
   // red green blue
   if (params.rgb) {
-    vec2f inters;
-    for (auto i = 0; i < img.imsize()[0]; i++) {
-      for (auto j = 0; j < img.imsize()[1]; j++) {
-        auto c = xyz(graded[{i, j}]);
-
-        if (i == j && i == 1920 - j) {
-          inters = {(float)i, (float)j};
-          for (int k = inters.y; k < img.imsize()[1]; k++) {
-            graded[{i, k}] = {0.0, 0.0, 0.0};
-          }
-        }
-        if ((i == j && inters.x == 0) || (i == 1920 - j && inters.x != 0))
-          c = {0.0, 0.0, 0.0};
-        if (i < j && inters.x == 0) {
-          c.x = c.x;
-          c.y = c.x;
-          c.z = (c.x + 0.93f) / 2;
-        } else if (i < 1920 - j) {
-          c.x = c.x;
-          c.y = (c.y + 0.93f) / 2;
-          c.z = c.z;
-        } else {
-          c.x = (c.x + 0.93f) / 2;
-          c.y = c.y;
-          c.z = c.z;
-        }
-        graded[{i, j}] = vec4f{c.x, c.y, c.z, graded[{i, j}].w};
-      }
+    // the two diagonals cross at (960, 960); from there on, the pattern
+    // switches diagonal and the column below the crossing is cleared
+    auto crossed = size.x > 960 && size.y > 960 &&
+                   (i > 960 || (i == 960 && j >= 960));
+    if (crossed && i == 960) c = {0.0, 0.0, 0.0}, alpha = 0;
+    if ((i == j && !crossed) || (i == 1920 - j && crossed))
+      c = {0.0, 0.0, 0.0};
+    if (i < j && !crossed) {
+      c.y = c.x;
+      c.z = (c.x + 0.93f) / 2;
+    } else if (i < 1920 - j) {
+      c.y = (c.y + 0.93f) / 2;
+    } else {
+      c.x = (c.x + 0.93f) / 2;
     }
   }
   // negative
-  if (params.negative) {
-    for (auto i = 0; i < img.imsize()[0]; i++) {
-      for (auto j = 0; j < img.imsize()[1]; j++) {
-        auto c         = xyz(graded[{i, j}]);
-        graded[{i, j}] = vec4f{1 - c.x, 1 - c.y, 1 - c.z, graded[{i, j}].w};
-      }
-    }
-  }
+  if (params.negative) c = {1 - c.x, 1 - c.y, 1 - c.z};
   // vintage
-  if (params.vintage) {
-    for (auto i = 0; i < img.imsize()[0]; i++) {
-      for (auto j = 0; j < img.imsize()[1]; j++) {
-        auto c         = xyz(graded[{i, j}]);
-        graded[{i, j}] = vec4f{c.x, c.y, (0.15f + c.z) / 2, graded[{i, j}].w};
-      }
-    }
-  }
+  if (params.vintage) c.z = (0.15f + c.z) / 2;
   // posterization
   if (params.posterization) {
-    for (auto i = 0; i < img.imsize()[0]; i++) {
-      for (auto j = 0; j < img.imsize()[1]; j++) {
-        auto c   = xyz(graded[{i, j}]);
-        auto max = (c.x > c.y) ? 0 : (c.z > c.y) ? 2 : 1;
-
-        c.x = (max == 0) ? c.x : ((float)(int)(c.x * 9)) / 9;
-        c.y = (max == 1) ? c.y : (((float)(int)(c.y * 9))) / 9;
-        c.z = (max == 2) ? c.z : (((float)(int)(c.z * 9))) / 9;
-
-        graded[{i, j}] = vec4f{c.x, c.y, (c.z > 0) ? c.z : 0, graded[{i, j}].w};
-      }
-    }
+    auto max = (c.x > c.y) ? 0 : (c.z > c.y) ? 2 : 1;
+    c.x      = (max == 0) ? c.x : ((float)(int)(c.x * 9)) / 9;
+    c.y      = (max == 1) ? c.y : (((float)(int)(c.y * 9))) / 9;
+    c.z      = (max == 2) ? c.z : (((float)(int)(c.z * 9))) / 9;
+    c.z      = (c.z > 0) ? c.z : 0;
   }
   // viewfinder
   if (params.viewfinder) {
-    auto med0   = img.imsize()[0] / 2;
-    auto med1   = img.imsize()[1] / 2;
-    auto mindim = min(img.imsize()[0], img.imsize()[1]);
-    auto md6    = (int)mindim / 4;
-
-    for (auto i = 0; i < img.imsize()[0]; i++) {
-      for (auto j = 0; j < img.imsize()[1]; j++) {
-        auto  c    = xyz(graded[{i, j}]);
-        auto  vr   = 1 - params.viewfinder;
-        vec2f ij   = {i, j};
-        vec2f imgf = {img.imsize()[0], img.imsize()[1]};
-        auto  r1   = length(operator-=(ij, operator/=(imgf, 2)));
-        auto  r2   = length(operator/=(imgf, 2));
-        auto  r    = r1 / r2;
-
-        if ((i < med0 - (int)(mindim / 175) ||
-                i > med0 + (int)(mindim / 175)) &&
-            (j < med1 - (int)(mindim / 175) ||
-                j > med1 + (int)(mindim / 175))) {
-          c = c * (1 - smoothstep(1.4 * vr, 1.5 * vr, r));
-
-        } else if ((i < med0 + 3 && i > med0 - 3) &&
-                   (j < med1 + 3 && j > med1 - 3)) {
-          c = {1.0, 0.05, 0.0};
-
-        } else if ((i < med0 + md6 && i > med0 - md6) &&
-                   (j < med1 + md6 && j > med1 - md6)) {
-          if (i == med0 || j == med1) c = {0.0, 0.0, 0.0};
-
-        } else {
-          c = {0.0, 0.0, 0.0};
-        }
-
-        graded[{i, j}] = vec4f{c.x, c.y, c.z, graded[{i, j}].w};
-      }
+    auto  med0   = size.x / 2;
+    auto  med1   = size.y / 2;
+    auto  mindim = min(size.x, size.y);
+    auto  md6    = (int)mindim / 4;
+    auto  vr     = 1 - params.viewfinder;
+    auto  pos    = vec2f{(float)i, (float)j};
+    auto  imgf   = vec2f{(float)size.x, (float)size.y};
+    auto  r      = length(pos - imgf / 2) / length(imgf / 4);
+    if ((i < med0 - (int)(mindim / 175) || i > med0 + (int)(mindim / 175)) &&
+        (j < med1 - (int)(mindim / 175) || j > med1 + (int)(mindim / 175))) {
+      c = c * (1 - smoothstep(1.4 * vr, 1.5 * vr, r));
+    } else if ((i < med0 + 3 && i > med0 - 3) &&
+               (j < med1 + 3 && j > med1 - 3)) {
+      c = {1.0, 0.05, 0.0};
+    } else if ((i < med0 + md6 && i > med0 - md6) &&
+               (j < med1 + md6 && j > med1 - md6)) {
+      if (i == med0 || j == med1) c = {0.0, 0.0, 0.0};
+    } else {
+      c = {0.0, 0.0, 0.0};
     }
   }
+  // stippling
   if (params.stippling) {
-    for (auto i = 0; i < img.imsize()[0]; i++) {
-      for (auto j = 0; j < img.imsize()[1]; j++) {
-        auto  uv       = xyz(graded[{i, j}]);
-        float c        = mask(uv);
-        graded[{i, j}] = vec4f{c, c, c, graded[{i, j}].w};
-      }
+    auto f = mask(c);
+    c      = {f, f, f};
+  }
+  return {c.x, c.y, c.z, alpha};
+}
+
+image<vec4f> grade_image(const image<vec4f>& img, const grade_params& params) {
+  // Stages are fused into per-pixel kernels run over cache-sized tiles. Only
+  // the stages that read neighboring pixels split the work in more passes:
+  // the mosaic grades its sample pixels first, and the comic pattern runs
+  // between the stages before and after it.
+  auto size   = img.imsize();
+  auto graded = image<vec4f>{size};
+  auto scale  = (float)pow(2, params.exposure);
+
+  // mosaic samples, graded once for each mosaic cell
+  auto mosaic  = abs(params.mosaic);
+  auto samples = image<vec4f>{};
+  if (mosaic > 1) {
+    samples = image<vec4f>{(size + mosaic - 1) / mosaic};
+    grade_tiles(samples.imsize(), [&](const vec2i& cell) {
+      auto ij       = cell * mosaic;
+      samples[cell] = grade_tonemap(img[ij], ij, size, params, scale);
+    });
+  }
+
+  // fused stages, up to the comic pattern if present
+  grade_tiles(size, [&](const vec2i& ij) {
+    auto pixel = vec4f{};
+    if (mosaic > 1) {
+      auto c = xyz(samples[ij / mosaic]);
+      pixel  = {c.x, c.y, c.z, img[ij].w};
+    } else {
+      pixel = grade_tonemap(img[ij], ij, size, params, scale);
     }
+    if (params.grid) pixel = grade_grid(pixel, ij, params.grid);
+    if (!params.pn) pixel = grade_effects(pixel, ij, size, params);
+    graded[ij] = pixel;
+  });
+
+  // comic pattern, followed by the remaining fused stages
+  if (params.pn) {
+    grade_pn(graded);
+    grade_tiles(size, [&](const vec2i& ij) {
+      graded[ij] = grade_effects(graded[ij], ij, size, params);
+    });
   }
 
   return graded;
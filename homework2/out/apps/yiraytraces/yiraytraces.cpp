@@ -220,12 +220,8 @@ void reset_display(app_state* app) {
     for (auto sample = 0; sample < app->params.samples; sample++) {
       if (app->render_stop) return;
       render_samples(app->render_state, app->scene, app->camera, app->params);
-      for (auto j = 0; j < app->render_state->render.imsize().y; j++) {
-        for (auto i = 0; i < app->render_state->render.imsize().x; i++) {
-          app->render[{i, j}]  = app->render_state->render[{i, j}];
-          app->display[{i, j}] = tonemap(app->render[{i, j}], app->exposure);
-        }
-      }
+      app->render = app->render_state->render;
+      tonemap_image_mt(app->display, app->render, app->exposure);
     }
   });
 }
@@ -250,6 +246,7 @@ int main(int argc, const char* argv[]) {
   add_option(
       cli, "--bounces,-b", app->params.bounces, "Maximum number of bounces.");
   add_option(cli, "--clamp", app->params.clamp, "Final pixel clamping.");
+  add_option(cli, "--bvh", app->params.bvh, "Bvh type", raytrace_bvh_names);
   add_option(cli, "--skyenv/--no-skyenv", add_skyenv, "Add sky envmap");
   add_option(cli, "--output,-o", app->imagename, "Image output");
   add_option(cli, "scene", app->filename, "Scene filename", true);
@@ -155,6 +155,7 @@ int main(int argc, const char* argv[]) {
       cli, "--shader,-t", params.shader, "Shader type.", raytrace_shader_names);
   add_option(cli, "--bounces,-b", params.bounces, "Maximum number of bounces.");
   add_option(cli, "--clamp", params.clamp, "Final pixel clamping.");
+  add_option(cli, "--bvh", params.bvh, "Bvh type", raytrace_bvh_names);
   add_option(cli, "--save-batch", save_batch, "Save images progressively");
   add_option(cli, "--output-image,-o", imfilename, "Image filename");
   add_option(cli, "scene", filename, "Scene filename", true);
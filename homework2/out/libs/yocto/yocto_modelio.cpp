@@ -29,6 +29,8 @@
 #include "yocto_modelio.h"
 
 #include <cstdio>
+#include <charconv>
+#include <cstring>
 #include <filesystem>
 #include <memory>
 #include <stdexcept>
@@ -39,6 +41,7 @@
 
 #include "yocto_color.h"
 #include "yocto_commonio.h"
+#include "yocto_parallel.h"
 
 // -----------------------------------------------------------------------------
 // USING DIRECTIVES
@@ -267,15 +270,221 @@ inline bool parse_value(string_view& str, frame3f& value) {
 // -----------------------------------------------------------------------------
 namespace yocto {
 
-ply_element::~ply_element() {
-  for (auto property : properties) delete property;
+// Size in bytes of a ply type
+static size_t get_ply_type_size(ply_type type) {
+  switch (type) {
+    case ply_type::i8: return 1;
+    case ply_type::i16: return 2;
+    case ply_type::i32: return 4;
+    case ply_type::i64: return 8;
+    case ply_type::u8: return 1;
+    case ply_type::u16: return 2;
+    case ply_type::u32: return 4;
+    case ply_type::u64: return 8;
+    case ply_type::f32: return 4;
+    case ply_type::f64: return 8;
+    default: return 0;
+  }
 }
-ply_model::~ply_model() {
-  for (auto element : elements) delete element;
+
+// Calls func with a value of the C++ type of a ply type, so that typed code
+// is written once for all types and dispatched once per property
+template <typename Func>
+static auto visit_ply_type(ply_type type, Func&& func) {
+  switch (type) {
+    case ply_type::i8: return func(int8_t{});
+    case ply_type::i16: return func(int16_t{});
+    case ply_type::i32: return func(int32_t{});
+    case ply_type::i64: return func(int64_t{});
+    case ply_type::u8: return func(uint8_t{});
+    case ply_type::u16: return func(uint16_t{});
+    case ply_type::u32: return func(uint32_t{});
+    case ply_type::u64: return func(uint64_t{});
+    case ply_type::f64: return func(double{});
+    default: return func(float{});
+  }
 }
 
-// Load ply
-bool load_ply(const string& filename, ply_model* ply, string& error) {
+// Check whether an element has lists, and so records of varying size
+static bool has_ply_lists(const ply_element* elem) {
+  for (auto& prop : elem->properties)
+    if (prop.is_list) return true;
+  return false;
+}
+
+// Swap the byte order of count values, spaced by stride bytes
+static void swap_ply_values(
+    ply_type type, byte* data, size_t count, size_t stride) {
+  visit_ply_type(type, [&](auto value) {
+    for (auto idx = (size_t)0; idx < count; idx++) {
+      memcpy(&value, data + idx * stride, sizeof(value));
+      value = swap_endian(value);
+      memcpy(data + idx * stride, &value, sizeof(value));
+    }
+  });
+}
+
+// Gather count values, spaced by stride bytes, into values spaced by vstride
+template <typename T>
+static void gather_ply_values(ply_type type, const byte* data, size_t stride,
+    T* values, size_t count, size_t vstride) {
+  visit_ply_type(type, [&](auto value) {
+    for (auto idx = (size_t)0; idx < count; idx++) {
+      memcpy(&value, data + idx * stride, sizeof(value));
+      values[idx * vstride] = (T)value;
+    }
+  });
+}
+
+// Size of the data left in a file
+static size_t get_remaining_size(file_stream& fs) {
+  auto start = ftell(fs.fs);
+  if (start < 0 || fseek(fs.fs, 0, SEEK_END) != 0) return 0;
+  auto end = ftell(fs.fs);
+  if (end < start || fseek(fs.fs, start, SEEK_SET) != 0) return 0;
+  return (size_t)(end - start);
+}
+
+// Read more binary data, dropping the bytes before offset. The read size
+// grows with the pending data, so that any record eventually fits, and is
+// capped by the data left in the file.
+static bool refill_ply_data(file_stream& fs, vector<byte>& data,
+    size_t& offset, size_t& remaining) {
+  data.erase(data.begin(), data.begin() + offset);
+  offset    = 0;
+  auto size = data.size();
+  auto read = std::min(remaining, std::max(size, (size_t)(1 << 22)));
+  if (read == 0) return false;
+  data.resize(size + read);
+  if (!read_data(fs, data.data() + size, read)) return false;
+  remaining -= read;
+  return true;
+}
+
+// Decode count records of a binary element with lists starting at offset,
+// and advance offset past them. Returns false, leaving the element as is,
+// if the data ends before the last record. Records are walked twice, first
+// to size the buffers and then to copy the values.
+static bool decode_ply_lists(ply_element* elem, size_t count,
+    const vector<byte>& data, size_t& offset, bool big_endian) {
+  auto sizes = vector<size_t>{};
+  for (auto& prop : elem->properties)
+    sizes.push_back(get_ply_type_size(prop.type));
+
+  // count list values, checking bounds
+  auto counts = vector<size_t>(elem->properties.size(), 0);
+  auto end    = offset;
+  for (auto idx = (size_t)0; idx < count; idx++) {
+    for (auto pidx = 0; pidx < (int)elem->properties.size(); pidx++) {
+      auto vcount = (size_t)1;
+      if (elem->properties[pidx].is_list) {
+        if (end >= data.size()) return false;
+        vcount = data[end++];
+      }
+      if (vcount * sizes[pidx] > data.size() - end) return false;
+      end += vcount * sizes[pidx];
+      counts[pidx] += vcount;
+    }
+  }
+
+  // copy values
+  elem->data.resize(count * elem->stride);
+  for (auto pidx = 0; pidx < (int)elem->properties.size(); pidx++) {
+    auto& prop = elem->properties[pidx];
+    if (!prop.is_list) continue;
+    prop.data.resize(counts[pidx] * sizes[pidx]);
+    prop.ldata_u8.resize(count);
+  }
+  auto starts = vector<size_t>(elem->properties.size(), 0);
+  for (auto idx = (size_t)0; idx < count; idx++) {
+    auto record = elem->data.data() + idx * elem->stride;
+    for (auto pidx = 0; pidx < (int)elem->properties.size(); pidx++) {
+      auto& prop   = elem->properties[pidx];
+      auto  vcount = (size_t)1;
+      auto  dest   = record + prop.offset;
+      if (prop.is_list) {
+        prop.ldata_u8[idx] = data[offset++];
+        vcount             = prop.ldata_u8[idx];
+        dest               = prop.data.data() + starts[pidx];
+        starts[pidx] += vcount * sizes[pidx];
+      }
+      if (vcount == 0) continue;
+      memcpy(dest, data.data() + offset, vcount * sizes[pidx]);
+      if (big_endian) swap_ply_values(prop.type, dest, vcount, sizes[pidx]);
+      offset += vcount * sizes[pidx];
+    }
+  }
+  return true;
+}
+
+// Read count records of a binary element. Records without lists have a
+// fixed size, so they are read with a single call into the element data,
+// after the bytes already buffered in data. Records with lists are decoded
+// from data, reading more of the file until they fit.
+static bool read_ply_element(file_stream& fs, ply_element* elem, size_t count,
+    vector<byte>& data, size_t& offset, size_t& remaining, bool big_endian) {
+  if (has_ply_lists(elem)) {
+    while (!decode_ply_lists(elem, count, data, offset, big_endian)) {
+      if (!refill_ply_data(fs, data, offset, remaining)) return false;
+    }
+    return true;
+  }
+
+  auto size     = count * elem->stride;
+  auto buffered = std::min(size, data.size() - offset);
+  elem->data.resize(size);
+  if (size == 0) return true;
+  if (buffered != 0) memcpy(elem->data.data(), data.data() + offset, buffered);
+  offset += buffered;
+  if (size - buffered > remaining) return false;
+  if (!read_data(fs, elem->data.data() + buffered, size - buffered))
+    return false;
+  remaining -= size - buffered;
+  if (big_endian) {
+    for (auto& prop : elem->properties)
+      swap_ply_values(
+          prop.type, elem->data.data() + prop.offset, count, elem->stride);
+  }
+  return true;
+}
+
+// Encode the records of an element in the layout of binary files
+static void encode_ply_element(
+    const ply_element* elem, vector<byte>& buffer, bool big_endian) {
+  if (!has_ply_lists(elem)) {
+    buffer.assign(elem->data.begin(), elem->data.end());
+    if (!big_endian) return;
+    for (auto& prop : elem->properties)
+      swap_ply_values(
+          prop.type, buffer.data() + prop.offset, elem->count, elem->stride);
+    return;
+  }
+
+  buffer.clear();
+  auto starts = vector<size_t>(elem->properties.size(), 0);
+  for (auto idx = (size_t)0; idx < elem->count; idx++) {
+    auto record = elem->data.data() + idx * elem->stride;
+    for (auto pidx = 0; pidx < (int)elem->properties.size(); pidx++) {
+      auto& prop   = elem->properties[pidx];
+      auto  size   = get_ply_type_size(prop.type);
+      auto  vcount = (size_t)1;
+      auto  source = record + prop.offset;
+      if (prop.is_list) {
+        vcount = prop.ldata_u8[idx];
+        source = prop.data.data() + starts[pidx];
+        starts[pidx] += vcount * size;
+        buffer.push_back((byte)vcount);
+      }
+      auto start = buffer.size();
+      buffer.insert(buffer.end(), source, source + vcount * size);
+      if (big_endian)
+        swap_ply_values(prop.type, buffer.data() + start, vcount, size);
+    }
+  }
+}
+
+// Parse the ply header, leaving the file at the start of the data
+static bool parse_ply_header(file_stream& fs, ply_model* ply) {
   // ply type names
   static auto type_map = unordered_map<string, ply_type>{{"char", ply_type::i8},
       {"short", ply_type::i16}, {"int", ply_type::i32}, {"long", ply_type::i64},
@@ -292,24 +501,6 @@ bool load_ply(const string& filename, ply_model* ply, string& error) {
   ply->comments.clear();
   ply->elements.clear();
 
-  // error helpers
-  auto open_error = [filename, &error]() {
-    error = filename + ": file not found";
-    return false;
-  };
-  auto parse_error = [filename, &error]() {
-    error = filename + ": parse error";
-    return false;
-  };
-  auto read_error = [filename, &error]() {
-    error = filename + ": read error";
-    return false;
-  };
-
-  // open file
-  auto fs = open_file(filename, "rb");
-  if (!fs) return open_error();
-
   // parsing checks
   auto first_line = true;
   auto end_header = false;
@@ -325,22 +516,22 @@ bool load_ply(const string& filename, ply_model* ply, string& error) {
 
     // get command
     auto cmd = ""s;
-    if (!parse_value(str, cmd)) return parse_error();
+    if (!parse_value(str, cmd)) return false;
     if (cmd.empty()) continue;
 
     // check magic number
     if (first_line) {
-      if (cmd != "ply") return parse_error();
+      if (cmd != "ply") return false;
       first_line = false;
       continue;
     }
 
     // possible token values
     if (cmd == "ply") {
-      if (!first_line) return parse_error();
+      if (!first_line) return false;
     } else if (cmd == "format") {
       auto fmt = ""s;
-      if (!parse_value(str, fmt)) return parse_error();
+      if (!parse_value(str, fmt)) return false;
       if (fmt == "ascii") {
         ply->format = ply_format::ascii;
       } else if (fmt == "binary_little_endian") {
@@ -348,7 +539,7 @@ bool load_ply(const string& filename, ply_model* ply, string& error) {
       } else if (fmt == "binary_big_endian") {
         ply->format = ply_format::binary_big_endian;
       } else {
-        return parse_error();
+        return false;
       }
     } else if (cmd == "comment") {
       skip_whitespace(str);
@@ -357,176 +548,182 @@ bool load_ply(const string& filename, ply_model* ply, string& error) {
       skip_whitespace(str);
       // comment is the rest of the str
     } else if (cmd == "element") {
-      auto elem = ply->elements.emplace_back(new ply_element{});
-      if (!parse_value(str, elem->name)) return parse_error();
-      if (!parse_value(str, elem->count)) return parse_error();
+      auto& elem = ply->elements.emplace_back();
+      if (!parse_value(str, elem.name)) return false;
+      if (!parse_value(str, elem.count)) return false;
     } else if (cmd == "property") {
-      if (ply->elements.empty()) return parse_error();
-      auto prop = ply->elements.back()->properties.emplace_back(
-          new ply_property{});
-      auto tname = ""s;
-      if (!parse_value(str, tname)) return parse_error();
+      if (ply->elements.empty()) return false;
+      auto& elem  = ply->elements.back();
+      auto& prop  = elem.properties.emplace_back();
+      auto  tname = ""s;
+      if (!parse_value(str, tname)) return false;
       if (tname == "list") {
-        prop->is_list = true;
-        if (!parse_value(str, tname)) return parse_error();
+        prop.is_list = true;
+        if (!parse_value(str, tname)) return false;
         auto itype = type_map.at(tname);
-        if (itype != ply_type::u8) return parse_error();
-        if (!parse_value(str, tname)) return parse_error();
-        if (type_map.find(tname) == type_map.end()) return parse_error();
-        prop->type = type_map.at(tname);
+        if (itype != ply_type::u8) return false;
+        if (!parse_value(str, tname)) return false;
+        if (type_map.find(tname) == type_map.end()) return false;
+        prop.type = type_map.at(tname);
       } else {
-        prop->is_list = false;
-        if (type_map.find(tname) == type_map.end()) return parse_error();
-        prop->type = type_map.at(tname);
+        prop.is_list = false;
+        if (type_map.find(tname) == type_map.end()) return false;
+        prop.type   = type_map.at(tname);
+        prop.offset = elem.stride;
+        elem.stride += get_ply_type_size(prop.type);
       }
-      if (!parse_value(str, prop->name)) return parse_error();
+      if (!parse_value(str, prop.name)) return false;
     } else if (cmd == "end_header") {
       end_header = true;
       break;
     } else {
-      return parse_error();
+      return false;
     }
   }
 
   // check exit
-  if (!end_header) return parse_error();
-
-  // allocate data ---------------------------------
-  for (auto element : ply->elements) {
-    for (auto property : element->properties) {
-      auto count = property->is_list ? element->count * 3 : element->count;
-      switch (property->type) {
-        case ply_type::i8: property->data_i8.reserve(count); break;
-        case ply_type::i16: property->data_i16.reserve(count); break;
-        case ply_type::i32: property->data_i32.reserve(count); break;
-        case ply_type::i64: property->data_i64.reserve(count); break;
-        case ply_type::u8: property->data_u8.reserve(count); break;
-        case ply_type::u16: property->data_u16.reserve(count); break;
-        case ply_type::u32: property->data_u32.reserve(count); break;
-        case ply_type::u64: property->data_u64.reserve(count); break;
-        case ply_type::f32: property->data_f32.reserve(count); break;
-        case ply_type::f64: property->data_f64.reserve(count); break;
-      }
-      if (property->is_list) property->ldata_u8.reserve(element->count);
+  return end_header;
+}
+
+// Parse one ascii record of an element, appending its values
+static bool parse_ply_record(string_view str, ply_element* elem) {
+  auto record = elem->data.size();
+  elem->data.resize(record + elem->stride);
+  for (auto& prop : elem->properties) {
+    auto vcount = (uint8_t)1;
+    if (prop.is_list) {
+      if (!parse_value(str, vcount)) return false;
+      prop.ldata_u8.push_back(vcount);
     }
+    auto ok = visit_ply_type(prop.type, [&](auto value) {
+      for (auto i = 0; i < vcount; i++) {
+        if (!parse_value(str, value)) return false;
+        if (prop.is_list) {
+          auto bytes = (const byte*)&value;
+          prop.data.insert(prop.data.end(), bytes, bytes + sizeof(value));
+        } else {
+          memcpy(elem->data.data() + record + prop.offset, &value,
+              sizeof(value));
+        }
+      }
+      return true;
+    });
+    if (!ok) return false;
   }
+  return true;
+}
+
+// Release the values of an element
+static void clear_ply_values(ply_element* elem) {
+  elem->data.clear();
+  for (auto& prop : elem->properties) {
+    prop.data.clear();
+    prop.ldata_u8.clear();
+  }
+}
+
+// Load ply
+bool load_ply(const string& filename, ply_model* ply, string& error) {
+  // error helpers
+  auto open_error = [filename, &error]() {
+    error = filename + ": file not found";
+    return false;
+  };
+  auto parse_error = [filename, &error]() {
+    error = filename + ": parse error";
+    return false;
+  };
+  auto read_error = [filename, &error]() {
+    error = filename + ": read error";
+    return false;
+  };
+
+  // open file
+  auto fs = open_file(filename, "rb");
+  if (!fs) return open_error();
+
+  // read header
+  if (!parse_ply_header(fs, ply)) return parse_error();
 
   // read data -------------------------------------
   if (ply->format == ply_format::ascii) {
     auto buffer = array<char, 4096>{};
-    for (auto elem : ply->elements) {
-      for (auto idx = 0; idx < elem->count; idx++) {
+    for (auto& elem : ply->elements) {
+      elem.data.reserve(elem.count * elem.stride);
+      for (auto& prop : elem.properties) {
+        if (!prop.is_list) continue;
+        prop.data.reserve(elem.count * 3 * get_ply_type_size(prop.type));
+        prop.ldata_u8.reserve(elem.count);
+      }
+      for (auto idx = 0; idx < elem.count; idx++) {
         if (!read_line(fs, buffer)) return read_error();
-        auto str = string_view{buffer.data()};
-        for (auto prop : elem->properties) {
-          if (prop->is_list) {
-            if (!parse_value(str, prop->ldata_u8.emplace_back()))
-              return parse_error();
-          }
-          auto vcount = prop->is_list ? prop->ldata_u8.back() : 1;
-          for (auto i = 0; i < vcount; i++) {
-            switch (prop->type) {
-              case ply_type::i8:
-                if (!parse_value(str, prop->data_i8.emplace_back()))
-                  return parse_error();
-                break;
-              case ply_type::i16:
-                if (!parse_value(str, prop->data_i16.emplace_back()))
-                  return parse_error();
-                break;
-              case ply_type::i32:
-                if (!parse_value(str, prop->data_i32.emplace_back()))
-                  return parse_error();
-                break;
-              case ply_type::i64:
-                if (!parse_value(str, prop->data_i64.emplace_back()))
-                  return parse_error();
-                break;
-              case ply_type::u8:
-                if (!parse_value(str, prop->data_u8.emplace_back()))
-                  return parse_error();
-                break;
-              case ply_type::u16:
-                if (!parse_value(str, prop->data_u16.emplace_back()))
-                  return parse_error();
-                break;
-              case ply_type::u32:
-                if (!parse_value(str, prop->data_u32.emplace_back()))
-                  return parse_error();
-                break;
-              case ply_type::u64:
-                if (!parse_value(str, prop->data_u64.emplace_back()))
-                  return parse_error();
-                break;
-              case ply_type::f32:
-                if (!parse_value(str, prop->data_f32.emplace_back()))
-                  return parse_error();
-                break;
-              case ply_type::f64:
-                if (!parse_value(str, prop->data_f64.emplace_back()))
-                  return parse_error();
-                break;
-            }
-          }
-        }
+        if (!parse_ply_record(string_view{buffer.data()}, &elem))
+          return parse_error();
       }
     }
   } else {
     auto big_endian = ply->format == ply_format::binary_big_endian;
-    for (auto elem : ply->elements) {
-      for (auto idx = 0; idx < elem->count; idx++) {
-        for (auto prop : elem->properties) {
-          if (prop->is_list) {
-            if (!read_value(fs, prop->ldata_u8.emplace_back(), big_endian))
-              return read_error();
-          }
-          auto vcount = prop->is_list ? prop->ldata_u8.back() : 1;
-          for (auto i = 0; i < vcount; i++) {
-            switch (prop->type) {
-              case ply_type::i8:
-                if (!read_value(fs, prop->data_i8.emplace_back(), big_endian))
-                  return read_error();
-                break;
-              case ply_type::i16:
-                if (!read_value(fs, prop->data_i16.emplace_back(), big_endian))
-                  return read_error();
-                break;
-              case ply_type::i32:
-                if (!read_value(fs, prop->data_i32.emplace_back(), big_endian))
-                  return read_error();
-                break;
-              case ply_type::i64:
-                if (!read_value(fs, prop->data_i64.emplace_back(), big_endian))
-                  return read_error();
-                break;
-              case ply_type::u8:
-                if (!read_value(fs, prop->data_u8.emplace_back(), big_endian))
-                  return read_error();
-                break;
-              case ply_type::u16:
-                if (!read_value(fs, prop->data_u16.emplace_back(), big_endian))
-                  return read_error();
-                break;
-              case ply_type::u32:
-                if (!read_value(fs, prop->data_u32.emplace_back(), big_endian))
-                  return read_error();
-                break;
-              case ply_type::u64:
-                if (!read_value(fs, prop->data_u64.emplace_back(), big_endian))
-                  return read_error();
-                break;
-              case ply_type::f32:
-                if (!read_value(fs, prop->data_f32.emplace_back(), big_endian))
-                  return read_error();
-                break;
-              case ply_type::f64:
-                if (!read_value(fs, prop->data_f64.emplace_back(), big_endian))
-                  return read_error();
-                break;
-            }
-          }
+    auto data       = vector<byte>{};
+    auto offset     = (size_t)0;
+    auto remaining  = get_remaining_size(fs);
+    for (auto& elem : ply->elements) {
+      if (!read_ply_element(
+              fs, &elem, elem.count, data, offset, remaining, big_endian))
+        return read_error();
+    }
+  }
+  return true;
+}
+
+// Stream ply
+bool stream_ply(const string& filename, ply_model* ply,
+    const ply_element_callback& element_cb, string& error,
+    size_t block_size) {
+  // error helpers
+  auto open_error = [filename, &error]() {
+    error = filename + ": file not found";
+    return false;
+  };
+  auto parse_error = [filename, &error]() {
+    error = filename + ": parse error";
+    return false;
+  };
+  auto read_error = [filename, &error]() {
+    error = filename + ": read error";
+    return false;
+  };
+
+  // open file
+  auto fs = open_file(filename, "rb");
+  if (!fs) return open_error();
+
+  // read header
+  if (!parse_ply_header(fs, ply)) return parse_error();
+  block_size = std::max(block_size, (size_t)1);
+
+  // read data in blocks ---------------------------
+  auto buffer     = array<char, 4096>{};
+  auto big_endian = ply->format == ply_format::binary_big_endian;
+  auto data       = vector<byte>{};
+  auto offset     = (size_t)0;
+  auto remaining  = get_remaining_size(fs);
+  for (auto& elem : ply->elements) {
+    for (auto start = (size_t)0; start < elem.count; start += block_size) {
+      auto count = std::min(block_size, elem.count - start);
+      if (ply->format == ply_format::ascii) {
+        for (auto idx = (size_t)0; idx < count; idx++) {
+          if (!read_line(fs, buffer)) return read_error();
+          if (!parse_ply_record(string_view{buffer.data()}, &elem))
+            return parse_error();
         }
+      } else {
+        if (!read_ply_element(
+                fs, &elem, count, data, offset, remaining, big_endian))
+          return read_error();
       }
+      auto done = !element_cb(ply, &elem, start);
+      clear_ply_values(&elem);
+      if (done) return true;
     }
   }
   return true;
@@ -568,18 +765,18 @@ bool save_ply(const string& filename, ply_model* ply, string& error) {
     return write_error();
   for (auto& comment : ply->comments)
     if (!format_values(fs, "comment {}\n", comment)) return write_error();
-  for (auto elem : ply->elements) {
+  for (auto& elem : ply->elements) {
     if (!format_values(
-            fs, "element {} {}\n", elem->name, (uint64_t)elem->count))
+            fs, "element {} {}\n", elem.name, (uint64_t)elem.count))
       return write_error();
-    for (auto prop : elem->properties) {
-      if (prop->is_list) {
+    for (auto& prop : elem.properties) {
+      if (prop.is_list) {
         if (!format_values(fs, "property list uchar {} {}\n",
-                type_map[prop->type], prop->name))
+                type_map[prop.type], prop.name))
           return write_error();
       } else {
         if (!format_values(
-                fs, "property {} {}\n", type_map[prop->type], prop->name))
+                fs, "property {} {}\n", type_map[prop.type], prop.name))
           return write_error();
       }
     }
@@ -589,118 +786,44 @@ bool save_ply(const string& filename, ply_model* ply, string& error) {
 
   // properties
   if (ply->format == ply_format::ascii) {
-    for (auto elem : ply->elements) {
-      auto cur = vector<size_t>(elem->properties.size(), 0);
-      for (auto idx = 0; idx < elem->count; idx++) {
-        for (auto prop : elem->properties) {
-          if (prop->is_list)
-            if (!format_values(fs, "{} ", (int)prop->ldata_u8[idx]))
-              return write_error();
-          auto vcount = prop->is_list ? prop->ldata_u8[idx] : 1;
-          for (auto i = 0; i < vcount; i++) {
-            switch (prop->type) {
-              case ply_type::i8:
-                if (!format_values(fs, "{} ", prop->data_i8[cur[idx]++]))
-                  return write_error();
-                break;
-              case ply_type::i16:
-                if (!format_values(fs, "{} ", prop->data_i16[cur[idx]++]))
-                  return write_error();
-                break;
-              case ply_type::i32:
-                if (!format_values(fs, "{} ", prop->data_i32[cur[idx]++]))
-                  return write_error();
-                break;
-              case ply_type::i64:
-                if (!format_values(fs, "{} ", prop->data_i64[cur[idx]++]))
-                  return write_error();
-                break;
-              case ply_type::u8:
-                if (!format_values(fs, "{} ", prop->data_u8[cur[idx]++]))
-                  return write_error();
-                break;
-              case ply_type::u16:
-                if (!format_values(fs, "{} ", prop->data_u16[cur[idx]++]))
-                  return write_error();
-                break;
-              case ply_type::u32:
-                if (!format_values(fs, "{} ", prop->data_u32[cur[idx]++]))
-                  return write_error();
-                break;
-              case ply_type::u64:
-                if (!format_values(fs, "{} ", prop->data_u64[cur[idx]++]))
-                  return write_error();
-                break;
-              case ply_type::f32:
-                if (!format_values(fs, "{} ", prop->data_f32[cur[idx]++]))
-                  return write_error();
-                break;
-              case ply_type::f64:
-                if (!format_values(fs, "{} ", prop->data_f64[cur[idx]++]))
-                  return write_error();
-                break;
-            }
+    for (auto& elem : ply->elements) {
+      auto starts = vector<size_t>(elem.properties.size(), 0);
+      for (auto idx = (size_t)0; idx < elem.count; idx++) {
+        auto record = elem.data.data() + idx * elem.stride;
+        for (auto pidx = 0; pidx < (int)elem.properties.size(); pidx++) {
+          auto& prop   = elem.properties[pidx];
+          auto  vcount = (size_t)1;
+          auto  source = record + prop.offset;
+          if (prop.is_list) {
+            vcount = prop.ldata_u8[idx];
+            source = prop.data.data() + starts[pidx];
+            starts[pidx] += vcount * get_ply_type_size(prop.type);
+            if (!format_values(fs, "{} ", (int)vcount)) return write_error();
           }
-          if (!format_values(fs, "\n")) return write_error();
+          auto ok = visit_ply_type(prop.type, [&](auto value) {
+            for (auto i = (size_t)0; i < vcount; i++) {
+              memcpy(&value, source + i * sizeof(value), sizeof(value));
+              if (!format_values(fs, "{} ", value)) return false;
+            }
+            return true;
+          });
+          if (!ok) return write_error();
         }
+        if (!format_values(fs, "\n")) return write_error();
       }
     }
   } else {
+    // records without lists are written as they are stored when possible
     auto big_endian = ply->format == ply_format::binary_big_endian;
-    for (auto elem : ply->elements) {
-      auto cur = vector<size_t>(elem->properties.size(), 0);
-      for (auto idx = 0; idx < elem->count; idx++) {
-        for (auto pidx = 0; pidx < elem->properties.size(); pidx++) {
-          auto prop = elem->properties[pidx];
-          if (prop->is_list)
-            if (!write_value(fs, prop->ldata_u8[idx], big_endian))
-              return write_error();
-          auto vcount = prop->is_list ? prop->ldata_u8[idx] : 1;
-          for (auto i = 0; i < vcount; i++) {
-            switch (prop->type) {
-              case ply_type::i8:
-                if (!write_value(fs, prop->data_i8[cur[pidx]++], big_endian))
-                  return write_error();
-                break;
-              case ply_type::i16:
-                if (!write_value(fs, prop->data_i16[cur[pidx]++], big_endian))
-                  return write_error();
-                break;
-              case ply_type::i32:
-                if (!write_value(fs, prop->data_i32[cur[pidx]++], big_endian))
-                  return write_error();
-                break;
-              case ply_type::i64:
-                if (!write_value(fs, prop->data_i64[cur[pidx]++], big_endian))
-                  return write_error();
-                break;
-              case ply_type::u8:
-                if (!write_value(fs, prop->data_u8[cur[pidx]++], big_endian))
-                  return write_error();
-                break;
-              case ply_type::u16:
-                if (!write_value(fs, prop->data_u16[cur[pidx]++], big_endian))
-                  return write_error();
-                break;
-              case ply_type::u32:
-                if (!write_value(fs, prop->data_u32[cur[pidx]++], big_endian))
-                  return write_error();
-                break;
-              case ply_type::u64:
-                if (!write_value(fs, prop->data_u64[cur[pidx]++], big_endian))
-                  return write_error();
-                break;
-              case ply_type::f32:
-                if (!write_value(fs, prop->data_f32[cur[pidx]++], big_endian))
-                  return write_error();
-                break;
-              case ply_type::f64:
-                if (!write_value(fs, prop->data_f64[cur[pidx]++], big_endian))
-                  return write_error();
-                break;
-            }
-          }
-        }
+    auto buffer     = vector<byte>{};
+    for (auto& elem : ply->elements) {
+      if (!big_endian && !has_ply_lists(&elem)) {
+        if (!write_data(fs, elem.data.data(), elem.data.size()))
+          return write_error();
+      } else {
+        encode_ply_element(&elem, buffer, big_endian);
+        if (!write_data(fs, buffer.data(), buffer.size()))
+          return write_error();
       }
     }
   }
@@ -709,116 +832,70 @@ bool save_ply(const string& filename, ply_model* ply, string& error) {
 }
 
 // Get ply properties
-bool has_property(
-    ply_model* ply, const string& element, const string& property) {
-  for (auto elem : ply->elements) {
-    if (elem->name != element) continue;
-    for (auto prop : elem->properties) {
-      if (prop->name == property) return true;
-    }
+static ply_element* get_element(ply_model* ply, const string& element) {
+  for (auto& elem : ply->elements) {
+    if (elem.name == element) return &elem;
   }
-  return false;
+  return nullptr;
 }
-ply_property* get_property(
-    ply_model* ply, const string& element, const string& property) {
-  for (auto elem : ply->elements) {
-    if (elem->name != element) continue;
-    for (auto prop : elem->properties) {
-      if (prop->name == property) return prop;
-    }
+static ply_property* get_property(ply_element* elem, const string& property) {
+  if (elem == nullptr) return nullptr;
+  for (auto& prop : elem->properties) {
+    if (prop.name == property) return &prop;
   }
-  throw std::runtime_error("property not found");
+  return nullptr;
 }
-template <typename T, typename T1>
-inline bool convert_property(const vector<T1>& prop, vector<T>& values) {
-  values = vector<T>(prop.size());
-  for (auto i = (size_t)0; i < prop.size(); i++) values[i] = (T)prop[i];
-  return true;
+bool has_property(
+    ply_model* ply, const string& element, const string& property) {
+  return get_property(get_element(ply, element), property) != nullptr;
 }
-template <typename T>
-inline bool convert_property(ply_property* prop, vector<T>& values) {
-  switch (prop->type) {
-    case ply_type::i8: return convert_property(prop->data_i8, values);
-    case ply_type::i16: return convert_property(prop->data_i16, values);
-    case ply_type::i32: return convert_property(prop->data_i32, values);
-    case ply_type::i64: return convert_property(prop->data_i64, values);
-    case ply_type::u8: return convert_property(prop->data_u8, values);
-    case ply_type::u16: return convert_property(prop->data_u16, values);
-    case ply_type::u32: return convert_property(prop->data_u32, values);
-    case ply_type::u64: return convert_property(prop->data_u64, values);
-    case ply_type::f32: return convert_property(prop->data_f32, values);
-    case ply_type::f64: return convert_property(prop->data_f64, values);
-  }
-  // return here to silence warnings
-  throw std::runtime_error{"should not have gotten here"};
-  return false;
+// Gather N non-list properties into values with N float components
+template <typename T, size_t N>
+static bool get_ply_values(ply_model* ply, const string& element,
+    const array<string, N>& properties, vector<T>& values) {
+  static_assert(sizeof(T) == sizeof(float) * N, "incompatible types");
+  values.clear();
+  auto elem = get_element(ply, element);
+  if (elem == nullptr) return false;
+  for (auto& property : properties) {
+    auto prop = get_property(elem, property);
+    if (prop == nullptr || prop->is_list) return false;
+  }
+  values.resize(elem->stride != 0 ? elem->data.size() / elem->stride : 0);
+  for (auto idx = 0; idx < (int)N; idx++) {
+    auto prop = get_property(elem, properties[idx]);
+    gather_ply_values(prop->type, elem->data.data() + prop->offset,
+        elem->stride, (float*)values.data() + idx, values.size(), N);
+  }
+  return true;
 }
 bool get_value(ply_model* ply, const string& element, const string& property,
     vector<float>& values) {
-  values.clear();
-  if (!has_property(ply, element, property)) return false;
-  auto prop = get_property(ply, element, property);
-  if (prop->is_list) return false;
-  if (!convert_property(prop, values)) return false;
-  return true;
+  return get_ply_values(ply, element, array<string, 1>{property}, values);
 }
 bool get_values(ply_model* ply, const string& element,
     const array<string, 2>& properties, vector<vec2f>& values) {
-  values.clear();
-  auto x = vector<float>{}, y = vector<float>{};
-  if (!get_value(ply, element, properties[0], x)) return false;
-  if (!get_value(ply, element, properties[1], y)) return false;
-  values = vector<vec2f>(x.size());
-  for (auto i = (size_t)0; i < values.size(); i++) values[i] = {x[i], y[i]};
-  return true;
+  return get_ply_values<vec2f, 2>(ply, element, properties, values);
 }
 bool get_values(ply_model* ply, const string& element,
     const array<string, 3>& properties, vector<vec3f>& values) {
-  values.clear();
-  auto x = vector<float>{}, y = vector<float>{}, z = vector<float>{};
-  if (!get_value(ply, element, properties[0], x)) return false;
-  if (!get_value(ply, element, properties[1], y)) return false;
-  if (!get_value(ply, element, properties[2], z)) return false;
-  values = vector<vec3f>(x.size());
-  for (auto i = (size_t)0; i < values.size(); i++)
-    values[i] = {x[i], y[i], z[i]};
-  return true;
+  return get_ply_values<vec3f, 3>(ply, element, properties, values);
 }
 bool get_values(ply_model* ply, const string& element,
     const array<string, 4>& properties, vector<vec4f>& values) {
-  values.clear();
-  auto x = vector<float>{}, y = vector<float>{}, z = vector<float>{},
-       w = vector<float>{};
-  if (!get_value(ply, element, properties[0], x)) return false;
-  if (!get_value(ply, element, properties[1], y)) return false;
-  if (!get_value(ply, element, properties[2], z)) return false;
-  if (!get_value(ply, element, properties[3], w)) return false;
-  values = vector<vec4f>(x.size());
-  for (auto i = (size_t)0; i < values.size(); i++)
-    values[i] = {x[i], y[i], z[i], w[i]};
-  return true;
+  return get_ply_values<vec4f, 4>(ply, element, properties, values);
 }
 bool get_values(ply_model* ply, const string& element,
     const array<string, 12>& properties, vector<frame3f>& values) {
-  values.clear();
-  auto coords = array<vector<float>, 12>{};
-  for (auto idx = 0; idx < 12; idx++)
-    if (!get_value(ply, element, properties[idx], coords[idx])) return false;
-  values = vector<frame3f>(coords[0].size());
-  for (auto i = (size_t)0; i < values.size(); i++) {
-    for (auto c = 0; c < 12; c++) (&values[i].x.x)[c] = coords[c][i];
-  }
-  return true;
+  return get_ply_values<frame3f, 12>(ply, element, properties, values);
 }
 bool get_lists(ply_model* ply, const string& element, const string& property,
     vector<vector<int>>& lists) {
   lists.clear();
-  if (!has_property(ply, element, property)) return false;
-  auto prop = get_property(ply, element, property);
-  if (!prop->is_list) return false;
-  auto& sizes  = prop->ldata_u8;
-  auto  values = vector<int>{};
-  if (!convert_property(prop, values)) return false;
+  auto sizes  = vector<byte>{};
+  auto values = vector<int>{};
+  if (!get_list_sizes(ply, element, property, sizes)) return false;
+  if (!get_list_values(ply, element, property, values)) return false;
   lists    = vector<vector<int>>(sizes.size());
   auto cur = (size_t)0;
   for (auto i = (size_t)0; i < lists.size(); i++) {
@@ -831,18 +908,20 @@ bool get_lists(ply_model* ply, const string& element, const string& property,
 }
 bool get_list_sizes(ply_model* ply, const string& element,
     const string& property, vector<byte>& sizes) {
-  if (!has_property(ply, element, property)) return {};
-  auto prop = get_property(ply, element, property);
-  if (!prop->is_list) return {};
+  auto prop = get_property(get_element(ply, element), property);
+  if (prop == nullptr || !prop->is_list) return {};
   sizes = prop->ldata_u8;
   return true;
 }
 bool get_list_values(ply_model* ply, const string& element,
     const string& property, vector<int>& values) {
-  if (!has_property(ply, element, property)) return {};
-  auto prop = get_property(ply, element, property);
-  if (!prop->is_list) return {};
-  return convert_property<int>(prop, values);
+  auto prop = get_property(get_element(ply, element), property);
+  if (prop == nullptr || !prop->is_list) return {};
+  auto size = get_ply_type_size(prop->type);
+  values.resize(prop->data.size() / size);
+  gather_ply_values(
+      prop->type, prop->data.data(), size, values.data(), values.size(), 1);
+  return true;
 }
 
 inline vector<vec2f> flip_ply_texcoord(const vector<vec2f>& texcoords) {
@@ -960,49 +1039,70 @@ bool has_quads(ply_model* ply) {
 }
 
 // Add ply properties
-inline ply_element* add_element(
+static ply_element* add_element(
     ply_model* ply, const string& element_name, size_t count) {
-  for (auto elem : ply->elements) {
-    if (elem->name == element_name) return elem;
-  }
-  auto elem   = ply->elements.emplace_back(new ply_element{});
-  elem->name  = element_name;
-  elem->count = count;
-  return elem;
-}
-inline ply_property* add_property(ply_model* ply, const string& element_name,
-    const string& property_name, size_t count, ply_type type, bool is_list) {
-  if (add_element(ply, element_name, count) == nullptr) return nullptr;
-  for (auto elem : ply->elements) {
-    if (elem->name != element_name) continue;
-    for (auto prop : elem->properties) {
-      if (prop->name == property_name) return prop;
-    }
-    auto prop     = elem->properties.emplace_back(new ply_property{});
-    prop->name    = property_name;
-    prop->type    = type;
-    prop->is_list = is_list;
-    return prop;
+  for (auto& elem : ply->elements) {
+    if (elem.name == element_name)
+      return elem.count == count ? &elem : nullptr;
   }
-  return nullptr;
+  auto& elem = ply->elements.emplace_back();
+  elem.name  = element_name;
+  elem.count = count;
+  return &elem;
+}
+// Returns the offset in the element records of a new or existing property,
+// growing the record stride for new properties that are not lists. Call
+// resize_ply_records() after adding properties to move the values.
+static bool add_property(ply_element* elem, const string& property_name,
+    ply_type type, bool is_list, size_t& offset) {
+  for (auto& prop : elem->properties) {
+    if (prop.name != property_name) continue;
+    offset = prop.offset;
+    return prop.type == type && prop.is_list == is_list;
+  }
+  auto& prop   = elem->properties.emplace_back();
+  prop.name    = property_name;
+  prop.type    = type;
+  prop.is_list = is_list;
+  if (!is_list) {
+    prop.offset = elem->stride;
+    elem->stride += get_ply_type_size(type);
+  }
+  offset = prop.offset;
+  return true;
 }
-template <typename T>
-inline vector<T> make_vector(const T* value, size_t count, int stride) {
-  auto ret = vector<T>(count);
-  for (auto idx = (size_t)0; idx < count; idx++) ret[idx] = value[idx * stride];
-  return ret;
+// Resize element records to the current stride, keeping the stored values
+static void resize_ply_records(ply_element* elem, size_t old_stride) {
+  auto size = elem->count * elem->stride;
+  if (old_stride == elem->stride && elem->data.size() == size) return;
+  auto data = vector<byte>(size, 0);
+  if (old_stride != 0) {
+    auto count = std::min(elem->count, elem->data.size() / old_stride);
+    for (auto idx = (size_t)0; idx < count; idx++)
+      memcpy(data.data() + idx * elem->stride,
+          elem->data.data() + idx * old_stride, old_stride);
+  }
+  elem->data.swap(data);
 }
 
-inline bool add_values(ply_model* ply, const float* values, size_t count,
+// Scatter interleaved values into the records of an element, as float
+// properties, after growing the records once for all of them
+static bool add_values(ply_model* ply, const float* values, size_t count,
     const string& element, const string* properties, int nprops) {
   if (values == nullptr) return false;
+  auto elem = add_element(ply, element, count);
+  if (elem == nullptr) return false;
+  auto stride  = elem->stride;
+  auto offsets = vector<size_t>(nprops);
   for (auto p = 0; p < nprops; p++) {
-    if (add_property(ply, element, properties[p], count, ply_type::f32,
-            false) == nullptr)
+    if (!add_property(elem, properties[p], ply_type::f32, false, offsets[p]))
       return false;
-    auto prop = get_property(ply, element, properties[p]);
-    prop->data_f32.resize(count);
-    for (auto i = 0; i < count; i++) prop->data_f32[i] = values[p + i * nprops];
+  }
+  resize_ply_records(elem, stride);
+  for (auto p = 0; p < nprops; p++) {
+    auto data = elem->data.data() + offsets[p];
+    for (auto i = (size_t)0; i < count; i++)
+      memcpy(data + i * elem->stride, values + p + i * nprops, sizeof(float));
   }
   return true;
 }
@@ -1039,42 +1139,45 @@ bool add_values(ply_model* ply, const string& element,
       properties.data(), (int)properties.size());
 }
 
+// Set the values and sizes of an int list property
+static bool add_lists(ply_model* ply, const string& element,
+    const string& property, const byte* sizes, size_t count,
+    const int* values, size_t nvalues) {
+  auto elem = add_element(ply, element, count);
+  if (elem == nullptr) return false;
+  auto stride = elem->stride, offset = (size_t)0;
+  if (!add_property(elem, property, ply_type::i32, true, offset)) return false;
+  resize_ply_records(elem, stride);
+  auto prop = get_property(elem, property);
+  prop->ldata_u8.assign(sizes, sizes + count);
+  prop->data.assign((const byte*)values, (const byte*)(values + nvalues));
+  return true;
+}
 bool add_lists(ply_model* ply, const string& element, const string& property,
     const vector<vector<int>>& values) {
   if (values.empty()) return false;
-  if (add_property(ply, element, property, values.size(), ply_type::i32,
-          true) == nullptr)
-    return false;
-  auto prop = get_property(ply, element, property);
-  prop->data_i32.reserve(values.size() * 4);
-  prop->ldata_u8.reserve(values.size());
+  auto sizes   = vector<byte>{};
+  auto indices = vector<int>{};
+  sizes.reserve(values.size());
+  indices.reserve(values.size() * 4);
   for (auto& value : values) {
-    prop->data_i32.insert(prop->data_i32.end(), value.begin(), value.end());
-    prop->ldata_u8.push_back((uint8_t)value.size());
+    indices.insert(indices.end(), value.begin(), value.end());
+    sizes.push_back((byte)value.size());
   }
-  return true;
+  return add_lists(ply, element, property, sizes, indices);
 }
 bool add_lists(ply_model* ply, const string& element, const string& property,
     const vector<byte>& sizes, const vector<int>& values) {
   if (values.empty()) return false;
-  if (add_property(ply, element, property, sizes.size(), ply_type::i32, true) ==
-      nullptr)
-    return false;
-  auto prop      = get_property(ply, element, property);
-  prop->data_i32 = values;
-  prop->ldata_u8 = sizes;
-  return true;
+  return add_lists(ply, element, property, sizes.data(), sizes.size(),
+      values.data(), values.size());
 }
 bool add_lists(ply_model* ply, const int* values, size_t count, int size,
     const string& element, const string& property) {
   if (values == nullptr) return false;
-  if (add_property(ply, element, property, count, ply_type::i32, true) ==
-      nullptr)
-    return false;
-  auto prop = get_property(ply, element, property);
-  prop->data_i32.assign(values, values + count * size);
-  prop->ldata_u8.assign(count, (byte)size);
-  return true;
+  auto sizes = vector<byte>(count, (byte)size);
+  return add_lists(ply, element, property, sizes.data(), count, values,
+      count * size);
 }
 bool add_lists(ply_model* ply, const string& element, const string& property,
     const vector<int>& values) {
@@ -1546,31 +1649,170 @@ obj_shape* add_shape(obj_scene* obj) {
   return obj->shapes.emplace_back(new obj_shape{});
 }
 
+// Parse numbers in place with from_chars, which is bounded by the line
+// and does not depend on the locale. Leading whitespace and plus signs are
+// skipped to match strtol and strtof. Standard libraries without floating
+// point from_chars use strtof, checked against the end of the line.
+inline bool parse_obj_value(string_view& str, int& value) {
+  skip_whitespace(str);
+  if (!str.empty() && str.front() == '+') str.remove_prefix(1);
+  auto [end, ec] = std::from_chars(str.data(), str.data() + str.size(), value);
+  if (ec != std::errc{}) return false;
+  str.remove_prefix(end - str.data());
+  return true;
+}
+inline bool parse_obj_value(string_view& str, float& value) {
+  skip_whitespace(str);
+  if (!str.empty() && str.front() == '+') str.remove_prefix(1);
+#if defined(__cpp_lib_to_chars) && __cpp_lib_to_chars >= 201611L
+  auto [end, ec] = std::from_chars(str.data(), str.data() + str.size(), value);
+  if (ec != std::errc{}) return false;
+#else
+  if (str.empty()) return false;
+  auto end = (char*)str.data();
+  value    = strtof(str.data(), &end);
+  if (end == str.data() || end > str.data() + str.size()) return false;
+#endif
+  str.remove_prefix(end - str.data());
+  return true;
+}
+inline bool parse_obj_value(string_view& str, vec2f& value) {
+  for (auto i = 0; i < 2; i++)
+    if (!parse_obj_value(str, value[i])) return false;
+  return true;
+}
+inline bool parse_obj_value(string_view& str, vec3f& value) {
+  for (auto i = 0; i < 3; i++)
+    if (!parse_obj_value(str, value[i])) return false;
+  return true;
+}
+inline bool parse_obj_value(string_view& str, obj_vertex& value) {
+  value = obj_vertex{0, 0, 0};
+  if (!parse_obj_value(str, value.position)) return false;
+  if (!str.empty() && str.front() == '/') {
+    str.remove_prefix(1);
+    if (!str.empty() && str.front() == '/') {
+      str.remove_prefix(1);
+      if (!parse_obj_value(str, value.normal)) return false;
+    } else {
+      if (!parse_obj_value(str, value.texcoord)) return false;
+      if (!str.empty() && str.front() == '/') {
+        str.remove_prefix(1);
+        if (!parse_obj_value(str, value.normal)) return false;
+      }
+    }
+  }
+  return true;
+}
+
+// Obj command that changes the parsing state, kept for elements and names.
+// Elements store the vertex counts of their chunk, used to resolve relative
+// indices when chunks are merged.
+struct obj_command {
+  string_view cmd   = {};
+  string_view name  = {};
+  int         size  = 0;
+  obj_vertex  count = {};
+};
+
+// Obj chunk, made of whole lines, parsed independently of the others
+struct obj_chunk {
+  string_view         text      = {};
+  vector<vec3f>       positions = {};
+  vector<vec3f>       normals   = {};
+  vector<vec2f>       texcoords = {};
+  vector<obj_vertex>  vertices  = {};
+  vector<obj_command> commands  = {};
+};
+
+// Parse the lines of a chunk. Vertex data is parsed to arrays, while the
+// commands that modify shapes are recorded to be replayed in order.
+static bool parse_obj_chunk(obj_chunk& chunk, bool geom_only) {
+  auto text = chunk.text;
+  while (!text.empty()) {
+    // str
+    auto line = text.find('\n');
+    auto str  = text.substr(0, line);
+    text.remove_prefix(line == string_view::npos ? text.size() : line + 1);
+    remove_comment(str);
+    skip_whitespace(str);
+    if (str.empty()) continue;
+
+    // get command
+    auto cmd = string_view{};
+    if (!parse_value(str, cmd)) return false;
+    if (cmd.empty()) continue;
+
+    // possible token values
+    if (cmd == "v") {
+      if (!parse_obj_value(str, chunk.positions.emplace_back())) return false;
+    } else if (cmd == "vn") {
+      if (!parse_obj_value(str, chunk.normals.emplace_back())) return false;
+    } else if (cmd == "vt") {
+      if (!parse_obj_value(str, chunk.texcoords.emplace_back())) return false;
+    } else if (cmd == "f" || cmd == "l" || cmd == "p") {
+      auto& command = chunk.commands.emplace_back();
+      command.cmd   = cmd;
+      command.count = {(int)chunk.positions.size(),
+          (int)chunk.texcoords.size(), (int)chunk.normals.size()};
+      skip_whitespace(str);
+      while (!str.empty()) {
+        auto vert = obj_vertex{};
+        if (!parse_obj_value(str, vert)) return false;
+        if (vert.position == 0) break;
+        chunk.vertices.push_back(vert);
+        command.size += 1;
+        skip_whitespace(str);
+      }
+    } else if (cmd == "o" || cmd == "g") {
+      if (geom_only) continue;
+      auto& command = chunk.commands.emplace_back();
+      command.cmd   = cmd;
+      skip_whitespace(str);
+      if (!str.empty() && !parse_value(str, command.name)) return false;
+    } else if (cmd == "usemtl" || cmd == "mtllib") {
+      if (geom_only) continue;
+      auto& command = chunk.commands.emplace_back();
+      command.cmd   = cmd;
+      if (!parse_value(str, command.name)) return false;
+    } else {
+      // unused
+    }
+  }
+  return true;
+}
+
+// Add the vertices of a parsed element to a shape, resolving relative
+// indices with the vertex counts of the previous chunks in base
+static void add_obj_vertices(obj_shape* shape, obj_element& element,
+    const obj_command& command, const obj_vertex*& vertex,
+    const obj_vertex& base) {
+  auto count = obj_vertex{base.position + command.count.position,
+      base.texcoord + command.count.texcoord,
+      base.normal + command.count.normal};
+  for (auto idx = 0; idx < command.size; idx++) {
+    auto vert = *vertex++;
+    if (vert.position < 0) vert.position = count.position + vert.position + 1;
+    if (vert.texcoord < 0) vert.texcoord = count.texcoord + vert.texcoord + 1;
+    if (vert.normal < 0) vert.normal = count.normal + vert.normal + 1;
+    shape->vertices.push_back(vert);
+    element.size += 1;
+  }
+}
+
 // Read obj
 bool load_obj(const string& filename, obj_scene* obj, string& error,
     bool geom_only, bool split_elements, bool split_materials) {
   // error helpers
-  auto open_error = [filename, &error]() {
-    error = filename + ": file not found";
-    return false;
-  };
   auto parse_error = [filename, &error]() {
     error = filename + ": parse error";
     return false;
   };
-  auto read_error = [filename, &error]() {
-    error = filename + ": read error";
-    return false;
-  };
   auto dependent_error = [filename, &error]() {
     error = filename + ": error in " + error;
     return false;
   };
 
-  // open file
-  auto fs = open_file(filename, "rt");
-  if (!fs) return open_error();
-
   // parsing state
   auto opositions   = vector<vec3f>{};
   auto onormals     = vector<vec3f>{};
@@ -1582,6 +1824,13 @@ bool load_obj(const string& filename, obj_scene* obj, string& error,
   auto mtllibs      = vector<string>{};
   auto material_map = unordered_map<string, obj_material*>{};
 
+  // open file
+  auto fs = open_file(filename, "rb");
+  if (!fs) {
+    error = filename + ": file not found";
+    return false;
+  }
+
   // initialize obj
   obj->~obj_scene();
   obj->cameras.clear();
@@ -1593,128 +1842,140 @@ bool load_obj(const string& filename, obj_scene* obj, string& error,
   obj->shapes.emplace_back(new obj_shape{});
   auto empty_material = (obj_material*)nullptr;
 
-  // read the file str by str
-  auto buffer = array<char, 4096>{};
-  while (read_line(fs, buffer)) {
-    // str
-    auto str = string_view{buffer.data()};
-    remove_comment(str);
-    skip_whitespace(str);
-    if (str.empty()) continue;
+  // read batches of chunks of whole lines, a few per thread, keeping the
+  // partial line at the end. Chunks are parsed in parallel and merged in
+  // file order, so that only one batch is in memory at a time.
+  auto chunk_size = (size_t)1 << 20;
+  auto batch_size = chunk_size * get_parallel_threads() * 4;
+  auto text       = string{};
+  auto chunks     = vector<obj_chunk>{};
+  auto eof        = false;
+  while (!eof) {
+    auto size = text.size();
+    text.resize(size + batch_size);
+    auto read = fread(text.data() + size, 1, text.size() - size, fs.fs);
+    text.resize(size + read);
+    eof = read == 0;
+    if (eof && text.empty()) break;
+    auto end = eof ? text.size() : text.rfind('\n');
+    if (end == string::npos) continue;
+    if (!eof) end += 1;
+
+    // split the batch in chunks
+    chunks.clear();
+    auto view = string_view{text}.substr(0, end);
+    while (!view.empty()) {
+      auto length = view.find('\n', std::min(chunk_size, view.size() - 1));
+      length      = length == string_view::npos ? view.size() : length + 1;
+      chunks.emplace_back().text = view.substr(0, length);
+      view.remove_prefix(length);
+    }
 
-    // get command
-    auto cmd = ""s;
-    if (!parse_value(str, cmd)) return parse_error();
-    if (cmd.empty()) continue;
+    // parse chunks in parallel
+    auto parsed = vector<bool>(chunks.size());
+    parallel_for_batch((int)chunks.size(), 1, [&](int idx) {
+      parsed[idx] = parse_obj_chunk(chunks[idx], geom_only);
+    });
+    for (auto ok : parsed) {
+      if (!ok) return parse_error();
+    }
 
-    // possible token values
-    if (cmd == "v") {
-      if (!parse_value(str, opositions.emplace_back())) return parse_error();
-      vert_size.position += 1;
-    } else if (cmd == "vn") {
-      if (!parse_value(str, onormals.emplace_back())) return parse_error();
-      vert_size.normal += 1;
-    } else if (cmd == "vt") {
-      if (!parse_value(str, otexcoords.emplace_back())) return parse_error();
-      vert_size.texcoord += 1;
-    } else if (cmd == "f" || cmd == "l" || cmd == "p") {
-      // split if split_elements and different primitives
-      if (auto shape = obj->shapes.back();
-          split_elements && !shape->vertices.empty()) {
-        if ((cmd == "f" && (!shape->lines.empty() || !shape->points.empty())) ||
-            (cmd == "l" && (!shape->faces.empty() || !shape->points.empty())) ||
-            (cmd == "p" && (!shape->faces.empty() || !shape->lines.empty()))) {
-          add_shape(obj);
-          obj->shapes.back()->name = oname + gname;
-        }
-      }
-      // split if splt_material and different materials
-      if (auto shape = obj->shapes.back();
-          !geom_only && split_materials && !shape->materials.empty()) {
-        if (shape->materials.size() > 1)
-          throw std::runtime_error("should not have happened");
-        if (shape->materials.back() != mname) {
-          add_shape(obj);
-          obj->shapes.back()->name = oname + gname;
-        }
-      }
-      // grab shape and add element
-      auto  shape   = obj->shapes.back();
-      auto& element = (cmd == "f")
-                          ? shape->faces.emplace_back()
-                          : (cmd == "l") ? shape->lines.emplace_back()
-                                         : shape->points.emplace_back();
-      // get element material or add if needed
-      if (!geom_only) {
-        if (mname.empty() && empty_material == nullptr) {
-          empty_material   = obj->materials.emplace_back(new obj_material{});
-          material_map[""] = empty_material;
-        }
-        auto mat_idx = -1;
-        for (auto midx = 0; midx < shape->materials.size(); midx++)
-          if (shape->materials[midx] == mname) mat_idx = midx;
-        if (mat_idx < 0) {
-          shape->materials.push_back(mname);
-          mat_idx = (int)shape->materials.size() - 1;
-        }
-        element.material = (uint8_t)mat_idx;
-      }
-      // parse vertices
-      skip_whitespace(str);
-      while (!str.empty()) {
-        auto vert = obj_vertex{};
-        if (!parse_value(str, vert)) return parse_error();
-        if (vert.position == 0) break;
-        if (vert.position < 0)
-          vert.position = vert_size.position + vert.position + 1;
-        if (vert.texcoord < 0)
-          vert.texcoord = vert_size.texcoord + vert.texcoord + 1;
-        if (vert.normal < 0) vert.normal = vert_size.normal + vert.normal + 1;
-        shape->vertices.push_back(vert);
-        element.size += 1;
-        skip_whitespace(str);
-      }
-    } else if (cmd == "o" || cmd == "g") {
-      if (geom_only) continue;
-      skip_whitespace(str);
-      if (cmd == "o") {
-        if (str.empty()) {
-          oname = "";
-        } else {
-          if (!parse_value(str, oname)) return parse_error();
-        }
-      } else {
-        if (str.empty()) {
-          gname = "";
-        } else {
-          if (!parse_value(str, gname)) return parse_error();
+    // merge chunks, replaying their commands in file order
+    for (auto& chunk : chunks) {
+      auto vertex = (const obj_vertex*)chunk.vertices.data();
+      for (auto& command : chunk.commands) {
+        auto cmd = command.cmd;
+        if (cmd == "f" || cmd == "l" || cmd == "p") {
+          // split if split_elements and different primitives
+          if (auto shape = obj->shapes.back();
+              split_elements && !shape->vertices.empty()) {
+            if ((cmd == "f" &&
+                    (!shape->lines.empty() || !shape->points.empty())) ||
+                (cmd == "l" &&
+                    (!shape->faces.empty() || !shape->points.empty())) ||
+                (cmd == "p" &&
+                    (!shape->faces.empty() || !shape->lines.empty()))) {
+              add_shape(obj);
+              obj->shapes.back()->name = oname + gname;
+            }
+          }
+          // split if splt_material and different materials
+          if (auto shape = obj->shapes.back();
+              !geom_only && split_materials && !shape->materials.empty()) {
+            if (shape->materials.size() > 1)
+              throw std::runtime_error("should not have happened");
+            if (shape->materials.back() != mname) {
+              add_shape(obj);
+              obj->shapes.back()->name = oname + gname;
+            }
+          }
+          // grab shape and add element
+          auto  shape   = obj->shapes.back();
+          auto& element = (cmd == "f")
+                              ? shape->faces.emplace_back()
+                              : (cmd == "l") ? shape->lines.emplace_back()
+                                             : shape->points.emplace_back();
+          // get element material or add if needed
+          if (!geom_only) {
+            if (mname.empty() && empty_material == nullptr) {
+              empty_material = obj->materials.emplace_back(
+                  new obj_material{});
+              material_map[""] = empty_material;
+            }
+            auto mat_idx = -1;
+            for (auto midx = 0; midx < shape->materials.size(); midx++)
+              if (shape->materials[midx] == mname) mat_idx = midx;
+            if (mat_idx < 0) {
+              shape->materials.push_back(mname);
+              mat_idx = (int)shape->materials.size() - 1;
+            }
+            element.material = (uint8_t)mat_idx;
+          }
+          // add vertices
+          add_obj_vertices(shape, element, command, vertex, vert_size);
+        } else if (cmd == "o" || cmd == "g") {
+          if (cmd == "o") {
+            oname = string{command.name};
+          } else {
+            gname = string{command.name};
+          }
+          if (!obj->shapes.back()->vertices.empty()) {
+            obj->shapes.emplace_back(new obj_shape{});
+            obj->shapes.back()->name = oname + gname;
+          } else {
+            obj->shapes.back()->name = oname + gname;
+          }
+        } else if (cmd == "usemtl") {
+          mname = string{command.name};
+        } else if (cmd == "mtllib") {
+          auto mtllib = string{command.name};
+          if (std::find(mtllibs.begin(), mtllibs.end(), mtllib) ==
+              mtllibs.end()) {
+            mtllibs.push_back(mtllib);
+            if (!load_mtl(
+                    path_join(path_dirname(filename), mtllib), obj, error))
+              return dependent_error();
+            for (auto material : obj->materials)
+              material_map[material->name] = material;
+          }
         }
       }
-      if (!obj->shapes.back()->vertices.empty()) {
-        obj->shapes.emplace_back(new obj_shape{});
-        obj->shapes.back()->name = oname + gname;
-      } else {
-        obj->shapes.back()->name = oname + gname;
-      }
-    } else if (cmd == "usemtl") {
-      if (geom_only) continue;
-      if (!parse_value(str, mname)) return parse_error();
-    } else if (cmd == "s") {
-      if (geom_only) continue;
-    } else if (cmd == "mtllib") {
-      if (geom_only) continue;
-      auto mtllib = ""s;
-      if (!parse_value(str, mtllib)) return parse_error();
-      if (std::find(mtllibs.begin(), mtllibs.end(), mtllib) == mtllibs.end()) {
-        mtllibs.push_back(mtllib);
-        if (!load_mtl(path_join(path_dirname(filename), mtllib), obj, error))
-          return dependent_error();
-        for (auto material : obj->materials)
-          material_map[material->name] = material;
-      }
-    } else {
-      // unused
+
+      // append vertex data
+      opositions.insert(
+          opositions.end(), chunk.positions.begin(), chunk.positions.end());
+      onormals.insert(
+          onormals.end(), chunk.normals.begin(), chunk.normals.end());
+      otexcoords.insert(
+          otexcoords.end(), chunk.texcoords.begin(), chunk.texcoords.end());
+      vert_size.position += (int)chunk.positions.size();
+      vert_size.texcoord += (int)chunk.texcoords.size();
+      vert_size.normal += (int)chunk.normals.size();
+
+      // free chunk data as soon as it is merged
+      chunk = obj_chunk{};
     }
+    text.erase(0, end);
   }
 
   // fix empty material
@@ -1763,6 +2024,84 @@ bool load_obj(const string& filename, obj_scene* obj, string& error,
   return true;
 }
 
+// Stream obj
+bool stream_obj(const string& filename, const obj_block_callback& block_cb,
+    string& error, size_t block_size) {
+  // error helpers
+  auto open_error = [filename, &error]() {
+    error = filename + ": file not found";
+    return false;
+  };
+  auto parse_error = [filename, &error]() {
+    error = filename + ": parse error";
+    return false;
+  };
+
+  // open file
+  auto fs = open_file(filename, "rb");
+  if (!fs) return open_error();
+
+  // read blocks of whole lines, keeping the partial line at the end
+  auto text   = string{};
+  auto block  = obj_shape{};
+  auto lines  = obj_shape{};
+  auto points = obj_shape{};
+  auto offset = obj_vertex{};
+  auto eof    = false;
+  while (!eof) {
+    auto size = text.size();
+    text.resize(size + std::max(block_size, (size_t)1));
+    auto read = fread(text.data() + size, 1, text.size() - size, fs.fs);
+    text.resize(size + read);
+    eof = read == 0;
+    if (eof && text.empty()) break;
+    auto end = eof ? text.size() : text.rfind('\n');
+    if (end == string::npos) continue;
+    if (!eof) end += 1;
+
+    // parse block
+    auto chunk = obj_chunk{};
+    chunk.text = string_view{text}.substr(0, end);
+    if (!parse_obj_chunk(chunk, true)) return parse_error();
+
+    // make block shape, with the vertices of faces, lines and points in turn
+    block.positions = std::move(chunk.positions);
+    block.normals   = std::move(chunk.normals);
+    block.texcoords = std::move(chunk.texcoords);
+    block.vertices.clear();
+    block.faces.clear();
+    block.lines.clear();
+    block.points.clear();
+    lines.vertices.clear();
+    points.vertices.clear();
+    auto vertex = (const obj_vertex*)chunk.vertices.data();
+    for (auto& command : chunk.commands) {
+      if (command.cmd == "f") {
+        auto& element = block.faces.emplace_back();
+        add_obj_vertices(&block, element, command, vertex, offset);
+      } else if (command.cmd == "l") {
+        auto& element = block.lines.emplace_back();
+        add_obj_vertices(&lines, element, command, vertex, offset);
+      } else {
+        auto& element = block.points.emplace_back();
+        add_obj_vertices(&points, element, command, vertex, offset);
+      }
+    }
+    block.vertices.insert(
+        block.vertices.end(), lines.vertices.begin(), lines.vertices.end());
+    block.vertices.insert(
+        block.vertices.end(), points.vertices.begin(), points.vertices.end());
+    text.erase(0, end);
+
+    // emit block
+    if (!block_cb(&block, offset)) return true;
+    offset.position += (int)block.positions.size();
+    offset.texcoord += (int)block.texcoords.size();
+    offset.normal += (int)block.normals.size();
+  }
+  return true;
+}
+
 // Format values
 inline void format_value(string& str, const obj_texture& value) {
   str += value.path.empty() ? "" : value.path;
@@ -0,0 +1,655 @@
+//
+// # Yocto/SIMD: Internal vector types and pixel kernels
+//
+// Yocto/SIMD is an internal header, used by the library implementation only.
+// It defines thin wrappers over scalar, SSE2 and AVX2 registers that share
+// the same interface, so that data-parallel kernels, like the pixel kernels
+// below or the wide BVH node tests, are written once as templates. Wrappers
+// only use operations that are exactly rounded, so a kernel gives
+// bit-identical results on all instruction sets, and the scalar
+// instantiation works as reference for the vector ones.
+// Since translation units built for different instruction sets include this
+// header, all its code has internal linkage.
+//
+
+//
+// LICENSE:
+//
+// Copyright (c) 2016 -- 2020 Fabio Pellacini
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+#ifndef _YOCTO_SIMD_H_
+#define _YOCTO_SIMD_H_
+
+// -----------------------------------------------------------------------------
+// INCLUDES
+// -----------------------------------------------------------------------------
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define YOCTO_SSE2
+#include <emmintrin.h>
+#endif
+#if defined(__AVX2__)
+#define YOCTO_AVX2
+#include <immintrin.h>
+#endif
+
+// -----------------------------------------------------------------------------
+// PIXEL KERNELS
+// -----------------------------------------------------------------------------
+namespace yocto {
+
+// Instruction sets of the pixel kernels.
+enum struct simd_type { scalar, sse2, avx2 };
+
+// Tone mapping parameters, as used by the kernels.
+struct tonemap_kernel_params {
+  float scale  = 1;
+  bool  filmic = false;
+  bool  srgb   = true;
+};
+
+// Color grading parameters, as used by the kernels. Constant terms are
+// precomputed once per image.
+struct colorgrade_kernel_params {
+  bool  exposure      = false;
+  float scale         = 1;
+  bool  tint          = false;
+  float tint_rgb[3]   = {1, 1, 1};
+  bool  lincontrast   = false;
+  float lincontrast2  = 1;
+  bool  logcontrast   = false;
+  float logcontrast2  = 1;
+  float log_grey      = 0;
+  float grey          = 0.5f;
+  bool  linsaturation = false;
+  float linsaturation2 = 1;
+  bool  filmic        = false;
+  bool  srgb          = false;
+  bool  contrast      = false;
+  float contrast_gain = 0.5f;
+  bool  saturation    = false;
+  float saturation2   = 1;
+  bool  lgg           = false;
+  float lift[3]       = {0, 0, 0};
+  float gain[3]       = {1, 1, 1};
+  float inv_gamma[3]  = {1, 1, 1};
+};
+
+// Kernels working on arrays of `count` rgba pixels, stored as floats or bytes.
+struct pixel_kernels {
+  simd_type type = simd_type::scalar;
+  void (*tonemap)(float* ldr, const float* hdr, size_t count,
+      const tonemap_kernel_params& params) = nullptr;
+  void (*tonemapb)(uint8_t* ldr, const float* hdr, size_t count,
+      const tonemap_kernel_params& params) = nullptr;
+  void (*colorgrade)(float* graded, const float* img, size_t count,
+      const colorgrade_kernel_params& params) = nullptr;
+  void (*rgb_to_srgb)(float* srgb, const float* rgb, size_t count) = nullptr;
+  void (*srgb_to_rgb)(float* rgb, const float* srgb, size_t count) = nullptr;
+  void (*rgb_to_srgbb)(uint8_t* srgb, const float* rgb, size_t count) = nullptr;
+  void (*srgbb_to_rgb)(float* rgb, const uint8_t* srgb, size_t count) = nullptr;
+  void (*float_to_byte)(uint8_t* bt, const float* fl, size_t count) = nullptr;
+  void (*byte_to_float)(float* fl, const uint8_t* bt, size_t count) = nullptr;
+};
+
+// Get the AVX2 kernels. Returns false if they were not compiled in.
+bool get_avx2_pixel_kernels(pixel_kernels& kernels);
+
+}  // namespace yocto
+
+// -----------------------------------------------------------------------------
+// SIMD VECTOR TYPES
+// -----------------------------------------------------------------------------
+namespace yocto {
+namespace {
+
+// Scalar lane, used as reference and for the pixels left over at the end of
+// an array.
+struct vfloat1 {
+  static const int width = 1;
+  using mask             = bool;
+  float v;
+
+  vfloat1() = default;
+  vfloat1(float a) : v{a} {}
+  static vfloat1 load(const float* a) { return *a; }
+  static vfloat1 load(const uint8_t* a) { return (float)*a; }
+};
+
+inline vfloat1 operator+(vfloat1 a, vfloat1 b) { return a.v + b.v; }
+inline vfloat1 operator-(vfloat1 a, vfloat1 b) { return a.v - b.v; }
+inline vfloat1 operator*(vfloat1 a, vfloat1 b) { return a.v * b.v; }
+inline vfloat1 operator/(vfloat1 a, vfloat1 b) { return a.v / b.v; }
+inline bool    operator<(vfloat1 a, vfloat1 b) { return a.v < b.v; }
+inline bool    operator<=(vfloat1 a, vfloat1 b) { return a.v <= b.v; }
+inline vfloat1 min(vfloat1 a, vfloat1 b) { return (a.v < b.v) ? a : b; }
+inline vfloat1 max(vfloat1 a, vfloat1 b) { return (a.v > b.v) ? a : b; }
+inline vfloat1 select(bool m, vfloat1 a, vfloat1 b) { return m ? a : b; }
+inline int     movemask(bool m) { return m ? 1 : 0; }
+inline void    store(float* a, vfloat1 b) { *a = b.v; }
+// Truncates toward zero. Requires |a| < 2^31.
+inline vfloat1 trunc(vfloat1 a) { return (float)(int32_t)a.v; }
+// Unbiased exponent and mantissa in [1,2) of a positive normal float.
+inline vfloat1 float_exponent(vfloat1 a) {
+  auto bits = (uint32_t)0;
+  memcpy(&bits, &a.v, sizeof(bits));
+  return (float)((int32_t)((bits >> 23) & 0xff) - 127);
+}
+inline vfloat1 float_mantissa(vfloat1 a) {
+  auto bits = (uint32_t)0;
+  memcpy(&bits, &a.v, sizeof(bits));
+  bits = (bits & 0x007fffff) | 0x3f800000;
+  auto m = 0.0f;
+  memcpy(&m, &bits, sizeof(m));
+  return m;
+}
+// 2^n for an integer-valued n in [-127,128].
+inline vfloat1 exp2i(vfloat1 n) {
+  auto bits = (uint32_t)((int32_t)n.v + 127) << 23;
+  auto p    = 0.0f;
+  memcpy(&p, &bits, sizeof(p));
+  return p;
+}
+inline void load_pixels(
+    const float* px, vfloat1& r, vfloat1& g, vfloat1& b, vfloat1& a) {
+  r = px[0], g = px[1], b = px[2], a = px[3];
+}
+inline void store_pixels(
+    float* px, vfloat1 r, vfloat1 g, vfloat1 b, vfloat1 a) {
+  px[0] = r.v, px[1] = g.v, px[2] = b.v, px[3] = a.v;
+}
+inline void load_pixels(
+    const uint8_t* px, vfloat1& r, vfloat1& g, vfloat1& b, vfloat1& a) {
+  r = px[0], g = px[1], b = px[2], a = px[3];
+}
+// Stores the channels truncated to integers and clamped to [0,255].
+inline void store_pixels(
+    uint8_t* px, vfloat1 r, vfloat1 g, vfloat1 b, vfloat1 a) {
+  auto to_byte = [](float c) {
+    auto i = (int32_t)c;
+    return (uint8_t)(i < 0 ? 0 : (i > 255 ? 255 : i));
+  };
+  px[0] = to_byte(r.v), px[1] = to_byte(g.v), px[2] = to_byte(b.v),
+  px[3] = to_byte(a.v);
+}
+
+#ifdef YOCTO_SSE2
+
+// Four SSE2 lanes.
+struct vfloat4 {
+  static const int width = 4;
+  struct mask {
+    __m128 v;
+  };
+  __m128 v;
+
+  vfloat4() = default;
+  vfloat4(__m128 a) : v{a} {}
+  vfloat4(float a) : v{_mm_set1_ps(a)} {}
+  // Loads from an address aligned to 16 bytes.
+  static vfloat4 load(const float* a) { return _mm_load_ps(a); }
+  // Loads and converts 4 bytes.
+  static vfloat4 load(const uint8_t* a) {
+    auto bytes = (int32_t)0;
+    memcpy(&bytes, a, sizeof(bytes));
+    auto zero = _mm_setzero_si128();
+    auto b    = _mm_cvtsi32_si128(bytes);
+    return _mm_cvtepi32_ps(
+        _mm_unpacklo_epi16(_mm_unpacklo_epi8(b, zero), zero));
+  }
+};
+
+inline vfloat4 operator+(vfloat4 a, vfloat4 b) { return _mm_add_ps(a.v, b.v); }
+inline vfloat4 operator-(vfloat4 a, vfloat4 b) { return _mm_sub_ps(a.v, b.v); }
+inline vfloat4 operator*(vfloat4 a, vfloat4 b) { return _mm_mul_ps(a.v, b.v); }
+inline vfloat4 operator/(vfloat4 a, vfloat4 b) { return _mm_div_ps(a.v, b.v); }
+inline vfloat4::mask operator<(vfloat4 a, vfloat4 b) {
+  return {_mm_cmplt_ps(a.v, b.v)};
+}
+inline vfloat4::mask operator<=(vfloat4 a, vfloat4 b) {
+  return {_mm_cmple_ps(a.v, b.v)};
+}
+inline vfloat4 min(vfloat4 a, vfloat4 b) { return _mm_min_ps(a.v, b.v); }
+inline vfloat4 max(vfloat4 a, vfloat4 b) { return _mm_max_ps(a.v, b.v); }
+inline vfloat4 select(vfloat4::mask m, vfloat4 a, vfloat4 b) {
+  return _mm_or_ps(_mm_and_ps(m.v, a.v), _mm_andnot_ps(m.v, b.v));
+}
+inline int  movemask(vfloat4::mask m) { return _mm_movemask_ps(m.v); }
+inline void store(float* a, vfloat4 b) { _mm_store_ps(a, b.v); }
+inline vfloat4 trunc(vfloat4 a) {
+  return _mm_cvtepi32_ps(_mm_cvttps_epi32(a.v));
+}
+inline vfloat4 float_exponent(vfloat4 a) {
+  auto bits = _mm_srli_epi32(_mm_castps_si128(a.v), 23);
+  bits      = _mm_and_si128(bits, _mm_set1_epi32(0xff));
+  return _mm_cvtepi32_ps(_mm_sub_epi32(bits, _mm_set1_epi32(127)));
+}
+inline vfloat4 float_mantissa(vfloat4 a) {
+  auto bits = _mm_and_si128(
+      _mm_castps_si128(a.v), _mm_set1_epi32(0x007fffff));
+  return _mm_castsi128_ps(_mm_or_si128(bits, _mm_set1_epi32(0x3f800000)));
+}
+inline vfloat4 exp2i(vfloat4 n) {
+  auto bits = _mm_add_epi32(_mm_cvttps_epi32(n.v), _mm_set1_epi32(127));
+  return _mm_castsi128_ps(_mm_slli_epi32(bits, 23));
+}
+inline void load_pixels(
+    const float* px, vfloat4& r, vfloat4& g, vfloat4& b, vfloat4& a) {
+  auto p0 = _mm_loadu_ps(px + 0), p1 = _mm_loadu_ps(px + 4),
+       p2 = _mm_loadu_ps(px + 8), p3 = _mm_loadu_ps(px + 12);
+  _MM_TRANSPOSE4_PS(p0, p1, p2, p3);
+  r = p0, g = p1, b = p2, a = p3;
+}
+inline void store_pixels(
+    float* px, vfloat4 r, vfloat4 g, vfloat4 b, vfloat4 a) {
+  _MM_TRANSPOSE4_PS(r.v, g.v, b.v, a.v);
+  _mm_storeu_ps(px + 0, r.v);
+  _mm_storeu_ps(px + 4, g.v);
+  _mm_storeu_ps(px + 8, b.v);
+  _mm_storeu_ps(px + 12, a.v);
+}
+inline void load_pixels(
+    const uint8_t* px, vfloat4& r, vfloat4& g, vfloat4& b, vfloat4& a) {
+  auto zero = _mm_setzero_si128();
+  auto p    = _mm_loadu_si128((const __m128i*)px);
+  auto lo = _mm_unpacklo_epi8(p, zero), hi = _mm_unpackhi_epi8(p, zero);
+  auto p0 = _mm_cvtepi32_ps(_mm_unpacklo_epi16(lo, zero)),
+       p1 = _mm_cvtepi32_ps(_mm_unpackhi_epi16(lo, zero)),
+       p2 = _mm_cvtepi32_ps(_mm_unpacklo_epi16(hi, zero)),
+       p3 = _mm_cvtepi32_ps(_mm_unpackhi_epi16(hi, zero));
+  _MM_TRANSPOSE4_PS(p0, p1, p2, p3);
+  r = p0, g = p1, b = p2, a = p3;
+}
+inline void store_pixels(
+    uint8_t* px, vfloat4 r, vfloat4 g, vfloat4 b, vfloat4 a) {
+  _MM_TRANSPOSE4_PS(r.v, g.v, b.v, a.v);
+  // saturating packs clamp to [0,255] exactly as the scalar version
+  auto lo = _mm_packs_epi32(_mm_cvttps_epi32(r.v), _mm_cvttps_epi32(g.v));
+  auto hi = _mm_packs_epi32(_mm_cvttps_epi32(b.v), _mm_cvttps_epi32(a.v));
+  _mm_storeu_si128((__m128i*)px, _mm_packus_epi16(lo, hi));
+}
+
+#endif
+
+#ifdef YOCTO_AVX2
+
+// Eight AVX2 lanes. Pixels are transposed within each 128-bit half, so lanes
+// hold pixels out of order; this is invisible to per-pixel kernels.
+struct vfloat8 {
+  static const int width = 8;
+  struct mask {
+    __m256 v;
+  };
+  __m256 v;
+
+  vfloat8() = default;
+  vfloat8(__m256 a) : v{a} {}
+  vfloat8(float a) : v{_mm256_set1_ps(a)} {}
+  // Loads from an address aligned to 32 bytes.
+  static vfloat8 load(const float* a) { return _mm256_load_ps(a); }
+  // Loads and converts 8 bytes.
+  static vfloat8 load(const uint8_t* a) {
+    return _mm256_cvtepi32_ps(
+        _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)a)));
+  }
+};
+
+inline vfloat8 operator+(vfloat8 a, vfloat8 b) {
+  return _mm256_add_ps(a.v, b.v);
+}
+inline vfloat8 operator-(vfloat8 a, vfloat8 b) {
+  return _mm256_sub_ps(a.v, b.v);
+}
+inline vfloat8 operator*(vfloat8 a, vfloat8 b) {
+  return _mm256_mul_ps(a.v, b.v);
+}
+inline vfloat8 operator/(vfloat8 a, vfloat8 b) {
+  return _mm256_div_ps(a.v, b.v);
+}
+inline vfloat8::mask operator<(vfloat8 a, vfloat8 b) {
+  return {_mm256_cmp_ps(a.v, b.v, _CMP_LT_OS)};
+}
+inline vfloat8::mask operator<=(vfloat8 a, vfloat8 b) {
+  return {_mm256_cmp_ps(a.v, b.v, _CMP_LE_OS)};
+}
+inline vfloat8 min(vfloat8 a, vfloat8 b) { return _mm256_min_ps(a.v, b.v); }
+inline vfloat8 max(vfloat8 a, vfloat8 b) { return _mm256_max_ps(a.v, b.v); }
+inline vfloat8 select(vfloat8::mask m, vfloat8 a, vfloat8 b) {
+  return _mm256_blendv_ps(b.v, a.v, m.v);
+}
+inline int  movemask(vfloat8::mask m) { return _mm256_movemask_ps(m.v); }
+inline void store(float* a, vfloat8 b) { _mm256_store_ps(a, b.v); }
+inline vfloat8 trunc(vfloat8 a) {
+  return _mm256_cvtepi32_ps(_mm256_cvttps_epi32(a.v));
+}
+inline vfloat8 float_exponent(vfloat8 a) {
+  auto bits = _mm256_srli_epi32(_mm256_castps_si256(a.v), 23);
+  bits      = _mm256_and_si256(bits, _mm256_set1_epi32(0xff));
+  return _mm256_cvtepi32_ps(_mm256_sub_epi32(bits, _mm256_set1_epi32(127)));
+}
+inline vfloat8 float_mantissa(vfloat8 a) {
+  auto bits = _mm256_and_si256(
+      _mm256_castps_si256(a.v), _mm256_set1_epi32(0x007fffff));
+  return _mm256_castsi256_ps(
+      _mm256_or_si256(bits, _mm256_set1_epi32(0x3f800000)));
+}
+inline vfloat8 exp2i(vfloat8 n) {
+  auto bits = _mm256_add_epi32(
+      _mm256_cvttps_epi32(n.v), _mm256_set1_epi32(127));
+  return _mm256_castsi256_ps(_mm256_slli_epi32(bits, 23));
+}
+inline void transpose_pixels(__m256& p0, __m256& p1, __m256& p2, __m256& p3) {
+  auto t0 = _mm256_unpacklo_ps(p0, p1), t1 = _mm256_unpacklo_ps(p2, p3),
+       t2 = _mm256_unpackhi_ps(p0, p1), t3 = _mm256_unpackhi_ps(p2, p3);
+  p0 = _mm256_shuffle_ps(t0, t1, _MM_SHUFFLE(1, 0, 1, 0));
+  p1 = _mm256_shuffle_ps(t0, t1, _MM_SHUFFLE(3, 2, 3, 2));
+  p2 = _mm256_shuffle_ps(t2, t3, _MM_SHUFFLE(1, 0, 1, 0));
+  p3 = _mm256_shuffle_ps(t2, t3, _MM_SHUFFLE(3, 2, 3, 2));
+}
+inline void load_pixels(
+    const float* px, vfloat8& r, vfloat8& g, vfloat8& b, vfloat8& a) {
+  auto p0 = _mm256_loadu_ps(px + 0), p1 = _mm256_loadu_ps(px + 8),
+       p2 = _mm256_loadu_ps(px + 16), p3 = _mm256_loadu_ps(px + 24);
+  transpose_pixels(p0, p1, p2, p3);
+  r = p0, g = p1, b = p2, a = p3;
+}
+inline void store_pixels(
+    float* px, vfloat8 r, vfloat8 g, vfloat8 b, vfloat8 a) {
+  transpose_pixels(r.v, g.v, b.v, a.v);
+  _mm256_storeu_ps(px + 0, r.v);
+  _mm256_storeu_ps(px + 8, g.v);
+  _mm256_storeu_ps(px + 16, b.v);
+  _mm256_storeu_ps(px + 24, a.v);
+}
+inline void load_pixels(
+    const uint8_t* px, vfloat8& r, vfloat8& g, vfloat8& b, vfloat8& a) {
+  auto load = [](const uint8_t* px) {
+    return _mm256_cvtepi32_ps(
+        _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)px)));
+  };
+  auto p0 = load(px + 0), p1 = load(px + 8), p2 = load(px + 16),
+       p3 = load(px + 24);
+  transpose_pixels(p0, p1, p2, p3);
+  r = p0, g = p1, b = p2, a = p3;
+}
+inline void store_pixels(
+    uint8_t* px, vfloat8 r, vfloat8 g, vfloat8 b, vfloat8 a) {
+  transpose_pixels(r.v, g.v, b.v, a.v);
+  // saturating packs clamp to [0,255] exactly as the scalar version, but
+  // interleave the 128-bit halves, which the permute undoes
+  auto lo = _mm256_packs_epi32(
+      _mm256_cvttps_epi32(r.v), _mm256_cvttps_epi32(g.v));
+  auto hi = _mm256_packs_epi32(
+      _mm256_cvttps_epi32(b.v), _mm256_cvttps_epi32(a.v));
+  auto packed = _mm256_permutevar8x32_epi32(_mm256_packus_epi16(lo, hi),
+      _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7));
+  _mm256_storeu_si256((__m256i*)px, packed);
+}
+
+#endif
+
+}  // namespace
+}  // namespace yocto
+
+// -----------------------------------------------------------------------------
+// IMPLEMENTATION OF PIXEL KERNELS
+// -----------------------------------------------------------------------------
+namespace yocto {
+namespace {
+
+// Base 2 logarithm for positive normal floats, using the Cephes polynomial.
+template <typename F>
+inline F log2_kernel(F x) {
+  auto e    = float_exponent(x);
+  auto m    = float_mantissa(x);
+  auto half = m < 1.41421356f;
+  m         = select(half, m, m * 0.5f);
+  e         = select(half, e, e + 1);
+  auto t    = m - 1;
+  auto z    = t * t;
+  auto y    = F{7.0376836292e-2f};
+  y         = y * t - 1.1514610310e-1f;
+  y         = y * t + 1.1676998740e-1f;
+  y         = y * t - 1.2420140846e-1f;
+  y         = y * t + 1.4249322787e-1f;
+  y         = y * t - 1.6668057665e-1f;
+  y         = y * t + 2.0000714765e-1f;
+  y         = y * t - 2.4999993993e-1f;
+  y         = y * t + 3.3333331174e-1f;
+  y         = y * t * z - z * 0.5f;
+  return (t + y) * 1.44269504089f + e;
+}
+
+// Base 2 exponential, using the Cephes polynomial.
+template <typename F>
+inline F exp2_kernel(F x) {
+  x      = min(max(x, F{-127.0f}), F{128.0f});
+  auto n = trunc(x + 0.5f);
+  n      = select(x + 0.5f < n, n - 1, n);
+  auto f = x - n;
+  auto p = F{1.535336188319500e-4f};
+  p      = p * f + 1.339887440266574e-3f;
+  p      = p * f + 9.618437357674640e-3f;
+  p      = p * f + 5.550332471162809e-2f;
+  p      = p * f + 2.402264791363012e-1f;
+  p      = p * f + 6.931472028550421e-1f;
+  return (p * f + 1) * exp2i(n);
+}
+
+// Power function for x >= 0. Infinities and NaNs are passed through.
+// Results are within 9 ulps of std::pow, used by the scalar functions in
+// yocto_color, so tone mapped bytes may differ by one at rounding edges.
+template <typename F>
+inline F pow_kernel(F x, F y) {
+  auto p = exp2_kernel(y * log2_kernel(max(x, F{1.1754944e-38f})));
+  return select(x < 3.4028235e38f, select(x <= 0.0f, F{0.0f}, p), x);
+}
+
+template <typename F>
+inline F rgb_to_srgb_kernel(F rgb) {
+  return select(rgb <= 0.0031308f, rgb * 12.92f,
+      pow_kernel(rgb, F{1 / 2.4f}) * (1 + 0.055f) - 0.055f);
+}
+template <typename F>
+inline F srgb_to_rgb_kernel(F srgb) {
+  return select(srgb <= 0.04045f, srgb / 12.92f,
+      pow_kernel((srgb + 0.055f) / (1.0f + 0.055f), F{2.4f}));
+}
+
+template <typename F>
+inline F filmic_kernel(F hdr_) {
+  auto hdr = hdr_ * 0.6f;
+  auto ldr = (hdr * hdr * 2.51f + hdr * 0.03f) /
+             (hdr * hdr * 2.43f + hdr * 0.59f + 0.14f);
+  return max(F{0.0f}, ldr);
+}
+
+template <typename F>
+inline F gain_kernel(F a, float gain) {
+  auto bias = [](F a, float bias) {
+    return a / ((1 / bias - 2) * (1 - a) + 1);
+  };
+  return select(a < 0.5f, bias(a * 2, gain) / 2,
+      bias(a * 2 - 1, 1 - gain) / 2 + 0.5f);
+}
+
+template <typename F>
+inline void tonemap_kernel(
+    F& r, F& g, F& b, const tonemap_kernel_params& params) {
+  if (params.scale != 1) r = r * params.scale, g = g * params.scale,
+                         b = b * params.scale;
+  if (params.filmic) r = filmic_kernel(r), g = filmic_kernel(g),
+                     b = filmic_kernel(b);
+  if (params.srgb) r = rgb_to_srgb_kernel(r), g = rgb_to_srgb_kernel(g),
+                   b = rgb_to_srgb_kernel(b);
+}
+
+template <typename F>
+inline void colorgrade_kernel(
+    F& r, F& g, F& b, const colorgrade_kernel_params& params) {
+  F rgb[3] = {r, g, b};
+  if (params.exposure) {
+    for (auto& c : rgb) c = c * params.scale;
+  }
+  if (params.tint) {
+    for (auto k = 0; k < 3; k++) rgb[k] = rgb[k] * params.tint_rgb[k];
+  }
+  if (params.lincontrast) {
+    for (auto& c : rgb)
+      c = max(F{0.0f},
+          (c - params.grey) * params.lincontrast2 + params.grey);
+  }
+  if (params.logcontrast) {
+    for (auto& c : rgb) {
+      auto log_ldr  = log2_kernel(c + 0.0001f);
+      auto adjusted = (log_ldr - params.log_grey) * params.logcontrast2 +
+                      params.log_grey;
+      c = max(F{0.0f}, exp2_kernel(adjusted) - 0.0001f);
+    }
+  }
+  if (params.linsaturation) {
+    auto grey = rgb[0] * 0.333333f + rgb[1] * 0.333333f + rgb[2] * 0.333333f;
+    for (auto& c : rgb)
+      c = max(F{0.0f}, (c - grey) * params.linsaturation2 + grey);
+  }
+  if (params.filmic) {
+    for (auto& c : rgb) c = filmic_kernel(c);
+  }
+  if (params.srgb) {
+    for (auto& c : rgb) c = rgb_to_srgb_kernel(c);
+  }
+  if (params.contrast) {
+    for (auto& c : rgb) c = gain_kernel(c, params.contrast_gain);
+  }
+  if (params.saturation) {
+    auto grey = rgb[0] * 0.333333f + rgb[1] * 0.333333f + rgb[2] * 0.333333f;
+    for (auto& c : rgb)
+      c = max(F{0.0f}, (c - grey) * params.saturation2 + grey);
+  }
+  if (params.lgg) {
+    for (auto k = 0; k < 3; k++) {
+      auto lerp_value = min(
+          max(pow_kernel(rgb[k], F{params.inv_gamma[k]}), F{0.0f}), F{1.0f});
+      rgb[k] = lerp_value * params.gain[k] +
+               (1 - lerp_value) * params.lift[k];
+    }
+  }
+  r = rgb[0], g = rgb[1], b = rgb[2];
+}
+
+// Runs `func(r, g, b, a)` over `count` pixels, `F::width` at a time, and the
+// scalar version over the remaining ones.
+template <typename F, typename Out, typename In, typename Func>
+inline void run_pixel_kernel(
+    Out* out, const In* in, size_t count, Func&& func) {
+  auto idx = (size_t)0;
+  for (; idx + F::width <= count; idx += F::width) {
+    F r, g, b, a;
+    load_pixels(in + idx * 4, r, g, b, a);
+    func(r, g, b, a);
+    store_pixels(out + idx * 4, r, g, b, a);
+  }
+  for (; idx < count; idx++) {
+    vfloat1 r, g, b, a;
+    load_pixels(in + idx * 4, r, g, b, a);
+    func(r, g, b, a);
+    store_pixels(out + idx * 4, r, g, b, a);
+  }
+}
+
+// Pixel kernels for the instruction set of `F`.
+template <typename F>
+inline pixel_kernels make_pixel_kernels(simd_type type) {
+  auto kernels = pixel_kernels{};
+  kernels.type = type;
+  kernels.tonemap = [](float* ldr, const float* hdr, size_t count,
+                        const tonemap_kernel_params& params) {
+    run_pixel_kernel<F>(ldr, hdr, count,
+        [&params](auto& r, auto& g, auto& b, auto& a) {
+          tonemap_kernel(r, g, b, params);
+        });
+  };
+  kernels.tonemapb = [](uint8_t* ldr, const float* hdr, size_t count,
+                         const tonemap_kernel_params& params) {
+    run_pixel_kernel<F>(ldr, hdr, count,
+        [&params](auto& r, auto& g, auto& b, auto& a) {
+          tonemap_kernel(r, g, b, params);
+          r = r * 256, g = g * 256, b = b * 256, a = a * 256;
+        });
+  };
+  kernels.colorgrade = [](float* graded, const float* img, size_t count,
+                           const colorgrade_kernel_params& params) {
+    run_pixel_kernel<F>(graded, img, count,
+        [&params](auto& r, auto& g, auto& b, auto& a) {
+          colorgrade_kernel(r, g, b, params);
+        });
+  };
+  kernels.rgb_to_srgb = [](float* srgb, const float* rgb, size_t count) {
+    run_pixel_kernel<F>(srgb, rgb, count, [](auto& r, auto& g, auto& b, auto&) {
+      r = rgb_to_srgb_kernel(r), g = rgb_to_srgb_kernel(g),
+      b = rgb_to_srgb_kernel(b);
+    });
+  };
+  kernels.srgb_to_rgb = [](float* rgb, const float* srgb, size_t count) {
+    run_pixel_kernel<F>(rgb, srgb, count, [](auto& r, auto& g, auto& b, auto&) {
+      r = srgb_to_rgb_kernel(r), g = srgb_to_rgb_kernel(g),
+      b = srgb_to_rgb_kernel(b);
+    });
+  };
+  kernels.rgb_to_srgbb = [](uint8_t* srgb, const float* rgb, size_t count) {
+    run_pixel_kernel<F>(
+        srgb, rgb, count, [](auto& r, auto& g, auto& b, auto& a) {
+          r = rgb_to_srgb_kernel(r) * 256, g = rgb_to_srgb_kernel(g) * 256,
+          b = rgb_to_srgb_kernel(b) * 256, a = a * 256;
+        });
+  };
+  kernels.srgbb_to_rgb = [](float* rgb, const uint8_t* srgb, size_t count) {
+    run_pixel_kernel<F>(
+        rgb, srgb, count, [](auto& r, auto& g, auto& b, auto& a) {
+          r = srgb_to_rgb_kernel(r / 255.0f);
+          g = srgb_to_rgb_kernel(g / 255.0f);
+          b = srgb_to_rgb_kernel(b / 255.0f);
+          a = a / 255.0f;
+        });
+  };
+  kernels.float_to_byte = [](uint8_t* bt, const float* fl, size_t count) {
+    run_pixel_kernel<F>(bt, fl, count, [](auto& r, auto& g, auto& b, auto& a) {
+      r = r * 256, g = g * 256, b = b * 256, a = a * 256;
+    });
+  };
+  kernels.byte_to_float = [](float* fl, const uint8_t* bt, size_t count) {
+    run_pixel_kernel<F>(fl, bt, count, [](auto& r, auto& g, auto& b, auto& a) {
+      r = r / 255.0f, g = g / 255.0f, b = b / 255.0f, a = a / 255.0f;
+    });
+  };
+  return kernels;
+}
+
+}  // namespace
+}  // namespace yocto
+
+#endif
@@ -210,6 +210,31 @@ struct raytrace_bvh_primitive {
   int    primitive = 0;
 };
 
+// Minimum number of primitives processed by each parallel task.
+const int bvh_parallel_grain = 1 << 14;
+
+// Reduces the primitives in a range, splitting them in `nchunks` chunks that
+// are processed as parallel tasks and merged in order. `func` accumulates
+// one primitive and `merge` accumulates a chunk result.
+template <typename T, typename Func, typename Merge>
+static T reduce_primitives(int start, int end, int nchunks, const T& init,
+    Func&& func, Merge&& merge) {
+  if (nchunks <= 1) {
+    auto result = init;
+    for (auto i = start; i < end; i++) func(result, i);
+    return result;
+  }
+  auto results = vector<T>(nchunks, init);
+  parallel_for_batch(nchunks, 1, [&](int cidx) {
+    auto cstart = start + (int)((int64_t)(end - start) * cidx / nchunks);
+    auto cend   = start + (int)((int64_t)(end - start) * (cidx + 1) / nchunks);
+    for (auto i = cstart; i < cend; i++) func(results[cidx], i);
+  });
+  auto result = init;
+  for (auto& cresult : results) merge(result, cresult);
+  return result;
+}
+
 // Splits a BVH node. Returns split position and axis.
 static pair<int, int> split_middle(
     vector<raytrace_bvh_primitive>& primitives, int start, int end) {
@@ -244,12 +269,138 @@ static pair<int, int> split_middle(
   return {mid, axis};
 }
 
+// Number of bins used to evaluate SAH splits.
+const int bvh_sah_bins = 16;
+
+// SAH bins for the three axes, each storing the bounds and number of the
+// primitives whose centers fall in it.
+struct raytrace_bvh_bins {
+  array<array<bbox3f, bvh_sah_bins>, 3> bboxes = {};
+  array<array<int, bvh_sah_bins>, 3>    counts = {};
+};
+
+// Splits a BVH node using the SAH heuristic. Returns split position and axis.
+// Primitives are binned once along each axis and the split costs of all bin
+// boundaries are evaluated with prefix sums over the bins.
+static pair<int, int> split_sah(vector<raytrace_bvh_primitive>& primitives,
+    int start, int end, int nchunks = 1) {
+  // initialize split axis and position
+  auto split_axis = 0;
+  auto mid        = (start + end) / 2;
+
+  // compute primintive bounds and size
+  auto cbbox = reduce_primitives(
+      start, end, nchunks, invalidb3f,
+      [&](bbox3f& cbbox, int i) {
+        cbbox = merge(cbbox, primitives[i].center);
+      },
+      [](bbox3f& cbbox, const bbox3f& cbbox_) {
+        cbbox = merge(cbbox, cbbox_);
+      });
+  auto csize = cbbox.max - cbbox.min;
+  if (csize == zero3f) return {mid, split_axis};
+
+  // bin of a primitive center along an axis
+  auto nbins = bvh_sah_bins;
+  auto get_bin = [&](const vec3f& center, int axis) {
+    if (csize[axis] == 0) return 0;
+    auto b = (int)((center[axis] - cbbox.min[axis]) * nbins / csize[axis]);
+    return clamp(b, 0, nbins - 1);
+  };
+
+  // bin primitives
+  auto empty_bins = raytrace_bvh_bins{};
+  for (auto& axis_bboxes : empty_bins.bboxes) axis_bboxes.fill(invalidb3f);
+  auto bins = reduce_primitives(
+      start, end, nchunks, empty_bins,
+      [&](raytrace_bvh_bins& bins, int i) {
+        auto& primitive = primitives[i];
+        for (auto axis = 0; axis < 3; axis++) {
+          auto b               = get_bin(primitive.center, axis);
+          bins.bboxes[axis][b] = merge(bins.bboxes[axis][b], primitive.bbox);
+          bins.counts[axis][b] += 1;
+        }
+      },
+      [](raytrace_bvh_bins& bins, const raytrace_bvh_bins& bins_) {
+        for (auto axis = 0; axis < 3; axis++) {
+          for (auto b = 0; b < bvh_sah_bins; b++) {
+            bins.bboxes[axis][b] = merge(
+                bins.bboxes[axis][b], bins_.bboxes[axis][b]);
+            bins.counts[axis][b] += bins_.counts[axis][b];
+          }
+        }
+      });
+
+  // consider the bin boundaries, compute their cost and keep the minimum
+  auto split_bin = 0;
+  auto min_cost  = flt_max;
+  auto area      = [](auto& b) {
+    auto size = b.max - b.min;
+    return 1e-12f + 2 * size.x * size.y + 2 * size.x * size.z +
+           2 * size.y * size.z;
+  };
+  for (auto saxis = 0; saxis < 3; saxis++) {
+    // right bounds and counts, accumulated from the last bin
+    auto right_bboxes  = array<bbox3f, bvh_sah_bins>{};
+    auto right_nprimss = array<int, bvh_sah_bins>{};
+    auto right_bbox    = invalidb3f;
+    auto right_nprims  = 0;
+    for (auto b = nbins - 1; b > 0; b--) {
+      right_bbox       = merge(right_bbox, bins.bboxes[saxis][b]);
+      right_nprims     = right_nprims + bins.counts[saxis][b];
+      right_bboxes[b]  = right_bbox;
+      right_nprimss[b] = right_nprims;
+    }
+    // left bounds and counts, accumulated from the first bin
+    auto left_bbox   = invalidb3f;
+    auto left_nprims = 0;
+    for (auto b = 1; b < nbins; b++) {
+      left_bbox   = merge(left_bbox, bins.bboxes[saxis][b - 1]);
+      left_nprims = left_nprims + bins.counts[saxis][b - 1];
+      if (left_nprims == 0 || right_nprimss[b] == 0) continue;
+      auto cost = 1 + left_nprims * area(left_bbox) / area(cbbox) +
+                  right_nprimss[b] * area(right_bboxes[b]) / area(cbbox);
+      if (cost < min_cost) {
+        min_cost   = cost;
+        split_bin  = b;
+        split_axis = saxis;
+      }
+    }
+  }
+
+  // if no boundary separates the centers, just break the primitives in half
+  if (split_bin == 0) return {mid, 0};
+
+  // split using the same bins as the cost evaluation
+  mid = (int)(std::partition(primitives.data() + start, primitives.data() + end,
+                  [&](auto& primitive) {
+                    return get_bin(primitive.center, split_axis) < split_bin;
+                  }) -
+              primitives.data());
+
+  return {mid, split_axis};
+}
+
+// Split bvh nodes according to a type
+static pair<int, int> split_nodes(vector<raytrace_bvh_primitive>& primitives,
+    int start, int end, raytrace_bvh_type type, int nchunks = 1) {
+  switch (type) {
+    case raytrace_bvh_type::default_:
+      return split_middle(primitives, start, end);
+    case raytrace_bvh_type::highquality:
+      return split_sah(primitives, start, end, nchunks);
+    case raytrace_bvh_type::middle:
+      return split_middle(primitives, start, end);
+    default: throw std::runtime_error("should not have gotten here");
+  }
+}
+
 // Maximum number of primitives per BVH node.
 const int bvh_max_prims = 4;
 
 // Build BVH nodes
-static void build_bvh(vector<raytrace_bvh_node>& nodes,
-    vector<raytrace_bvh_primitive>&              primitives) {
+static void build_bvh_serial(vector<raytrace_bvh_node>& nodes,
+    vector<raytrace_bvh_primitive>& primitives, raytrace_bvh_type type) {
   // prepare to build nodes
   nodes.clear();
   nodes.reserve(primitives.size() * 2);
@@ -276,7 +427,7 @@ static void build_bvh(vector<raytrace_bvh_node>& nodes,
     // split into two children
     if (end - start > bvh_max_prims) {
       // get split
-      auto [mid, axis] = split_middle(primitives, start, end);
+      auto [mid, axis] = split_nodes(primitives, start, end, type);
 
       // make an internal node
       node.internal = true;
@@ -299,6 +450,91 @@ static void build_bvh(vector<raytrace_bvh_node>& nodes,
   nodes.shrink_to_fit();
 }
 
+// Build the BVH node `nodeid` over the primitives in [start, end) and,
+// recursively, its children. Children of large nodes near the root are built
+// as tasks of the thread pool and their primitives are binned in parallel
+// chunks, so nested builds share the threads of the pool.
+// Nodes are allocated in pairs from a counter, so that the tree is the same
+// for any thread schedule, but nodes may be stored in a different order.
+static void build_bvh_node(vector<raytrace_bvh_node>& nodes,
+    vector<raytrace_bvh_primitive>& primitives, atomic<int>& num_nodes,
+    int nodeid, int start, int end, raytrace_bvh_type type) {
+  // parallel chunks for this node; small nodes are processed serially
+  auto nchunks = (end - start) / bvh_parallel_grain;
+  nchunks      = nchunks > 1 ? min(nchunks, get_parallel_threads()) : 1;
+
+  // compute bounds
+  auto bbox = reduce_primitives(
+      start, end, nchunks, invalidb3f,
+      [&](bbox3f& bbox, int i) { bbox = merge(bbox, primitives[i].bbox); },
+      [](bbox3f& bbox, const bbox3f& bbox_) { bbox = merge(bbox, bbox_); });
+  nodes[nodeid].bbox = bbox;
+
+  // make a leaf node
+  if (end - start <= bvh_max_prims) {
+    auto& node    = nodes[nodeid];
+    node.internal = false;
+    node.num      = end - start;
+    node.start    = start;
+    return;
+  }
+
+  // get split
+  auto [mid, axis] = split_nodes(primitives, start, end, type, nchunks);
+
+  // make an internal node
+  auto children = num_nodes.fetch_add(2);
+  {
+    auto& node    = nodes[nodeid];
+    node.internal = true;
+    node.axis     = axis;
+    node.num      = 2;
+    node.start    = children;
+  }
+
+  // build children
+  if (end - start > bvh_parallel_grain) {
+    auto ranges = array<vec2i, 2>{vec2i{start, mid}, vec2i{mid, end}};
+    parallel_for_batch(2, 1, [&](int child) {
+      build_bvh_node(nodes, primitives, num_nodes, children + child,
+          ranges[child].x, ranges[child].y, type);
+    });
+  } else {
+    build_bvh_node(
+        nodes, primitives, num_nodes, children + 0, start, mid, type);
+    build_bvh_node(
+        nodes, primitives, num_nodes, children + 1, mid, end, type);
+  }
+}
+
+// Build BVH nodes
+static void build_bvh_parallel(vector<raytrace_bvh_node>& nodes,
+    vector<raytrace_bvh_primitive>& primitives, raytrace_bvh_type type) {
+  // prepare to build nodes; a binary tree has less than twice as many nodes
+  // as primitives
+  nodes.clear();
+  nodes.resize(primitives.size() * 2 + 1);
+
+  // build nodes from the root
+  auto num_nodes = atomic<int>{1};
+  build_bvh_node(
+      nodes, primitives, num_nodes, 0, 0, (int)primitives.size(), type);
+
+  // cleanup
+  nodes.resize(num_nodes);
+  nodes.shrink_to_fit();
+}
+
+// Build BVH nodes, in parallel unless disabled
+static void build_bvh(vector<raytrace_bvh_node>& nodes,
+    vector<raytrace_bvh_primitive>& primitives, const raytrace_params& params) {
+  if (params.noparallel) {
+    build_bvh_serial(nodes, primitives, params.bvh);
+  } else {
+    build_bvh_parallel(nodes, primitives, params.bvh);
+  }
+}
+
 static void init_bvh(raytrace_shape* shape, const raytrace_params& params) {
   // build primitives
   auto primitives = vector<raytrace_bvh_primitive>{};
@@ -333,7 +569,7 @@ static void init_bvh(raytrace_shape* shape, const raytrace_params& params) {
   // build nodes
   if (shape->bvh) delete shape->bvh;
   shape->bvh = new raytrace_bvh_tree{};
-  build_bvh(shape->bvh->nodes, primitives);
+  build_bvh(shape->bvh->nodes, primitives, params);
 
   // set bvh primitives
   shape->bvh->primitives.reserve(primitives.size());
@@ -345,12 +581,22 @@ static void init_bvh(raytrace_shape* shape, const raytrace_params& params) {
 void init_bvh(raytrace_scene* scene, const raytrace_params& params,
     progress_callback progress_cb) {
   // handle progress
-  auto progress = vec2i{0, 1 + (int)scene->shapes.size()};
-
-  // shapes
-  for (auto idx = 0; idx < scene->shapes.size(); idx++) {
-    if (progress_cb) progress_cb("build shape bvh", progress.x++, progress.y);
+  auto progress       = vec2i{0, 1 + (int)scene->shapes.size()};
+  auto progress_mutex = std::mutex{};
+
+  // shapes, built as tasks of the pool, so that their nodes share its threads
+  auto build_shape = [&](int idx) {
+    if (progress_cb) {
+      auto lock = std::lock_guard{progress_mutex};
+      progress_cb("build shape bvh", progress.x++, progress.y);
+    }
     init_bvh(scene->shapes[idx], params);
+  };
+  if (params.noparallel) {
+    for (auto idx = 0; idx < (int)scene->shapes.size(); idx++)
+      build_shape(idx);
+  } else {
+    parallel_for_batch((int)scene->shapes.size(), 1, build_shape);
   }
 
   // handle progress
@@ -372,7 +618,7 @@ void init_bvh(raytrace_scene* scene, const raytrace_params& params,
   // build nodes
   if (scene->bvh) delete scene->bvh;
   scene->bvh = new raytrace_bvh_tree{};
-  build_bvh(scene->bvh->nodes, primitives);
+  build_bvh(scene->bvh->nodes, primitives, params);
 
   // set bvh primitives
   scene->bvh->primitives.reserve(primitives.size());
@@ -288,6 +288,11 @@ enum struct raytrace_shader_type {
 // Default trace seed
 const auto default_seed = 961748941ull;
 
+// Strategy used to build the bvh: split in the middle of the largest axis,
+// or with the binned surface area heuristic, slower to build but faster
+// to trace
+enum struct raytrace_bvh_type { default_, highquality, middle };
+
 // Options for trace functions
 struct raytrace_params {
   int             resolution = 720;
@@ -296,18 +301,22 @@ struct raytrace_params {
   int             bounces    = 4;
   float           clamp      = 100000;
   uint64_t        seed       = default_seed;
+  raytrace_bvh_type        bvh        = raytrace_bvh_type::default_;
   bool            noparallel = false;
   int             pratio     = 8;
 };
 
 const auto raytrace_shader_names = vector<string>{
     "raytrace", "eyelight", "normal", "texcoord", "color","cartoon","mioshader"};
+const auto raytrace_bvh_names = vector<string>{
+    "default", "highquality", "middle"};
 
 // Progress report callback
 using progress_callback =
     function<void(const string& message, int current, int total)>;
 
-// Build the bvh acceleration structure.
+// Build the bvh acceleration structure. Shapes are built concurrently, and
+// large shapes and the instance bvh with parallel tasks, unless `noparallel`.
 void init_bvh(raytrace_scene* scene, const raytrace_params& params,
     progress_callback progress_cb = {});
 
@@ -387,22 +387,27 @@ void make_grass(sceneio_scene* scene, sceneio_instance* object,
       object->shape->texcoords, object->shape, params.num);
   int  size = object->shape->positions.size();
   auto rng  = make_rng(172842);
+  // one instance array for each grass model
+  auto arrays = vector<sceneio_instance*>(grasses.size(), nullptr);
   for (auto i = 0; i < size; i++) {
-    auto grass = add_instance(scene);
-
-    auto random  = floor(rand1f(rng) * (grasses.size() - 1));
-    auto modello = grasses[random];
-
-    grass->frame    = modello->frame;
-    grass->shape    = modello->shape;
-    grass->material = modello->material;
-    auto  position  = object->shape->positions[i];
-    float roty      = (float)rand1f(rng) * 2.0f * pi;
-    float rotz      = (float)rand1f(rng) / 10.0f + 0.1f;
-    auto  scale     = vec3f{rand3f(rng) / 10.0f + 0.9f};
-    grass->frame *= translation_frame(position) * scaling_frame(vec3f{scale}) *
-                    rotation_frame(vec3f{0, 1, 0}, roty) *
-                    rotation_frame(vec3f{0, 0, 1}, rotz);
+    auto random = (int)floor(rand1f(rng) * (grasses.size() - 1));
+    auto& grass = arrays[random];
+    if (grass == nullptr) {
+      auto modello    = grasses[random];
+      grass           = add_instance(scene);
+      grass->shape    = modello->shape;
+      grass->material = modello->material;
+    }
+
+    auto  frame    = grasses[random]->frame;
+    auto  position = object->shape->positions[i];
+    float roty     = (float)rand1f(rng) * 2.0f * pi;
+    float rotz     = (float)rand1f(rng) / 10.0f + 0.1f;
+    auto  scale    = vec3f{rand3f(rng) / 10.0f + 0.9f};
+    frame *= translation_frame(position) * scaling_frame(vec3f{scale}) *
+             rotation_frame(vec3f{0, 1, 0}, roty) *
+             rotation_frame(vec3f{0, 0, 1}, rotz);
+    grass->frames.push_back(frame);
   }
 }
 
@@ -620,6 +625,13 @@ int main(int argc, const char* argv[]) {
     if (!make_directory(path_join(path_dirname(output), "textures"), ioerror))
       print_fatal(ioerror);
   }
+  auto has_frames = false;
+  for (auto instance : scene->instances)
+    if (!instance->frames.empty()) has_frames = true;
+  if (has_frames) {
+    if (!make_directory(path_join(path_dirname(output), "instances"), ioerror))
+      print_fatal(ioerror);
+  }
 
   // save scene
   if (!save_scene(output, scene, ioerror, print_progress)) print_fatal(ioerror);
@@ -110,7 +110,8 @@ void reset_display(app_state* app) {
       });
 }
 
-// Construct a scene from io
+// Construct a scene from io. Shape, texture and instance arrays are moved
+// out of the io scene, that should not be used afterwards.
 void init_scene(trace_scene* scene, sceneio_scene* ioscene,
     trace_camera*& camera, sceneio_camera* iocamera,
     progress_callback progress_cb = {}) {
@@ -142,8 +143,8 @@ void init_scene(trace_scene* scene, sceneio_scene* ioscene,
     if (progress_cb)
       progress_cb("converting textures", progress.x++, progress.y);
     auto texture           = add_texture(scene);
-    texture->hdr           = iotexture->hdr;
-    texture->ldr           = iotexture->ldr;
+    texture->hdr           = std::move(iotexture->hdr);
+    texture->ldr           = std::move(iotexture->ldr);
     texture_map[iotexture] = texture;
   }
 
@@ -188,19 +189,19 @@ void init_scene(trace_scene* scene, sceneio_scene* ioscene,
   for (auto ioshape : ioscene->shapes) {
     if (progress_cb) progress_cb("converting shapes", progress.x++, progress.y);
     auto shape              = add_shape(scene);
-    shape->points           = ioshape->points;
-    shape->lines            = ioshape->lines;
-    shape->triangles        = ioshape->triangles;
-    shape->quads            = ioshape->quads;
-    shape->quadspos         = ioshape->quadspos;
-    shape->quadsnorm        = ioshape->quadsnorm;
-    shape->quadstexcoord    = ioshape->quadstexcoord;
-    shape->positions        = ioshape->positions;
-    shape->normals          = ioshape->normals;
-    shape->texcoords        = ioshape->texcoords;
-    shape->colors           = ioshape->colors;
-    shape->radius           = ioshape->radius;
-    shape->tangents         = ioshape->tangents;
+    shape->points           = std::move(ioshape->points);
+    shape->lines            = std::move(ioshape->lines);
+    shape->triangles        = std::move(ioshape->triangles);
+    shape->quads            = std::move(ioshape->quads);
+    shape->quadspos         = std::move(ioshape->quadspos);
+    shape->quadsnorm        = std::move(ioshape->quadsnorm);
+    shape->quadstexcoord    = std::move(ioshape->quadstexcoord);
+    shape->positions        = std::move(ioshape->positions);
+    shape->normals          = std::move(ioshape->normals);
+    shape->texcoords        = std::move(ioshape->texcoords);
+    shape->colors           = std::move(ioshape->colors);
+    shape->radius           = std::move(ioshape->radius);
+    shape->tangents         = std::move(ioshape->tangents);
     shape->subdivisions     = ioshape->subdivisions;
     shape->catmullclark     = ioshape->catmullclark;
     shape->smooth           = ioshape->smooth;
@@ -216,6 +217,7 @@ void init_scene(trace_scene* scene, sceneio_scene* ioscene,
     instance->frame    = ioinstance->frame;
     instance->shape    = shape_map.at(ioinstance->shape);
     instance->material = material_map.at(ioinstance->material);
+    instance->frames   = std::move(ioinstance->frames);
   }
 
   for (auto ioenvironment : ioscene->environments) {
@@ -242,6 +244,7 @@ int main(int argc, const char* argv[]) {
   // command line options
   auto camera_name = ""s;
   auto add_skyenv  = false;
+  auto tesscache   = ""s;
 
   // parse command line
   auto cli = make_cli("ysceneitraces", "progressive path tracing");
@@ -258,10 +261,15 @@ int main(int argc, const char* argv[]) {
   add_option(cli, "--clamp", app->params.clamp, "Final pixel clamping.");
   add_option(
       cli, "--filter/--no-filter", app->params.tentfilter, "Filter image.");
+  add_option(cli, "--mipmap/--no-mipmap", app->params.mipmap,
+      "Filter textures with mipmaps.");
+  add_option(cli, "--texcache", app->params.texcache,
+      "Texture cache size in megabytes.");
   add_option(cli, "--env-hidden/--no-env-hidden", app->params.envhidden,
       "Environments are hidden in renderer");
   add_option(cli, "--bvh", app->params.bvh, "Bvh type", trace_bvh_names);
   add_option(cli, "--skyenv/--no-skyenv", add_skyenv, "Add sky envmap");
+  add_option(cli, "--tesscache", tesscache, "Tesselation cache directory");
   add_option(cli, "--output,-o", app->imagename, "Image output");
   add_option(cli, "scene", app->filename, "Scene filename", true);
   parse_cli(cli, argc, argv);
@@ -290,7 +298,8 @@ int main(int argc, const char* argv[]) {
   ioscene_guard.reset();
 
   // tesselation
-  tesselate_shapes(app->scene, print_progress);
+  tesselate_shapes(
+      app->scene, print_progress, tesscache, app->params.noparallel);
 
   // build bvh
   init_bvh(app->bvh, app->scene, app->params, print_progress);
@@ -298,6 +307,10 @@ int main(int argc, const char* argv[]) {
   // init renderer
   init_lights(app->lights, app->scene, app->params, print_progress);
 
+  // init texture cache
+  if (!init_texture_cache(app->scene, app->params, ioerror))
+    print_fatal(ioerror);
+
   // fix renderer type if no lights
   if (app->lights->lights.empty() && is_sampler_lit(app->params)) {
     print_info("no lights presents, switching to eyelight shader");
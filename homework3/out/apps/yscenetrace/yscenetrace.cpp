@@ -33,12 +33,15 @@
 #include <yocto/yocto_trace.h>
 using namespace yocto;
 
+#include <filesystem>
+#include <functional>
 #include <map>
 #include <memory>
 #include <unordered_map>
 using std::unordered_map;
 
-// Construct a scene from io
+// Construct a scene from io. Shape, texture and instance arrays are moved
+// out of the io scene, that should not be used afterwards.
 void init_scene(trace_scene* scene, sceneio_scene* ioscene,
     trace_camera*& camera, sceneio_camera* iocamera,
     progress_callback progress_cb = {}) {
@@ -70,8 +73,8 @@ void init_scene(trace_scene* scene, sceneio_scene* ioscene,
     if (progress_cb)
       progress_cb("converting textures", progress.x++, progress.y);
     auto texture           = add_texture(scene);
-    texture->hdr           = iotexture->hdr;
-    texture->ldr           = iotexture->ldr;
+    texture->hdr           = std::move(iotexture->hdr);
+    texture->ldr           = std::move(iotexture->ldr);
     texture_map[iotexture] = texture;
   }
 
@@ -116,19 +119,19 @@ void init_scene(trace_scene* scene, sceneio_scene* ioscene,
   for (auto ioshape : ioscene->shapes) {
     if (progress_cb) progress_cb("converting shapes", progress.x++, progress.y);
     auto shape              = add_shape(scene);
-    shape->points           = ioshape->points;
-    shape->lines            = ioshape->lines;
-    shape->triangles        = ioshape->triangles;
-    shape->quads            = ioshape->quads;
-    shape->quadspos         = ioshape->quadspos;
-    shape->quadsnorm        = ioshape->quadsnorm;
-    shape->quadstexcoord    = ioshape->quadstexcoord;
-    shape->positions        = ioshape->positions;
-    shape->normals          = ioshape->normals;
-    shape->texcoords        = ioshape->texcoords;
-    shape->colors           = ioshape->colors;
-    shape->radius           = ioshape->radius;
-    shape->tangents         = ioshape->tangents;
+    shape->points           = std::move(ioshape->points);
+    shape->lines            = std::move(ioshape->lines);
+    shape->triangles        = std::move(ioshape->triangles);
+    shape->quads            = std::move(ioshape->quads);
+    shape->quadspos         = std::move(ioshape->quadspos);
+    shape->quadsnorm        = std::move(ioshape->quadsnorm);
+    shape->quadstexcoord    = std::move(ioshape->quadstexcoord);
+    shape->positions        = std::move(ioshape->positions);
+    shape->normals          = std::move(ioshape->normals);
+    shape->texcoords        = std::move(ioshape->texcoords);
+    shape->colors           = std::move(ioshape->colors);
+    shape->radius           = std::move(ioshape->radius);
+    shape->tangents         = std::move(ioshape->tangents);
     shape->subdivisions     = ioshape->subdivisions;
     shape->catmullclark     = ioshape->catmullclark;
     shape->smooth           = ioshape->smooth;
@@ -144,6 +147,7 @@ void init_scene(trace_scene* scene, sceneio_scene* ioscene,
     instance->frame    = ioinstance->frame;
     instance->shape    = shape_map.at(ioinstance->shape);
     instance->material = material_map.at(ioinstance->material);
+    instance->frames   = std::move(ioinstance->frames);
   }
 
   for (auto ioenvironment : ioscene->environments) {
@@ -162,6 +166,34 @@ void init_scene(trace_scene* scene, sceneio_scene* ioscene,
   camera = camera_map.at(iocamera);
 }
 
+// Key of a compiled scene. It hashes the scene file, the size and time of
+// the files referenced by the scene, and the options that change the
+// converted scene.
+uint64_t make_compiled_key(const string& filename,
+    const vector<string>& sources, const string& camera_name,
+    bool add_skyenv) {
+  namespace fs = std::filesystem;
+  auto hash    = fnv_hash{};
+  auto text    = ""s;
+  auto error   = ""s;
+  if (!load_text(filename, text, error)) text = "";
+  hash_data(hash, camera_name.data(), camera_name.size());
+  hash_value(hash, add_skyenv);
+  hash_data(hash, text.data(), text.size());
+  for (auto& source : sources) {
+    auto ec   = std::error_code{};
+    auto path = fs::u8path(source);
+    auto size = (uint64_t)fs::file_size(path, ec);
+    auto time = (int64_t)fs::last_write_time(path, ec)
+                    .time_since_epoch()
+                    .count();
+    hash_data(hash, source.data(), source.size());
+    hash_value(hash, size);
+    hash_value(hash, time);
+  }
+  return hash.value;
+}
+
 int main(int argc, const char* argv[]) {
   // options
   auto params         = trace_params{};
@@ -171,65 +203,135 @@ int main(int argc, const char* argv[]) {
   auto imfilename     = "out.hdr"s;
   auto filename       = "scene.json"s;
   auto feature_images = false;
+  auto tesscache      = ""s;
+  auto compile        = false;
 
   // parse command line
   auto cli = make_cli("yscenetrace", "Offline path tracing");
   add_option(cli, "--camera", camera_name, "Camera name.");
   add_option(cli, "--resolution,-r", params.resolution, "Image resolution.");
   add_option(cli, "--samples,-s", params.samples, "Number of samples.");
+  add_option(cli, "--target", params.target,
+      "Adaptive sampling target relative error.");
+  add_option(cli, "--min-samples", params.minsamples,
+      "Number of samples before adaptive sampling.");
+  add_option(cli, "--budget", params.budget, "Time budget in seconds.");
   add_option(
       cli, "--tracer,-t", params.sampler, "Trace type.", trace_sampler_names);
   add_option(cli, "--falsecolor,-F", params.falsecolor,
       "Tracer false color type.", trace_falsecolor_names);
   add_option(cli, "--bounces,-b", params.bounces, "Maximum number of bounces.");
+  add_option(cli, "--lights", params.lights, "Light sampling.",
+      trace_light_sampling_names);
   add_option(cli, "--clamp", params.clamp, "Final pixel clamping.");
   add_option(cli, "--filter/--no-filter", params.tentfilter, "Filter image.");
+  add_option(cli, "--mipmap/--no-mipmap", params.mipmap,
+      "Filter textures with mipmaps.");
+  add_option(cli, "--texcache", params.texcache,
+      "Texture cache size in megabytes.");
   add_option(cli, "--env-hidden/--no-env-hidden", params.envhidden,
       "Environments are hidden in renderer");
   add_option(cli, "--save-batch", save_batch, "Save images progressively");
   add_option(cli, "--bvh", params.bvh, "Bvh type", trace_bvh_names);
   add_option(cli, "--skyenv/--no-skyenv", add_skyenv, "Add sky envmap");
+  add_option(cli, "--tesscache", tesscache, "Tesselation cache directory");
+  add_option(cli, "--compile", compile, "Compile scene and bvh and exit");
   add_option(cli, "--output-image,-o", imfilename, "Image filename");
   add_option(cli, "scene", filename, "Scene filename", true);
   add_option(cli, "--denoise-features,-d", feature_images,
       "Generate denoise feature images");
   parse_cli(cli, argc, argv);
 
-  // scene loading
-  auto ioscene_guard = std::make_unique<sceneio_scene>();
-  auto ioscene       = ioscene_guard.get();
-  auto ioerror       = ""s;
-  if (!load_scene(filename, ioscene, ioerror, print_progress))
-    print_fatal(ioerror);
-
-  // add sky
-  if (add_skyenv) add_sky(ioscene);
+#ifdef YOCTO_EMBREE
+  // embree bvhs are built by embree and cannot be saved
+  if (compile && params.bvh >= trace_bvh_type::embree_default)
+    print_fatal("cannot compile embree bvh");
+#endif
 
-  // get camera
-  auto iocamera = get_camera(ioscene, camera_name);
-
-  // scene conversion
+  // compiled scene, used if up to date
   auto scene_guard = std::make_unique<trace_scene>();
   auto scene       = scene_guard.get();
   auto camera      = (trace_camera*)nullptr;
-  init_scene(scene, ioscene, camera, iocamera);
+  auto ioerror     = ""s;
+  auto compiled    = replace_extension(filename, ".ybin");
+  auto sources     = vector<string>{};
+  auto loaded      = false;
+  if (!compile && path_exists(compiled)) {
+    print_progress("load compiled", 0, 1);
+    loaded = load_binary_sources(compiled, sources, ioerror) &&
+             load_binary_scene(compiled, scene, camera,
+                 make_compiled_key(filename, sources, camera_name, add_skyenv),
+                 ioerror);
+    if (!loaded) {
+      print_info(ioerror + ", loading scene");
+      scene_guard = std::make_unique<trace_scene>();
+      scene       = scene_guard.get();
+      camera      = nullptr;
+    }
+    print_progress("load compiled", 1, 1);
+  }
+
+  if (!loaded) {
+    // scene loading
+    auto ioscene_guard = std::make_unique<sceneio_scene>();
+    auto ioscene       = ioscene_guard.get();
+    if (!load_scene(filename, ioscene, ioerror, print_progress))
+      print_fatal(ioerror);
 
-  // cleanup
-  ioscene_guard.reset();
+    // add sky
+    if (add_skyenv) add_sky(ioscene);
 
-  // tesselation
-  tesselate_shapes(scene, print_progress);
+    // get camera
+    auto iocamera = get_camera(ioscene, camera_name);
 
-  // build bvh
+    // scene conversion
+    init_scene(scene, ioscene, camera, iocamera);
+    sources = ioscene->sources;
+
+    // cleanup
+    ioscene_guard.reset();
+
+    // tesselation
+    tesselate_shapes(scene, print_progress, tesscache, params.noparallel);
+  }
+
+  // bvh, loaded if saved for the same geometry
   auto bvh_guard = std::make_unique<trace_bvh>();
   auto bvh       = bvh_guard.get();
-  init_bvh(bvh, scene, params, print_progress);
+  auto bvhname   = replace_extension(filename, ".ybvh");
+  auto bvhloaded = false;
+  if (!compile && path_exists(bvhname)) {
+    print_progress("load bvh", 0, 1);
+    bvhloaded = load_bvh(bvhname, bvh, scene, params, ioerror);
+    if (!bvhloaded) {
+      print_info(ioerror + ", building bvh");
+      bvh_guard = std::make_unique<trace_bvh>();
+      bvh       = bvh_guard.get();
+    }
+    print_progress("load bvh", 1, 1);
+  }
+  if (!bvhloaded) init_bvh(bvh, scene, params, print_progress);
+
+  // save compiled scene and bvh
+  if (compile) {
+    print_progress("save compiled", 0, 2);
+    auto key = make_compiled_key(filename, sources, camera_name, add_skyenv);
+    if (!save_binary_scene(compiled, scene, camera, sources, key, ioerror))
+      print_fatal(ioerror);
+    print_progress("save compiled", 1, 2);
+    if (!save_bvh(bvhname, bvh, params, ioerror)) print_fatal(ioerror);
+    print_progress("save compiled", 2, 2);
+    return 0;
+  }
 
   // init renderer
   auto lights_guard = std::make_unique<trace_lights>();
   auto lights       = lights_guard.get();
   init_lights(lights, scene, params, print_progress);
 
+  // init texture cache
+  if (!init_texture_cache(scene, params, ioerror)) print_fatal(ioerror);
+
   // fix renderer type if no lights
   if (lights->lights.empty() && is_sampler_lit(params)) {
     print_info("no lights presents, switching to eyelight shader");
@@ -35,15 +35,19 @@
 #include <algorithm>
 #include <array>
 #include <atomic>
+#include <cstdio>
 #include <cstring>
 #include <deque>
 #include <memory>
 #include <stdexcept>
 #include <string>
+#include <type_traits>
 #include <utility>
 
+#include "yocto_commonio.h"
 #include "yocto_geometry.h"
 #include "yocto_parallel.h"
+#include "yocto_simd.h"
 
 #ifdef YOCTO_EMBREE
 #include <embree3/rtcore.h>
@@ -324,6 +328,7 @@ void set_shape(bvh_scene* bvh, int shape_id, const vector<int>& points,
                              : bvh_span{shape->positions_data};
   shape->radius_data = as_view ? vector<float>{} : radius;
   shape->radius = as_view ? bvh_span{radius} : bvh_span{shape->radius_data};
+  shape->leaf_order = false;
 }
 
 // Set instances
@@ -351,49 +356,130 @@ void set_instances(bvh_scene* bvh, int num_instances,
 // -----------------------------------------------------------------------------
 namespace yocto {
 
+// Minimum number of primitives processed by each parallel task.
+const int bvh_parallel_grain = 1 << 14;
+
+// Reduces the primitives in a range, splitting them in `nchunks` chunks that
+// are processed as parallel tasks and merged in order. `func` accumulates
+// one primitive and `merge` accumulates a chunk result.
+template <typename T, typename Func, typename Merge>
+static T reduce_primitives(int start, int end, int nchunks, const T& init,
+    Func&& func, Merge&& merge) {
+  if (nchunks <= 1) {
+    auto result = init;
+    for (auto i = start; i < end; i++) func(result, i);
+    return result;
+  }
+  auto results = vector<T>(nchunks, init);
+  parallel_for_batch(nchunks, 1, [&](int cidx) {
+    auto cstart = start + (int)((int64_t)(end - start) * cidx / nchunks);
+    auto cend   = start + (int)((int64_t)(end - start) * (cidx + 1) / nchunks);
+    for (auto i = cstart; i < cend; i++) func(results[cidx], i);
+  });
+  auto result = init;
+  for (auto& cresult : results) merge(result, cresult);
+  return result;
+}
+
+// Number of bins used to evaluate SAH splits.
+const int bvh_sah_bins = 16;
+
+// SAH bins for the three axes, each storing the bounds and number of the
+// primitives whose centers fall in it.
+struct bvh_bins {
+  array<array<bbox3f, bvh_sah_bins>, 3> bboxes = {};
+  array<array<int, bvh_sah_bins>, 3>    counts = {};
+};
+
 // Splits a BVH node using the SAH heuristic. Returns split position and axis.
+// Primitives are binned once along each axis and the split costs of all bin
+// boundaries are evaluated with prefix sums over the bins.
 static pair<int, int> split_sah(vector<int>& primitives,
     const vector<bbox3f>& bboxes, const vector<vec3f>& centers, int start,
-    int end) {
+    int end, int nchunks = 1) {
   // initialize split axis and position
   auto split_axis = 0;
   auto mid        = (start + end) / 2;
 
   // compute primintive bounds and size
-  auto cbbox = invalidb3f;
-  for (auto i = start; i < end; i++)
-    cbbox = merge(cbbox, centers[primitives[i]]);
+  auto cbbox = reduce_primitives(
+      start, end, nchunks, invalidb3f,
+      [&](bbox3f& cbbox, int i) {
+        cbbox = merge(cbbox, centers[primitives[i]]);
+      },
+      [](bbox3f& cbbox, const bbox3f& cbbox_) {
+        cbbox = merge(cbbox, cbbox_);
+      });
   auto csize = cbbox.max - cbbox.min;
   if (csize == zero3f) return {mid, split_axis};
 
+  // split position for a bin boundary
+  auto nbins     = bvh_sah_bins;
+  auto bin_split = [&](int axis, int b) {
+    return cbbox.min[axis] + b * csize[axis] / nbins;
+  };
+
+  // bin primitives; bins are adjusted so that a center is in bin b iff
+  // bin_split(b) <= center < bin_split(b+1), as used by the cost evaluation
+  auto empty_bins = bvh_bins{};
+  for (auto& axis_bboxes : empty_bins.bboxes) axis_bboxes.fill(invalidb3f);
+  auto bins = reduce_primitives(
+      start, end, nchunks, empty_bins,
+      [&](bvh_bins& bins, int i) {
+        auto& bbox   = bboxes[primitives[i]];
+        auto& center = centers[primitives[i]];
+        for (auto axis = 0; axis < 3; axis++) {
+          auto b = csize[axis] == 0 ? 0
+                                    : (int)((center[axis] - cbbox.min[axis]) *
+                                            nbins / csize[axis]);
+          b      = clamp(b, 0, nbins - 1);
+          while (b > 0 && center[axis] < bin_split(axis, b)) b--;
+          while (b < nbins - 1 && center[axis] >= bin_split(axis, b + 1)) b++;
+          bins.bboxes[axis][b] = merge(bins.bboxes[axis][b], bbox);
+          bins.counts[axis][b] += 1;
+        }
+      },
+      [](bvh_bins& bins, const bvh_bins& bins_) {
+        for (auto axis = 0; axis < 3; axis++) {
+          for (auto b = 0; b < bvh_sah_bins; b++) {
+            bins.bboxes[axis][b] = merge(
+                bins.bboxes[axis][b], bins_.bboxes[axis][b]);
+            bins.counts[axis][b] += bins_.counts[axis][b];
+          }
+        }
+      });
+
   // consider N bins, compute their cost and keep the minimum
-  const int nbins    = 16;
-  auto      middle   = 0.0f;
-  auto      min_cost = flt_max;
-  auto      area     = [](auto& b) {
+  auto middle   = 0.0f;
+  auto min_cost = flt_max;
+  auto area     = [](auto& b) {
     auto size = b.max - b.min;
     return 1e-12f + 2 * size.x * size.y + 2 * size.x * size.z +
            2 * size.y * size.z;
   };
   for (auto saxis = 0; saxis < 3; saxis++) {
+    // right bounds and counts, accumulated from the last bin
+    auto right_bboxes  = array<bbox3f, bvh_sah_bins>{};
+    auto right_nprimss = array<int, bvh_sah_bins>{};
+    auto right_bbox    = invalidb3f;
+    auto right_nprims  = 0;
+    for (auto b = nbins - 1; b > 0; b--) {
+      right_bbox       = merge(right_bbox, bins.bboxes[saxis][b]);
+      right_nprims     = right_nprims + bins.counts[saxis][b];
+      right_bboxes[b]  = right_bbox;
+      right_nprimss[b] = right_nprims;
+    }
+    // left bounds and counts, accumulated from the first bin
+    auto left_bbox   = invalidb3f;
+    auto left_nprims = 0;
     for (auto b = 1; b < nbins; b++) {
-      auto split     = cbbox.min[saxis] + b * csize[saxis] / nbins;
-      auto left_bbox = invalidb3f, right_bbox = invalidb3f;
-      auto left_nprims = 0, right_nprims = 0;
-      for (auto i = start; i < end; i++) {
-        if (centers[primitives[i]][saxis] < split) {
-          left_bbox = merge(left_bbox, bboxes[primitives[i]]);
-          left_nprims += 1;
-        } else {
-          right_bbox = merge(right_bbox, bboxes[primitives[i]]);
-          right_nprims += 1;
-        }
-      }
-      auto cost = 1 + left_nprims * area(left_bbox) / area(cbbox) +
-                  right_nprims * area(right_bbox) / area(cbbox);
+      left_bbox   = merge(left_bbox, bins.bboxes[saxis][b - 1]);
+      left_nprims = left_nprims + bins.counts[saxis][b - 1];
+      auto cost   = 1 + left_nprims * area(left_bbox) / area(cbbox) +
+                  right_nprimss[b] * area(right_bboxes[b]) / area(cbbox);
       if (cost < min_cost) {
         min_cost   = cost;
-        middle     = split;
+        middle     = bin_split(saxis, b);
         split_axis = saxis;
       }
     }
@@ -495,16 +581,22 @@ static pair<int, int> split_middle(vector<int>& primitives,
 // Split bvh nodes according to a type
 static pair<int, int> split_nodes(vector<int>& primitives,
     const vector<bbox3f>& bboxes, const vector<vec3f>& centers, int start,
-    int end, bvh_build_type type) {
+    int end, bvh_build_type type, int nchunks = 1) {
   switch (type) {
     case bvh_build_type::default_:
       return split_middle(primitives, bboxes, centers, start, end);
     case bvh_build_type::highquality:
-      return split_sah(primitives, bboxes, centers, start, end);
+      return split_sah(primitives, bboxes, centers, start, end, nchunks);
     case bvh_build_type::middle:
       return split_middle(primitives, bboxes, centers, start, end);
     case bvh_build_type::balanced:
       return split_balanced(primitives, bboxes, centers, start, end);
+    case bvh_build_type::wide4:
+      return split_sah(primitives, bboxes, centers, start, end, nchunks);
+    case bvh_build_type::wide8:
+      return split_sah(primitives, bboxes, centers, start, end, nchunks);
+    case bvh_build_type::compact:
+      return split_sah(primitives, bboxes, centers, start, end, nchunks);
     default: throw std::runtime_error("should not have gotten here");
   }
 }
@@ -578,107 +670,354 @@ static void build_bvh_serial(
   nodes.shrink_to_fit();
 }
 
-#if 0
+// Build the BVH node `nodeid` over the primitives in [start, end) and,
+// recursively, its children. Children of large nodes near the root are built
+// as tasks of the thread pool and their primitives are binned in parallel
+// chunks, so nested builds share the threads of the pool.
+// Nodes are allocated in pairs from a counter, so that the tree is the same
+// for any thread schedule, but nodes may be stored in a different order.
+static void build_bvh_node(bvh_tree& bvh, atomic<int>& num_nodes,
+    const vector<bbox3f>& bboxes, const vector<vec3f>& centers, int nodeid,
+    int start, int end, const bvh_params& params) {
+  // get values
+  auto& nodes      = bvh.nodes;
+  auto& primitives = bvh.primitives;
+
+  // parallel chunks for this node; small nodes are processed serially
+  auto nchunks = (end - start) / bvh_parallel_grain;
+  nchunks      = nchunks > 1 ? min(nchunks, get_parallel_threads()) : 1;
+
+  // compute bounds
+  auto bbox = reduce_primitives(
+      start, end, nchunks, invalidb3f,
+      [&](bbox3f& bbox, int i) { bbox = merge(bbox, bboxes[primitives[i]]); },
+      [](bbox3f& bbox, const bbox3f& bbox_) { bbox = merge(bbox, bbox_); });
+  nodes[nodeid].bbox = bbox;
+
+  // make a leaf node
+  if (end - start <= bvh_max_prims) {
+    auto& node    = nodes[nodeid];
+    node.internal = false;
+    node.num      = (int16_t)(end - start);
+    node.start    = start;
+    return;
+  }
+
+  // get split
+  auto [mid, axis] = split_nodes(
+      primitives, bboxes, centers, start, end, params.bvh, nchunks);
+
+  // make an internal node
+  auto children = num_nodes.fetch_add(2);
+  {
+    auto& node    = nodes[nodeid];
+    node.internal = true;
+    node.axis     = (uint8_t)axis;
+    node.num      = 2;
+    node.start    = children;
+  }
+
+  // build children
+  if (end - start > bvh_parallel_grain) {
+    auto ranges = array<vec2i, 2>{vec2i{start, mid}, vec2i{mid, end}};
+    parallel_for_batch(2, 1, [&](int child) {
+      build_bvh_node(bvh, num_nodes, bboxes, centers, children + child,
+          ranges[child].x, ranges[child].y, params);
+    });
+  } else {
+    build_bvh_node(
+        bvh, num_nodes, bboxes, centers, children + 0, start, mid, params);
+    build_bvh_node(
+        bvh, num_nodes, bboxes, centers, children + 1, mid, end, params);
+  }
+}
 
 // Build BVH nodes
 static void build_bvh_parallel(
-    bvh_tree_& bvh, const vector<bbox3f>& bboxes, bvh_build_type type) {
+    bvh_tree& bvh, const vector<bbox3f>& bboxes, const bvh_params& params) {
   // get values
   auto& nodes      = bvh.nodes;
   auto& primitives = bvh.primitives;
 
-  // prepare to build nodes
+  // prepare to build nodes; a binary tree has less than twice as many nodes
+  // as primitives
   nodes.clear();
-  nodes.reserve(bboxes.size() * 2);
+  nodes.resize(bboxes.size() * 2 + 1);
 
   // prepare primitives
-  bvh.primitives.resize(bboxes.size());
-  for (auto idx = 0; idx < bboxes.size(); idx++) bvh.primitives[idx] = idx;
+  primitives.resize(bboxes.size());
+  for (auto idx = 0; idx < bboxes.size(); idx++) primitives[idx] = idx;
 
   // prepare centers
   auto centers = vector<vec3f>(bboxes.size());
   for (auto idx = 0; idx < bboxes.size(); idx++)
     centers[idx] = center(bboxes[idx]);
 
-  // queue up first node
-  auto queue = deque<vec3i>{{0, 0, (int)primitives.size()}};
-  nodes.emplace_back();
+  // build nodes from the root
+  auto num_nodes = atomic<int>{1};
+  build_bvh_node(
+      bvh, num_nodes, bboxes, centers, 0, 0, (int)bboxes.size(), params);
 
-  // synchronization
-  atomic<int>          num_processed_prims(0);
-  std::mutex           queue_mutex;
-  vector<future<void>> futures;
-  auto                 nthreads = std::thread::hardware_concurrency();
+  // cleanup
+  nodes.resize(num_nodes);
+  nodes.shrink_to_fit();
+}
 
-  // create nodes until the queue is empty
-  for (auto thread_id = 0; thread_id < nthreads; thread_id++) {
-    futures.emplace_back(std::async(
-        std::launch::async, [&nodes, &primitives, &bboxes, &centers, &type,
-                                &num_processed_prims, &queue_mutex, &queue] {
-          while (true) {
-            // exit if needed
-            if (num_processed_prims >= primitives.size()) return;
-
-            // grab node to work on
-            auto next = zero3i;
-            {
-              std::lock_guard<std::mutex> lock{queue_mutex};
-              if (!queue.empty()) {
-                next = queue.front();
-                queue.pop_front();
-              }
-            }
+// Surface area of a bounding box.
+static float bbox_area(const bbox3f& bbox) {
+  auto size = bbox.max - bbox.min;
+  return 2 * (size.x * size.y + size.x * size.z + size.y * size.z);
+}
 
-            // wait a bit if needed
-            if (next == zero3i) {
-              std::this_thread::sleep_for(std::chrono::microseconds(10));
-              continue;
-            }
+// Collect the children of a wide node from the binary node `node_id`.
+// Starting from the children of the binary node, repeatedly replaces the
+// internal child with the largest surface area with its two children, until
+// there are N children. Returns the number of children.
+template <size_t N>
+static int collect_wide_children(
+    const vector<bvh_node>& nodes, int node_id, array<int, N>& children) {
+  auto  num_children = 0;
+  auto& node         = nodes[node_id];
+  if (node.internal) {
+    children[num_children++] = node.start + 0;
+    children[num_children++] = node.start + 1;
+  } else {
+    children[num_children++] = node_id;
+  }
+  while (num_children < N) {
+    auto largest = -1;
+    auto area    = 0.0f;
+    for (auto idx = 0; idx < num_children; idx++) {
+      auto& child = nodes[children[idx]];
+      if (!child.internal) continue;
+      if (largest < 0 || bbox_area(child.bbox) > area) {
+        largest = idx;
+        area    = bbox_area(child.bbox);
+      }
+    }
+    if (largest < 0) break;
+    auto start               = nodes[children[largest]].start;
+    children[largest]        = start + 0;
+    children[num_children++] = start + 1;
+  }
+  return num_children;
+}
 
-            // grab node
-            auto  nodeid = next.x, start = next.y, end = next.z;
-            auto& node = nodes[nodeid];
-
-            // compute bounds
-            node.bbox = invalidb3f;
-            for (auto i = start; i < end; i++)
-              node.bbox = merge(node.bbox, bboxes[primitives[i]]);
-
-            // split into two children
-            if (end - start > bvh_max_prims) {
-              // get split
-              auto [mid, axis] = split_nodes(
-                  primitives, bboxes, centers, start, end, type);
-
-              // make an internal node
-              {
-                std::lock_guard<std::mutex> lock{queue_mutex};
-                node.internal = true;
-                node.axis     = (int8_t)axis;
-                node.num      = 2;
-                node.start    = (int)nodes.size();
-                nodes.emplace_back();
-                nodes.emplace_back();
-                queue.push_back({node.start + 0, start, mid});
-                queue.push_back({node.start + 1, mid, end});
-              }
-            } else {
-              // Make a leaf node
-              node.internal = false;
-              node.num      = (int16_t)(end - start);
-              node.start    = start;
-              num_processed_prims += node.num;
-            }
-          }
-        }));
+// Collapse a binary BVH into wide nodes.
+template <int N>
+static void build_wide_nodes(
+    vector<bvh_wide_node<N>>& wide_nodes, const vector<bvh_node>& nodes) {
+  // prepare to build nodes
+  wide_nodes.clear();
+  if (nodes.empty()) return;
+  wide_nodes.reserve(nodes.size() / (N - 1) + 1);
+
+  // queue up first node, as pairs of wide node and binary node
+  auto stack = vector<pair<int, int>>{{0, 0}};
+  wide_nodes.emplace_back();
+
+  // create nodes until the stack is empty
+  while (!stack.empty()) {
+    auto [wide_id, node_id] = stack.back();
+    stack.pop_back();
+
+    // collect children
+    auto children     = array<int, N>{};
+    auto num_children = collect_wide_children(nodes, node_id, children);
+
+    // fill wide node
+    auto wide_node = bvh_wide_node<N>{};
+    for (auto idx = 0; idx < N; idx++) {
+      auto bbox = idx < num_children ? nodes[children[idx]].bbox : invalidb3f;
+      for (auto axis = 0; axis < 3; axis++) {
+        wide_node.bounds[axis + 0][idx] = bbox.min[axis];
+        wide_node.bounds[axis + 3][idx] = bbox.max[axis];
+      }
+      if (idx >= num_children) continue;
+      auto& child = nodes[children[idx]];
+      if (child.internal) {
+        wide_node.internal[idx] = true;
+        wide_node.start[idx]    = (int)wide_nodes.size();
+        stack.push_back({(int)wide_nodes.size(), children[idx]});
+        wide_nodes.emplace_back();
+      } else {
+        wide_node.internal[idx] = false;
+        wide_node.start[idx]    = child.start;
+        wide_node.num[idx]      = child.num;
+      }
+    }
+    wide_nodes[wide_id] = wide_node;
   }
-  for (auto& f : futures) f.get();
 
   // cleanup
-  nodes.shrink_to_fit();
+  wide_nodes.shrink_to_fit();
 }
 
-#endif
+// Quantize the bounds of the children of a compact node. The node bounds
+// are set to cover all children and the quantized bounds are rounded
+// outwards, checking them with the same arithmetic used for traversal.
+// Nodes without children get a zero box and empty child bounds.
+static void quantize_bounds(
+    bvh_qnode& qnode, const array<bbox3f, 4>& bboxes, int num_bboxes) {
+  // empty nodes
+  if (num_bboxes == 0) {
+    qnode.min   = zero3f;
+    qnode.scale = zero3f;
+    for (auto axis = 0; axis < 3; axis++) {
+      for (auto idx = 0; idx < 4; idx++) {
+        qnode.bounds[axis + 0][idx] = 255;
+        qnode.bounds[axis + 3][idx] = 0;
+      }
+    }
+    return;
+  }
+
+  // node bounds
+  auto bbox = invalidb3f;
+  for (auto idx = 0; idx < num_bboxes; idx++) bbox = merge(bbox, bboxes[idx]);
+
+  // quantization steps
+  qnode.min   = bbox.min;
+  qnode.scale = (bbox.max - bbox.min) / 255;
+  for (auto axis = 0; axis < 3; axis++) {
+    while (qnode.min[axis] + 255 * qnode.scale[axis] < bbox.max[axis])
+      qnode.scale[axis] = std::nextafter(qnode.scale[axis], flt_max);
+  }
+
+  // child bounds
+  for (auto idx = 0; idx < 4; idx++) {
+    for (auto axis = 0; axis < 3; axis++) {
+      // unused children get empty bounds
+      if (idx >= num_bboxes) {
+        qnode.bounds[axis + 0][idx] = 255;
+        qnode.bounds[axis + 3][idx] = 0;
+        continue;
+      }
+      auto min = qnode.min[axis], scale = qnode.scale[axis];
+      auto qmin = 0, qmax = 0;
+      if (scale > 0) {
+        qmin = clamp(
+            (int)std::floor((bboxes[idx].min[axis] - min) / scale), 0, 255);
+        qmax = clamp(
+            (int)std::ceil((bboxes[idx].max[axis] - min) / scale), 0, 255);
+        while (qmin > 0 && min + qmin * scale > bboxes[idx].min[axis]) qmin--;
+        while (qmax < 255 && min + qmax * scale < bboxes[idx].max[axis])
+          qmax++;
+      }
+      qnode.bounds[axis + 0][idx] = (uint8_t)qmin;
+      qnode.bounds[axis + 3][idx] = (uint8_t)qmax;
+    }
+  }
+}
+
+// Largest number of primitives of a compact bvh, since leaves store their
+// start in 28 bits.
+const size_t bvh_compact_max_prims = (size_t)1 << 28;
+
+// Encode a leaf child of a compact node.
+static int32_t encode_leaf(int start, int num) {
+  return ~(int32_t)((uint32_t)start << 3 | (uint32_t)num);
+}
+
+// Collapse a binary BVH into compact nodes. Children with empty bounds, like
+// instances of empty shapes, are dropped since no ray can hit them.
+static void build_compact_nodes(
+    vector<bvh_qnode>& qnodes, const vector<bvh_node>& nodes) {
+  // prepare to build nodes
+  qnodes.clear();
+  if (nodes.empty()) return;
+  qnodes.reserve(nodes.size() / 3 + 1);
+
+  // queue up first node, as pairs of compact node and binary node
+  auto stack = vector<pair<int, int>>{{0, 0}};
+  qnodes.emplace_back();
+
+  // create nodes until the stack is empty
+  while (!stack.empty()) {
+    auto [qnode_id, node_id] = stack.back();
+    stack.pop_back();
+
+    // collect children
+    auto children     = array<int, 4>{};
+    auto num_children = collect_wide_children(nodes, node_id, children);
+
+    // drop empty children
+    auto bboxes     = array<bbox3f, 4>{};
+    auto num_bboxes = 0;
+    for (auto idx = 0; idx < num_children; idx++) {
+      auto& bbox = nodes[children[idx]].bbox;
+      if (bbox.min.x > bbox.max.x) continue;
+      children[num_bboxes] = children[idx];
+      bboxes[num_bboxes++] = bbox;
+    }
+
+    // fill compact node
+    auto qnode = bvh_qnode{};
+    quantize_bounds(qnode, bboxes, num_bboxes);
+    for (auto idx = 0; idx < 4; idx++) {
+      if (idx >= num_bboxes) {
+        qnode.children[idx] = encode_leaf(0, 0);
+        continue;
+      }
+      auto& child = nodes[children[idx]];
+      if (child.internal) {
+        qnode.children[idx] = (int)qnodes.size();
+        stack.push_back({(int)qnodes.size(), children[idx]});
+        qnodes.emplace_back();
+      } else {
+        qnode.children[idx] = encode_leaf(child.start, child.num);
+      }
+    }
+    qnodes[qnode_id] = qnode;
+  }
+
+  // cleanup
+  qnodes.shrink_to_fit();
+}
+
+// Build the wide or compact nodes requested by the build type. Compact
+// nodes replace the binary ones.
+static void build_wide_nodes(bvh_tree& bvh, bvh_build_type type) {
+  bvh.nodes4.clear();
+  bvh.nodes8.clear();
+  bvh.qnodes.clear();
+  if (type == bvh_build_type::wide4) build_wide_nodes(bvh.nodes4, bvh.nodes);
+  if (type == bvh_build_type::wide8) build_wide_nodes(bvh.nodes8, bvh.nodes);
+  if (type == bvh_build_type::compact) {
+    if (bvh.primitives.size() > bvh_compact_max_prims)
+      throw std::runtime_error("too many primitives for a compact bvh");
+    build_compact_nodes(bvh.qnodes, bvh.nodes);
+    bvh.nodes = {};
+  }
+}
+
+// Bounds of a bvh. The bounds of compact bvhs are slightly enlarged by
+// quantization.
+static bbox3f bvh_bounds(const bvh_tree& bvh) {
+  if (!bvh.nodes.empty()) return bvh.nodes[0].bbox;
+  if (!bvh.qnodes.empty()) {
+    auto& qnode = bvh.qnodes[0];
+    return {qnode.min, qnode.min + 255 * qnode.scale};
+  }
+  return invalidb3f;
+}
+
+// Check if a bvh is empty
+static bool bvh_empty(const bvh_tree& bvh) {
+  return bvh.nodes.empty() && bvh.qnodes.empty();
+}
+
+// Reorder elements owned by a shape
+template <typename T>
+static void reorder_elements(
+    bvh_span<T>& elements, vector<T>& data, const vector<int>& order) {
+  if (elements.empty()) return;
+  auto reordered = vector<T>(order.size());
+  for (auto idx = 0; idx < order.size(); idx++)
+    reordered[idx] = elements[order[idx]];
+  data     = std::move(reordered);
+  elements = bvh_span<T>{data};
+}
 
 // Update bvh
 static void update_bvh(bvh_tree& bvh, const vector<bbox3f>& bboxes) {
@@ -695,6 +1034,10 @@ static void update_bvh(bvh_tree& bvh, const vector<bbox3f>& bboxes) {
       }
     }
   }
+
+  // update wide nodes
+  if (!bvh.nodes4.empty()) build_wide_nodes(bvh.nodes4, bvh.nodes);
+  if (!bvh.nodes8.empty()) build_wide_nodes(bvh.nodes8, bvh.nodes);
 }
 
 static void build_bvh(bvh_shape* shape, const bvh_params& params) {
@@ -706,6 +1049,9 @@ static void build_bvh(bvh_shape* shape, const bvh_params& params) {
   }
 #endif
 
+  // original ids of elements already in leaf order
+  auto element_ids = shape->leaf_order ? shape->bvh.primitives : vector<int>{};
+
   // build primitives
   auto bboxes = vector<bbox3f>{};
   if (!shape->points.empty()) {
@@ -738,7 +1084,29 @@ static void build_bvh(bvh_shape* shape, const bvh_params& params) {
   }
 
   // build nodes
-  build_bvh_serial(shape->bvh, bboxes, params);
+  if (params.noparallel) {
+    build_bvh_serial(shape->bvh, bboxes, params);
+  } else {
+    build_bvh_parallel(shape->bvh, bboxes, params);
+  }
+  build_wide_nodes(shape->bvh, params.bvh);
+
+  // store owned elements in leaf order for compact bvhs, so that leaves
+  // access them without going through primitives; once reordered, elements
+  // stay in leaf order also for later builds
+  auto owned = shape->positions.data() == shape->positions_data.data();
+  if (shape->leaf_order ||
+      (params.bvh == bvh_build_type::compact && owned)) {
+    auto& order = shape->bvh.primitives;
+    reorder_elements(shape->points, shape->points_data, order);
+    reorder_elements(shape->lines, shape->lines_data, order);
+    reorder_elements(shape->triangles, shape->triangles_data, order);
+    reorder_elements(shape->quads, shape->quads_data, order);
+    if (shape->leaf_order) {
+      for (auto& primitive : order) primitive = element_ids[primitive];
+    }
+    shape->leaf_order = true;
+  }
 }
 
 void build_bvh(bvh_scene* scene, const bvh_params& params) {
@@ -756,13 +1124,18 @@ void build_bvh(bvh_scene* scene, const bvh_params& params) {
   for (auto idx = 0; idx < bboxes.size(); idx++) {
     auto  instance = scene->instance_cb(idx);
     auto& shape    = scene->shapes[instance.shape];
-    bboxes[idx]    = shape->bvh.nodes.empty() ? invalidb3f
-                                           : transform_bbox(instance.frame,
-                                                 shape->bvh.nodes[0].bbox);
+    bboxes[idx]    = bvh_empty(shape->bvh)
+                      ? invalidb3f
+                      : transform_bbox(instance.frame, bvh_bounds(shape->bvh));
   }
 
   // build nodes
-  build_bvh_serial(scene->bvh, bboxes, params);
+  if (params.noparallel) {
+    build_bvh_serial(scene->bvh, bboxes, params);
+  } else {
+    build_bvh_parallel(scene->bvh, bboxes, params);
+  }
+  build_wide_nodes(scene->bvh, params.bvh);
 }
 
 void init_bvh(bvh_scene* scene, const bvh_params& params,
@@ -791,6 +1164,11 @@ static void update_bvh(bvh_shape* shape) {
   }
 #endif
 
+  // compact bvhs do not keep the binary nodes to refit, so they are rebuilt
+  if (!shape->bvh.qnodes.empty()) {
+    return build_bvh(shape, bvh_params{bvh_build_type::compact});
+  }
+
   // build primitives
   auto bboxes = vector<bbox3f>{};
   if (!shape->points.empty()) {
@@ -822,6 +1200,14 @@ static void update_bvh(bvh_shape* shape) {
     }
   }
 
+  // elements in leaf order are refit by their original ids
+  if (shape->leaf_order) {
+    auto element_bboxes = vector<bbox3f>(bboxes.size());
+    for (auto idx = 0; idx < bboxes.size(); idx++)
+      element_bboxes[shape->bvh.primitives[idx]] = bboxes[idx];
+    bboxes = std::move(element_bboxes);
+  }
+
   // update nodes
   update_bvh(shape->bvh, bboxes);
 }
@@ -833,12 +1219,17 @@ void update_bvh(bvh_scene* scene, const vector<int>& updated_instances) {
   }
 #endif
 
+  // compact bvhs do not keep the binary nodes to refit, so they are rebuilt
+  if (!scene->bvh.qnodes.empty()) {
+    return build_bvh(scene, bvh_params{bvh_build_type::compact});
+  }
+
   // build primitives
   auto bboxes = vector<bbox3f>(scene->num_instances);
   for (auto idx = 0; idx < bboxes.size(); idx++) {
     auto  instance = scene->instance_cb(idx);
     auto& sbvh     = scene->shapes[instance.shape]->bvh;
-    bboxes[idx]    = transform_bbox(instance.frame, sbvh.nodes[0].bbox);
+    bboxes[idx]    = transform_bbox(instance.frame, bvh_bounds(sbvh));
   }
 
   // update nodes
@@ -866,11 +1257,426 @@ void update_bvh(bvh_scene* scene, const vector<int>& updated_instances,
 
 }  // namespace yocto
 
+// -----------------------------------------------------------------------------
+// IMPLEMENTATION FOR BVH SAVING AND LOADING
+// -----------------------------------------------------------------------------
+namespace yocto {
+
+// Hash of the geometry of a shape. Elements in leaf order are hashed in
+// their original order, so that hashes match before and after the build.
+static uint64_t hash_geometry(const bvh_shape* shape) {
+  auto hash          = fnv_hash{};
+  auto hash_elements = [shape, &hash](const auto& elements) {
+    hash_value(hash, (uint64_t)elements.size());
+    if (!shape->leaf_order) {
+      return hash_data(
+          hash, elements.data(), elements.size() * sizeof(elements[0]));
+    }
+    auto order = vector<int>(elements.size());
+    for (auto idx = 0; idx < (int)order.size(); idx++)
+      order[shape->bvh.primitives[idx]] = idx;
+    for (auto idx : order) hash_value(hash, elements[idx]);
+  };
+  auto hash_vertices = [&hash](const auto& vertices) {
+    hash_value(hash, (uint64_t)vertices.size());
+    hash_data(hash, vertices.data(), vertices.size() * sizeof(vertices[0]));
+  };
+  hash_elements(shape->points);
+  hash_elements(shape->lines);
+  hash_elements(shape->triangles);
+  hash_elements(shape->quads);
+  hash_vertices(shape->positions);
+  hash_vertices(shape->radius);
+  return hash.value;
+}
+
+// Hash of the instances of a scene
+static uint64_t hash_geometry(const bvh_scene* scene) {
+  auto hash = fnv_hash{};
+  hash_value(hash, scene->num_instances);
+  for (auto idx = 0; idx < scene->num_instances; idx++) {
+    auto instance = scene->instance_cb(idx);
+    hash_value(hash, instance.frame);
+    hash_value(hash, instance.shape);
+  }
+  return hash.value;
+}
+
+// Write and read a buffer as its size followed by its values. Sizes read
+// are checked against the bytes left in the file before allocating.
+template <typename T>
+static bool write_buffer(file_stream& fs, const vector<T>& values) {
+  if (!write_value(fs, (uint64_t)values.size())) return false;
+  return write_values(fs, values.data(), values.size());
+}
+template <typename T>
+static bool read_buffer(
+    file_stream& fs, vector<T>& values, uint64_t& remaining) {
+  auto size = (uint64_t)0;
+  if (!read_value(fs, size)) return false;
+  remaining -= sizeof(size);
+  if (size > remaining / sizeof(T)) return false;
+  remaining -= size * sizeof(T);
+  values.resize(size);
+  return read_values(fs, values.data(), values.size());
+}
+
+// Checksum of the arrays of a tree, so that corrupt trees are not used
+static uint64_t hash_tree(const bvh_tree& bvh) {
+  auto hash = fnv_hash{};
+  hash_values(hash, bvh.nodes);
+  hash_values(hash, bvh.primitives);
+  hash_values(hash, bvh.nodes4);
+  hash_values(hash, bvh.nodes8);
+  hash_values(hash, bvh.qnodes);
+  return hash.value;
+}
+
+// Write and read the arrays of a tree, followed by their checksum
+static bool write_tree(file_stream& fs, const bvh_tree& bvh) {
+  if (!write_buffer(fs, bvh.nodes)) return false;
+  if (!write_buffer(fs, bvh.primitives)) return false;
+  if (!write_buffer(fs, bvh.nodes4)) return false;
+  if (!write_buffer(fs, bvh.nodes8)) return false;
+  if (!write_buffer(fs, bvh.qnodes)) return false;
+  if (!write_value(fs, hash_tree(bvh))) return false;
+  return true;
+}
+static bool read_tree(file_stream& fs, bvh_tree& bvh, uint64_t& remaining) {
+  if (!read_buffer(fs, bvh.nodes, remaining)) return false;
+  if (!read_buffer(fs, bvh.primitives, remaining)) return false;
+  if (!read_buffer(fs, bvh.nodes4, remaining)) return false;
+  if (!read_buffer(fs, bvh.nodes8, remaining)) return false;
+  if (!read_buffer(fs, bvh.qnodes, remaining)) return false;
+  auto checksum = (uint64_t)0;
+  if (!read_value(fs, checksum)) return false;
+  remaining -= sizeof(checksum);
+  return checksum == hash_tree(bvh);
+}
+
+// Bvh file header
+static const auto bvh_file_magic   = (uint64_t)0x4856424f54434f59ull;
+static const auto bvh_file_version = 2;
+
+bool save_bvh(const string& filename, const bvh_scene* bvh,
+    const bvh_params& params, string& error) {
+#ifdef YOCTO_EMBREE
+  if (bvh->embree_bvh) {
+    error = filename + ": cannot save embree bvh";
+    return false;
+  }
+#endif
+
+  return save_atomic(
+      filename,
+      [bvh, &params](file_stream& fs) {
+        // header
+        if (!write_value(fs, bvh_file_magic)) return false;
+        if (!write_value(fs, bvh_file_version)) return false;
+        if (!write_value(fs, params.bvh)) return false;
+        if (!write_value(fs, (uint64_t)bvh->shapes.size())) return false;
+
+        // shape trees
+        for (auto shape : bvh->shapes) {
+          if (!write_value(fs, hash_geometry(shape))) return false;
+          if (!write_value(fs, shape->leaf_order)) return false;
+          if (!write_tree(fs, shape->bvh)) return false;
+        }
+
+        // instance tree
+        if (!write_value(fs, hash_geometry(bvh))) return false;
+        if (!write_tree(fs, bvh->bvh)) return false;
+        return true;
+      },
+      error);
+}
+
+bool load_bvh(const string& filename, bvh_scene* bvh,
+    const bvh_params& params, string& error) {
+  auto read_error = [filename, &error]() {
+    error = filename + ": read error";
+    return false;
+  };
+  auto match_error = [filename, &error]() {
+    error = filename + ": out of date";
+    return false;
+  };
+
+  // open file
+  auto fs = open_file(filename, "rb");
+  if (!fs) {
+    error = filename + ": file not found";
+    return false;
+  }
+
+  // header
+  auto magic   = (uint64_t)0;
+  auto version = 0;
+  auto type    = bvh_build_type::default_;
+  auto nshapes = (uint64_t)0;
+  if (!read_value(fs, magic)) return read_error();
+  if (!read_value(fs, version)) return read_error();
+  if (!read_value(fs, type)) return read_error();
+  if (!read_value(fs, nshapes)) return read_error();
+  if (magic != bvh_file_magic) return read_error();
+  if (version != bvh_file_version || type != params.bvh) return match_error();
+  if (nshapes != bvh->shapes.size()) return match_error();
+
+  // bytes left in the file, used to check the sizes of buffers
+  auto offset = (uint64_t)ftell(fs.fs);
+  fseek(fs.fs, 0, SEEK_END);
+  auto remaining = (uint64_t)ftell(fs.fs) - offset;
+  fseek(fs.fs, (long)offset, SEEK_SET);
+
+  // shape trees, checked before any is used
+  auto trees      = vector<bvh_tree>(bvh->shapes.size());
+  auto leaf_order = vector<bool>(bvh->shapes.size());
+  for (auto idx = 0; idx < (int)bvh->shapes.size(); idx++) {
+    auto shape  = bvh->shapes[idx];
+    auto hash   = (uint64_t)0;
+    auto leaves = false;
+    if (!read_value(fs, hash)) return read_error();
+    if (!read_value(fs, leaves)) return read_error();
+    remaining -= sizeof(hash) + sizeof(leaves);
+    if (!read_tree(fs, trees[idx], remaining)) return read_error();
+    if (hash != hash_geometry(shape)) return match_error();
+    // elements can be stored in leaf order only if owned
+    auto owned = shape->positions.data() == shape->positions_data.data();
+    if (leaves && !shape->leaf_order && !owned) return match_error();
+    leaf_order[idx] = leaves;
+  }
+
+  // instance tree
+  auto tree = bvh_tree{};
+  auto hash = (uint64_t)0;
+  if (!read_value(fs, hash)) return read_error();
+  remaining -= sizeof(hash);
+  if (!read_tree(fs, tree, remaining)) return read_error();
+  if (hash != hash_geometry(bvh)) return match_error();
+
+  // set trees, moving owned elements in leaf order as the build does
+  for (auto idx = 0; idx < (int)bvh->shapes.size(); idx++) {
+    auto shape = bvh->shapes[idx];
+    if (leaf_order[idx] && !shape->leaf_order) {
+      auto& order = trees[idx].primitives;
+      reorder_elements(shape->points, shape->points_data, order);
+      reorder_elements(shape->lines, shape->lines_data, order);
+      reorder_elements(shape->triangles, shape->triangles_data, order);
+      reorder_elements(shape->quads, shape->quads_data, order);
+    }
+    shape->bvh        = std::move(trees[idx]);
+    shape->leaf_order = leaf_order[idx];
+  }
+  bvh->bvh = std::move(tree);
+
+  // done
+  return true;
+}
+
+}  // namespace yocto
+
 // -----------------------------------------------------------------------------
 // IMPLEMENTATION FOR BVH INTERSECTION
 // -----------------------------------------------------------------------------
 namespace yocto {
 
+// Lanes used to test N children or rays at once. With SSE2, 8-wide nodes and
+// packets are tested as two groups of 4 lanes; a single 8-lane test is used
+// only when the library is compiled for AVX2, e.g. with -mavx2.
+#if defined(YOCTO_AVX2)
+template <int N>
+using bvh_vfloat = std::conditional_t<N % 8 == 0, vfloat8, vfloat4>;
+#elif defined(YOCTO_SSE2)
+template <int N>
+using bvh_vfloat = vfloat4;
+#else
+template <int N>
+using bvh_vfloat = vfloat1;
+#endif
+
+// Intersect a ray with all children of a wide node with a slab test. Bounds
+// are loaded with `load(row, idx)`, that returns the lanes of a bounds row
+// starting from child idx. Returns the mask of the children hit and writes
+// their entry distances.
+template <int N, typename Load>
+static int intersect_slabs(const ray3f& ray, const vec3f& ray_dinv,
+    const vec3i& ray_dsign, float* distances, Load&& load) {
+  using F   = bvh_vfloat<N>;
+  auto mask = 0;
+  for (auto idx = 0; idx < N; idx += F::width) {
+    auto tmin = F{ray.tmin}, tmax = F{ray.tmax};
+    for (auto axis = 0; axis < 3; axis++) {
+      auto near = load(axis + 3 * ray_dsign[axis], idx);
+      auto far  = load(axis + 3 - 3 * ray_dsign[axis], idx);
+      // nans from 0 * inf are discarded, since max and min return the
+      // second argument if either is a nan
+      tmin = max((near - F{ray.o[axis]}) * F{ray_dinv[axis]}, tmin);
+      tmax = min((far - F{ray.o[axis]}) * F{ray_dinv[axis]}, tmax);
+    }
+    tmax = tmax * F{1.00000024f};  // for double: 1.0000000000000004
+    mask |= movemask(tmin <= tmax) << idx;
+    store(distances + idx, tmin);
+  }
+  return mask;
+}
+
+// Intersect a ray with all children of a wide node.
+template <int N>
+static int intersect_children(const bvh_wide_node<N>& node, const ray3f& ray,
+    const vec3f& ray_dinv, const vec3i& ray_dsign, float* distances) {
+  return intersect_slabs<N>(
+      ray, ray_dinv, ray_dsign, distances, [&node](int row, int idx) {
+        return bvh_vfloat<N>::load(&node.bounds[row][idx]);
+      });
+}
+
+// Intersect a ray with all children of a compact node, dequantizing bounds
+// as in quantize_bounds().
+static int intersect_children(const bvh_qnode& node, const ray3f& ray,
+    const vec3f& ray_dinv, const vec3i& ray_dsign, float* distances) {
+  return intersect_slabs<4>(
+      ray, ray_dinv, ray_dsign, distances, [&node](int row, int idx) {
+        auto axis = row % 3;
+        return bvh_vfloat<4>{node.min[axis]} +
+               bvh_vfloat<4>::load(&node.bounds[row][idx]) *
+                   bvh_vfloat<4>{node.scale[axis]};
+      });
+}
+
+// Child of a wide or compact node, as stored on the traversal stack.
+struct bvh_child {
+  int32_t start;
+  int16_t num;
+  bool    internal;
+  float   distance;
+};
+
+// Get a child of a wide node.
+template <int N>
+static bvh_child get_child(
+    const bvh_wide_node<N>& node, int idx, float distance) {
+  return {node.start[idx], node.num[idx], node.internal[idx], distance};
+}
+
+// Get a child of a compact node, decoding leaves.
+static bvh_child get_child(const bvh_qnode& node, int idx, float distance) {
+  auto child = node.children[idx];
+  if (child >= 0) return {child, 0, true, distance};
+  return {~child >> 3, (int16_t)(~child & 7), false, distance};
+}
+
+// Intersect ray with a wide or compact bvh. Children hit are pushed on the
+// stack sorted by distance, so that the closest is visited first, and are
+// skipped if the ray has been shortened past them. Leaves are intersected by
+// `intersect_leaf(ray, start, num)`, that returns whether any primitive was
+// hit and shortens the ray to the closest hit.
+template <typename Node, typename Func>
+static bool intersect_wide_bvh(const vector<Node>& nodes, ray3f& ray,
+    bool find_any, Func&& intersect_leaf) {
+  // node stack, left uninitialized since it is large
+  const auto                        N = Node::width;
+  array<bvh_child, 64 * Node::width> node_stack;
+  auto                               node_cur = 0;
+  node_stack[node_cur++]                      = {0, 0, true, ray.tmin};
+
+  // shared variables
+  auto hit = false;
+
+  // prepare ray for fast queries
+  auto ray_dinv  = vec3f{1 / ray.d.x, 1 / ray.d.y, 1 / ray.d.z};
+  auto ray_dsign = vec3i{(ray_dinv.x < 0) ? 1 : 0, (ray_dinv.y < 0) ? 1 : 0,
+      (ray_dinv.z < 0) ? 1 : 0};
+
+  // children distances
+  alignas(32) float distances[N];
+
+  // walking stack
+  while (node_cur != 0) {
+    // grab node
+    auto next = node_stack[--node_cur];
+    if (next.distance > ray.tmax * 1.00000024f) continue;
+
+    // intersect leaf
+    if (!next.internal) {
+      if (intersect_leaf(ray, next.start, next.num)) hit = true;
+      if (find_any && hit) return hit;
+      continue;
+    }
+
+    // intersect children, inserting them from the farthest to the closest
+    auto& node  = nodes[next.start];
+    auto  mask  = intersect_children(node, ray, ray_dinv, ray_dsign, distances);
+    auto  first = node_cur;
+    for (auto idx = 0; idx < N; idx++) {
+      if ((mask & (1 << idx)) == 0) continue;
+      auto child = get_child(node, idx, distances[idx]);
+      if (!child.internal && child.num == 0) continue;
+      auto pos = node_cur++;
+      while (pos > first && node_stack[pos - 1].distance < child.distance) {
+        node_stack[pos] = node_stack[pos - 1];
+        pos--;
+      }
+      node_stack[pos] = child;
+    }
+  }
+
+  return hit;
+}
+
+// Index of the element at a leaf position, that skips primitives for
+// elements stored in leaf order.
+static int get_element(const bvh_shape* shape, int idx) {
+  return shape->leaf_order ? idx : shape->bvh.primitives[idx];
+}
+
+// Intersect ray with the elements of a shape in a bvh leaf.
+static bool intersect_elements(const bvh_shape* shape, ray3f& ray, int start,
+    int num, int& element, vec2f& uv, float& distance) {
+  auto hit = false;
+  if (!shape->points.empty()) {
+    for (auto idx = start; idx < start + num; idx++) {
+      auto& p = shape->points[get_element(shape, idx)];
+      if (intersect_point(
+              ray, shape->positions[p], shape->radius[p], uv, distance)) {
+        hit      = true;
+        element  = shape->bvh.primitives[idx];
+        ray.tmax = distance;
+      }
+    }
+  } else if (!shape->lines.empty()) {
+    for (auto idx = start; idx < start + num; idx++) {
+      auto& l = shape->lines[get_element(shape, idx)];
+      if (intersect_line(ray, shape->positions[l.x], shape->positions[l.y],
+              shape->radius[l.x], shape->radius[l.y], uv, distance)) {
+        hit      = true;
+        element  = shape->bvh.primitives[idx];
+        ray.tmax = distance;
+      }
+    }
+  } else if (!shape->triangles.empty()) {
+    for (auto idx = start; idx < start + num; idx++) {
+      auto& t = shape->triangles[get_element(shape, idx)];
+      if (intersect_triangle(ray, shape->positions[t.x], shape->positions[t.y],
+              shape->positions[t.z], uv, distance)) {
+        hit      = true;
+        element  = shape->bvh.primitives[idx];
+        ray.tmax = distance;
+      }
+    }
+  } else if (!shape->quads.empty()) {
+    for (auto idx = start; idx < start + num; idx++) {
+      auto& q = shape->quads[get_element(shape, idx)];
+      if (intersect_quad(ray, shape->positions[q.x], shape->positions[q.y],
+              shape->positions[q.z], shape->positions[q.w], uv, distance)) {
+        hit      = true;
+        element  = shape->bvh.primitives[idx];
+        ray.tmax = distance;
+      }
+    }
+  }
+  return hit;
+}
+
 // Intersect ray with a bvh.
 static bool intersect_bvh(const bvh_shape* shape, const ray3f& ray_,
     int& element, vec2f& uv, float& distance, bool find_any) {
@@ -882,7 +1688,21 @@ static bool intersect_bvh(const bvh_shape* shape, const ray3f& ray_,
 #endif
 
   // check empty
-  if (shape->bvh.nodes.empty()) return false;
+  if (bvh_empty(shape->bvh)) return false;
+
+  // copy ray to modify it
+  auto ray = ray_;
+
+  // intersect wide bvh
+  auto intersect_leaf = [&](ray3f& ray, int start, int num) {
+    return intersect_elements(shape, ray, start, num, element, uv, distance);
+  };
+  if (!shape->bvh.nodes8.empty())
+    return intersect_wide_bvh(shape->bvh.nodes8, ray, find_any, intersect_leaf);
+  if (!shape->bvh.nodes4.empty())
+    return intersect_wide_bvh(shape->bvh.nodes4, ray, find_any, intersect_leaf);
+  if (!shape->bvh.qnodes.empty())
+    return intersect_wide_bvh(shape->bvh.qnodes, ray, find_any, intersect_leaf);
 
   // node stack
   auto node_stack        = array<int, 128>{};
@@ -892,9 +1712,6 @@ static bool intersect_bvh(const bvh_shape* shape, const ray3f& ray_,
   // shared variables
   auto hit = false;
 
-  // copy ray to modify it
-  auto ray = ray_;
-
   // prepare ray for fast queries
   auto ray_dinv  = vec3f{1 / ray.d.x, 1 / ray.d.y, 1 / ray.d.z};
   auto ray_dsign = vec3i{(ray_dinv.x < 0) ? 1 : 0, (ray_dinv.y < 0) ? 1 : 0,
@@ -921,46 +1738,10 @@ static bool intersect_bvh(const bvh_shape* shape, const ray3f& ray_,
         node_stack[node_cur++] = node.start + 1;
         node_stack[node_cur++] = node.start + 0;
       }
-    } else if (!shape->points.empty()) {
-      for (auto idx = node.start; idx < node.start + node.num; idx++) {
-        auto& p = shape->points[shape->bvh.primitives[idx]];
-        if (intersect_point(
-                ray, shape->positions[p], shape->radius[p], uv, distance)) {
-          hit      = true;
-          element  = shape->bvh.primitives[idx];
-          ray.tmax = distance;
-        }
-      }
-    } else if (!shape->lines.empty()) {
-      for (auto idx = node.start; idx < node.start + node.num; idx++) {
-        auto& l = shape->lines[shape->bvh.primitives[idx]];
-        if (intersect_line(ray, shape->positions[l.x], shape->positions[l.y],
-                shape->radius[l.x], shape->radius[l.y], uv, distance)) {
-          hit      = true;
-          element  = shape->bvh.primitives[idx];
-          ray.tmax = distance;
-        }
-      }
-    } else if (!shape->triangles.empty()) {
-      for (auto idx = node.start; idx < node.start + node.num; idx++) {
-        auto& t = shape->triangles[shape->bvh.primitives[idx]];
-        if (intersect_triangle(ray, shape->positions[t.x],
-                shape->positions[t.y], shape->positions[t.z], uv, distance)) {
-          hit      = true;
-          element  = shape->bvh.primitives[idx];
-          ray.tmax = distance;
-        }
-      }
-    } else if (!shape->quads.empty()) {
-      for (auto idx = node.start; idx < node.start + node.num; idx++) {
-        auto& q = shape->quads[shape->bvh.primitives[idx]];
-        if (intersect_quad(ray, shape->positions[q.x], shape->positions[q.y],
-                shape->positions[q.z], shape->positions[q.w], uv, distance)) {
-          hit      = true;
-          element  = shape->bvh.primitives[idx];
-          ray.tmax = distance;
-        }
-      }
+    } else {
+      if (intersect_elements(
+              shape, ray, node.start, node.num, element, uv, distance))
+        hit = true;
     }
 
     // check for early exit
@@ -970,6 +1751,24 @@ static bool intersect_bvh(const bvh_shape* shape, const ray3f& ray_,
   return hit;
 }
 
+// Intersect ray with the instances of a scene in a bvh leaf.
+static bool intersect_instances(const bvh_scene* scene, ray3f& ray, int start,
+    int num, int& instance, int& element, vec2f& uv, float& distance,
+    bool find_any, bool non_rigid_frames) {
+  auto hit = false;
+  for (auto idx = start; idx < start + num; idx++) {
+    auto [frame, shape_id] = scene->instance_cb(scene->bvh.primitives[idx]);
+    auto& shape            = scene->shapes[shape_id];
+    auto  inv_ray = transform_ray(inverse(frame, non_rigid_frames), ray);
+    if (intersect_bvh(shape, inv_ray, element, uv, distance, find_any)) {
+      hit      = true;
+      instance = scene->bvh.primitives[idx];
+      ray.tmax = distance;
+    }
+  }
+  return hit;
+}
+
 // Intersect ray with a bvh.
 static bool intersect_bvh(const bvh_scene* scene, const ray3f& ray_,
     int& instance, int& element, vec2f& uv, float& distance, bool find_any,
@@ -983,7 +1782,22 @@ static bool intersect_bvh(const bvh_scene* scene, const ray3f& ray_,
 #endif
 
   // check empty
-  if (scene->bvh.nodes.empty()) return false;
+  if (bvh_empty(scene->bvh)) return false;
+
+  // copy ray to modify it
+  auto ray = ray_;
+
+  // intersect wide bvh
+  auto intersect_leaf = [&](ray3f& ray, int start, int num) {
+    return intersect_instances(scene, ray, start, num, instance, element, uv,
+        distance, find_any, non_rigid_frames);
+  };
+  if (!scene->bvh.nodes8.empty())
+    return intersect_wide_bvh(scene->bvh.nodes8, ray, find_any, intersect_leaf);
+  if (!scene->bvh.nodes4.empty())
+    return intersect_wide_bvh(scene->bvh.nodes4, ray, find_any, intersect_leaf);
+  if (!scene->bvh.qnodes.empty())
+    return intersect_wide_bvh(scene->bvh.qnodes, ray, find_any, intersect_leaf);
 
   // node stack
   auto node_stack        = array<int, 128>{};
@@ -993,9 +1807,6 @@ static bool intersect_bvh(const bvh_scene* scene, const ray3f& ray_,
   // shared variables
   auto hit = false;
 
-  // copy ray to modify it
-  auto ray = ray_;
-
   // prepare ray for fast queries
   auto ray_dinv  = vec3f{1 / ray.d.x, 1 / ray.d.y, 1 / ray.d.z};
   auto ray_dsign = vec3i{(ray_dinv.x < 0) ? 1 : 0, (ray_dinv.y < 0) ? 1 : 0,
@@ -1023,16 +1834,9 @@ static bool intersect_bvh(const bvh_scene* scene, const ray3f& ray_,
         node_stack[node_cur++] = node.start + 0;
       }
     } else {
-      for (auto idx = node.start; idx < node.start + node.num; idx++) {
-        auto [frame, shape_id] = scene->instance_cb(scene->bvh.primitives[idx]);
-        auto& shape            = scene->shapes[shape_id];
-        auto  inv_ray = transform_ray(inverse(frame, non_rigid_frames), ray);
-        if (intersect_bvh(shape, inv_ray, element, uv, distance, find_any)) {
-          hit      = true;
-          instance = scene->bvh.primitives[idx];
-          ray.tmax = distance;
-        }
-      }
+      if (intersect_instances(scene, ray, node.start, node.num, instance,
+              element, uv, distance, find_any, non_rigid_frames))
+        hit = true;
     }
 
     // check for early exit
@@ -1054,17 +1858,435 @@ static bool intersect_bvh(const bvh_scene* scene, int instance,
 
 }  // namespace yocto
 
+// -----------------------------------------------------------------------------
+// IMPLEMENTATION FOR BVH RAY PACKETS AND STREAMS
+// -----------------------------------------------------------------------------
+namespace yocto {
+
+// Packet of up to N rays. Rays are stored both whole, for primitive tests,
+// and by coordinate, to test node bounds for all rays at once. Rays are
+// tracked with bit masks, with bit i set for the i-th ray.
+template <int N>
+struct bvh_packet {
+  alignas(32) float o[3][N];
+  alignas(32) float dinv[3][N];
+  alignas(32) float tmin[N];
+  alignas(32) float tmax[N];
+  ray3f rays[N];
+};
+
+// Set a ray of a packet.
+template <int N>
+static void set_packet_ray(bvh_packet<N>& packet, int idx, const ray3f& ray) {
+  for (auto axis = 0; axis < 3; axis++) {
+    packet.o[axis][idx]    = ray.o[axis];
+    packet.dinv[axis][idx] = 1 / ray.d[axis];
+  }
+  packet.tmin[idx] = ray.tmin;
+  packet.tmax[idx] = ray.tmax;
+  packet.rays[idx] = ray;
+}
+
+// Shorten a ray of a packet after a hit.
+template <int N>
+static void set_packet_tmax(bvh_packet<N>& packet, int idx, float tmax) {
+  packet.tmax[idx]      = tmax;
+  packet.rays[idx].tmax = tmax;
+}
+
+// Intersect all rays of a packet with a bounding box, with the same
+// arithmetic of intersect_bbox(). Returns the mask of the rays that hit.
+template <int N>
+static int intersect_packet_bbox(
+    const bvh_packet<N>& packet, const bbox3f& bbox) {
+  using F   = bvh_vfloat<N>;
+  auto mask = 0;
+  for (auto idx = 0; idx < N; idx += F::width) {
+    F tmin[3], tmax[3];
+    for (auto axis = 0; axis < 3; axis++) {
+      auto o      = F::load(&packet.o[axis][idx]);
+      auto dinv   = F::load(&packet.dinv[axis][idx]);
+      auto it_min = (F{bbox.min[axis]} - o) * dinv;
+      auto it_max = (F{bbox.max[axis]} - o) * dinv;
+      tmin[axis]  = min(it_min, it_max);
+      tmax[axis]  = max(it_min, it_max);
+    }
+    auto t0 = max(max(max(tmin[0], tmin[1]), tmin[2]),
+        F::load(&packet.tmin[idx]));
+    auto t1 = min(min(min(tmax[0], tmax[1]), tmax[2]),
+        F::load(&packet.tmax[idx]));
+    t1      = t1 * F{1.00000024f};  // for double: 1.0000000000000004
+    mask |= movemask(t0 <= t1) << idx;
+  }
+  return mask;
+}
+
+// Intersect the rays in `active` with a binary bvh. Nodes are visited once
+// for all rays that hit them, in the order given by the direction of the
+// first of them along the split axis. Leaves are intersected by
+// `intersect_leaf(packet, mask, start, num)`, that returns the mask of the
+// rays that hit and shortens them. Returns the mask of the rays that hit.
+template <int N, typename Func>
+static int intersect_packet_bvh(const vector<bvh_node>& nodes,
+    bvh_packet<N>& packet, int active, bool find_any, Func&& intersect_leaf) {
+  // node stack
+  auto node_stack        = array<int, 128>{};
+  auto node_cur          = 0;
+  node_stack[node_cur++] = 0;
+
+  // shared variables
+  auto hits = 0;
+
+  // walking stack
+  while (node_cur != 0) {
+    // grab node
+    auto& node = nodes[node_stack[--node_cur]];
+
+    // intersect bbox
+    auto mask = intersect_packet_bbox(packet, node.bbox) & active;
+    if (mask == 0) continue;
+
+    // intersect node, switching based on node type
+    if (node.internal) {
+      auto first = 0;
+      while ((mask & (1 << first)) == 0) first++;
+      if (packet.dinv[node.axis][first] < 0) {
+        node_stack[node_cur++] = node.start + 0;
+        node_stack[node_cur++] = node.start + 1;
+      } else {
+        node_stack[node_cur++] = node.start + 1;
+        node_stack[node_cur++] = node.start + 0;
+      }
+    } else {
+      hits |= intersect_leaf(packet, mask, node.start, node.num);
+    }
+
+    // rays that hit are done when looking for any hit
+    if (find_any) {
+      active &= ~hits;
+      if (active == 0) return hits;
+    }
+  }
+
+  return hits;
+}
+
+// Intersect the rays in `active` with a shape. Shapes without binary nodes
+// are intersected one ray at a time.
+template <int N>
+static int intersect_packet_bvh(const bvh_shape* shape, bvh_packet<N>& packet,
+    int active, bvh_intersection* intersections, bool find_any) {
+  auto hits = 0;
+  if (shape->bvh.nodes.empty()) {
+    for (auto idx = 0; idx < N; idx++) {
+      if ((active & (1 << idx)) == 0) continue;
+      auto& intersection = intersections[idx];
+      if (intersect_bvh(shape, packet.rays[idx], intersection.element,
+              intersection.uv, intersection.distance, find_any)) {
+        hits |= 1 << idx;
+        set_packet_tmax(packet, idx, intersection.distance);
+      }
+    }
+    return hits;
+  }
+
+  auto intersect_leaf = [&](bvh_packet<N>& packet, int mask, int start,
+                            int num) {
+    auto leaf_hits = 0;
+    for (auto idx = 0; idx < N; idx++) {
+      if ((mask & (1 << idx)) == 0) continue;
+      auto& intersection = intersections[idx];
+      if (intersect_elements(shape, packet.rays[idx], start, num,
+              intersection.element, intersection.uv, intersection.distance)) {
+        leaf_hits |= 1 << idx;
+        packet.tmax[idx] = packet.rays[idx].tmax;
+      }
+    }
+    return leaf_hits;
+  };
+  return intersect_packet_bvh(
+      shape->bvh.nodes, packet, active, find_any, intersect_leaf);
+}
+
+// Intersect `num` rays with a scene as a packet. Instances are intersected
+// with the rays that hit their leaf, transformed together. Scenes without
+// binary nodes are intersected one ray at a time.
+template <int N>
+static void intersect_packet_bvh(const bvh_scene* scene, const ray3f* rays,
+    int num_rays, bvh_intersection* intersections, bool find_any,
+    bool non_rigid_frames) {
+  for (auto idx = 0; idx < num_rays; idx++) intersections[idx] = {};
+
+  // intersect one ray at a time
+  auto use_rays = bvh_empty(scene->bvh) || scene->bvh.nodes.empty();
+#ifdef YOCTO_EMBREE
+  if (scene->embree_bvh) use_rays = true;
+#endif
+  if (use_rays) {
+    for (auto idx = 0; idx < num_rays; idx++) {
+      auto& intersection = intersections[idx];
+      intersection.hit   = intersect_bvh(scene, rays[idx],
+          intersection.instance, intersection.element, intersection.uv,
+          intersection.distance, find_any, non_rigid_frames);
+    }
+    return;
+  }
+
+  // init packet
+  auto packet = bvh_packet<N>{};
+  for (auto idx = 0; idx < N; idx++) {
+    set_packet_ray(packet, idx, idx < num_rays ? rays[idx] : ray3f{});
+  }
+  auto active = (1 << num_rays) - 1;
+
+  // intersect instances, transforming rays to their local frames
+  auto local_packet   = bvh_packet<N>{};
+  auto intersect_leaf = [&](bvh_packet<N>& packet, int mask, int start,
+                            int num) {
+    auto leaf_hits = 0;
+    for (auto prim = start; prim < start + num; prim++) {
+      auto [frame, shape_id] = scene->instance_cb(scene->bvh.primitives[prim]);
+      auto& shape            = scene->shapes[shape_id];
+      auto  inv_frame        = inverse(frame, non_rigid_frames);
+      for (auto idx = 0; idx < N; idx++) {
+        if ((mask & (1 << idx)) == 0) continue;
+        set_packet_ray(
+            local_packet, idx, transform_ray(inv_frame, packet.rays[idx]));
+      }
+      auto shape_hits = intersect_packet_bvh(
+          shape, local_packet, mask, intersections, find_any);
+      for (auto idx = 0; idx < N; idx++) {
+        if ((shape_hits & (1 << idx)) == 0) continue;
+        intersections[idx].instance = scene->bvh.primitives[prim];
+        set_packet_tmax(packet, idx, intersections[idx].distance);
+      }
+      leaf_hits |= shape_hits;
+      if (find_any) mask &= ~shape_hits;
+      if (mask == 0) break;
+    }
+    return leaf_hits;
+  };
+  auto hits = intersect_packet_bvh(
+      scene->bvh.nodes, packet, active, find_any, intersect_leaf);
+  for (auto idx = 0; idx < num_rays; idx++) {
+    intersections[idx].hit = (hits & (1 << idx)) != 0;
+  }
+}
+
+// Size of the packets used to trace ray streams.
+const auto bvh_stream_packet = 16;
+
+// Sorting key of a ray in a stream, made of its direction octant, followed
+// by a Morton code of its origin within the given bounds and one of its
+// direction, so that rays close in the order are likely to be coherent.
+static uint64_t get_stream_key(const ray3f& ray, const bbox3f& bounds) {
+  auto spread = [](uint64_t x) {
+    // interleaves the lowest 10 bits of x with two zero bits
+    x &= 0x3ff;
+    x = (x | (x << 16)) & 0x30000ff;
+    x = (x | (x << 8)) & 0x300f00f;
+    x = (x | (x << 4)) & 0x30c30c3;
+    x = (x | (x << 2)) & 0x9249249;
+    return x;
+  };
+  auto morton = [&spread](const vec3f& uvw, int bits) {
+    auto scale = (float)((1 << bits) - 1);
+    auto q     = vec3i{(int)(clamp(uvw.x, 0.0f, 1.0f) * scale),
+        (int)(clamp(uvw.y, 0.0f, 1.0f) * scale),
+        (int)(clamp(uvw.z, 0.0f, 1.0f) * scale)};
+    return spread(q.x) | (spread(q.y) << 1) | (spread(q.z) << 2);
+  };
+  auto octant = (uint64_t)((ray.d.x < 0 ? 1 : 0) | (ray.d.y < 0 ? 2 : 0) |
+                           (ray.d.z < 0 ? 4 : 0));
+  auto size   = max(bounds.max - bounds.min, vec3f{flt_min, flt_min, flt_min});
+  auto origin = morton((ray.o - bounds.min) / size, 10);
+  auto direction = morton((ray.d / max(abs(ray.d)) + 1) / 2, 7);
+  return (octant << 51) | (origin << 21) | direction;
+}
+
+// Check whether the rays of a packet are coherent enough to be traced
+// together, that is if they stay within a narrow beam across the scene.
+static bool is_packet_coherent(
+    const ray3f* rays, int num, const bbox3f& bounds) {
+  auto size    = distance(bounds.min, bounds.max);
+  auto origins = invalidb3f;
+  auto spread  = 0.0f;
+  auto dir     = normalize(rays[0].d);
+  for (auto idx = 0; idx < num; idx++) {
+    origins = merge(origins, rays[idx].o);
+    spread  = max(spread, distance(dir, normalize(rays[idx].d)));
+  }
+  return distance(origins.min, origins.max) + spread * size <= 0.05f * size;
+}
+
+// Intersect a stream of rays, sorted so that rays traced in the same packet
+// are coherent. Packets of incoherent rays are traced one ray at a time.
+static void intersect_stream_bvh(const bvh_scene* scene,
+    const vector<ray3f>& rays, vector<bvh_intersection>& intersections,
+    bool find_any, bool non_rigid_frames) {
+  // bounds of the ray origins and of the scene, if finite
+  auto bounds = invalidb3f;
+  for (auto& ray : rays) bounds = merge(bounds, ray.o);
+  auto scene_bounds = bvh_bounds(scene->bvh);
+  if (isfinite(scene_bounds.min) && isfinite(scene_bounds.max))
+    bounds = merge(bounds, scene_bounds);
+
+  // sort rays
+  auto keys   = vector<pair<uint64_t, int>>(rays.size());
+  for (auto idx = 0; idx < (int)rays.size(); idx++) {
+    keys[idx] = {get_stream_key(rays[idx], bounds), idx};
+  }
+  std::sort(keys.begin(), keys.end());
+
+  // trace packets
+  intersections.assign(rays.size(), {});
+  auto packet_rays          = array<ray3f, bvh_stream_packet>{};
+  auto packet_intersections = array<bvh_intersection, bvh_stream_packet>{};
+  for (auto start = 0; start < (int)keys.size(); start += bvh_stream_packet) {
+    auto num = min(bvh_stream_packet, (int)keys.size() - start);
+    for (auto idx = 0; idx < num; idx++) {
+      packet_rays[idx] = rays[keys[start + idx].second];
+    }
+    if (is_packet_coherent(packet_rays.data(), num, bounds)) {
+      intersect_packet_bvh<bvh_stream_packet>(scene, packet_rays.data(), num,
+          packet_intersections.data(), find_any, non_rigid_frames);
+    } else {
+      for (auto idx = 0; idx < num; idx++) {
+        packet_intersections[idx] = intersect_bvh(
+            scene, packet_rays[idx], find_any, non_rigid_frames);
+      }
+    }
+    for (auto idx = 0; idx < num; idx++) {
+      intersections[keys[start + idx].second] = packet_intersections[idx];
+    }
+  }
+}
+
+}  // namespace yocto
+
 // -----------------------------------------------------------------------------
 // IMPLEMENTATION FOR BVH OVERLAP
 // -----------------------------------------------------------------------------
 namespace yocto {
 
+// Get the bounds of a child of a compact node.
+static bbox3f get_child_bbox(const bvh_qnode& node, int idx) {
+  auto bbox = bbox3f{};
+  for (auto axis = 0; axis < 3; axis++) {
+    bbox.min[axis] = node.min[axis] + node.bounds[axis + 0][idx] *
+                                          node.scale[axis];
+    bbox.max[axis] = node.min[axis] + node.bounds[axis + 3][idx] *
+                                          node.scale[axis];
+  }
+  return bbox;
+}
+
+// Overlap a point with a compact bvh. Leaves are checked by
+// `overlap_leaf(max_distance, start, num)`, that returns whether any
+// primitive overlaps and shortens max distance to the closest overlap.
+template <typename Func>
+static bool overlap_compact_bvh(const vector<bvh_qnode>& nodes,
+    const vec3f& pos, float max_distance, bool find_any,
+    Func&& overlap_leaf) {
+  // node stack
+  auto node_stack        = array<int, 64>{};
+  auto node_cur          = 0;
+  node_stack[node_cur++] = 0;
+
+  // hit
+  auto hit = false;
+
+  // walking stack
+  while (node_cur != 0) {
+    // grab node
+    auto& node = nodes[node_stack[--node_cur]];
+
+    // overlap children
+    for (auto idx = 0; idx < 4; idx++) {
+      auto child = get_child(node, idx, 0);
+      if (!child.internal && child.num == 0) continue;
+      if (!overlap_bbox(pos, max_distance, get_child_bbox(node, idx)))
+        continue;
+      if (child.internal) {
+        node_stack[node_cur++] = child.start;
+      } else if (overlap_leaf(max_distance, child.start, child.num)) {
+        hit = true;
+        if (find_any) return hit;
+      }
+    }
+  }
+
+  return hit;
+}
+
+// Overlap a point with the elements of a shape in a bvh leaf.
+static bool overlap_elements(const bvh_shape* shape, const vec3f& pos,
+    float& max_distance, int start, int num, int& element, vec2f& uv,
+    float& distance) {
+  auto hit = false;
+  if (!shape->points.empty()) {
+    for (auto idx = start; idx < start + num; idx++) {
+      auto& p = shape->points[get_element(shape, idx)];
+      if (overlap_point(pos, max_distance, shape->positions[p],
+              shape->radius[p], uv, distance)) {
+        hit          = true;
+        element      = shape->bvh.primitives[idx];
+        max_distance = distance;
+      }
+    }
+  } else if (!shape->lines.empty()) {
+    for (auto idx = start; idx < start + num; idx++) {
+      auto& l = shape->lines[get_element(shape, idx)];
+      if (overlap_line(pos, max_distance, shape->positions[l.x],
+              shape->positions[l.y], shape->radius[l.x], shape->radius[l.y],
+              uv, distance)) {
+        hit          = true;
+        element      = shape->bvh.primitives[idx];
+        max_distance = distance;
+      }
+    }
+  } else if (!shape->triangles.empty()) {
+    for (auto idx = start; idx < start + num; idx++) {
+      auto& t = shape->triangles[get_element(shape, idx)];
+      if (overlap_triangle(pos, max_distance, shape->positions[t.x],
+              shape->positions[t.y], shape->positions[t.z], shape->radius[t.x],
+              shape->radius[t.y], shape->radius[t.z], uv, distance)) {
+        hit          = true;
+        element      = shape->bvh.primitives[idx];
+        max_distance = distance;
+      }
+    }
+  } else if (!shape->quads.empty()) {
+    for (auto idx = start; idx < start + num; idx++) {
+      auto& q = shape->quads[get_element(shape, idx)];
+      if (overlap_quad(pos, max_distance, shape->positions[q.x],
+              shape->positions[q.y], shape->positions[q.z],
+              shape->positions[q.w], shape->radius[q.x], shape->radius[q.y],
+              shape->radius[q.z], shape->radius[q.w], uv, distance)) {
+        hit          = true;
+        element      = shape->bvh.primitives[idx];
+        max_distance = distance;
+      }
+    }
+  }
+  return hit;
+}
+
 // Intersect ray with a bvh.
 static bool overlap_bvh(const bvh_shape* shape, const vec3f& pos,
     float max_distance, int& element, vec2f& uv, float& distance,
     bool find_any) {
   // check if empty
-  if (shape->bvh.nodes.empty()) return false;
+  if (bvh_empty(shape->bvh)) return false;
+
+  // overlap compact bvh
+  if (!shape->bvh.qnodes.empty()) {
+    return overlap_compact_bvh(shape->bvh.qnodes, pos, max_distance, find_any,
+        [&](float& max_distance, int start, int num) {
+          return overlap_elements(
+              shape, pos, max_distance, start, num, element, uv, distance);
+        });
+  }
 
   // node stack
   auto node_stack        = array<int, 64>{};
@@ -1088,55 +2310,10 @@ static bool overlap_bvh(const bvh_shape* shape, const vec3f& pos,
       // internal node
       node_stack[node_cur++] = node.start + 0;
       node_stack[node_cur++] = node.start + 1;
-    } else if (!shape->points.empty()) {
-      for (auto idx = 0; idx < node.num; idx++) {
-        auto  primitive = shape->bvh.primitives[node.start + idx];
-        auto& p         = shape->points[primitive];
-        if (overlap_point(pos, max_distance, shape->positions[p],
-                shape->radius[p], uv, distance)) {
-          hit          = true;
-          element      = primitive;
-          max_distance = distance;
-        }
-      }
-    } else if (!shape->lines.empty()) {
-      for (auto idx = 0; idx < node.num; idx++) {
-        auto  primitive = shape->bvh.primitives[node.start + idx];
-        auto& l         = shape->lines[primitive];
-        if (overlap_line(pos, max_distance, shape->positions[l.x],
-                shape->positions[l.y], shape->radius[l.x], shape->radius[l.y],
-                uv, distance)) {
-          hit          = true;
-          element      = primitive;
-          max_distance = distance;
-        }
-      }
-    } else if (!shape->triangles.empty()) {
-      for (auto idx = 0; idx < node.num; idx++) {
-        auto  primitive = shape->bvh.primitives[node.start + idx];
-        auto& t         = shape->triangles[primitive];
-        if (overlap_triangle(pos, max_distance, shape->positions[t.x],
-                shape->positions[t.y], shape->positions[t.z],
-                shape->radius[t.x], shape->radius[t.y], shape->radius[t.z], uv,
-                distance)) {
-          hit          = true;
-          element      = primitive;
-          max_distance = distance;
-        }
-      }
-    } else if (!shape->quads.empty()) {
-      for (auto idx = 0; idx < node.num; idx++) {
-        auto  primitive = shape->bvh.primitives[node.start + idx];
-        auto& q         = shape->quads[primitive];
-        if (overlap_quad(pos, max_distance, shape->positions[q.x],
-                shape->positions[q.y], shape->positions[q.z],
-                shape->positions[q.w], shape->radius[q.x], shape->radius[q.y],
-                shape->radius[q.z], shape->radius[q.w], uv, distance)) {
-          hit          = true;
-          element      = primitive;
-          max_distance = distance;
-        }
-      }
+    } else {
+      if (overlap_elements(shape, pos, max_distance, node.start, node.num,
+              element, uv, distance))
+        hit = true;
     }
 
     // check for early exit
@@ -1146,12 +2323,41 @@ static bool overlap_bvh(const bvh_shape* shape, const vec3f& pos,
   return hit;
 }
 
+// Overlap a point with the instances of a scene in a bvh leaf.
+static bool overlap_instances(const bvh_scene* scene, const vec3f& pos,
+    float& max_distance, int start, int num, int& instance, int& element,
+    vec2f& uv, float& distance, bool find_any, bool non_rigid_frames) {
+  auto hit = false;
+  for (auto idx = start; idx < start + num; idx++) {
+    auto primitive         = scene->bvh.primitives[idx];
+    auto [frame, shape_id] = scene->instance_cb(primitive);
+    auto shape             = scene->shapes[shape_id];
+    auto inv_pos = transform_point(inverse(frame, non_rigid_frames), pos);
+    if (overlap_bvh(
+            shape, inv_pos, max_distance, element, uv, distance, find_any)) {
+      hit          = true;
+      instance     = primitive;
+      max_distance = distance;
+    }
+  }
+  return hit;
+}
+
 // Intersect ray with a bvh.
 static bool overlap_bvh(const bvh_scene* scene, const vec3f& pos,
     float max_distance, int& instance, int& element, vec2f& uv, float& distance,
     bool find_any, bool non_rigid_frames) {
   // check if empty
-  if (scene->bvh.nodes.empty()) return false;
+  if (bvh_empty(scene->bvh)) return false;
+
+  // overlap compact bvh
+  if (!scene->bvh.qnodes.empty()) {
+    return overlap_compact_bvh(scene->bvh.qnodes, pos, max_distance, find_any,
+        [&](float& max_distance, int start, int num) {
+          return overlap_instances(scene, pos, max_distance, start, num,
+              instance, element, uv, distance, find_any, non_rigid_frames);
+        });
+  }
 
   // node stack
   auto node_stack        = array<int, 64>{};
@@ -1176,18 +2382,9 @@ static bool overlap_bvh(const bvh_scene* scene, const vec3f& pos,
       node_stack[node_cur++] = node.start + 0;
       node_stack[node_cur++] = node.start + 1;
     } else {
-      for (auto idx = 0; idx < node.num; idx++) {
-        auto primitive         = scene->bvh.primitives[node.start + idx];
-        auto [frame, shape_id] = scene->instance_cb(primitive);
-        auto shape             = scene->shapes[shape_id];
-        auto inv_pos = transform_point(inverse(frame, non_rigid_frames), pos);
-        if (overlap_bvh(shape, inv_pos, max_distance, element, uv, distance,
-                find_any)) {
-          hit          = true;
-          instance     = primitive;
-          max_distance = distance;
-        }
-      }
+      if (overlap_instances(scene, pos, max_distance, node.start, node.num,
+              instance, element, uv, distance, find_any, non_rigid_frames))
+        hit = true;
     }
 
     // check for early exit
@@ -1275,6 +2472,53 @@ bvh_intersection intersect_bvh(const bvh_scene* scene, int instance,
   return intersection;
 }
 
+array<bvh_intersection, 8> intersect_bvh_packet(const bvh_scene* scene,
+    const array<ray3f, 8>& rays, bool find_any, bool non_rigid_frames) {
+  auto intersections = array<bvh_intersection, 8>{};
+  intersect_packet_bvh<8>(scene, rays.data(), (int)rays.size(),
+      intersections.data(), find_any, non_rigid_frames);
+  return intersections;
+}
+array<bvh_intersection, 16> intersect_bvh_packet(const bvh_scene* scene,
+    const array<ray3f, 16>& rays, bool find_any, bool non_rigid_frames) {
+  auto intersections = array<bvh_intersection, 16>{};
+  intersect_packet_bvh<16>(scene, rays.data(), (int)rays.size(),
+      intersections.data(), find_any, non_rigid_frames);
+  return intersections;
+}
+vector<bvh_intersection> intersect_bvh_stream(const bvh_scene* scene,
+    const vector<ray3f>& rays, bool find_any, bool non_rigid_frames) {
+  auto intersections = vector<bvh_intersection>{};
+  intersect_stream_bvh(scene, rays, intersections, find_any, non_rigid_frames);
+  return intersections;
+}
+
+array<bool, 8> occlude_bvh_packet(const bvh_scene* scene,
+    const array<ray3f, 8>& rays, bool non_rigid_frames) {
+  auto intersections = intersect_bvh_packet(
+      scene, rays, true, non_rigid_frames);
+  auto occluded      = array<bool, 8>{};
+  for (auto idx = 0; idx < 8; idx++) occluded[idx] = intersections[idx].hit;
+  return occluded;
+}
+array<bool, 16> occlude_bvh_packet(const bvh_scene* scene,
+    const array<ray3f, 16>& rays, bool non_rigid_frames) {
+  auto intersections = intersect_bvh_packet(
+      scene, rays, true, non_rigid_frames);
+  auto occluded      = array<bool, 16>{};
+  for (auto idx = 0; idx < 16; idx++) occluded[idx] = intersections[idx].hit;
+  return occluded;
+}
+vector<bool> occlude_bvh_stream(const bvh_scene* scene,
+    const vector<ray3f>& rays, bool non_rigid_frames) {
+  auto intersections = intersect_bvh_stream(
+      scene, rays, true, non_rigid_frames);
+  auto occluded      = vector<bool>(rays.size());
+  for (auto idx = 0; idx < (int)rays.size(); idx++)
+    occluded[idx] = intersections[idx].hit;
+  return occluded;
+}
+
 bvh_intersection overlap_bvh(const bvh_scene* scene, const vec3f& pos,
     float max_distance, bool find_any, bool non_rigid_frames) {
   auto intersection = bvh_intersection{};
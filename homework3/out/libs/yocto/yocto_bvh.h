@@ -81,13 +81,47 @@ struct bvh_node {
   bool    internal = false;
 };
 
+// Wide BVH node storing the bounds of up to N children by coordinate, so
+// that a ray is tested against all children at once. Children refer either
+// to other wide nodes, for internal children, or to the primitive array,
+// for leaf children. Unused children have empty bounds.
+template <int N>
+struct alignas(32) bvh_wide_node {
+  static const int width = N;
+
+  float   bounds[6][N] = {};  // min x, y, z and max x, y, z of children
+  int32_t start[N]     = {};
+  int16_t num[N]       = {};
+  bool    internal[N]  = {};
+};
+using bvh_node4 = bvh_wide_node<4>;
+using bvh_node8 = bvh_wide_node<8>;
+
+// Compact 4-wide BVH node that fits a cache line. Child bounds are quantized
+// to 8 bits over the node bounds, as min + bounds * scale rounded outwards.
+// Children are node indices if non-negative, or leaves encoded as
+// ~(start << 3 | num). Unused children are empty leaves.
+struct alignas(64) bvh_qnode {
+  static const int width = 4;
+
+  vec3f   min          = {0, 0, 0};
+  vec3f   scale        = {0, 0, 0};
+  uint8_t bounds[6][4] = {};  // min x, y, z and max x, y, z of children
+  int32_t children[4]  = {};
+};
+
 // BVH tree stored as a node array with the tree structure is encoded using
 // array indices. BVH nodes indices refer to either the node array,
 // for internal nodes, or the primitive arrays, for leaf nodes.
-// Application data is not stored explicitly.
+// Application data is not stored explicitly. Wide BVHs store the binary
+// tree, used for refits and overlap queries, and its collapsed wide nodes,
+// used for ray intersection. Compact BVHs only store compact nodes.
 struct bvh_tree {
-  vector<bvh_node> nodes      = {};
-  vector<int>      primitives = {};
+  vector<bvh_node>  nodes      = {};
+  vector<int>       primitives = {};
+  vector<bvh_node4> nodes4     = {};
+  vector<bvh_node8> nodes8     = {};
+  vector<bvh_qnode> qnodes     = {};
 };
 
 // BVH span to give a view over an array
@@ -135,6 +169,11 @@ struct bvh_shape {
 #ifdef YOCTO_EMBREE
   RTCScene embree_bvh = nullptr;
 #endif
+
+  // owned elements reordered in the bvh leaf order, with bvh primitives
+  // storing their original ids; set by compact bvhs
+  bool leaf_order = false;
+
   ~bvh_shape();
 };
 
@@ -183,6 +222,9 @@ enum struct bvh_build_type {
   highquality,
   middle,
   balanced,
+  wide4,    // highquality tree traversed with 4-wide nodes
+  wide8,    // highquality tree traversed with 8-wide nodes
+  compact,  // highquality tree stored with compact nodes only
 #ifdef YOCTO_EMBREE
   embree_default,
   embree_highquality,
@@ -191,7 +233,8 @@ enum struct bvh_build_type {
 };
 
 const auto bvh_build_names = vector<string>{
-    "default", "highquality", "middle", "balanced",
+    "default", "highquality", "middle", "balanced", "wide4", "wide8",
+    "compact",
 #ifdef YOCTO_EMBREE
     "embree-default", "embree-highquality", "embree-compact"
 #endif
@@ -200,7 +243,7 @@ const auto bvh_build_names = vector<string>{
 // Bvh parameters
 struct bvh_params {
   bvh_build_type bvh        = bvh_build_type::default_;
-  bool           noparallel = false;  // only serial momentarily
+  bool           noparallel = false;
 };
 
 // Progress report callback
@@ -216,6 +259,16 @@ void update_bvh(bvh_scene* bvh, const vector<int>& updated_instances,
     const vector<int>&       updated_shapes,
     const progress_callback& progress_cb = {});
 
+// Save and load the trees of a bvh, that are the shape trees and the
+// instance tree, so that later runs skip the build. Shapes and instances
+// are set as for init_bvh() and are not stored. Each tree is stored with
+// a hash of its geometry, and loads fail if the hashes or the build type
+// do not match the bvh being loaded. Embree bvhs cannot be saved.
+bool save_bvh(const string& filename, const bvh_scene* bvh,
+    const bvh_params& params, string& error);
+bool load_bvh(const string& filename, bvh_scene* bvh,
+    const bvh_params& params, string& error);
+
 // Results of intersect_xxx and overlap_xxx functions that include hit flag,
 // instance id, shape element id, shape element uv and intersection distance.
 // The values are all set for scene intersection. Shape intersection does not
@@ -237,6 +290,32 @@ bvh_intersection intersect_bvh(const bvh_scene* bvh, const ray3f& ray,
 bvh_intersection intersect_bvh(const bvh_scene* bvh, int instance,
     const ray3f& ray, bool find_any = false, bool non_rigid_frames = true);
 
+// Intersect a packet of 8 or 16 coherent rays, like camera rays of nearby
+// pixels, returning the same results as intersect_bvh() for each ray. Node
+// bounds are tested for all rays at once.
+array<bvh_intersection, 8>  intersect_bvh_packet(const bvh_scene* bvh,
+     const array<ray3f, 8>& rays, bool find_any = false,
+     bool non_rigid_frames = true);
+array<bvh_intersection, 16> intersect_bvh_packet(const bvh_scene* bvh,
+    const array<ray3f, 16>& rays, bool find_any = false,
+    bool non_rigid_frames = true);
+
+// Intersect a stream of rays of any size. Rays are sorted by direction and
+// origin, and traced in packets of coherent rays. Results are in the order
+// of the rays.
+vector<bvh_intersection> intersect_bvh_stream(const bvh_scene* bvh,
+    const vector<ray3f>& rays, bool find_any = false,
+    bool non_rigid_frames = true);
+
+// Check whether rays hit anything, as for shadow rays, stopping each ray at
+// its first hit.
+array<bool, 8>  occlude_bvh_packet(const bvh_scene* bvh,
+     const array<ray3f, 8>& rays, bool non_rigid_frames = true);
+array<bool, 16> occlude_bvh_packet(const bvh_scene* bvh,
+    const array<ray3f, 16>& rays, bool non_rigid_frames = true);
+vector<bool>    occlude_bvh_stream(const bvh_scene* bvh,
+       const vector<ray3f>& rays, bool non_rigid_frames = true);
+
 // Find a shape element that overlaps a point within a given distance
 // max distance, returning either the closest or any overlap depending on
 // `find_any`. Returns the point distance, the instance id, the shape element
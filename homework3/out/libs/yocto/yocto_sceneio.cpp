@@ -29,12 +29,15 @@
 #include "yocto_sceneio.h"
 
 #include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <cctype>
 #include <climits>
+#include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <memory>
+#include <mutex>
 #include <stdexcept>
 #include <unordered_map>
 
@@ -351,7 +354,12 @@ bbox3f compute_bounds(const sceneio_scene* scene) {
   }
   for (auto instance : scene->instances) {
     auto sbvh = shape_bbox[instance->shape];
-    bbox      = merge(bbox, transform_bbox(instance->frame, sbvh));
+    if (instance->frames.empty()) {
+      bbox = merge(bbox, transform_bbox(instance->frame, sbvh));
+    } else {
+      for (auto& frame : instance->frames)
+        bbox = merge(bbox, transform_bbox(frame * instance->frame, sbvh));
+    }
   }
   return bbox;
 }
@@ -406,39 +414,17 @@ void tesselate_shape(sceneio_shape* shape) {
       std::tie(shape->lines, shape->positions) = subdivide_lines(
           shape->lines, shape->positions, shape->subdivisions);
     } else if (!shape->triangles.empty()) {
-      std::tie(std::ignore, shape->texcoords) = subdivide_triangles(
-          shape->triangles, shape->texcoords, shape->subdivisions);
-      std::tie(std::ignore, shape->normals) = subdivide_triangles(
-          shape->triangles, shape->normals, shape->subdivisions);
-      std::tie(std::ignore, shape->colors) = subdivide_triangles(
-          shape->triangles, shape->colors, shape->subdivisions);
-      std::tie(std::ignore, shape->radius) = subdivide_triangles(
-          shape->triangles, shape->radius, shape->subdivisions);
-      std::tie(shape->triangles, shape->positions) = subdivide_triangles(
-          shape->triangles, shape->positions, shape->subdivisions);
+      subdivide_triangles(shape->triangles, shape->positions, shape->normals,
+          shape->texcoords, shape->colors, shape->radius, shape->subdivisions);
     } else if (!shape->quads.empty()) {
       if (shape->catmullclark) {
-        std::tie(std::ignore, shape->texcoords) = subdivide_catmullclark(
-            shape->quads, shape->texcoords, shape->subdivisions, true);
-        std::tie(std::ignore, shape->normals) = subdivide_catmullclark(
-            shape->quads, shape->normals, shape->subdivisions, true);
-        std::tie(std::ignore, shape->colors) = subdivide_catmullclark(
-            shape->quads, shape->colors, shape->subdivisions);
-        std::tie(std::ignore, shape->radius) = subdivide_catmullclark(
-            shape->quads, shape->radius, shape->subdivisions);
-        std::tie(std::ignore, shape->positions) = subdivide_catmullclark(
-            shape->quads, shape->positions, shape->subdivisions);
+        subdivide_catmullclark(shape->quads, shape->positions, shape->normals,
+            shape->texcoords, shape->colors, shape->radius,
+            shape->subdivisions);
       } else {
-        std::tie(std::ignore, shape->texcoords) = subdivide_quads(
-            shape->quads, shape->texcoords, shape->subdivisions);
-        std::tie(std::ignore, shape->normals) = subdivide_quads(
-            shape->quads, shape->normals, shape->subdivisions);
-        std::tie(std::ignore, shape->colors) = subdivide_quads(
-            shape->quads, shape->colors, shape->subdivisions);
-        std::tie(std::ignore, shape->radius) = subdivide_quads(
-            shape->quads, shape->radius, shape->subdivisions);
-        std::tie(shape->quads, shape->positions) = subdivide_quads(
-            shape->quads, shape->positions, shape->subdivisions);
+        subdivide_quads(shape->quads, shape->positions, shape->normals,
+            shape->texcoords, shape->colors, shape->radius,
+            shape->subdivisions);
       }
     } else if (!shape->quadspos.empty()) {
       if (shape->catmullclark) {
@@ -537,15 +523,84 @@ void tesselate_shape(sceneio_shape* shape) {
   }
 }  // namespace yocto
 
-void tesselate_shapes(
-    sceneio_scene* scene, const progress_callback& progress_cb) {
+// Hash of the inputs of tesselate_shape(), used as the key of the
+// tesselation cache
+static uint64_t hash_tesselation(const sceneio_shape* shape) {
+  auto texture = shape->displacement != 0 ? shape->displacement_tex : nullptr;
+  auto size    = zero2i;
+  auto data    = (const void*)nullptr;
+  auto bytes   = (size_t)0;
+  if (texture != nullptr && !texture->hdr.empty()) {
+    size  = texture->hdr.imsize();
+    data  = texture->hdr.data();
+    bytes = texture->hdr.count() * sizeof(vec4f);
+  } else if (texture != nullptr && !texture->ldr.empty()) {
+    size  = texture->ldr.imsize();
+    data  = texture->ldr.data();
+    bytes = texture->ldr.count() * sizeof(vec4b);
+  }
+  return hash_tesselation(shape->subdivisions, shape->catmullclark,
+      shape->smooth, shape->displacement, shape->points, shape->lines,
+      shape->triangles, shape->quads, shape->quadspos, shape->quadsnorm,
+      shape->quadstexcoord, shape->positions, shape->normals, shape->texcoords,
+      shape->colors, shape->radius, size, data, bytes);
+}
+
+// Load a tesselated shape from the cache
+static bool load_tesselation(const string& filename, sceneio_shape* shape) {
+  auto error = string{};
+  if (!load_tesselation(filename, shape->points, shape->lines,
+          shape->triangles, shape->quads, shape->positions, shape->normals,
+          shape->texcoords, shape->colors, shape->radius, error))
+    return false;
+  shape->quadspos         = {};
+  shape->quadsnorm        = {};
+  shape->quadstexcoord    = {};
+  shape->subdivisions     = 0;
+  shape->displacement     = 0;
+  shape->displacement_tex = nullptr;
+  return true;
+}
+
+// Save a tesselated shape to the cache
+static bool save_tesselation(const string& filename, const sceneio_shape* shape) {
+  auto error = string{};
+  return save_tesselation(filename, shape->points, shape->lines,
+      shape->triangles, shape->quads, shape->positions, shape->normals,
+      shape->texcoords, shape->colors, shape->radius, error);
+}
+
+void tesselate_shapes(sceneio_scene* scene,
+    const progress_callback& progress_cb, const string& cachedir,
+    bool noparallel) {
   // handle progress
-  auto progress = vec2i{0, (int)scene->shapes.size()};
+  auto progress       = vec2i{0, (int)scene->shapes.size()};
+  auto progress_mutex = std::mutex{};
+
+  // the cache only saves time, so its errors fall back to tesselating
+  auto error    = string{};
+  auto usecache = !cachedir.empty() && make_directory(cachedir, error);
 
   // tesselate shapes
-  for (auto shape : scene->shapes) {
-    if (progress_cb) progress_cb("tesselate shape", progress.x++, progress.y);
+  auto tesselate = [&](int idx) {
+    auto shape = scene->shapes[idx];
+    if (progress_cb) {
+      auto lock = std::lock_guard{progress_mutex};
+      progress_cb("tesselate shape", progress.x++, progress.y);
+    }
+    auto cacheable = shape->subdivisions > 0 ||
+                     (shape->displacement != 0 &&
+                         shape->displacement_tex != nullptr);
+    if (!usecache || !cacheable) return tesselate_shape(shape);
+    auto filename = tesselation_filename(cachedir, hash_tesselation(shape));
+    if (load_tesselation(filename, shape)) return;
     tesselate_shape(shape);
+    save_tesselation(filename, shape);
+  };
+  if (noparallel) {
+    for (auto idx = 0; idx < (int)scene->shapes.size(); idx++) tesselate(idx);
+  } else {
+    parallel_for_batch((int)scene->shapes.size(), 1, tesselate);
   }
 
   // done
@@ -1139,6 +1194,44 @@ bool save_instance(const string& filename, const vector<frame3f>& frames,
   }
 }
 
+// Asset loader, that reads one file of a scene into its element.
+struct sceneio_loader {
+  string                        message = "";
+  function<bool(string& error)> load    = {};
+};
+
+// Run asset loaders concurrently, one task per asset, unless disabled.
+// Concurrency is bounded by the parallel pool, and each asset is decoded
+// directly into its element. Once a loader fails, the ones after it are
+// skipped, while the ones before it still run, so the reported error is
+// the one of the first failed asset, as in a serial load. Progress is
+// reported in completion order.
+static bool load_assets(const vector<sceneio_loader>& loaders, string& error,
+    const progress_callback& progress_cb, vec2i& progress, bool noparallel) {
+  auto errors         = vector<string>(loaders.size());
+  auto first_failed   = std::atomic<int>{(int)loaders.size()};
+  auto progress_mutex = std::mutex{};
+  auto load_asset     = [&](int idx) {
+    if (idx > first_failed.load()) return;
+    if (progress_cb) {
+      auto lock = std::lock_guard{progress_mutex};
+      progress_cb(loaders[idx].message, progress.x++, progress.y);
+    }
+    if (loaders[idx].load(errors[idx])) return;
+    auto failed = first_failed.load();
+    while (idx < failed && !first_failed.compare_exchange_weak(failed, idx)) {
+    }
+  };
+  if (noparallel) {
+    for (auto idx = 0; idx < (int)loaders.size(); idx++) load_asset(idx);
+  } else {
+    parallel_for_batch((int)loaders.size(), 1, load_asset);
+  }
+  if (first_failed.load() == (int)loaders.size()) return true;
+  error = errors[first_failed.load()];
+  return false;
+}
+
 }  // namespace yocto
 
 // -----------------------------------------------------------------------------
@@ -1497,69 +1590,73 @@ static bool load_json_scene(const string& filename, sceneio_scene* scene,
     return path_join(path_dirname(filename), group, name + extensions.front());
   };
 
+  // shapes, textures and instances do not depend on each other, so they
+  // are loaded together before instances are applied
+  auto loaders = vector<sceneio_loader>{};
+
   // load shapes
   shape_map.erase("");
   for (auto [name, shape] : shape_map) {
-    if (progress_cb) progress_cb("load shape", progress.x++, progress.y);
     auto path = make_filename(name, "shapes", {".ply", ".obj"});
-    if (!load_shape(path, shape->points, shape->lines, shape->triangles,
-            shape->quads, shape->quadspos, shape->quadsnorm,
-            shape->quadstexcoord, shape->positions, shape->normals,
-            shape->texcoords, shape->colors, shape->radius, error,
-            shape->catmullclark && shape->subdivisions > 0))
-      return dependent_error();
+    scene->sources.push_back(path);
+    loaders.push_back({"load shape", [path, shape = shape](string& error) {
+                         return load_shape(path, shape->points, shape->lines,
+                             shape->triangles, shape->quads, shape->quadspos,
+                             shape->quadsnorm, shape->quadstexcoord,
+                             shape->positions, shape->normals,
+                             shape->texcoords, shape->colors, shape->radius,
+                             error,
+                             shape->catmullclark && shape->subdivisions > 0);
+                       }});
   }
   // load textures
   ctexture_map.erase("");
   for (auto [name, texture] : ctexture_map) {
-    if (progress_cb) progress_cb("load texture", progress.x++, progress.y);
     auto path = make_filename(
         name, "textures", {".hdr", ".exr", ".png", ".jpg"});
-    if (!load_image(path, texture->hdr, texture->ldr, error))
-      return dependent_error();
+    scene->sources.push_back(path);
+    loaders.push_back(
+        {"load texture", [path, texture = texture](string& error) {
+           return load_image(path, texture->hdr, texture->ldr, error);
+         }});
   }
   // load textures
   stexture_map.erase("");
   for (auto [name, texture] : stexture_map) {
-    if (progress_cb) progress_cb("load texture", progress.x++, progress.y);
     auto path = make_filename(
         name, "textures", {".hdr", ".exr", ".png", ".jpg"});
-    if (!load_image(path, texture->hdr, texture->ldr, error))
-      return dependent_error();
+    scene->sources.push_back(path);
+    loaders.push_back(
+        {"load texture", [path, texture = texture](string& error) {
+           return load_image(path, texture->hdr, texture->ldr, error);
+         }});
   }
 
   // load instances
   ply_instance_map.erase("");
   for (auto [name, instance] : ply_instance_map) {
-    if (progress_cb) progress_cb("load instance", progress.x++, progress.y);
     auto path = make_filename(name, "instances", {".ply"});
-    if (!load_instance(path, instance->frames, error)) return dependent_error();
-  }
-
-  // apply instances
-  if (!ply_instances.empty()) {
-    if (progress_cb)
-      progress_cb("flatten instances", progress.x++, progress.y++);
-    auto instances = scene->instances;
-    scene->instances.clear();
-    for (auto instance : instances) {
-      auto it = instance_ply.find(instance);
-      if (it == instance_ply.end()) {
-        auto ninstance      = add_instance(scene, instance->name);
-        ninstance->frame    = instance->frame;
-        ninstance->shape    = instance->shape;
-        ninstance->material = instance->material;
-      } else {
-        auto ply_instance = it->second;
-        for (auto& frame : ply_instance->frames) {
-          auto ninstance      = add_instance(scene, instance->name);
-          ninstance->frame    = frame * instance->frame;
-          ninstance->shape    = instance->shape;
-          ninstance->material = instance->material;
-        }
-      }
+    scene->sources.push_back(path);
+    loaders.push_back(
+        {"load instance", [path, instance = instance](string& error) {
+           return load_instance(path, instance->frames, error);
+         }});
+  }
+
+  // load assets
+  if (!load_assets(loaders, error, progress_cb, progress, noparallel))
+    return dependent_error();
+
+  // apply instances as instance arrays, removing the ones without copies
+  for (auto [instance, ply_instance] : instance_ply) {
+    if (ply_instance->frames.empty()) {
+      scene->instances.erase(std::remove(scene->instances.begin(),
+                                 scene->instances.end(), instance),
+          scene->instances.end());
+      delete instance;
+    } else {
+      instance->frames = ply_instance->frames;
     }
-    for (auto instance : instances) delete instance;
   }
 
   // fix scene
@@ -1600,6 +1697,8 @@ static bool save_json_scene(const string& filename, const sceneio_scene* scene,
   // handle progress
   auto progress = vec2i{
       0, 2 + (int)scene->shapes.size() + (int)scene->textures.size()};
+  for (auto instance : scene->instances)
+    if (!instance->frames.empty()) progress.y += 1;
   if (progress_cb) progress_cb("save scene", progress.x++, progress.y);
 
   // save json file
@@ -1676,6 +1775,7 @@ static bool save_json_scene(const string& filename, const sceneio_scene* scene,
     add_opt(ejs, "frame", instance->frame, def_object.frame);
     add_ref(ejs, "shape", instance->shape);
     add_ref(ejs, "material", instance->material);
+    if (!instance->frames.empty()) ejs["instance"] = instance->name;
     if (instance->shape != nullptr) {
       add_opt(ejs, "subdivisions", instance->shape->subdivisions,
           def_shape.subdivisions);
@@ -1722,6 +1822,15 @@ static bool save_json_scene(const string& filename, const sceneio_scene* scene,
       return dependent_error();
   }
 
+  // save instances
+  for (auto instance : scene->instances) {
+    if (instance->frames.empty()) continue;
+    if (progress_cb) progress_cb("save instance", progress.x++, progress.y);
+    auto path = make_filename(instance->name, "instances", ".ply");
+    if (!save_instance(path, instance->frames, error))
+      return dependent_error();
+  }
+
   // done
   if (progress_cb) progress_cb("save done", progress.x++, progress.y);
   return true;
@@ -1758,6 +1867,8 @@ static bool load_obj_scene(const string& filename, sceneio_scene* scene,
   auto obj_guard = std::make_unique<obj_scene>();
   auto obj       = obj_guard.get();
   if (!load_obj(filename, obj, error, false, true, false)) return false;
+  if (path_exists(replace_extension(filename, ".mtl")))
+    scene->sources.push_back(replace_extension(filename, ".mtl"));
 
   // handle progress
   if (progress_cb) progress_cb("load scene", progress.x++, progress.y);
@@ -1861,18 +1972,10 @@ static bool load_obj_scene(const string& filename, sceneio_scene* scene,
       } else {
         return shape_error();
       }
-      if (oshape->instances.empty()) {
-        auto instance      = add_instance(scene);
-        instance->shape    = shape;
-        instance->material = material;
-      } else {
-        for (auto& frame : oshape->instances) {
-          auto instance      = add_instance(scene);
-          instance->frame    = frame;
-          instance->shape    = shape;
-          instance->material = material;
-        }
-      }
+      auto instance      = add_instance(scene);
+      instance->shape    = shape;
+      instance->material = material;
+      instance->frames   = oshape->instances;
     }
   }
 
@@ -1896,6 +1999,7 @@ static bool load_obj_scene(const string& filename, sceneio_scene* scene,
   ctexture_map.erase("");
   for (auto [name, texture] : ctexture_map) {
     if (progress_cb) progress_cb("load texture", progress.x++, progress.y);
+    scene->sources.push_back(make_filename(name));
     if (!load_image(make_filename(name), texture->hdr, texture->ldr, error))
       return dependent_error();
   }
@@ -1904,6 +2008,7 @@ static bool load_obj_scene(const string& filename, sceneio_scene* scene,
   stexture_map.erase("");
   for (auto [name, texture] : stexture_map) {
     if (progress_cb) progress_cb("load texture", progress.x++, progress.y);
+    scene->sources.push_back(make_filename(name));
     if (!load_image(make_filename(name), texture->hdr, texture->ldr, error))
       return dependent_error();
   }
@@ -1997,6 +2102,7 @@ static bool save_obj_scene(const string& filename, const sceneio_scene* scene,
     auto oshape       = add_shape(obj);
     oshape->name      = shape->name;
     oshape->materials = {material_map.at(instance->material)};
+    oshape->instances = instance->frames;
     if (!shape->triangles.empty()) {
       set_triangles(oshape, shape->triangles, positions, normals,
           shape->texcoords, {}, true);
@@ -2165,6 +2271,11 @@ static bool load_gltf_scene(const string& filename, sceneio_scene* scene,
   if (cgltf_load_buffers(&params, data, dirname.c_str()) !=
       cgltf_result_success)
     return read_error();
+  for (auto bid = 0; bid < (int)gltf->buffers_count; bid++) {
+    auto uri = gltf->buffers[bid].uri;
+    if (uri == nullptr || string{uri}.rfind("data:", 0) == 0) continue;
+    scene->sources.push_back(path_join(path_dirname(filename), uri));
+  }
 
   // handle progress
   if (progress_cb) progress_cb("load scene", progress.x++, progress.y);
@@ -2494,6 +2605,7 @@ static bool load_gltf_scene(const string& filename, sceneio_scene* scene,
   ctexture_map.erase("");
   for (auto [tpath, texture] : ctexture_map) {
     if (progress_cb) progress_cb("load texture", progress.x++, progress.y);
+    scene->sources.push_back(path_join(path_dirname(filename), tpath));
     if (!load_image(path_join(path_dirname(filename), tpath), texture->hdr,
             texture->ldr, error))
       return dependent_error();
@@ -2505,6 +2617,7 @@ static bool load_gltf_scene(const string& filename, sceneio_scene* scene,
     if (progress_cb) progress_cb("load texture", progress.x++, progress.y);
     auto color_opacityf = image<vec4f>{};
     auto color_opacityb = image<vec4b>{};
+    scene->sources.push_back(path_join(path_dirname(filename), tpath));
     if (!load_image(path_join(path_dirname(filename), tpath), color_opacityf,
             color_opacityb, error))
       return dependent_error();
@@ -2548,6 +2661,7 @@ static bool load_gltf_scene(const string& filename, sceneio_scene* scene,
     if (progress_cb) progress_cb("load texture", progress.x++, progress.y);
     auto metallic_roughnessf = image<vec4f>{};
     auto metallic_roughnessb = image<vec4b>{};
+    scene->sources.push_back(path_join(path_dirname(filename), tpath));
     if (!load_image(path_join(path_dirname(filename), tpath),
             metallic_roughnessf, metallic_roughnessb, error))
       return dependent_error();
@@ -2710,6 +2824,9 @@ static bool load_pbrt_scene(const string& filename, sceneio_scene* scene,
 
   // convert shapes
   for (auto pshape : pbrt->shapes) {
+    if (!pshape->filename_.empty())
+      scene->sources.push_back(
+          path_join(path_dirname(filename), pshape->filename_));
     auto shape       = add_shape(scene);
     shape->positions = pshape->positions;
     shape->normals   = pshape->normals;
@@ -2717,19 +2834,11 @@ static bool load_pbrt_scene(const string& filename, sceneio_scene* scene,
     shape->triangles = pshape->triangles;
     for (auto& uv : shape->texcoords) uv.y = 1 - uv.y;
     auto material = material_map.at(pshape->material);
-    if (pshape->instances.empty()) {
-      auto instance      = add_instance(scene);
-      instance->frame    = pshape->frame;
-      instance->shape    = shape;
-      instance->material = material;
-    } else {
-      for (auto frame : pshape->instances) {
-        auto instance      = add_instance(scene);
-        instance->frame    = frame * pshape->frame;
-        instance->shape    = shape;
-        instance->material = material;
-      }
-    }
+    auto instance      = add_instance(scene);
+    instance->frame    = pshape->frame;
+    instance->shape    = shape;
+    instance->material = material;
+    instance->frames   = pshape->instances;
   }
 
   // convert environments
@@ -2764,6 +2873,7 @@ static bool load_pbrt_scene(const string& filename, sceneio_scene* scene,
   ctexture_map.erase("");
   for (auto [name, texture] : ctexture_map) {
     if (progress_cb) progress_cb("load texture", progress.x++, progress.y);
+    scene->sources.push_back(make_filename(name));
     if (!load_image(make_filename(name), texture->hdr, texture->ldr, error))
       return dependent_error();
   }
@@ -2772,6 +2882,7 @@ static bool load_pbrt_scene(const string& filename, sceneio_scene* scene,
   stexture_map.erase("");
   for (auto [name, texture] : stexture_map) {
     if (progress_cb) progress_cb("load texture", progress.x++, progress.y);
+    scene->sources.push_back(make_filename(name));
     if (!load_image(make_filename(name), texture->hdr, texture->ldr, error))
       return dependent_error();
   }
@@ -2780,6 +2891,7 @@ static bool load_pbrt_scene(const string& filename, sceneio_scene* scene,
   atexture_map.erase("");
   for (auto [name, texture] : atexture_map) {
     if (progress_cb) progress_cb("load texture", progress.x++, progress.y);
+    scene->sources.push_back(make_filename(name));
     if (!load_image(make_filename(name), texture->hdr, texture->ldr, error))
       return dependent_error();
     for (auto& c : texture->hdr) {
@@ -2856,6 +2968,7 @@ static bool save_pbrt_scene(const string& filename, const sceneio_scene* scene,
     pshape->filename_ = instance->shape->name + ".ply";
     pshape->frame     = instance->frame;
     pshape->frend     = instance->frame;
+    pshape->instances = instance->frames;
     pshape->material  = material_map.at(instance->material);
   }
 
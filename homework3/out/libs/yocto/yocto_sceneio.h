@@ -181,12 +181,15 @@ struct sceneio_shape {
 };
 
 // Object.
+// Instance arrays place copies of the shape at frames[i] * frame, without
+// storing an object per copy.
 struct sceneio_instance {
   // instance data
   string            name     = "";
   frame3f           frame    = identity3x4f;
   sceneio_shape*    shape    = nullptr;
   sceneio_material* material = nullptr;
+  vector<frame3f>   frames   = {};  // copies, if not empty
 };
 
 // Environment map.
@@ -220,6 +223,9 @@ struct sceneio_scene {
   vector<sceneio_texture*>     textures     = {};
   vector<sceneio_material*>    materials    = {};
 
+  // files referenced by the scene, set when loading
+  vector<string> sources = {};
+
   // cleanup
   ~sceneio_scene();
 };
@@ -283,9 +289,12 @@ bool save_scene(const string& filename, const sceneio_scene* scene,
 // -----------------------------------------------------------------------------
 namespace yocto {
 
-// Apply subdivision and displacement rules.
-void tesselate_shapes(
-    sceneio_scene* scene, const progress_callback& progress_cb = {});
+// Apply subdivision and displacement rules, in parallel over shapes.
+// Subdivided and displaced shapes are cached in `cachedir`, if not empty,
+// keyed by a hash of their data.
+void tesselate_shapes(sceneio_scene* scene,
+    const progress_callback& progress_cb = {}, const string& cachedir = "",
+    bool noparallel = false);
 void tesselate_shape(sceneio_shape* shape);
 
 }  // namespace yocto
@@ -1531,6 +1531,50 @@ pair<vector<vec2i>, vector<T>> subdivide_lines_impl(
   return tess;
 }
 
+// Split topology for one level of triangle subdivision. It depends only on
+// the triangles, so it is shared by all the vertex attributes.
+struct triangles_split {
+  int           nverts    = 0;
+  vector<vec2i> edges     = {};
+  vector<vec3i> triangles = {};
+};
+static triangles_split split_triangles(
+    const vector<vec3i>& triangles, int nverts) {
+  // get edges
+  auto emap  = make_edge_map(triangles);
+  auto split = triangles_split{nverts, get_edges(emap), {}};
+  // create triangles
+  auto nfaces      = (int)triangles.size();
+  auto& ttriangles = split.triangles;
+  ttriangles.resize(nfaces * 4);
+  for (auto i = 0; i < nfaces; i++) {
+    auto t                = triangles[i];
+    ttriangles[i * 4 + 0] = {t.x, nverts + edge_index(emap, {t.x, t.y}),
+        nverts + edge_index(emap, {t.z, t.x})};
+    ttriangles[i * 4 + 1] = {t.y, nverts + edge_index(emap, {t.y, t.z}),
+        nverts + edge_index(emap, {t.x, t.y})};
+    ttriangles[i * 4 + 2] = {t.z, nverts + edge_index(emap, {t.z, t.x}),
+        nverts + edge_index(emap, {t.y, t.z})};
+    ttriangles[i * 4 + 3] = {nverts + edge_index(emap, {t.x, t.y}),
+        nverts + edge_index(emap, {t.y, t.z}),
+        nverts + edge_index(emap, {t.z, t.x})};
+  }
+  return split;
+}
+template <typename T>
+static vector<T> split_triangles_vertices(
+    const triangles_split& split, const vector<T>& vert) {
+  auto nverts = split.nverts;
+  auto nedges = (int)split.edges.size();
+  auto tvert  = vector<T>(nverts + nedges);
+  for (auto i = 0; i < nverts; i++) tvert[i] = vert[i];
+  for (auto i = 0; i < nedges; i++) {
+    auto e            = split.edges[i];
+    tvert[nverts + i] = (vert[e.x] + vert[e.y]) / 2;
+  }
+  return tvert;
+}
+
 // Subdivide triangle.
 template <typename T>
 void subdivide_triangles_impl(vector<vec3i>& triangles, vector<T>& vert,
@@ -1542,36 +1586,9 @@ void subdivide_triangles_impl(vector<vec3i>& triangles, vector<T>& vert,
   if (triangles.empty() || vert.empty()) return;
   // loop over levels
   for (auto l = 0; l < level; l++) {
-    // get edges
-    auto emap  = make_edge_map(triangles);
-    auto edges = get_edges(emap);
-    // number of elements
-    auto nverts = (int)vert.size();
-    auto nedges = (int)edges.size();
-    auto nfaces = (int)triangles.size();
-    // create vertices
-    auto tvert = vector<T>(nverts + nedges);
-    for (auto i = 0; i < nverts; i++) tvert[i] = vert[i];
-    for (auto i = 0; i < nedges; i++) {
-      auto e            = edges[i];
-      tvert[nverts + i] = (vert[e.x] + vert[e.y]) / 2;
-    }
-    // create triangles
-    auto ttriangles = vector<vec3i>(nfaces * 4);
-    for (auto i = 0; i < nfaces; i++) {
-      auto t                = triangles[i];
-      ttriangles[i * 4 + 0] = {t.x, nverts + edge_index(emap, {t.x, t.y}),
-          nverts + edge_index(emap, {t.z, t.x})};
-      ttriangles[i * 4 + 1] = {t.y, nverts + edge_index(emap, {t.y, t.z}),
-          nverts + edge_index(emap, {t.x, t.y})};
-      ttriangles[i * 4 + 2] = {t.z, nverts + edge_index(emap, {t.z, t.x}),
-          nverts + edge_index(emap, {t.y, t.z})};
-      ttriangles[i * 4 + 3] = {nverts + edge_index(emap, {t.x, t.y}),
-          nverts + edge_index(emap, {t.y, t.z}),
-          nverts + edge_index(emap, {t.z, t.x})};
-    }
-    swap(ttriangles, triangles);
-    swap(tvert, vert);
+    auto split = split_triangles(triangles, (int)vert.size());
+    vert       = split_triangles_vertices(split, vert);
+    triangles  = std::move(split.triangles);
   }
 }
 template <typename T>
@@ -1582,6 +1599,86 @@ pair<vector<vec3i>, vector<T>> subdivide_triangles_impl(
   return tess;
 }
 
+// Split topology for one level of quad subdivision. It depends only on the
+// quads, so it is shared by all the vertex attributes. The split boundary is
+// only needed by Catmull-Clark.
+struct quads_split {
+  int           nverts   = 0;
+  vector<vec2i> edges    = {};
+  vector<vec4i> quads    = {};
+  vector<vec2i> boundary = {};
+};
+static quads_split split_quads(
+    const vector<vec4i>& quads, int nverts, bool with_boundary) {
+  // get edges
+  auto emap  = make_edge_map(quads);
+  auto split = quads_split{nverts, get_edges(emap), {}, {}};
+  // number of elements
+  auto nedges = (int)split.edges.size();
+  auto nfaces = (int)quads.size();
+  // create quads
+  auto& tquads = split.quads;
+  tquads.resize(nfaces * 4);  // conservative allocation
+  auto qi = 0;
+  for (auto i = 0; i < nfaces; i++) {
+    auto q = quads[i];
+    if (q.z != q.w) {
+      tquads[qi++] = {q.x, nverts + edge_index(emap, {q.x, q.y}),
+          nverts + nedges + i, nverts + edge_index(emap, {q.w, q.x})};
+      tquads[qi++] = {q.y, nverts + edge_index(emap, {q.y, q.z}),
+          nverts + nedges + i, nverts + edge_index(emap, {q.x, q.y})};
+      tquads[qi++] = {q.z, nverts + edge_index(emap, {q.z, q.w}),
+          nverts + nedges + i, nverts + edge_index(emap, {q.y, q.z})};
+      tquads[qi++] = {q.w, nverts + edge_index(emap, {q.w, q.x}),
+          nverts + nedges + i, nverts + edge_index(emap, {q.z, q.w})};
+    } else {
+      tquads[qi++] = {q.x, nverts + edge_index(emap, {q.x, q.y}),
+          nverts + nedges + i, nverts + edge_index(emap, {q.z, q.x})};
+      tquads[qi++] = {q.y, nverts + edge_index(emap, {q.y, q.z}),
+          nverts + nedges + i, nverts + edge_index(emap, {q.x, q.y})};
+      tquads[qi++] = {q.z, nverts + edge_index(emap, {q.z, q.x}),
+          nverts + nedges + i, nverts + edge_index(emap, {q.y, q.z})};
+    }
+  }
+  tquads.resize(qi);
+  // split boundary
+  if (with_boundary) {
+    auto boundary  = get_boundary(emap);
+    auto nboundary = (int)boundary.size();
+    auto& tboundary = split.boundary;
+    tboundary.resize(nboundary * 2);
+    for (auto i = 0; i < nboundary; i++) {
+      auto e               = boundary[i];
+      tboundary[i * 2 + 0] = {e.x, nverts + edge_index(emap, e)};
+      tboundary[i * 2 + 1] = {nverts + edge_index(emap, e), e.y};
+    }
+  }
+  return split;
+}
+template <typename T>
+static vector<T> split_quads_vertices(const vector<vec4i>& quads,
+    const quads_split& split, const vector<T>& vert) {
+  auto nverts = split.nverts;
+  auto nedges = (int)split.edges.size();
+  auto nfaces = (int)quads.size();
+  auto tvert  = vector<T>(nverts + nedges + nfaces);
+  for (auto i = 0; i < nverts; i++) tvert[i] = vert[i];
+  for (auto i = 0; i < nedges; i++) {
+    auto e            = split.edges[i];
+    tvert[nverts + i] = (vert[e.x] + vert[e.y]) / 2;
+  }
+  for (auto i = 0; i < nfaces; i++) {
+    auto q = quads[i];
+    if (q.z != q.w) {
+      tvert[nverts + nedges + i] =
+          (vert[q.x] + vert[q.y] + vert[q.z] + vert[q.w]) / 4;
+    } else {
+      tvert[nverts + nedges + i] = (vert[q.x] + vert[q.y] + vert[q.z]) / 3;
+    }
+  }
+  return tvert;
+}
+
 // Subdivide quads.
 template <typename T>
 void subdivide_quads_impl(vector<vec4i>& quads, vector<T>& vert,
@@ -1593,56 +1690,9 @@ void subdivide_quads_impl(vector<vec4i>& quads, vector<T>& vert,
   if (quads.empty() || vert.empty()) return;
   // loop over levels
   for (auto l = 0; l < level; l++) {
-    // get edges
-    auto emap  = make_edge_map(quads);
-    auto edges = get_edges(emap);
-    // number of elements
-    auto nverts = (int)vert.size();
-    auto nedges = (int)edges.size();
-    auto nfaces = (int)quads.size();
-    // create vertices
-    auto tvert = vector<T>(nverts + nedges + nfaces);
-    for (auto i = 0; i < nverts; i++) tvert[i] = vert[i];
-    for (auto i = 0; i < nedges; i++) {
-      auto e            = edges[i];
-      tvert[nverts + i] = (vert[e.x] + vert[e.y]) / 2;
-    }
-    for (auto i = 0; i < nfaces; i++) {
-      auto q = quads[i];
-      if (q.z != q.w) {
-        tvert[nverts + nedges + i] =
-            (vert[q.x] + vert[q.y] + vert[q.z] + vert[q.w]) / 4;
-      } else {
-        tvert[nverts + nedges + i] = (vert[q.x] + vert[q.y] + vert[q.z]) / 3;
-      }
-    }
-    // create quads
-    auto tquads = vector<vec4i>(nfaces * 4);  // conservative allocation
-    auto qi     = 0;
-    for (auto i = 0; i < nfaces; i++) {
-      auto q = quads[i];
-      if (q.z != q.w) {
-        tquads[qi++] = {q.x, nverts + edge_index(emap, {q.x, q.y}),
-            nverts + nedges + i, nverts + edge_index(emap, {q.w, q.x})};
-        tquads[qi++] = {q.y, nverts + edge_index(emap, {q.y, q.z}),
-            nverts + nedges + i, nverts + edge_index(emap, {q.x, q.y})};
-        tquads[qi++] = {q.z, nverts + edge_index(emap, {q.z, q.w}),
-            nverts + nedges + i, nverts + edge_index(emap, {q.y, q.z})};
-        tquads[qi++] = {q.w, nverts + edge_index(emap, {q.w, q.x}),
-            nverts + nedges + i, nverts + edge_index(emap, {q.z, q.w})};
-      } else {
-        tquads[qi++] = {q.x, nverts + edge_index(emap, {q.x, q.y}),
-            nverts + nedges + i, nverts + edge_index(emap, {q.z, q.x})};
-        tquads[qi++] = {q.y, nverts + edge_index(emap, {q.y, q.z}),
-            nverts + nedges + i, nverts + edge_index(emap, {q.x, q.y})};
-        tquads[qi++] = {q.z, nverts + edge_index(emap, {q.z, q.x}),
-            nverts + nedges + i, nverts + edge_index(emap, {q.y, q.z})};
-      }
-    }
-    tquads.resize(qi);
-    // done
-    swap(tquads, quads);
-    swap(tvert, vert);
+    auto split = split_quads(quads, (int)vert.size(), false);
+    vert       = split_quads_vertices(quads, split, vert);
+    quads      = std::move(split.quads);
   }
 }
 template <typename T>
@@ -1701,6 +1751,64 @@ pair<vector<vec4i>, vector<T>> subdivide_beziers_impl(
   return tess;
 }
 
+// Apply the Catmull-Clark averaging and correction rules to split vertices.
+template <typename T>
+static vector<T> smooth_catmullclark_vertices(
+    const quads_split& split, const vector<T>& tvert, bool lock_boundary) {
+  // setup creases -----------------------------------
+  auto tcrease_edges = vector<vec2i>();
+  auto tcrease_verts = vector<int>();
+  if (lock_boundary) {
+    for (auto& b : split.boundary) {
+      tcrease_verts.push_back(b.x);
+      tcrease_verts.push_back(b.y);
+    }
+  } else {
+    for (auto& b : split.boundary) tcrease_edges.push_back(b);
+  }
+
+  // define vertex valence ---------------------------
+  auto tvert_val = vector<int>(tvert.size(), 2);
+  for (auto& e : split.boundary) {
+    tvert_val[e.x] = (lock_boundary) ? 0 : 1;
+    tvert_val[e.y] = (lock_boundary) ? 0 : 1;
+  }
+
+  // averaging pass ----------------------------------
+  auto avert  = vector<T>(tvert.size(), T());
+  auto acount = vector<int>(tvert.size(), 0);
+  for (auto p : tcrease_verts) {
+    if (tvert_val[p] != 0) continue;
+    avert[p] += tvert[p];
+    acount[p] += 1;
+  }
+  for (auto& e : tcrease_edges) {
+    auto c = (tvert[e.x] + tvert[e.y]) / 2;
+    for (auto vid : {e.x, e.y}) {
+      if (tvert_val[vid] != 1) continue;
+      avert[vid] += c;
+      acount[vid] += 1;
+    }
+  }
+  for (auto& q : split.quads) {
+    auto c = (tvert[q.x] + tvert[q.y] + tvert[q.z] + tvert[q.w]) / 4;
+    for (auto vid : {q.x, q.y, q.z, q.w}) {
+      if (tvert_val[vid] != 2) continue;
+      avert[vid] += c;
+      acount[vid] += 1;
+    }
+  }
+  for (auto i = 0; i < tvert.size(); i++) avert[i] /= (float)acount[i];
+
+  // correction pass ----------------------------------
+  // p = p + (avg_p - p) * (4/avg_count)
+  for (auto i = 0; i < tvert.size(); i++) {
+    if (tvert_val[i] != 2) continue;
+    avert[i] = tvert[i] + (avert[i] - tvert[i]) * (4 / (float)acount[i]);
+  }
+  return avert;
+}
+
 // Subdivide catmullclark.
 template <typename T>
 void subdivide_catmullclark_impl(vector<vec4i>& quads, vector<T>& vert,
@@ -1713,122 +1821,10 @@ void subdivide_catmullclark_impl(vector<vec4i>& quads, vector<T>& vert,
   if (quads.empty() || vert.empty()) return;
   // loop over levels
   for (auto l = 0; l < level; l++) {
-    // get edges
-    auto emap     = make_edge_map(quads);
-    auto edges    = get_edges(emap);
-    auto boundary = get_boundary(emap);
-    // number of elements
-    auto nverts    = (int)vert.size();
-    auto nedges    = (int)edges.size();
-    auto nboundary = (int)boundary.size();
-    auto nfaces    = (int)quads.size();
-
-    // split elements ------------------------------------
-    // create vertices
-    auto tvert = vector<T>(nverts + nedges + nfaces);
-    for (auto i = 0; i < nverts; i++) tvert[i] = vert[i];
-    for (auto i = 0; i < nedges; i++) {
-      auto e            = edges[i];
-      tvert[nverts + i] = (vert[e.x] + vert[e.y]) / 2;
-    }
-    for (auto i = 0; i < nfaces; i++) {
-      auto q = quads[i];
-      if (q.z != q.w) {
-        tvert[nverts + nedges + i] =
-            (vert[q.x] + vert[q.y] + vert[q.z] + vert[q.w]) / 4;
-      } else {
-        tvert[nverts + nedges + i] = (vert[q.x] + vert[q.y] + vert[q.z]) / 3;
-      }
-    }
-    // create quads
-    auto tquads = vector<vec4i>(nfaces * 4);  // conservative allocation
-    auto qi     = 0;
-    for (auto i = 0; i < nfaces; i++) {
-      auto q = quads[i];
-      if (q.z != q.w) {
-        tquads[qi++] = {q.x, nverts + edge_index(emap, {q.x, q.y}),
-            nverts + nedges + i, nverts + edge_index(emap, {q.w, q.x})};
-        tquads[qi++] = {q.y, nverts + edge_index(emap, {q.y, q.z}),
-            nverts + nedges + i, nverts + edge_index(emap, {q.x, q.y})};
-        tquads[qi++] = {q.z, nverts + edge_index(emap, {q.z, q.w}),
-            nverts + nedges + i, nverts + edge_index(emap, {q.y, q.z})};
-        tquads[qi++] = {q.w, nverts + edge_index(emap, {q.w, q.x}),
-            nverts + nedges + i, nverts + edge_index(emap, {q.z, q.w})};
-      } else {
-        tquads[qi++] = {q.x, nverts + edge_index(emap, {q.x, q.y}),
-            nverts + nedges + i, nverts + edge_index(emap, {q.z, q.x})};
-        tquads[qi++] = {q.y, nverts + edge_index(emap, {q.y, q.z}),
-            nverts + nedges + i, nverts + edge_index(emap, {q.x, q.y})};
-        tquads[qi++] = {q.z, nverts + edge_index(emap, {q.z, q.x}),
-            nverts + nedges + i, nverts + edge_index(emap, {q.y, q.z})};
-      }
-    }
-    tquads.resize(qi);
-
-    // split boundary
-    auto tboundary = vector<vec2i>(nboundary * 2);
-    for (auto i = 0; i < nboundary; i++) {
-      auto e               = boundary[i];
-      tboundary[i * 2 + 0] = {e.x, nverts + edge_index(emap, e)};
-      tboundary[i * 2 + 1] = {nverts + edge_index(emap, e), e.y};
-    }
-
-    // setup creases -----------------------------------
-    auto tcrease_edges = vector<vec2i>();
-    auto tcrease_verts = vector<int>();
-    if (lock_boundary) {
-      for (auto& b : tboundary) {
-        tcrease_verts.push_back(b.x);
-        tcrease_verts.push_back(b.y);
-      }
-    } else {
-      for (auto& b : tboundary) tcrease_edges.push_back(b);
-    }
-
-    // define vertex valence ---------------------------
-    auto tvert_val = vector<int>(tvert.size(), 2);
-    for (auto& e : tboundary) {
-      tvert_val[e.x] = (lock_boundary) ? 0 : 1;
-      tvert_val[e.y] = (lock_boundary) ? 0 : 1;
-    }
-
-    // averaging pass ----------------------------------
-    auto avert  = vector<T>(tvert.size(), T());
-    auto acount = vector<int>(tvert.size(), 0);
-    for (auto p : tcrease_verts) {
-      if (tvert_val[p] != 0) continue;
-      avert[p] += tvert[p];
-      acount[p] += 1;
-    }
-    for (auto& e : tcrease_edges) {
-      auto c = (tvert[e.x] + tvert[e.y]) / 2;
-      for (auto vid : {e.x, e.y}) {
-        if (tvert_val[vid] != 1) continue;
-        avert[vid] += c;
-        acount[vid] += 1;
-      }
-    }
-    for (auto& q : tquads) {
-      auto c = (tvert[q.x] + tvert[q.y] + tvert[q.z] + tvert[q.w]) / 4;
-      for (auto vid : {q.x, q.y, q.z, q.w}) {
-        if (tvert_val[vid] != 2) continue;
-        avert[vid] += c;
-        acount[vid] += 1;
-      }
-    }
-    for (auto i = 0; i < tvert.size(); i++) avert[i] /= (float)acount[i];
-
-    // correction pass ----------------------------------
-    // p = p + (avg_p - p) * (4/avg_count)
-    for (auto i = 0; i < tvert.size(); i++) {
-      if (tvert_val[i] != 2) continue;
-      avert[i] = tvert[i] + (avert[i] - tvert[i]) * (4 / (float)acount[i]);
-    }
-    tvert = avert;
-
-    // done
-    swap(tquads, quads);
-    swap(tvert, vert);
+    auto split = split_quads(quads, (int)vert.size(), true);
+    vert       = smooth_catmullclark_vertices(
+        split, split_quads_vertices(quads, split, vert), lock_boundary);
+    quads = std::move(split.quads);
   }
 }
 template <typename T>
@@ -1930,6 +1926,79 @@ pair<vector<vec4i>, vector<vec4f>> subdivide_catmullclark(
   return subdivide_catmullclark_impl(quads, vert, level, lock_boundary);
 }
 
+// Check that the vertex attributes subdivided together index the same
+// vertices, that is that they are empty or as many as the positions.
+static void check_vertex_attributes(const vector<vec3f>& positions,
+    const vector<vec3f>& normals, const vector<vec2f>& texcoords,
+    const vector<vec4f>& colors, const vector<float>& radius) {
+  auto check = [&positions](const auto& vert) {
+    if (!vert.empty() && vert.size() != positions.size())
+      throw std::runtime_error("vertex attributes of different sizes");
+  };
+  check(normals);
+  check(texcoords);
+  check(colors);
+  check(radius);
+}
+
+// Subdivide all vertex attributes, splitting the topology once per level.
+void subdivide_triangles(vector<vec3i>& triangles, vector<vec3f>& positions,
+    vector<vec3f>& normals, vector<vec2f>& texcoords, vector<vec4f>& colors,
+    vector<float>& radius, int level) {
+  if (triangles.empty() || positions.empty()) return;
+  check_vertex_attributes(positions, normals, texcoords, colors, radius);
+  for (auto l = 0; l < level; l++) {
+    auto split = split_triangles(triangles, (int)positions.size());
+    auto apply = [&split](auto& vert) {
+      if (!vert.empty()) vert = split_triangles_vertices(split, vert);
+    };
+    apply(positions);
+    apply(normals);
+    apply(texcoords);
+    apply(colors);
+    apply(radius);
+    triangles = std::move(split.triangles);
+  }
+}
+void subdivide_quads(vector<vec4i>& quads, vector<vec3f>& positions,
+    vector<vec3f>& normals, vector<vec2f>& texcoords, vector<vec4f>& colors,
+    vector<float>& radius, int level) {
+  if (quads.empty() || positions.empty()) return;
+  check_vertex_attributes(positions, normals, texcoords, colors, radius);
+  for (auto l = 0; l < level; l++) {
+    auto split = split_quads(quads, (int)positions.size(), false);
+    auto apply = [&quads, &split](auto& vert) {
+      if (!vert.empty()) vert = split_quads_vertices(quads, split, vert);
+    };
+    apply(positions);
+    apply(normals);
+    apply(texcoords);
+    apply(colors);
+    apply(radius);
+    quads = std::move(split.quads);
+  }
+}
+void subdivide_catmullclark(vector<vec4i>& quads, vector<vec3f>& positions,
+    vector<vec3f>& normals, vector<vec2f>& texcoords, vector<vec4f>& colors,
+    vector<float>& radius, int level) {
+  if (quads.empty() || positions.empty()) return;
+  check_vertex_attributes(positions, normals, texcoords, colors, radius);
+  for (auto l = 0; l < level; l++) {
+    auto split = split_quads(quads, (int)positions.size(), true);
+    auto apply = [&quads, &split](auto& vert, bool lock_boundary) {
+      if (vert.empty()) return;
+      vert = smooth_catmullclark_vertices(
+          split, split_quads_vertices(quads, split, vert), lock_boundary);
+    };
+    apply(positions, false);
+    apply(normals, true);
+    apply(texcoords, true);
+    apply(colors, false);
+    apply(radius, false);
+    quads = std::move(split.quads);
+  }
+}
+
 }  // namespace yocto
 
 // -----------------------------------------------------------------------------
@@ -3533,32 +3602,69 @@ bool load_shape(const string& filename, vector<int>& points,
 
   auto ext = path_extension(filename);
   if (ext == ".ply" || ext == ".PLY") {
-    // open ply
-    auto ply_guard = std::make_unique<ply_model>();
-    auto ply       = ply_guard.get();
-    if (!load_ply(filename, ply, error)) return false;
-
-    if (!facevarying) {
-      // gets vertex
-      get_positions(ply, positions);
-      get_normals(ply, normals);
-      get_texcoords(ply, texcoords, flip_texcoord);
-      get_colors(ply, colors);
-      get_radius(ply, radius);
-
-      // get faces
-      if (has_quads(ply)) {
-        get_quads(ply, quads);
-      } else {
-        get_triangles(ply, triangles);
+    // stream ply, appending each block to the shape arrays
+    auto ply_guard  = std::make_unique<ply_model>();
+    auto ply        = ply_guard.get();
+    auto has_quads_ = false;
+    auto element_cb = [&](ply_model* ply, ply_element* element, size_t) {
+      auto append = [](auto& values, auto& block) {
+        if (values.empty()) {
+          std::swap(values, block);
+        } else {
+          values.insert(values.end(), block.begin(), block.end());
+        }
+      };
+      if (element->name == "vertex") {
+        auto positions_ = vector<vec3f>{}, normals_ = vector<vec3f>{};
+        auto texcoords_ = vector<vec2f>{};
+        get_positions(ply, positions_);
+        get_normals(ply, normals_);
+        get_texcoords(ply, texcoords_, flip_texcoord);
+        append(positions, positions_);
+        append(normals, normals_);
+        append(texcoords, texcoords_);
+        if (!facevarying) {
+          auto colors_ = vector<vec4f>{};
+          auto radius_ = vector<float>{};
+          get_colors(ply, colors_);
+          get_radius(ply, radius_);
+          append(colors, colors_);
+          append(radius, radius_);
+        }
+      } else if (element->name == "face" && !facevarying) {
+        // faces are read as triangles until the first quad, then as quads
+        if (!has_quads_ && has_quads(ply)) {
+          has_quads_ = true;
+          quads.reserve(triangles.size());
+          for (auto& t : triangles) quads.push_back({t.x, t.y, t.z, t.z});
+          triangles = {};
+        }
+        if (has_quads_) {
+          auto quads_ = vector<vec4i>{};
+          get_quads(ply, quads_);
+          append(quads, quads_);
+        } else {
+          auto triangles_ = vector<vec3i>{};
+          get_triangles(ply, triangles_);
+          append(triangles, triangles_);
+        }
+      } else if (element->name == "face" && facevarying) {
+        auto quads_ = vector<vec4i>{};
+        get_quads(ply, quads_);
+        append(quadspos, quads_);
+      } else if (element->name == "line" && !facevarying) {
+        auto lines_ = vector<vec2i>{};
+        get_lines(ply, lines_);
+        append(lines, lines_);
+      } else if (element->name == "point" && !facevarying) {
+        auto points_ = vector<int>{};
+        get_points(ply, points_);
+        append(points, points_);
       }
-      get_lines(ply, lines);
-      get_points(ply, points);
-    } else {
-      get_positions(ply, positions);
-      get_normals(ply, normals);
-      get_texcoords(ply, texcoords, flip_texcoord);
-      get_quads(ply, quadspos);
+      return true;
+    };
+    if (!stream_ply(filename, ply, element_cb, error)) return false;
+    if (facevarying) {
       if (!normals.empty()) quadsnorm = quadspos;
       if (!texcoords.empty()) quadstexcoord = quadspos;
     }
@@ -3757,6 +3863,142 @@ bool save_shape(const string& filename, const generic_shape& shape,
 
 }  // namespace yocto
 
+// -----------------------------------------------------------------------------
+// IMPLEMENTATION OF SHAPE TESSELATION CACHE
+// -----------------------------------------------------------------------------
+namespace yocto {
+
+// Version of the tesselation algorithms, to be increased when their results
+// change, so that the cache does not return stale shapes
+static const auto tesselation_version = 2;
+
+// Hash of the inputs of a shape tesselation
+uint64_t hash_tesselation(int subdivisions, bool catmullclark, bool smooth,
+    float displacement, const vector<int>& points, const vector<vec2i>& lines,
+    const vector<vec3i>& triangles, const vector<vec4i>& quads,
+    const vector<vec4i>& quadspos, const vector<vec4i>& quadsnorm,
+    const vector<vec4i>& quadstexcoord, const vector<vec3f>& positions,
+    const vector<vec3f>& normals, const vector<vec2f>& texcoords,
+    const vector<vec4f>& colors, const vector<float>& radius,
+    const vec2i& displacement_size, const void* displacement_data,
+    size_t displacement_bytes) {
+  auto hash = fnv_hash{};
+  hash_value(hash, tesselation_version);
+  hash_value(hash, subdivisions);
+  hash_value(hash, catmullclark);
+  hash_value(hash, smooth);
+  hash_value(hash, displacement);
+  hash_values(hash, points);
+  hash_values(hash, lines);
+  hash_values(hash, triangles);
+  hash_values(hash, quads);
+  hash_values(hash, quadspos);
+  hash_values(hash, quadsnorm);
+  hash_values(hash, quadstexcoord);
+  hash_values(hash, positions);
+  hash_values(hash, normals);
+  hash_values(hash, texcoords);
+  hash_values(hash, colors);
+  hash_values(hash, radius);
+  hash_value(hash, displacement_size);
+  hash_value(hash, (uint64_t)displacement_bytes);
+  hash_data(hash, displacement_data, displacement_bytes);
+  return hash.value;
+}
+
+// Tesselation cache file of a hash
+string tesselation_filename(const string& cachedir, uint64_t hash) {
+  char name[32];
+  snprintf(name, sizeof(name), "%016llx.tess", (unsigned long long)hash);
+  return path_join(cachedir, name);
+}
+
+// Load a tesselated shape from the cache
+bool load_tesselation(const string& filename, vector<int>& points,
+    vector<vec2i>& lines, vector<vec3i>& triangles, vector<vec4i>& quads,
+    vector<vec3f>& positions, vector<vec3f>& normals, vector<vec2f>& texcoords,
+    vector<vec4f>& colors, vector<float>& radius, string& error) {
+  auto read_error = [filename, &error]() {
+    error = filename + ": read error";
+    return false;
+  };
+
+  // open file
+  auto fs = open_file(filename, "rb");
+  if (!fs) {
+    error = filename + ": file not found";
+    return false;
+  }
+  fseek(fs.fs, 0, SEEK_END);
+  auto length = (uint64_t)ftell(fs.fs);
+  fseek(fs.fs, 0, SEEK_SET);
+
+  // read buffers, checking their sizes against the file length
+  auto read_buffer = [&fs, &length](auto& values) {
+    auto size = (uint64_t)0;
+    if (!read_value(fs, size)) return false;
+    length -= sizeof(size);
+    if (size > length / sizeof(values[0])) return false;
+    length -= size * sizeof(values[0]);
+    values.resize(size);
+    return read_values(fs, values.data(), values.size());
+  };
+  auto tpoints    = vector<int>{};
+  auto tlines     = vector<vec2i>{};
+  auto ttriangles = vector<vec3i>{};
+  auto tquads     = vector<vec4i>{};
+  auto tpositions = vector<vec3f>{};
+  auto tnormals   = vector<vec3f>{};
+  auto ttexcoords = vector<vec2f>{};
+  auto tcolors    = vector<vec4f>{};
+  auto tradius    = vector<float>{};
+  if (!read_buffer(tpoints)) return read_error();
+  if (!read_buffer(tlines)) return read_error();
+  if (!read_buffer(ttriangles)) return read_error();
+  if (!read_buffer(tquads)) return read_error();
+  if (!read_buffer(tpositions)) return read_error();
+  if (!read_buffer(tnormals)) return read_error();
+  if (!read_buffer(ttexcoords)) return read_error();
+  if (!read_buffer(tcolors)) return read_error();
+  if (!read_buffer(tradius)) return read_error();
+
+  // done
+  points    = std::move(tpoints);
+  lines     = std::move(tlines);
+  triangles = std::move(ttriangles);
+  quads     = std::move(tquads);
+  positions = std::move(tpositions);
+  normals   = std::move(tnormals);
+  texcoords = std::move(ttexcoords);
+  colors    = std::move(tcolors);
+  radius    = std::move(tradius);
+  return true;
+}
+
+// Save a tesselated shape to the cache
+bool save_tesselation(const string& filename, const vector<int>& points,
+    const vector<vec2i>& lines, const vector<vec3i>& triangles,
+    const vector<vec4i>& quads, const vector<vec3f>& positions,
+    const vector<vec3f>& normals, const vector<vec2f>& texcoords,
+    const vector<vec4f>& colors, const vector<float>& radius, string& error) {
+  return save_atomic(
+      filename,
+      [&](file_stream& fs) {
+        auto write_buffer = [&fs](const auto& values) {
+          if (!write_value(fs, (uint64_t)values.size())) return false;
+          return write_values(fs, values.data(), values.size());
+        };
+        return write_buffer(points) && write_buffer(lines) &&
+               write_buffer(triangles) && write_buffer(quads) &&
+               write_buffer(positions) && write_buffer(normals) &&
+               write_buffer(texcoords) && write_buffer(colors) &&
+               write_buffer(radius);
+      },
+      error);
+}
+
+}  // namespace yocto
+
 // -----------------------------------------------------------------------------
 // IMPLEMENTATION OF SHAPE STATS AND VALIDATION
 // -----------------------------------------------------------------------------
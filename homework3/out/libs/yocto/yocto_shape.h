@@ -473,6 +473,19 @@ pair<vector<vec4i>, vector<vec4f>> subdivide_catmullclark(
     const vector<vec4i>& quads, const vector<vec4f>& vert, int level,
     bool lock_boundary = false);
 
+// Subdivide all vertex attributes of a shape together, computing the split
+// topology only once per level. Empty attributes are skipped. Catmull-Clark
+// locks the boundary of normals and texture coordinates.
+void subdivide_triangles(vector<vec3i>& triangles, vector<vec3f>& positions,
+    vector<vec3f>& normals, vector<vec2f>& texcoords, vector<vec4f>& colors,
+    vector<float>& radius, int level);
+void subdivide_quads(vector<vec4i>& quads, vector<vec3f>& positions,
+    vector<vec3f>& normals, vector<vec2f>& texcoords, vector<vec4f>& colors,
+    vector<float>& radius, int level);
+void subdivide_catmullclark(vector<vec4i>& quads, vector<vec3f>& positions,
+    vector<vec3f>& normals, vector<vec2f>& texcoords, vector<vec4f>& colors,
+    vector<float>& radius, int level);
+
 }  // namespace yocto
 
 // -----------------------------------------------------------------------------
@@ -566,6 +579,44 @@ bool save_shape(const string& filename, const vector<int>& points,
 
 }  // namespace yocto
 
+// -----------------------------------------------------------------------------
+// SHAPE TESSELATION CACHE
+// -----------------------------------------------------------------------------
+namespace yocto {
+
+// Hash of the inputs of a shape tesselation, used as the key of the
+// tesselation cache. The displacement texture is given by its size and data.
+// The hash includes a version of the subdivision and displacement
+// algorithms, so that shapes cached by older versions are not loaded.
+uint64_t hash_tesselation(int subdivisions, bool catmullclark, bool smooth,
+    float displacement, const vector<int>& points, const vector<vec2i>& lines,
+    const vector<vec3i>& triangles, const vector<vec4i>& quads,
+    const vector<vec4i>& quadspos, const vector<vec4i>& quadsnorm,
+    const vector<vec4i>& quadstexcoord, const vector<vec3f>& positions,
+    const vector<vec3f>& normals, const vector<vec2f>& texcoords,
+    const vector<vec4f>& colors, const vector<float>& radius,
+    const vec2i& displacement_size, const void* displacement_data,
+    size_t displacement_bytes);
+
+// Tesselation cache file of a hash
+string tesselation_filename(const string& cachedir, uint64_t hash);
+
+// Load/save a tesselated shape from the cache. Missing, truncated or
+// corrupted files fail to load, leaving the buffers unchanged. Files are
+// written aside and renamed, so that concurrent renders do not read partial
+// files.
+bool load_tesselation(const string& filename, vector<int>& points,
+    vector<vec2i>& lines, vector<vec3i>& triangles, vector<vec4i>& quads,
+    vector<vec3f>& positions, vector<vec3f>& normals, vector<vec2f>& texcoords,
+    vector<vec4f>& colors, vector<float>& radius, string& error);
+bool save_tesselation(const string& filename, const vector<int>& points,
+    const vector<vec2i>& lines, const vector<vec3i>& triangles,
+    const vector<vec4i>& quads, const vector<vec3f>& positions,
+    const vector<vec3f>& normals, const vector<vec2f>& texcoords,
+    const vector<vec4f>& colors, const vector<float>& radius, string& error);
+
+}  // namespace yocto
+
 // -----------------------------------------------------------------------------
 // SHAPE STATS AND VALIDATION
 // -----------------------------------------------------------------------------
@@ -29,13 +29,18 @@
 #include "yocto_trace.h"
 
 #include <algorithm>
+#include <chrono>
+#include <cstdio>
 #include <cstring>
 #include <deque>
 #include <memory>
 #include <stdexcept>
+#include <tuple>
+#include <unordered_map>
 #include <utility>
 
 #include "yocto_color.h"
+#include "yocto_commonio.h"
 #include "yocto_geometry.h"
 #include "yocto_parallel.h"
 #include "yocto_sampling.h"
@@ -49,6 +54,7 @@ namespace yocto {
 
 // using directives
 using std::deque;
+using std::unordered_map;
 using namespace std::string_literals;
 
 }  // namespace yocto
@@ -67,7 +73,19 @@ trace_scene::~trace_scene() {
   for (auto environment : environments) delete environment;
 }
 
-trace_lights::~trace_lights() {}
+trace_texture_cache::~trace_texture_cache() {
+  if (file != nullptr) fclose(file);
+}
+
+trace_texture::~trace_texture() {
+  for (auto& tile : tiles) delete tile.load();
+}
+
+trace_lights::~trace_lights() {
+  for (auto light : lights) delete light;
+  for (auto copy : copies) delete copy;
+  delete bvh;
+}
 
 // add element
 trace_camera* add_camera(trace_scene* scene) {
@@ -82,7 +100,9 @@ trace_shape* add_shape(trace_scene* scene) {
   return shape;
 }
 trace_texture* add_texture(trace_scene* scene) {
-  return scene->textures.emplace_back(new trace_texture{});
+  auto texture   = scene->textures.emplace_back(new trace_texture{});
+  texture->cache = scene->texture_cache.get();
+  return texture;
 }
 trace_instance* add_instance(trace_scene* scene) {
   auto instance         = scene->instances.emplace_back(new trace_instance{});
@@ -100,6 +120,9 @@ trace_material* add_material(trace_scene* scene) {
 // -----------------------------------------------------------------------------
 namespace yocto {
 
+// Check if a texture is encoded as sRGB bytes
+static bool is_ldr_texture(const trace_texture* texture);
+
 void tesselate_shape(trace_shape* shape) {
   if (shape->subdivisions > 0) {
     if (!shape->points.empty()) {
@@ -116,39 +139,17 @@ void tesselate_shape(trace_shape* shape) {
       std::tie(shape->lines, shape->positions) = subdivide_lines(
           shape->lines, shape->positions, shape->subdivisions);
     } else if (!shape->triangles.empty()) {
-      std::tie(std::ignore, shape->texcoords) = subdivide_triangles(
-          shape->triangles, shape->texcoords, shape->subdivisions);
-      std::tie(std::ignore, shape->normals) = subdivide_triangles(
-          shape->triangles, shape->normals, shape->subdivisions);
-      std::tie(std::ignore, shape->colors) = subdivide_triangles(
-          shape->triangles, shape->colors, shape->subdivisions);
-      std::tie(std::ignore, shape->radius) = subdivide_triangles(
-          shape->triangles, shape->radius, shape->subdivisions);
-      std::tie(shape->triangles, shape->positions) = subdivide_triangles(
-          shape->triangles, shape->positions, shape->subdivisions);
+      subdivide_triangles(shape->triangles, shape->positions, shape->normals,
+          shape->texcoords, shape->colors, shape->radius, shape->subdivisions);
     } else if (!shape->quads.empty()) {
       if (shape->catmullclark) {
-        std::tie(std::ignore, shape->texcoords) = subdivide_catmullclark(
-            shape->quads, shape->texcoords, shape->subdivisions, true);
-        std::tie(std::ignore, shape->normals) = subdivide_catmullclark(
-            shape->quads, shape->normals, shape->subdivisions, true);
-        std::tie(std::ignore, shape->colors) = subdivide_catmullclark(
-            shape->quads, shape->colors, shape->subdivisions);
-        std::tie(std::ignore, shape->radius) = subdivide_catmullclark(
-            shape->quads, shape->radius, shape->subdivisions);
-        std::tie(std::ignore, shape->positions) = subdivide_catmullclark(
-            shape->quads, shape->positions, shape->subdivisions);
+        subdivide_catmullclark(shape->quads, shape->positions, shape->normals,
+            shape->texcoords, shape->colors, shape->radius,
+            shape->subdivisions);
       } else {
-        std::tie(std::ignore, shape->texcoords) = subdivide_quads(
-            shape->quads, shape->texcoords, shape->subdivisions);
-        std::tie(std::ignore, shape->normals) = subdivide_quads(
-            shape->quads, shape->normals, shape->subdivisions);
-        std::tie(std::ignore, shape->colors) = subdivide_quads(
-            shape->quads, shape->colors, shape->subdivisions);
-        std::tie(std::ignore, shape->radius) = subdivide_quads(
-            shape->quads, shape->radius, shape->subdivisions);
-        std::tie(shape->quads, shape->positions) = subdivide_quads(
-            shape->quads, shape->positions, shape->subdivisions);
+        subdivide_quads(shape->quads, shape->positions, shape->normals,
+            shape->texcoords, shape->colors, shape->radius,
+            shape->subdivisions);
       }
     } else if (!shape->quadspos.empty()) {
       if (shape->catmullclark) {
@@ -194,7 +195,7 @@ void tesselate_shape(trace_shape* shape) {
       for (auto idx = 0; idx < shape->positions.size(); idx++) {
         auto disp = mean(
             eval_texture(shape->displacement_tex, shape->texcoords[idx], true));
-        if (!shape->displacement_tex->ldr.empty()) disp -= 0.5f;
+        if (is_ldr_texture(shape->displacement_tex)) disp -= 0.5f;
         shape->positions[idx] += shape->normals[idx] * shape->displacement *
                                  disp;
       }
@@ -216,7 +217,7 @@ void tesselate_shape(trace_shape* shape) {
         for (auto i = 0; i < 4; i++) {
           auto disp = mean(eval_texture(
               shape->displacement_tex, shape->texcoords[qtxt[i]], true));
-          if (!shape->displacement_tex->ldr.empty()) disp -= 0.5f;
+          if (is_ldr_texture(shape->displacement_tex)) disp -= 0.5f;
           offset[qpos[i]] += shape->displacement * disp;
           count[qpos[i]] += 1;
         }
@@ -247,15 +248,83 @@ void tesselate_shape(trace_shape* shape) {
   }
 }
 
-void tesselate_shapes(
-    trace_scene* scene, const progress_callback& progress_cb) {
+// Hash of the inputs of tesselate_shape(), used as the key of the
+// tesselation cache
+static uint64_t hash_tesselation(const trace_shape* shape) {
+  auto texture = shape->displacement != 0 ? shape->displacement_tex : nullptr;
+  auto size    = zero2i;
+  auto data    = (const void*)nullptr;
+  auto bytes   = (size_t)0;
+  if (texture != nullptr && !texture->hdr.empty()) {
+    size  = texture->hdr.imsize();
+    data  = texture->hdr.data();
+    bytes = texture->hdr.count() * sizeof(vec4f);
+  } else if (texture != nullptr && !texture->ldr.empty()) {
+    size  = texture->ldr.imsize();
+    data  = texture->ldr.data();
+    bytes = texture->ldr.count() * sizeof(vec4b);
+  }
+  return hash_tesselation(shape->subdivisions, shape->catmullclark,
+      shape->smooth, shape->displacement, shape->points, shape->lines,
+      shape->triangles, shape->quads, shape->quadspos, shape->quadsnorm,
+      shape->quadstexcoord, shape->positions, shape->normals, shape->texcoords,
+      shape->colors, shape->radius, size, data, bytes);
+}
+
+// Load a tesselated shape from the cache
+static bool load_tesselation(const string& filename, trace_shape* shape) {
+  auto error = string{};
+  if (!load_tesselation(filename, shape->points, shape->lines,
+          shape->triangles, shape->quads, shape->positions, shape->normals,
+          shape->texcoords, shape->colors, shape->radius, error))
+    return false;
+  shape->quadspos         = {};
+  shape->quadsnorm        = {};
+  shape->quadstexcoord    = {};
+  shape->subdivisions     = 0;
+  shape->displacement     = 0;
+  shape->displacement_tex = nullptr;
+  return true;
+}
+
+// Save a tesselated shape to the cache
+static bool save_tesselation(const string& filename, const trace_shape* shape) {
+  auto error = string{};
+  return save_tesselation(filename, shape->points, shape->lines,
+      shape->triangles, shape->quads, shape->positions, shape->normals,
+      shape->texcoords, shape->colors, shape->radius, error);
+}
+
+void tesselate_shapes(trace_scene* scene, const progress_callback& progress_cb,
+    const string& cachedir, bool noparallel) {
   // handle progress
-  auto progress = vec2i{0, (int)scene->shapes.size()};
+  auto progress       = vec2i{0, (int)scene->shapes.size()};
+  auto progress_mutex = std::mutex{};
+
+  // the cache only saves time, so its errors fall back to tesselating
+  auto error    = string{};
+  auto usecache = !cachedir.empty() && make_directory(cachedir, error);
 
   // tesselate shapes
-  for (auto shape : scene->shapes) {
-    if (progress_cb) progress_cb("tesselate shape", progress.x++, progress.y);
+  auto tesselate = [&](int idx) {
+    auto shape = scene->shapes[idx];
+    if (progress_cb) {
+      auto lock = std::lock_guard{progress_mutex};
+      progress_cb("tesselate shape", progress.x++, progress.y);
+    }
+    auto cacheable = shape->subdivisions > 0 ||
+                     (shape->displacement != 0 &&
+                         shape->displacement_tex != nullptr);
+    if (!usecache || !cacheable) return tesselate_shape(shape);
+    auto filename = tesselation_filename(cachedir, hash_tesselation(shape));
+    if (load_tesselation(filename, shape)) return;
     tesselate_shape(shape);
+    save_tesselation(filename, shape);
+  };
+  if (noparallel) {
+    for (auto idx = 0; idx < (int)scene->shapes.size(); idx++) tesselate(idx);
+  } else {
+    parallel_for_batch((int)scene->shapes.size(), 1, tesselate);
   }
 
   // done
@@ -264,14 +333,309 @@ void tesselate_shapes(
 
 }  // namespace yocto
 
+// -----------------------------------------------------------------------------
+// IMPLEMENTATION OF BINARY SCENES
+// -----------------------------------------------------------------------------
+namespace yocto {
+
+// Binary scene stream. Saving and loading share the same visit functions,
+// that write or read values depending on the mode, so that the two layouts
+// cannot diverge. Element references are stored as indices.
+struct binary_scene_stream {
+  file_stream&                    fs;
+  bool                            save      = false;
+  uint64_t                        remaining = 0;  // bytes left when loading
+  unordered_map<const void*, int> ids       = {};
+};
+
+// Sizes read from the file are checked against the bytes left, so that
+// corrupt files fail instead of allocating unbounded buffers.
+template <typename T>
+static bool visit_value(binary_scene_stream& bs, T& value) {
+  if (bs.save) return write_value(bs.fs, value);
+  if (sizeof(T) > bs.remaining || !read_value(bs.fs, value)) return false;
+  bs.remaining -= sizeof(T);
+  return true;
+}
+template <typename T>
+static bool visit_values(binary_scene_stream& bs, vector<T>& values) {
+  auto size = (uint64_t)values.size();
+  if (!visit_value(bs, size)) return false;
+  if (bs.save) return write_values(bs.fs, values.data(), values.size());
+  if (size > bs.remaining / sizeof(T)) return false;
+  bs.remaining -= size * sizeof(T);
+  values.resize(size);
+  return read_values(bs.fs, values.data(), values.size());
+}
+static bool visit_string(binary_scene_stream& bs, string& value) {
+  auto size = (uint64_t)value.size();
+  if (!visit_value(bs, size)) return false;
+  if (bs.save) return write_values(bs.fs, value.data(), value.size());
+  if (size > bs.remaining) return false;
+  bs.remaining -= size;
+  value.resize(size);
+  return read_values(bs.fs, value.data(), value.size());
+}
+template <typename T>
+static bool visit_image(binary_scene_stream& bs, image<T>& img) {
+  auto size = img.imsize();
+  if (!visit_value(bs, size)) return false;
+  if (bs.save) return write_values(bs.fs, img.data(), img.count());
+  if (size.x < 0 || size.y < 0) return false;
+  if ((uint64_t)size.x * (uint64_t)size.y > bs.remaining / sizeof(T))
+    return false;
+  bs.remaining -= (uint64_t)size.x * (uint64_t)size.y * sizeof(T);
+  img = image<T>{size};
+  return read_values(bs.fs, img.data(), img.count());
+}
+template <typename T>
+static bool visit_ref(
+    binary_scene_stream& bs, T*& value, const vector<T*>& values) {
+  auto id = -1;
+  if (bs.save && value != nullptr) id = bs.ids.at(value);
+  if (!visit_value(bs, id)) return false;
+  if (bs.save) return true;
+  if (id < -1 || id >= (int)values.size()) return false;
+  value = id >= 0 ? values[id] : nullptr;
+  return true;
+}
+
+// Visit the scene elements. Elements are created when loading.
+static bool visit_scene(binary_scene_stream& bs, trace_scene* scene) {
+  // elements
+  auto sizes = array<uint64_t, 6>{scene->cameras.size(),
+      scene->textures.size(), scene->materials.size(), scene->shapes.size(),
+      scene->instances.size(), scene->environments.size()};
+  if (!visit_value(bs, sizes)) return false;
+  if (!bs.save) {
+    for (auto size : sizes)
+      if (size > bs.remaining) return false;
+    for (auto idx = (uint64_t)0; idx < sizes[0]; idx++) add_camera(scene);
+    for (auto idx = (uint64_t)0; idx < sizes[1]; idx++) add_texture(scene);
+    for (auto idx = (uint64_t)0; idx < sizes[2]; idx++) add_material(scene);
+    for (auto idx = (uint64_t)0; idx < sizes[3]; idx++) add_shape(scene);
+    for (auto idx = (uint64_t)0; idx < sizes[4]; idx++) add_instance(scene);
+    for (auto idx = (uint64_t)0; idx < sizes[5]; idx++)
+      add_environment(scene);
+  }
+  auto set_ids = [&bs](const auto& elements) {
+    for (auto idx = 0; idx < (int)elements.size(); idx++)
+      bs.ids[elements[idx]] = idx;
+  };
+  if (bs.save) {
+    set_ids(scene->cameras);
+    set_ids(scene->textures);
+    set_ids(scene->materials);
+    set_ids(scene->shapes);
+  }
+
+  // cameras
+  for (auto camera : scene->cameras) {
+    if (!visit_value(bs, *camera)) return false;
+  }
+
+  // textures
+  for (auto texture : scene->textures) {
+    if (!visit_image(bs, texture->hdr)) return false;
+    if (!visit_image(bs, texture->ldr)) return false;
+  }
+
+  // materials
+  auto& textures = scene->textures;
+  for (auto material : scene->materials) {
+    if (!visit_value(bs, material->emission)) return false;
+    if (!visit_value(bs, material->color)) return false;
+    if (!visit_value(bs, material->specular)) return false;
+    if (!visit_value(bs, material->roughness)) return false;
+    if (!visit_value(bs, material->metallic)) return false;
+    if (!visit_value(bs, material->ior)) return false;
+    if (!visit_value(bs, material->spectint)) return false;
+    if (!visit_value(bs, material->coat)) return false;
+    if (!visit_value(bs, material->transmission)) return false;
+    if (!visit_value(bs, material->translucency)) return false;
+    if (!visit_value(bs, material->scattering)) return false;
+    if (!visit_value(bs, material->scanisotropy)) return false;
+    if (!visit_value(bs, material->trdepth)) return false;
+    if (!visit_value(bs, material->opacity)) return false;
+    if (!visit_value(bs, material->thin)) return false;
+    if (!visit_ref(bs, material->emission_tex, textures)) return false;
+    if (!visit_ref(bs, material->color_tex, textures)) return false;
+    if (!visit_ref(bs, material->specular_tex, textures)) return false;
+    if (!visit_ref(bs, material->metallic_tex, textures)) return false;
+    if (!visit_ref(bs, material->roughness_tex, textures)) return false;
+    if (!visit_ref(bs, material->transmission_tex, textures)) return false;
+    if (!visit_ref(bs, material->translucency_tex, textures)) return false;
+    if (!visit_ref(bs, material->spectint_tex, textures)) return false;
+    if (!visit_ref(bs, material->scattering_tex, textures)) return false;
+    if (!visit_ref(bs, material->coat_tex, textures)) return false;
+    if (!visit_ref(bs, material->opacity_tex, textures)) return false;
+    if (!visit_ref(bs, material->normal_tex, textures)) return false;
+  }
+
+  // shapes
+  for (auto shape : scene->shapes) {
+    if (!visit_values(bs, shape->points)) return false;
+    if (!visit_values(bs, shape->lines)) return false;
+    if (!visit_values(bs, shape->triangles)) return false;
+    if (!visit_values(bs, shape->quads)) return false;
+    if (!visit_values(bs, shape->quadspos)) return false;
+    if (!visit_values(bs, shape->quadsnorm)) return false;
+    if (!visit_values(bs, shape->quadstexcoord)) return false;
+    if (!visit_values(bs, shape->positions)) return false;
+    if (!visit_values(bs, shape->normals)) return false;
+    if (!visit_values(bs, shape->texcoords)) return false;
+    if (!visit_values(bs, shape->colors)) return false;
+    if (!visit_values(bs, shape->radius)) return false;
+    if (!visit_values(bs, shape->tangents)) return false;
+    if (!visit_value(bs, shape->subdivisions)) return false;
+    if (!visit_value(bs, shape->catmullclark)) return false;
+    if (!visit_value(bs, shape->smooth)) return false;
+    if (!visit_value(bs, shape->displacement)) return false;
+    if (!visit_ref(bs, shape->displacement_tex, textures)) return false;
+  }
+
+  // instances
+  for (auto instance : scene->instances) {
+    if (!visit_value(bs, instance->frame)) return false;
+    if (!visit_ref(bs, instance->shape, scene->shapes)) return false;
+    if (!visit_ref(bs, instance->material, scene->materials)) return false;
+    if (!visit_values(bs, instance->frames)) return false;
+  }
+
+  // environments
+  for (auto environment : scene->environments) {
+    if (!visit_value(bs, environment->frame)) return false;
+    if (!visit_value(bs, environment->emission)) return false;
+    if (!visit_ref(bs, environment->emission_tex, textures)) return false;
+  }
+
+  return true;
+}
+
+// Binary scene header, checked before reading the scene
+static const auto binary_scene_magic   = (uint64_t)0x31454e4543534259ull;
+static const auto binary_scene_version = 2;
+
+// Visit the header up to the sources
+static bool visit_header(binary_scene_stream& bs, vector<string>& sources) {
+  auto magic   = binary_scene_magic;
+  auto version = binary_scene_version;
+  if (!visit_value(bs, magic)) return false;
+  if (!visit_value(bs, version)) return false;
+  if (magic != binary_scene_magic || version != binary_scene_version)
+    return false;
+  auto size = (uint64_t)sources.size();
+  if (!visit_value(bs, size)) return false;
+  if (!bs.save) {
+    if (size > bs.remaining) return false;
+    sources.resize(size);
+  }
+  for (auto& source : sources) {
+    if (!visit_string(bs, source)) return false;
+  }
+  return true;
+}
+
+// Length of a file opened for reading
+static uint64_t binary_scene_length(file_stream& fs) {
+  fseek(fs.fs, 0, SEEK_END);
+  auto length = (uint64_t)ftell(fs.fs);
+  fseek(fs.fs, 0, SEEK_SET);
+  return length;
+}
+
+bool save_binary_scene(const string& filename, const trace_scene* scene,
+    const trace_camera* camera, const vector<string>& sources, uint64_t key,
+    string& error) {
+  return save_atomic(
+      filename,
+      [scene, camera, &sources, key](file_stream& fs) {
+        auto bs = binary_scene_stream{fs, true};
+
+        // header
+        auto sources_ = sources;
+        auto key_     = key;
+        if (!visit_header(bs, sources_)) return false;
+        if (!visit_value(bs, key_)) return false;
+
+        // scene
+        if (!visit_scene(bs, (trace_scene*)scene)) return false;
+        auto camera_ = (trace_camera*)camera;
+        if (!visit_ref(bs, camera_, scene->cameras)) return false;
+        return true;
+      },
+      error);
+}
+
+bool load_binary_sources(
+    const string& filename, vector<string>& sources, string& error) {
+  // open file
+  auto fs = open_file(filename, "rb");
+  if (!fs) {
+    error = filename + ": file not found";
+    return false;
+  }
+  auto bs = binary_scene_stream{fs, false, binary_scene_length(fs)};
+
+  // header
+  if (!visit_header(bs, sources)) {
+    error = filename + ": out of date";
+    return false;
+  }
+  return true;
+}
+
+bool load_binary_scene(const string& filename, trace_scene* scene,
+    trace_camera*& camera, uint64_t key, string& error) {
+  auto read_error = [filename, &error]() {
+    error = filename + ": read error";
+    return false;
+  };
+  auto version_error = [filename, &error]() {
+    error = filename + ": out of date";
+    return false;
+  };
+
+  // open file
+  auto fs = open_file(filename, "rb");
+  if (!fs) {
+    error = filename + ": file not found";
+    return false;
+  }
+  auto bs = binary_scene_stream{fs, false, binary_scene_length(fs)};
+
+  // header
+  auto sources = vector<string>{};
+  auto key_    = (uint64_t)0;
+  if (!visit_header(bs, sources)) return version_error();
+  if (!visit_value(bs, key_)) return read_error();
+  if (key_ != key) return version_error();
+
+  // scene
+  if (!visit_scene(bs, scene)) return read_error();
+  if (!visit_ref(bs, camera, scene->cameras)) return read_error();
+
+  // done
+  return true;
+}
+
+}  // namespace yocto
+
 // -----------------------------------------------------------------------------
 // IMPLEMENTATION OF EVALUATION OF SCENE PROPERTIES
 // -----------------------------------------------------------------------------
 namespace yocto {
 
+// Check if a texture is encoded as sRGB bytes
+static bool is_ldr_texture(const trace_texture* texture) {
+  return texture->paged ? texture->paged_ldr : !texture->ldr.empty();
+}
+
 // Check texture size
 vec2i texture_size(const trace_texture* texture) {
-  if (!texture->hdr.empty()) {
+  if (texture->paged) {
+    return texture->levels[0];
+  } else if (!texture->hdr.empty()) {
     return texture->hdr.imsize();
   } else if (!texture->ldr.empty()) {
     return texture->ldr.imsize();
@@ -280,27 +644,174 @@ vec2i texture_size(const trace_texture* texture) {
   }
 }
 
-// Evaluate a texture
-vec4f lookup_texture(
-    const trace_texture* texture, const vec2i& ij, bool ldr_as_linear) {
-  if (!texture->hdr.empty()) {
-    return texture->hdr[ij];
-  } else if (!texture->ldr.empty()) {
-    return ldr_as_linear ? byte_to_float(texture->ldr[ij])
-                         : srgb_to_rgb(byte_to_float(texture->ldr[ij]));
+// Size of the tiles of the texture MIP levels
+const auto trace_texture_tile_size = 64;
+
+// Init the sizes of the MIP levels of a texture and their tiles. Each level
+// halves the size of the one before. Tiles of the image itself are used only
+// by paged textures.
+static void init_texture_mipmap(const trace_texture* texture) {
+  auto size       = texture_size(texture);
+  texture->levels = {size};
+  while (size.x > 1 || size.y > 1) {
+    size = max(size / 2, 1);
+    texture->levels.push_back(size);
+  }
+  texture->starts = vector<int>(texture->levels.size(), 0);
+  auto num_tiles  = 0;
+  for (auto level = 0; level < (int)texture->levels.size(); level++) {
+    auto tiles = (texture->levels[level] + trace_texture_tile_size - 1) /
+                 trace_texture_tile_size;
+    texture->starts[level] = num_tiles;
+    num_tiles += tiles.x * tiles.y;
+  }
+  texture->tiles = vector<atomic<trace_texture_tile*>>(num_tiles);
+  for (auto& tile : texture->tiles) tile = nullptr;
+}
+
+// Memory used by a texture tile
+static size_t get_tile_memory(const trace_texture_tile* tile) {
+  return sizeof(trace_texture_tile) + tile->hdr.size() * sizeof(vec4f) +
+         tile->ldr.size() * sizeof(vec4b);
+}
+
+// Seek in the cache file with 64-bit offsets
+static bool seek_texture_cache(FILE* fs, int64_t offset) {
+#ifdef _WIN32
+  return _fseeki64(fs, offset, SEEK_SET) == 0;
+#else
+  return fseeko(fs, (off_t)offset, SEEK_SET) == 0;
+#endif
+}
+
+// Get a tile of a MIP level. Missing tiles of the image of paged textures
+// are read from the cache file, while missing tiles of the other levels are
+// built from the level before, box filtering texels in the texture encoding.
+static vec4f lookup_texture(const trace_texture* texture, int level,
+    const vec2i& ij, bool ldr_as_linear);
+static const trace_texture_tile* get_texture_tile(
+    const trace_texture* texture, int level, const vec2i& tile) {
+  auto& size   = texture->levels[level];
+  auto  stride = (size.x + trace_texture_tile_size - 1) /
+                trace_texture_tile_size;
+  auto  index  = texture->starts[level] + tile.y * stride + tile.x;
+  auto& slot   = texture->tiles[index];
+  auto  ptr    = slot.load();
+  if (ptr == nullptr) {
+    auto origin = tile * trace_texture_tile_size;
+    auto extent = vec2i{min(trace_texture_tile_size, size.x - origin.x),
+        min(trace_texture_tile_size, size.y - origin.y)};
+    auto built  = new trace_texture_tile{};
+    auto ldr    = is_ldr_texture(texture);
+    if (!ldr) built->hdr.resize(extent.x * extent.y);
+    if (ldr) built->ldr.resize(extent.x * extent.y);
+    if (level == 0) {
+      auto  cache = texture->cache;
+      auto  lock  = std::lock_guard{cache->file_mutex};
+      auto  data  = ldr ? (void*)built->ldr.data() : (void*)built->hdr.data();
+      auto  bytes = ldr ? built->ldr.size() * sizeof(vec4b)
+                        : built->hdr.size() * sizeof(vec4f);
+      if (!seek_texture_cache(cache->file, texture->offsets[index]) ||
+          fread(data, 1, bytes, cache->file) != bytes)
+        throw std::runtime_error("cannot read texture cache");
+    } else {
+      auto prev = texture->levels[level - 1];
+      for (auto j = 0; j < extent.y; j++) {
+        for (auto i = 0; i < extent.x; i++) {
+          auto ij    = (origin + vec2i{i, j}) * 2;
+          auto ii    = min(ij + 1, prev - 1);
+          auto value = (lookup_texture(texture, level - 1, ij, true) +
+                           lookup_texture(texture, level - 1, {ii.x, ij.y},
+                               true) +
+                           lookup_texture(texture, level - 1, {ij.x, ii.y},
+                               true) +
+                           lookup_texture(texture, level - 1, ii, true)) /
+                       4;
+          if (!ldr) built->hdr[j * extent.x + i] = value;
+          if (ldr) built->ldr[j * extent.x + i] = float_to_byte(value);
+        }
+      }
+    }
+    if (slot.compare_exchange_strong(ptr, built)) {
+      ptr = built;
+      if (texture->cache) texture->cache->memory += get_tile_memory(built);
+    } else {
+      delete built;
+    }
+  }
+  auto clock = texture->cache ? texture->cache->clock.load() : 0;
+  if (ptr->used.load(std::memory_order_relaxed) != clock)
+    ptr->used.store(clock, std::memory_order_relaxed);
+  return ptr;
+}
+
+// Lookup a texel of a MIP level
+static vec4f lookup_texture(const trace_texture* texture, int level,
+    const vec2i& ij, bool ldr_as_linear) {
+  if (level == 0 && !texture->paged) {
+    if (!texture->hdr.empty()) {
+      return texture->hdr[ij];
+    } else if (!texture->ldr.empty()) {
+      return ldr_as_linear ? byte_to_float(texture->ldr[ij])
+                           : srgb_to_rgb(byte_to_float(texture->ldr[ij]));
+    } else {
+      return {1, 1, 1, 1};
+    }
+  }
+  auto tile   = get_texture_tile(texture, level, ij / trace_texture_tile_size);
+  auto& size  = texture->levels[level];
+  auto origin = (ij / trace_texture_tile_size) * trace_texture_tile_size;
+  auto width  = min(trace_texture_tile_size, size.x - origin.x);
+  auto idx    = (ij.y - origin.y) * width + (ij.x - origin.x);
+  if (!tile->hdr.empty()) {
+    return tile->hdr[idx];
   } else {
-    return {1, 1, 1, 1};
+    return ldr_as_linear ? byte_to_float(tile->ldr[idx])
+                         : srgb_to_rgb(byte_to_float(tile->ldr[idx]));
   }
 }
 
-// Evaluate a texture
-vec4f eval_texture(const trace_texture* texture, const vec2f& uv,
-    bool ldr_as_linear, bool no_interpolation, bool clamp_to_edge) {
-  // get texture
-  if (texture == nullptr) return {1, 1, 1, 1};
+// Slot of the current thread in the readers of the texture caches
+static int get_texture_readers_slot() {
+  static auto                   next = atomic<int>{0};
+  static thread_local const int slot = next++ %
+                                       trace_texture_cache::num_slots;
+  return slot;
+}
 
+// Evict the least recently used tiles
+static void trim_texture_cache(trace_texture_cache* cache);
+
+// A lookup that reads the tiles of a texture, counted as a reader of the
+// texture cache if tiles may be evicted. When the lookup ends, it trims the
+// cache if the cache is over its limit.
+struct trace_texture_reader {
+  trace_texture_reader(const trace_texture* texture) {
+    if (texture->cache == nullptr || texture->cache->limit == 0) return;
+    cache = texture->cache;
+    slot  = get_texture_readers_slot();
+    phase = cache->phase.load();
+    cache->readers[phase][slot].count += 1;
+  }
+  ~trace_texture_reader() {
+    if (cache == nullptr) return;
+    cache->readers[phase][slot].count -= 1;
+    if (cache->memory > cache->limit) trim_texture_cache(cache);
+  }
+  trace_texture_reader(const trace_texture_reader&) = delete;
+  trace_texture_reader& operator=(const trace_texture_reader&) = delete;
+
+  trace_texture_cache* cache = nullptr;
+  int                  slot  = 0;
+  int                  phase = 0;
+};
+
+// Evaluate a MIP level of a texture
+static vec4f eval_texture(const trace_texture* texture, int level,
+    const vec2f& uv, bool ldr_as_linear, bool no_interpolation,
+    bool clamp_to_edge) {
   // get image width/height
-  auto size = texture_size(texture);
+  auto size = level == 0 ? texture_size(texture) : texture->levels[level];
 
   // get coordinates normalized for tiling
   auto s = 0.0f, t = 0.0f;
@@ -319,13 +830,189 @@ vec4f eval_texture(const trace_texture* texture, const vec2f& uv,
   auto ii = (i + 1) % size.x, jj = (j + 1) % size.y;
   auto u = s - i, v = t - j;
 
-  if (no_interpolation) return lookup_texture(texture, {i, j}, ldr_as_linear);
+  if (no_interpolation)
+    return lookup_texture(texture, level, {i, j}, ldr_as_linear);
 
   // handle interpolation
-  return lookup_texture(texture, {i, j}, ldr_as_linear) * (1 - u) * (1 - v) +
-         lookup_texture(texture, {i, jj}, ldr_as_linear) * (1 - u) * v +
-         lookup_texture(texture, {ii, j}, ldr_as_linear) * u * (1 - v) +
-         lookup_texture(texture, {ii, jj}, ldr_as_linear) * u * v;
+  return lookup_texture(texture, level, {i, j}, ldr_as_linear) * (1 - u) *
+             (1 - v) +
+         lookup_texture(texture, level, {i, jj}, ldr_as_linear) * (1 - u) * v +
+         lookup_texture(texture, level, {ii, j}, ldr_as_linear) * u * (1 - v) +
+         lookup_texture(texture, level, {ii, jj}, ldr_as_linear) * u * v;
+}
+
+// Evaluate a texture
+vec4f lookup_texture(
+    const trace_texture* texture, const vec2i& ij, bool ldr_as_linear) {
+  if (!texture->paged) return lookup_texture(texture, 0, ij, ldr_as_linear);
+  auto reader = trace_texture_reader{texture};
+  return lookup_texture(texture, 0, ij, ldr_as_linear);
+}
+
+// Evaluate a texture. With a footprint, the texture is filtered by
+// interpolating the two MIP levels whose texels are closest to it.
+vec4f eval_texture(const trace_texture* texture, const vec2f& uv,
+    bool ldr_as_linear, bool no_interpolation, bool clamp_to_edge,
+    float footprint) {
+  // get texture
+  if (texture == nullptr) return {1, 1, 1, 1};
+
+  // pick mip level
+  auto size = texture_size(texture);
+  auto lod  = footprint > 0 && !no_interpolation
+                 ? log2(footprint * max(size.x, size.y))
+                 : 0.0f;
+  if (!(lod > 0) && !texture->paged)
+    return eval_texture(
+        texture, 0, uv, ldr_as_linear, no_interpolation, clamp_to_edge);
+  auto reader = trace_texture_reader{texture};
+  if (!(lod > 0))
+    return eval_texture(
+        texture, 0, uv, ldr_as_linear, no_interpolation, clamp_to_edge);
+  std::call_once(texture->mipmap, init_texture_mipmap, texture);
+  lod        = min(lod, (float)texture->levels.size() - 1);
+  auto level = (int)lod;
+  auto value = eval_texture(
+      texture, level, uv, ldr_as_linear, no_interpolation, clamp_to_edge);
+  if (level + 1 >= (int)texture->levels.size() || lod == level) return value;
+  return lerp(value,
+      eval_texture(texture, level + 1, uv, ldr_as_linear, no_interpolation,
+          clamp_to_edge),
+      lod - level);
+}
+
+// Wait for the readers of a phase of the texture cache
+static void wait_texture_readers(trace_texture_cache* cache, int phase) {
+  for (auto& readers : cache->readers[phase]) {
+    while (readers.count != 0) std::this_thread::yield();
+  }
+}
+
+// Evict the least recently used tiles. Tiles are unlinked first and deleted
+// once the lookups that could have read them are over. Only one thread
+// trims at a time, while the others go on.
+static void trim_texture_cache(trace_texture_cache* cache) {
+  auto lock = std::unique_lock{cache->trim_mutex, std::try_to_lock};
+  if (!lock.owns_lock()) return;
+  cache->clock += 1;
+  if (cache->limit == 0 || cache->memory <= cache->limit) return;
+  // trim below the limit, so that lookups do not trim at every new tile
+  auto target = cache->limit - cache->limit / 8;
+  // among tiles used at the same time, evict first the ones of finer levels,
+  // that are cheaper to get back than the ones built from them
+  auto tiles = vector<std::tuple<int, int, atomic<trace_texture_tile*>*>>{};
+  for (auto texture : cache->textures) {
+    for (auto level = 0; level < (int)texture->levels.size(); level++) {
+      auto start = texture->starts[level];
+      auto end   = level + 1 < (int)texture->levels.size()
+                       ? texture->starts[level + 1]
+                       : (int)texture->tiles.size();
+      for (auto index = start; index < end; index++) {
+        auto tile = texture->tiles[index].load();
+        if (tile == nullptr) continue;
+        tiles.push_back({tile->used.load(), level, &texture->tiles[index]});
+      }
+    }
+  }
+  std::sort(tiles.begin(), tiles.end(), [](auto& a, auto& b) {
+    return std::get<0>(a) != std::get<0>(b) ? std::get<0>(a) < std::get<0>(b)
+                                            : std::get<1>(a) < std::get<1>(b);
+  });
+  auto evicted = vector<trace_texture_tile*>{};
+  auto memory  = cache->memory.load();
+  for (auto& [used, level, slot] : tiles) {
+    if (memory <= target) break;
+    auto tile = slot->exchange(nullptr);
+    if (tile == nullptr) continue;
+    memory -= get_tile_memory(tile);
+    evicted.push_back(tile);
+  }
+  auto phase = cache->phase.load();
+  cache->phase = 1 - phase;
+  wait_texture_readers(cache, phase);
+  cache->phase = phase;
+  wait_texture_readers(cache, 1 - phase);
+  for (auto tile : evicted) {
+    cache->memory -= get_tile_memory(tile);
+    delete tile;
+  }
+}
+void trim_texture_cache(const trace_scene* scene) {
+  trim_texture_cache(scene->texture_cache.get());
+}
+
+// Position in the cache file with 64-bit offsets
+static int64_t tell_texture_cache(FILE* fs) {
+#ifdef _WIN32
+  return _ftelli64(fs);
+#else
+  return (int64_t)ftello(fs);
+#endif
+}
+
+// Write the image of a texture to the cache file by tiles
+template <typename T>
+static bool page_texture(
+    trace_texture* texture, const image<T>& img, FILE* fs) {
+  auto& size  = texture->levels[0];
+  auto  tiles = (size + trace_texture_tile_size - 1) / trace_texture_tile_size;
+  texture->offsets = vector<int64_t>(tiles.x * tiles.y, 0);
+  for (auto tj = 0; tj < tiles.y; tj++) {
+    for (auto ti = 0; ti < tiles.x; ti++) {
+      auto origin = vec2i{ti, tj} * trace_texture_tile_size;
+      auto extent = vec2i{min(trace_texture_tile_size, size.x - origin.x),
+          min(trace_texture_tile_size, size.y - origin.y)};
+      texture->offsets[tj * tiles.x + ti] = tell_texture_cache(fs);
+      for (auto j = 0; j < extent.y; j++) {
+        auto row = &img[{origin.x, origin.y + j}];
+        if (fwrite(row, sizeof(T), extent.x, fs) != (size_t)extent.x)
+          return false;
+      }
+    }
+  }
+  return true;
+}
+
+// Set up the texture cache
+bool init_texture_cache(
+    trace_scene* scene, const trace_params& params, string& error) {
+  auto cache   = scene->texture_cache.get();
+  cache->limit = (size_t)max(params.texcache, 0) << 20;
+  if (cache->limit == 0) return true;
+
+  // tiles of all textures, so that they can be evicted
+  cache->textures.clear();
+  for (auto texture : scene->textures) {
+    std::call_once(texture->mipmap, init_texture_mipmap, texture);
+    cache->textures.push_back(texture);
+  }
+
+  // page images
+  if (cache->file == nullptr) cache->file = std::tmpfile();
+  if (cache->file == nullptr) {
+    error = "cannot create texture cache file";
+    return false;
+  }
+  for (auto texture : scene->textures) {
+    if (texture->paged) continue;
+    if (texture->hdr.empty() && texture->ldr.empty()) continue;
+    if (fseek(cache->file, 0, SEEK_END) != 0 ||
+        !(texture->hdr.empty()
+                ? page_texture(texture, texture->ldr, cache->file)
+                : page_texture(texture, texture->hdr, cache->file))) {
+      error = "cannot write texture cache file";
+      return false;
+    }
+    texture->paged     = true;
+    texture->paged_ldr = !texture->ldr.empty();
+    texture->hdr       = {};
+    texture->ldr       = {};
+  }
+  if (fflush(cache->file) != 0) {
+    error = "cannot write texture cache file";
+    return false;
+  }
+  return true;
 }
 
 // Generates a ray from a camera for yimg::image plane coordinate uv and
@@ -524,8 +1211,8 @@ pair<vec3f, vec3f> eval_element_tangents(
   }
 }
 
-vec3f eval_normalmap(
-    const trace_instance* instance, int element, const vec2f& uv) {
+vec3f eval_normalmap(const trace_instance* instance, int element,
+    const vec2f& uv, float footprint) {
   auto shape      = instance->shape;
   auto normal_tex = instance->material->normal_tex;
   // apply normal mapping
@@ -533,7 +1220,8 @@ vec3f eval_normalmap(
   auto texcoord = eval_texcoord(instance, element, uv);
   if (normal_tex != nullptr &&
       (!shape->triangles.empty() || !shape->quads.empty())) {
-    auto normalmap = -1 + 2 * xyz(eval_texture(normal_tex, texcoord, true));
+    auto normalmap = -1 + 2 * xyz(eval_texture(normal_tex, texcoord, true,
+                                  false, false, footprint));
     auto [tu, tv]  = eval_element_tangents(instance, element);
     auto frame     = frame3f{tu, tv, normal, zero3f};
     frame.x        = orthonormalize(frame.x, frame.z);
@@ -547,13 +1235,13 @@ vec3f eval_normalmap(
 
 // Eval shading normal
 vec3f eval_shading_normal(const trace_instance* instance, int element,
-    const vec2f& uv, const vec3f& outgoing) {
+    const vec2f& uv, const vec3f& outgoing, float footprint) {
   auto shape    = instance->shape;
   auto material = instance->material;
   if (!shape->triangles.empty() || !shape->quads.empty()) {
     auto normal = eval_normal(instance, element, uv);
     if (material->normal_tex != nullptr) {
-      normal = eval_normalmap(instance, element, uv);
+      normal = eval_normalmap(instance, element, uv, footprint);
     }
     if (!material->thin) return normal;
     return dot(normal, outgoing) >= 0 ? normal : -normal;
@@ -610,37 +1298,36 @@ vec3f eval_environment(const trace_scene* scene, const vec3f& direction) {
 }
 
 // Evaluate point
-trace_material_sample eval_material(
-    const trace_material* material, const vec2f& texcoord) {
-  auto mat     = trace_material_sample{};
-  mat.emission = material->emission *
-                 xyz(eval_texture(material->emission_tex, texcoord, false));
-  mat.color = material->color *
-              xyz(eval_texture(material->color_tex, texcoord, false));
-  mat.specular = material->specular *
-                 eval_texture(material->specular_tex, texcoord, true).x;
-  mat.metallic = material->metallic *
-                 eval_texture(material->metallic_tex, texcoord, true).x;
+trace_material_sample eval_material(const trace_material* material,
+    const vec2f& texcoord, float footprint) {
+  auto eval_tex = [&texcoord, footprint](
+                      const trace_texture* texture, bool ldr_as_linear) {
+    return eval_texture(texture, texcoord, ldr_as_linear, false, false,
+        footprint);
+  };
+  auto mat      = trace_material_sample{};
+  mat.emission  = material->emission *
+                 xyz(eval_tex(material->emission_tex, false));
+  mat.color     = material->color * xyz(eval_tex(material->color_tex, false));
+  mat.specular  = material->specular * eval_tex(material->specular_tex, true).x;
+  mat.metallic  = material->metallic * eval_tex(material->metallic_tex, true).x;
   mat.roughness = material->roughness *
-                  eval_texture(material->roughness_tex, texcoord, true).x;
-  mat.ior  = material->ior;
-  mat.coat = material->coat *
-             eval_texture(material->coat_tex, texcoord, true).x;
+                  eval_tex(material->roughness_tex, true).x;
+  mat.ior          = material->ior;
+  mat.coat         = material->coat * eval_tex(material->coat_tex, true).x;
   mat.transmission = material->transmission *
-                     eval_texture(material->emission_tex, texcoord, true).x;
+                     eval_tex(material->emission_tex, true).x;
   mat.translucency = material->translucency *
-                     eval_texture(material->translucency_tex, texcoord, true).x;
-  mat.opacity = material->opacity *
-                eval_texture(material->opacity_tex, texcoord, true).x;
-  mat.thin       = material->thin || material->transmission == 0;
+                     eval_tex(material->translucency_tex, true).x;
+  mat.opacity = material->opacity * eval_tex(material->opacity_tex, true).x;
+  mat.thin    = material->thin || material->transmission == 0;
   mat.scattering = material->scattering *
-                   xyz(eval_texture(material->scattering_tex, texcoord, false));
+                   xyz(eval_tex(material->scattering_tex, false));
   mat.scanisotropy = material->scanisotropy;
   mat.trdepth      = material->trdepth;
-  mat.normalmap =
-      material->normal_tex != nullptr
-          ? -1 + 2 * xyz(eval_texture(material->normal_tex, texcoord, true))
-          : vec3f{0, 0, 1};
+  mat.normalmap    = material->normal_tex != nullptr
+                      ? -1 + 2 * xyz(eval_tex(material->normal_tex, true))
+                      : vec3f{0, 0, 1};
   return mat;
 }
 
@@ -650,45 +1337,53 @@ static const auto coat_roughness = 0.03f * 0.03f;
 
 // Eval material to obtain emission, brdf and opacity.
 vec3f eval_emission(const trace_instance* instance, int element,
-    const vec2f& uv, const vec3f& normal, const vec3f& outgoing) {
+    const vec2f& uv, const vec3f& normal, const vec3f& outgoing,
+    float footprint) {
   auto material = instance->material;
   auto texcoord = eval_texcoord(instance, element, uv);
   return material->emission *
-         xyz(eval_texture(material->emission_tex, texcoord));
+         xyz(eval_texture(material->emission_tex, texcoord, false, false,
+             false, footprint));
 }
 
 // Eval material to obtain emission, brdf and opacity.
 float eval_opacity(const trace_instance* instance, int element, const vec2f& uv,
-    const vec3f& normal, const vec3f& outgoing) {
+    const vec3f& normal, const vec3f& outgoing, float footprint) {
   auto material = instance->material;
   auto texcoord = eval_texcoord(instance, element, uv);
   auto opacity  = material->opacity *
-                 eval_texture(material->opacity_tex, texcoord, true).x;
+                 eval_texture(material->opacity_tex, texcoord, true, false,
+                     false, footprint)
+                     .x;
   if (opacity > 0.999f) opacity = 1;
   return opacity;
 }
 
 // Evaluate bsdf
 trace_bsdf eval_bsdf(const trace_instance* instance, int element,
-    const vec2f& uv, const vec3f& normal, const vec3f& outgoing) {
+    const vec2f& uv, const vec3f& normal, const vec3f& outgoing,
+    float footprint) {
   auto material = instance->material;
   auto texcoord = eval_texcoord(instance, element, uv);
-  auto color    = material->color * xyz(eval_color(instance, element, uv)) *
-               xyz(eval_texture(material->color_tex, texcoord, false));
+  auto eval_tex = [&texcoord, footprint](
+                      const trace_texture* texture, bool ldr_as_linear) {
+    return eval_texture(texture, texcoord, ldr_as_linear, false, false,
+        footprint);
+  };
+  auto color = material->color * xyz(eval_color(instance, element, uv)) *
+               xyz(eval_tex(material->color_tex, false));
   auto specular = material->specular *
-                  eval_texture(material->specular_tex, texcoord, true).x;
+                  eval_tex(material->specular_tex, true).x;
   auto metallic = material->metallic *
-                  eval_texture(material->metallic_tex, texcoord, true).x;
+                  eval_tex(material->metallic_tex, true).x;
   auto roughness = material->roughness *
-                   eval_texture(material->roughness_tex, texcoord, true).x;
-  auto ior  = material->ior;
-  auto coat = material->coat *
-              eval_texture(material->coat_tex, texcoord, true).x;
+                   eval_tex(material->roughness_tex, true).x;
+  auto ior          = material->ior;
+  auto coat         = material->coat * eval_tex(material->coat_tex, true).x;
   auto transmission = material->transmission *
-                      eval_texture(material->emission_tex, texcoord, true).x;
-  auto translucency =
-      material->translucency *
-      eval_texture(material->translucency_tex, texcoord, true).x;
+                      eval_tex(material->emission_tex, true).x;
+  auto translucency = material->translucency *
+                      eval_tex(material->translucency_tex, true).x;
   auto thin = material->thin || material->transmission == 0;
 
   // factors
@@ -753,23 +1448,26 @@ trace_bsdf eval_bsdf(const trace_instance* instance, int element,
 bool is_delta(const trace_bsdf& bsdf) { return bsdf.roughness == 0; }
 
 // evaluate volume
-trace_vsdf eval_vsdf(
-    const trace_instance* instance, int element, const vec2f& uv) {
+trace_vsdf eval_vsdf(const trace_instance* instance, int element,
+    const vec2f& uv, float footprint) {
   auto material = instance->material;
   // initialize factors
   auto texcoord = eval_texcoord(instance, element, uv);
-  auto color    = material->color * xyz(eval_color(instance, element, uv)) *
-               xyz(eval_texture(material->color_tex, texcoord, false));
+  auto eval_tex = [&texcoord, footprint](
+                      const trace_texture* texture, bool ldr_as_linear) {
+    return eval_texture(texture, texcoord, ldr_as_linear, false, false,
+        footprint);
+  };
+  auto color = material->color * xyz(eval_color(instance, element, uv)) *
+               xyz(eval_tex(material->color_tex, false));
   auto transmission = material->transmission *
-                      eval_texture(material->emission_tex, texcoord, true).x;
-  auto translucency =
-      material->translucency *
-      eval_texture(material->translucency_tex, texcoord, true).x;
+                      eval_tex(material->emission_tex, true).x;
+  auto translucency = material->translucency *
+                      eval_tex(material->translucency_tex, true).x;
   auto thin = material->thin ||
               (material->transmission == 0 && material->translucency == 0);
-  auto scattering =
-      material->scattering *
-      xyz(eval_texture(material->scattering_tex, texcoord, false));
+  auto scattering = material->scattering *
+                    xyz(eval_tex(material->scattering_tex, false));
   auto scanisotropy = material->scanisotropy;
   auto trdepth      = material->trdepth;
 
@@ -812,6 +1510,44 @@ static ray3f sample_camera(const trace_camera* camera, const vec2i& ij,
   }
 }
 
+// Ray cone of the camera rays, as the width at the origin and the spread
+// per unit distance, both covering one pixel.
+static vec2f eval_camera_cone(
+    const trace_camera* camera, const vec2i& image_size) {
+  auto film  = camera->aspect >= 1 ? camera->film
+                                   : camera->film * camera->aspect;
+  auto pixel = film / camera->lens / image_size.x;
+  return camera->orthographic ? vec2f{pixel, 0} : vec2f{0, pixel};
+}
+
+// Texture footprint of a ray cone of the given width hitting an element,
+// computed from the ratio of the texcoord and world areas of the element.
+// Returns 0 for elements without texture coordinates.
+static float eval_footprint(const trace_instance* instance, int element,
+    const vec3f& direction, float width) {
+  auto shape = instance->shape;
+  if (shape->texcoords.empty() || width <= 0) return 0;
+  auto t = vec3i{0, 0, 0};
+  if (!shape->triangles.empty()) {
+    t = shape->triangles[element];
+  } else if (!shape->quads.empty()) {
+    auto q = shape->quads[element];
+    t      = {q.x, q.y, q.w};
+  } else {
+    return 0;
+  }
+  auto p0 = transform_point(instance->frame, shape->positions[t.x]);
+  auto p1 = transform_point(instance->frame, shape->positions[t.y]);
+  auto p2 = transform_point(instance->frame, shape->positions[t.z]);
+  auto wn = cross(p1 - p0, p2 - p0);
+  auto wa = length(wn);
+  auto ta = abs(cross(shape->texcoords[t.y] - shape->texcoords[t.x],
+      shape->texcoords[t.z] - shape->texcoords[t.x]));
+  if (wa == 0 || ta == 0) return 0;
+  auto cosine = abs(dot(wn / wa, direction));
+  return sqrt(ta / wa) * width / max(cosine, 0.1f);
+}
+
 }  // namespace yocto
 
 // -----------------------------------------------------------------------------
@@ -819,27 +1555,97 @@ static ray3f sample_camera(const trace_camera* camera, const vec2i& ij,
 // -----------------------------------------------------------------------------
 namespace yocto {
 
-// Build the bvh acceleration structure.
-void init_bvh(trace_bvh* bvh, const trace_scene* scene,
-    const trace_params& params, const progress_callback& progress_cb) {
+// Number of copies of an instance, that is one if it is not an array.
+static int get_copies(const trace_instance* instance) {
+  return instance->frames.empty() ? 1 : (int)instance->frames.size();
+}
+
+// Number the copies of instance arrays after the copies of the instances
+// before them and return the number of copies. Scenes without arrays use
+// instance indices as ids.
+static int init_copy_ids(trace_bvh* bvh, const trace_scene* scene) {
+  bvh->copy_ids.clear();
+  auto has_arrays = false;
+  for (auto instance : scene->instances)
+    if (!instance->frames.empty()) has_arrays = true;
+  if (!has_arrays) return (int)scene->instances.size();
+  bvh->copy_ids.reserve(scene->instances.size());
+  auto num_copies = 0;
+  for (auto instance : scene->instances) {
+    bvh->copy_ids.push_back(num_copies);
+    num_copies += get_copies(instance);
+  }
+  return num_copies;
+}
+
+// Get the index of the instance of a bvh id.
+static int get_instance_index(const trace_bvh* bvh, int id) {
+  if (bvh->copy_ids.empty()) return id;
+  return (int)(std::upper_bound(
+                   bvh->copy_ids.begin(), bvh->copy_ids.end(), id) -
+               bvh->copy_ids.begin()) -
+         1;
+}
+
+// Get the instance of a bvh id. Copies of instance arrays are set in `copy`
+// with their frame, and `copy` is returned.
+static const trace_instance* get_instance(const trace_scene* scene,
+    const trace_bvh* bvh, int id, trace_instance& copy) {
+  auto idx      = get_instance_index(bvh, id);
+  auto instance = scene->instances[idx];
+  if (instance->frames.empty()) return instance;
+  copy.frame       = instance->frames[id - bvh->copy_ids[idx]] *
+                     instance->frame;
+  copy.shape       = instance->shape;
+  copy.material    = instance->material;
+  copy.instance_id = instance->instance_id;
+  return &copy;
+}
+
+// Set shapes and instance copies of a bvh as views of the scene
+static void init_bvh_views(trace_bvh* bvh, const trace_scene* scene) {
+  // number the copies of instance arrays
+  auto num_copies = init_copy_ids(bvh, scene);
+
   // initialize bvh
   for (auto shape : scene->shapes) {
     add_shape(bvh, shape->points, shape->lines, shape->triangles, shape->quads,
         shape->positions, shape->radius, true);
   }
   set_instances(
-      bvh, (int)scene->instances.size(),
-      [scene](int idx) {
-        auto instance = scene->instances[idx];
+      bvh, num_copies,
+      [scene, bvh](int id) {
+        auto copy     = trace_instance{};
+        auto instance = get_instance(scene, bvh, id, copy);
         return bvh_instance{instance->frame, instance->shape->shape_id};
       },
       true);
+}
+
+// Build the bvh acceleration structure.
+void init_bvh(trace_bvh* bvh, const trace_scene* scene,
+    const trace_params& params, const progress_callback& progress_cb) {
+  // initialize bvh
+  init_bvh_views(bvh, scene);
 
   // build
   init_bvh(bvh, bvh_params{(bvh_build_type)params.bvh, params.noparallel},
       progress_cb);
 }
 
+// Save and load bvh
+bool save_bvh(const string& filename, const trace_bvh* bvh,
+    const trace_params& params, string& error) {
+  return save_bvh(filename, bvh,
+      bvh_params{(bvh_build_type)params.bvh, params.noparallel}, error);
+}
+bool load_bvh(const string& filename, trace_bvh* bvh,
+    const trace_scene* scene, const trace_params& params, string& error) {
+  init_bvh_views(bvh, scene);
+  return load_bvh(filename, bvh,
+      bvh_params{(bvh_build_type)params.bvh, params.noparallel}, error);
+}
+
 // Refit bvh data
 void update_bvh(trace_bvh* bvh, const trace_scene* scene,
     const vector<trace_instance*>& updated_instances,
@@ -851,11 +1657,22 @@ void update_bvh(trace_bvh* bvh, const trace_scene* scene,
         (int)(std::find(scene->shapes.begin(), scene->shapes.end(), shape) -
               scene->shapes.begin()));
   }
+
+  // renumber copies, since instance arrays may have changed; if the number
+  // of copies changed, the bvh cannot be refit and is built again
+  auto num_copies = init_copy_ids(bvh, scene);
+  if (num_copies != bvh->num_instances) {
+    bvh->num_instances = num_copies;
+    init_bvh(bvh, bvh_params{(bvh_build_type)params.bvh, params.noparallel});
+    return;
+  }
   for (auto instance : updated_instances) {
-    updated_instances_ids.push_back(
-        (int)(std::find(
-                  scene->instances.begin(), scene->instances.end(), instance) -
-              scene->instances.begin()));
+    auto idx = (int)(std::find(scene->instances.begin(),
+                         scene->instances.end(), instance) -
+                     scene->instances.begin());
+    auto first = bvh->copy_ids.empty() ? idx : bvh->copy_ids[idx];
+    for (auto copy = 0; copy < get_copies(instance); copy++)
+      updated_instances_ids.push_back(first + copy);
   }
   update_bvh(bvh, updated_instances_ids, updated_shapes_ids);
 }
@@ -1139,10 +1956,91 @@ static float sample_scattering_pdf(
   return sample_phasefunction_pdf(vsdf.anisotropy, outgoing, incoming);
 }
 
+// Importance of a light tree node for a shading position, that is its
+// power over the squared distance, not less than the node size.
+static float eval_light_importance(
+    const trace_light_node& node, const vec3f& position) {
+  auto radius2 = max(distance_squared(node.bbox.min, node.bbox.max) / 4,
+      flt_eps);
+  return node.power /
+         max(distance_squared(position, center(node.bbox)), radius2);
+}
+
+// Probability of picking a light tree node over its sibling.
+static float eval_light_node_prob(
+    const trace_light_node& node, const trace_light_node& sibling,
+    const vec3f& position) {
+  auto importance = eval_light_importance(node, position);
+  auto total      = importance + eval_light_importance(sibling, position);
+  return total > 0 ? importance / total : 0.5f;
+}
+
+// Pick a light. Lights are picked by power with the alias table or, for
+// light trees, area lights are picked by descending the tree choosing
+// children by importance, and environments by power.
+static int sample_light(
+    const trace_lights* lights, const vec3f& position, float rl) {
+  auto offset = 0;
+  if (lights->sampling == trace_light_sampling_type::tree &&
+      !lights->nodes.empty()) {
+    auto area_prob = lights->power > 0 ? lights->area_power / lights->power
+                                       : 1.0f;
+    if (rl < area_prob || lights->area_lights == (int)lights->lights.size()) {
+      rl       = min(rl / area_prob, 1 - flt_eps);
+      auto idx = 0;
+      while (lights->nodes[idx].internal) {
+        auto& node = lights->nodes[idx];
+        auto  prob = eval_light_node_prob(
+            lights->nodes[node.start], lights->nodes[node.start + 1], position);
+        if (rl < prob) {
+          idx = node.start;
+          rl  = rl / prob;
+        } else {
+          idx = node.start + 1;
+          rl  = min((rl - prob) / (1 - prob), 1 - flt_eps);
+        }
+      }
+      return lights->nodes[idx].start;
+    }
+    rl     = min((rl - area_prob) / (1 - area_prob), 1 - flt_eps);
+    offset = lights->area_lights;
+  }
+  auto idx = sample_uniform((int)lights->alias_probs.size(), rl);
+  auto u   = rl * lights->alias_probs.size() - idx;
+  return offset +
+         (u < lights->alias_probs[idx] ? idx : lights->alias_ids[idx]);
+}
+
+// Probability of picking a light with sample_light().
+static float sample_light_pdf(
+    const trace_lights* lights, int light_id, const vec3f& position) {
+  auto light = lights->lights[light_id];
+  if (lights->sampling == trace_light_sampling_type::tree &&
+      !lights->nodes.empty()) {
+    if (light_id < lights->area_lights) {
+      auto pdf = lights->power > 0 ? lights->area_power / lights->power
+                                   : 1.0f;
+      for (auto idx = lights->leaves[light_id]; lights->nodes[idx].parent >= 0;
+           idx      = lights->nodes[idx].parent) {
+        auto& parent  = lights->nodes[lights->nodes[idx].parent];
+        auto  sibling = idx == parent.start ? parent.start + 1 : parent.start;
+        pdf *= eval_light_node_prob(
+            lights->nodes[idx], lights->nodes[sibling], position);
+      }
+      return pdf;
+    } else {
+      auto env_power = lights->power - lights->area_power;
+      return env_power > 0 ? light->power / lights->power : 0;
+    }
+  }
+  return lights->power > 0 ? light->power / lights->power
+                           : sample_uniform_pdf((int)lights->lights.size());
+}
+
 // Sample lights wrt solid angle
 static vec3f sample_lights(const trace_scene* scene, const trace_lights* lights,
     const vec3f& position, float rl, float rel, const vec2f& ruv) {
-  auto light_id = sample_uniform((int)lights->lights.size(), rl);
+  auto light_id = sample_light(lights, position, rl);
   auto light    = lights->lights[light_id];
   if (light->instance != nullptr) {
     auto instance = light->instance;
@@ -1170,213 +2068,285 @@ static vec3f sample_lights(const trace_scene* scene, const trace_lights* lights,
   }
 }
 
-// Sample lights pdf
-static float sample_lights_pdf(const trace_scene* scene, const trace_bvh* bvh,
+// Sample lights pdf. Area lights along the direction are found with the
+// light bvh, that returns them one at a time.
+static float sample_lights_pdf(const trace_scene* scene,
     const trace_lights* lights, const vec3f& position, const vec3f& direction) {
   auto pdf = 0.0f;
-  for (auto light : lights->lights) {
-    if (light->instance != nullptr) {
-      // check all intersection
-      auto lpdf          = 0.0f;
-      auto next_position = position;
-      for (auto bounce = 0; bounce < 100; bounce++) {
-        auto intersection = intersect_bvh(
-            bvh, light->instance->instance_id, {next_position, direction});
-        if (!intersection.hit) break;
-        // accumulate pdf
-        auto lposition = eval_position(
-            light->instance, intersection.element, intersection.uv);
-        auto lnormal = eval_element_normal(
-            light->instance, intersection.element);
-        // prob triangle * area triangle = area triangle mesh
-        auto area = light->elements_cdf.back();
-        lpdf += distance_squared(lposition, position) /
-                (abs(dot(lnormal, direction)) * area);
-        // continue
-        next_position = lposition + direction * 1e-3f;
-      }
-      pdf += lpdf;
-    } else if (light->environment != nullptr) {
-      auto environment = light->environment;
-      if (environment->emission_tex != nullptr) {
-        auto emission_tex = environment->emission_tex;
-        auto size         = texture_size(emission_tex);
-        auto wl = transform_direction(inverse(environment->frame), direction);
-        auto texcoord = vec2f{atan2(wl.z, wl.x) / (2 * pif),
-            acos(clamp(wl.y, -1.0f, 1.0f)) / pif};
-        if (texcoord.x < 0) texcoord.x += 1;
-        auto i    = clamp((int)(texcoord.x * size.x), 0, size.x - 1);
-        auto j    = clamp((int)(texcoord.y * size.y), 0, size.y - 1);
-        auto prob = sample_discrete_cdf_pdf(
-                        light->elements_cdf, j * size.x + i) /
-                    light->elements_cdf.back();
-        auto angle = (2 * pif / size.x) * (pif / size.y) *
-                     sin(pif * (j + 0.5f) / size.y);
-        pdf += prob / angle;
-      } else {
-        pdf += 1 / (4 * pif);
-      }
+  if (lights->bvh != nullptr) {
+    // check all intersection
+    auto next_position = position;
+    for (auto bounce = 0; bounce < 100; bounce++) {
+      auto intersection = intersect_bvh(
+          lights->bvh, {next_position, direction});
+      if (!intersection.hit) break;
+      // accumulate pdf
+      auto light     = lights->lights[intersection.instance];
+      auto lposition = eval_position(
+          light->instance, intersection.element, intersection.uv);
+      auto lnormal = eval_element_normal(light->instance, intersection.element);
+      // prob triangle * area triangle = area triangle mesh
+      auto area = light->elements_cdf.back();
+      pdf += sample_light_pdf(lights, intersection.instance, position) *
+             distance_squared(lposition, position) /
+             (abs(dot(lnormal, direction)) * area);
+      // continue
+      next_position = lposition + direction * 1e-3f;
+    }
+  }
+  for (auto light_id = lights->area_lights;
+       light_id < (int)lights->lights.size(); light_id++) {
+    auto environment = lights->lights[light_id]->environment;
+    auto light_pdf   = sample_light_pdf(lights, light_id, position);
+    if (environment->emission_tex != nullptr) {
+      auto  emission_tex = environment->emission_tex;
+      auto& elements_cdf = lights->lights[light_id]->elements_cdf;
+      auto  size         = texture_size(emission_tex);
+      auto  wl = transform_direction(inverse(environment->frame), direction);
+      auto  texcoord = vec2f{atan2(wl.z, wl.x) / (2 * pif),
+          acos(clamp(wl.y, -1.0f, 1.0f)) / pif};
+      if (texcoord.x < 0) texcoord.x += 1;
+      auto i    = clamp((int)(texcoord.x * size.x), 0, size.x - 1);
+      auto j    = clamp((int)(texcoord.y * size.y), 0, size.y - 1);
+      auto prob = sample_discrete_cdf_pdf(elements_cdf, j * size.x + i) /
+                  elements_cdf.back();
+      auto angle = (2 * pif / size.x) * (pif / size.y) *
+                   sin(pif * (j + 0.5f) / size.y);
+      pdf += light_pdf * prob / angle;
+    } else {
+      pdf += light_pdf / (4 * pif);
     }
   }
-  pdf *= sample_uniform_pdf((int)lights->lights.size());
   return pdf;
 }
 
-// Recursive path tracing.
-static vec4f trace_path(const trace_scene* scene, const trace_bvh* bvh,
-    const trace_lights* lights, const ray3f& ray_, rng_state& rng,
-    const trace_params& params) {
-  // initialize
-  auto radiance      = zero3f;
-  auto weight        = vec3f{1, 1, 1};
-  auto ray           = ray_;
-  auto volume_stack  = vector<trace_vsdf>{};
-  auto max_roughness = 0.0f;
-  auto hit           = !params.envhidden && !scene->environments.empty();
+// State of a path, that is advanced one vertex at a time.
+struct trace_path_state {
+  ray3f              ray           = {};
+  vec2f              cone          = {0, 0};
+  vec3f              radiance      = {0, 0, 0};
+  vec3f              weight        = {1, 1, 1};
+  vector<trace_vsdf> volume_stack  = {};
+  float              max_roughness = 0;
+  int                bounce        = 0;
+  bool               hit           = false;
+  bool               done          = false;
+};
+
+// Init a path from a camera ray and its ray cone.
+static trace_path_state init_path(const trace_scene* scene, const ray3f& ray,
+    const vec2f& cone, const trace_params& params) {
+  auto path = trace_path_state{};
+  path.ray  = ray;
+  path.cone = cone;
+  path.hit  = !params.envhidden && !scene->environments.empty();
+  path.done = params.bounces <= 0;
+  return path;
+}
 
-  // trace  path
-  for (auto bounce = 0; bounce < params.bounces; bounce++) {
-    // intersect next point
-    auto intersection = intersect_bvh(bvh, ray);
-    if (!intersection.hit) {
-      if (bounce > 0 || !params.envhidden)
-        radiance += weight * eval_environment(scene, ray.d);
-      break;
+// Shade the next vertex of a path, given the intersection of the path ray,
+// and set the ray to continue the path or mark it as done.
+static void shade_path(const trace_scene* scene, const trace_bvh* bvh,
+    const trace_lights* lights, trace_path_state& path,
+    bvh_intersection intersection, rng_state& rng,
+    const trace_params& params) {
+  // path variables
+  auto& ray           = path.ray;
+  auto& cone          = path.cone;
+  auto& radiance      = path.radiance;
+  auto& weight        = path.weight;
+  auto& volume_stack  = path.volume_stack;
+  auto& max_roughness = path.max_roughness;
+  auto& bounce        = path.bounce;
+  auto& hit           = path.hit;
+
+  // environment
+  if (!intersection.hit) {
+    if (bounce > 0 || !params.envhidden)
+      radiance += weight * eval_environment(scene, ray.d);
+    path.done = true;
+    return;
+  }
+
+  // handle transmission if inside a volume
+  auto in_volume = false;
+  if (!volume_stack.empty()) {
+    auto& vsdf     = volume_stack.back();
+    auto  distance = sample_transmittance(
+        vsdf.density, intersection.distance, rand1f(rng), rand1f(rng));
+    weight *= eval_transmittance(vsdf.density, distance) /
+              sample_transmittance_pdf(
+                  vsdf.density, distance, intersection.distance);
+    in_volume             = distance < intersection.distance;
+    intersection.distance = distance;
+  }
+
+  // ray cone width at the shading point
+  auto width = cone.x + cone.y * intersection.distance;
+
+  // switch between surface and volume
+  if (!in_volume) {
+    // prepare shading point
+    auto outgoing  = -ray.d;
+    auto copy      = trace_instance{};
+    auto instance  = get_instance(scene, bvh, intersection.instance, copy);
+    auto element   = intersection.element;
+    auto uv        = intersection.uv;
+    auto footprint = params.mipmap
+                         ? eval_footprint(instance, element, ray.d, width)
+                         : 0.0f;
+    auto position = eval_position(instance, element, uv);
+    auto normal   = eval_shading_normal(
+        instance, element, uv, outgoing, footprint);
+    auto emission = eval_emission(
+        instance, element, uv, normal, outgoing, footprint);
+    auto opacity = eval_opacity(
+        instance, element, uv, normal, outgoing, footprint);
+    auto bsdf = eval_bsdf(instance, element, uv, normal, outgoing, footprint);
+
+    // correct roughness
+    if (params.nocaustics) {
+      max_roughness  = max(bsdf.roughness, max_roughness);
+      bsdf.roughness = max_roughness;
     }
 
-    // handle transmission if inside a volume
-    auto in_volume = false;
-    if (!volume_stack.empty()) {
-      auto& vsdf     = volume_stack.back();
-      auto  distance = sample_transmittance(
-          vsdf.density, intersection.distance, rand1f(rng), rand1f(rng));
-      weight *= eval_transmittance(vsdf.density, distance) /
-                sample_transmittance_pdf(
-                    vsdf.density, distance, intersection.distance);
-      in_volume             = distance < intersection.distance;
-      intersection.distance = distance;
+    // handle opacity
+    if (opacity < 1 && rand1f(rng) >= opacity) {
+      ray  = {position + ray.d * 1e-2f, ray.d};
+      cone = {width, cone.y};
+      return;
     }
+    hit = true;
 
-    // switch between surface and volume
-    if (!in_volume) {
-      // prepare shading point
-      auto outgoing = -ray.d;
-      auto instance = scene->instances[intersection.instance];
-      auto element  = intersection.element;
-      auto uv       = intersection.uv;
-      auto position = eval_position(instance, element, uv);
-      auto normal   = eval_shading_normal(instance, element, uv, outgoing);
-      auto emission = eval_emission(instance, element, uv, normal, outgoing);
-      auto opacity  = eval_opacity(instance, element, uv, normal, outgoing);
-      auto bsdf     = eval_bsdf(instance, element, uv, normal, outgoing);
-
-      // correct roughness
-      if (params.nocaustics) {
-        max_roughness  = max(bsdf.roughness, max_roughness);
-        bsdf.roughness = max_roughness;
-      }
-
-      // handle opacity
-      if (opacity < 1 && rand1f(rng) >= opacity) {
-        ray = {position + ray.d * 1e-2f, ray.d};
-        bounce -= 1;
-        continue;
-      }
-      hit = true;
-
-      // accumulate emission
-      radiance += weight * eval_emission(emission, normal, outgoing);
+    // accumulate emission
+    radiance += weight * eval_emission(emission, normal, outgoing);
 
-      // next direction
-      auto incoming = zero3f;
-      if (!is_delta(bsdf)) {
-        if (rand1f(rng) < 0.5f) {
-          incoming = sample_bsdfcos(
-              bsdf, normal, outgoing, rand1f(rng), rand2f(rng));
-        } else {
-          incoming = sample_lights(
-              scene, lights, position, rand1f(rng), rand1f(rng), rand2f(rng));
-        }
-        weight *= eval_bsdfcos(bsdf, normal, outgoing, incoming) /
-                  (0.5f * sample_bsdfcos_pdf(bsdf, normal, outgoing, incoming) +
-                      0.5f * sample_lights_pdf(
-                                 scene, bvh, lights, position, incoming));
+    // next direction
+    auto incoming = zero3f;
+    if (!is_delta(bsdf)) {
+      if (rand1f(rng) < 0.5f) {
+        incoming = sample_bsdfcos(
+            bsdf, normal, outgoing, rand1f(rng), rand2f(rng));
       } else {
-        incoming = sample_delta(bsdf, normal, outgoing, rand1f(rng));
-        weight *= eval_delta(bsdf, normal, outgoing, incoming) /
-                  sample_delta_pdf(bsdf, normal, outgoing, incoming);
+        incoming = sample_lights(
+            scene, lights, position, rand1f(rng), rand1f(rng), rand2f(rng));
       }
+      weight *= eval_bsdfcos(bsdf, normal, outgoing, incoming) /
+                (0.5f * sample_bsdfcos_pdf(bsdf, normal, outgoing, incoming) +
+                    0.5f * sample_lights_pdf(
+                               scene, lights, position, incoming));
+    } else {
+      incoming = sample_delta(bsdf, normal, outgoing, rand1f(rng));
+      weight *= eval_delta(bsdf, normal, outgoing, incoming) /
+                sample_delta_pdf(bsdf, normal, outgoing, incoming);
+    }
 
-      // update volume stack
-      if (has_volume(instance) &&
-          dot(normal, outgoing) * dot(normal, incoming) < 0) {
-        if (volume_stack.empty()) {
-          auto vsdf = eval_vsdf(instance, element, uv);
-          volume_stack.push_back(vsdf);
-        } else {
-          volume_stack.pop_back();
-        }
+    // update volume stack
+    if (has_volume(instance) &&
+        dot(normal, outgoing) * dot(normal, incoming) < 0) {
+      if (volume_stack.empty()) {
+        auto vsdf = eval_vsdf(instance, element, uv, footprint);
+        volume_stack.push_back(vsdf);
+      } else {
+        volume_stack.pop_back();
       }
+    }
 
-      // setup next iteration
-      ray = {position, incoming};
-    } else {
-      // prepare shading point
-      auto  outgoing = -ray.d;
-      auto  position = ray.o + ray.d * intersection.distance;
-      auto& vsdf     = volume_stack.back();
-
-      // handle opacity
-      hit = true;
+    // setup next iteration, rough bounces widen the ray cone
+    ray  = {position, incoming};
+    cone = {width, cone.y + (is_delta(bsdf) ? 0 : sqrt(bsdf.roughness))};
+  } else {
+    // prepare shading point
+    auto  outgoing = -ray.d;
+    auto  position = ray.o + ray.d * intersection.distance;
+    auto& vsdf     = volume_stack.back();
 
-      // accumulate emission
-      // radiance += weight * eval_volemission(emission, outgoing);
+    // handle opacity
+    hit = true;
 
-      // next direction
-      auto incoming = zero3f;
-      if (rand1f(rng) < 0.5f) {
-        incoming = sample_scattering(vsdf, outgoing, rand1f(rng), rand2f(rng));
-      } else {
-        incoming = sample_lights(
-            scene, lights, position, rand1f(rng), rand1f(rng), rand2f(rng));
-      }
-      weight *=
-          eval_scattering(vsdf, outgoing, incoming) /
-          (0.5f * sample_scattering_pdf(vsdf, outgoing, incoming) +
-              0.5f * sample_lights_pdf(scene, bvh, lights, position, incoming));
+    // accumulate emission
+    // radiance += weight * eval_volemission(emission, outgoing);
 
-      // setup next iteration
-      ray = {position, incoming};
+    // next direction
+    auto incoming = zero3f;
+    if (rand1f(rng) < 0.5f) {
+      incoming = sample_scattering(vsdf, outgoing, rand1f(rng), rand2f(rng));
+    } else {
+      incoming = sample_lights(
+          scene, lights, position, rand1f(rng), rand1f(rng), rand2f(rng));
     }
+    weight *=
+        eval_scattering(vsdf, outgoing, incoming) /
+        (0.5f * sample_scattering_pdf(vsdf, outgoing, incoming) +
+            0.5f * sample_lights_pdf(scene, lights, position, incoming));
 
-    // check weight
-    if (weight == zero3f || !isfinite(weight)) break;
+    // setup next iteration, scattering widens the ray cone as a diffuse
+    // bounce
+    ray  = {position, incoming};
+    cone = {width, cone.y + 1};
+  }
 
-    // russian roulette
-    if (bounce > 3) {
-      auto rr_prob = min((float)0.99, max(weight));
-      if (rand1f(rng) >= rr_prob) break;
-      weight *= 1 / rr_prob;
+  // check weight
+  if (weight == zero3f || !isfinite(weight)) {
+    path.done = true;
+    return;
+  }
+
+  // russian roulette
+  if (bounce > 3) {
+    auto rr_prob = min((float)0.99, max(weight));
+    if (rand1f(rng) >= rr_prob) {
+      path.done = true;
+      return;
     }
+    weight *= 1 / rr_prob;
   }
 
-  return {radiance.x, radiance.y, radiance.z, hit ? 1.0f : 0.0f};
+  // next bounce
+  bounce += 1;
+  if (bounce >= params.bounces) path.done = true;
+}
+
+// Get the sample of a path
+static vec4f get_path_sample(const trace_path_state& path) {
+  return {path.radiance.x, path.radiance.y, path.radiance.z,
+      path.hit ? 1.0f : 0.0f};
+}
+
+// Recursive path tracing.
+static vec4f trace_path(const trace_scene* scene, const trace_bvh* bvh,
+    const trace_lights* lights, const ray3f& ray, const vec2f& cone,
+    const bvh_intersection& intersection, rng_state& rng,
+    const trace_params& params) {
+  // the camera ray is intersected by the caller
+  auto path = init_path(scene, ray, cone, params);
+  if (!path.done)
+    shade_path(scene, bvh, lights, path, intersection, rng, params);
+  while (!path.done) {
+    shade_path(scene, bvh, lights, path, intersect_bvh(bvh, path.ray), rng,
+        params);
+  }
+  return get_path_sample(path);
 }
 
 // Recursive path tracing.
 static vec4f trace_naive(const trace_scene* scene, const trace_bvh* bvh,
-    const trace_lights* lights, const ray3f& ray_, rng_state& rng,
+    const trace_lights* lights, const ray3f& ray_, const vec2f& cone_,
+    const bvh_intersection& intersection_, rng_state& rng,
     const trace_params& params) {
   // initialize
   auto radiance = zero3f;
   auto weight   = vec3f{1, 1, 1};
   auto ray      = ray_;
+  auto cone     = cone_;
   auto hit      = !params.envhidden && !scene->environments.empty();
+  auto first    = true;
 
   // trace  path
   for (auto bounce = 0; bounce < params.bounces; bounce++) {
-    // intersect next point
-    auto intersection = intersect_bvh(bvh, ray);
+    // intersect next point, the camera ray is intersected by the caller
+    auto intersection = first ? intersection_ : intersect_bvh(bvh, ray);
+    first             = false;
     if (!intersection.hit) {
       if (bounce > 0 || !params.envhidden)
         radiance += weight * eval_environment(scene, ray.d);
@@ -1384,19 +2354,28 @@ static vec4f trace_naive(const trace_scene* scene, const trace_bvh* bvh,
     }
 
     // prepare shading point
-    auto outgoing = -ray.d;
-    auto instance = scene->instances[intersection.instance];
-    auto element  = intersection.element;
-    auto uv       = intersection.uv;
+    auto outgoing  = -ray.d;
+    auto copy      = trace_instance{};
+    auto instance  = get_instance(scene, bvh, intersection.instance, copy);
+    auto element   = intersection.element;
+    auto uv        = intersection.uv;
+    auto width     = cone.x + cone.y * intersection.distance;
+    auto footprint = params.mipmap
+                         ? eval_footprint(instance, element, ray.d, width)
+                         : 0.0f;
     auto position = eval_position(instance, element, uv);
-    auto normal   = eval_shading_normal(instance, element, uv, outgoing);
-    auto emission = eval_emission(instance, element, uv, normal, outgoing);
-    auto opacity  = eval_opacity(instance, element, uv, normal, outgoing);
-    auto bsdf     = eval_bsdf(instance, element, uv, normal, outgoing);
+    auto normal   = eval_shading_normal(
+        instance, element, uv, outgoing, footprint);
+    auto emission = eval_emission(
+        instance, element, uv, normal, outgoing, footprint);
+    auto opacity = eval_opacity(
+        instance, element, uv, normal, outgoing, footprint);
+    auto bsdf = eval_bsdf(instance, element, uv, normal, outgoing, footprint);
 
     // handle opacity
     if (opacity < 1 && rand1f(rng) >= opacity) {
-      ray = {position + ray.d * 1e-2f, ray.d};
+      ray  = {position + ray.d * 1e-2f, ray.d};
+      cone = {width, cone.y};
       bounce -= 1;
       continue;
     }
@@ -1428,8 +2407,9 @@ static vec4f trace_naive(const trace_scene* scene, const trace_bvh* bvh,
       weight *= 1 / rr_prob;
     }
 
-    // setup next iteration
-    ray = {position, incoming};
+    // setup next iteration, rough bounces widen the ray cone
+    ray  = {position, incoming};
+    cone = {width, cone.y + sqrt(bsdf.roughness)};
   }
 
   return {radiance.x, radiance.y, radiance.z, hit ? 1.0f : 0.0f};
@@ -1437,18 +2417,22 @@ static vec4f trace_naive(const trace_scene* scene, const trace_bvh* bvh,
 
 // Eyelight for quick previewing.
 static vec4f trace_eyelight(const trace_scene* scene, const trace_bvh* bvh,
-    const trace_lights* lights, const ray3f& ray_, rng_state& rng,
+    const trace_lights* lights, const ray3f& ray_, const vec2f& cone_,
+    const bvh_intersection& intersection_, rng_state& rng,
     const trace_params& params) {
   // initialize
   auto radiance = zero3f;
   auto weight   = vec3f{1, 1, 1};
   auto ray      = ray_;
+  auto cone     = cone_;
   auto hit      = !params.envhidden && !scene->environments.empty();
+  auto first    = true;
 
   // trace  path
   for (auto bounce = 0; bounce < max(params.bounces, 4); bounce++) {
-    // intersect next point
-    auto intersection = intersect_bvh(bvh, ray);
+    // intersect next point, the camera ray is intersected by the caller
+    auto intersection = first ? intersection_ : intersect_bvh(bvh, ray);
+    first             = false;
     if (!intersection.hit) {
       if (bounce > 0 || !params.envhidden)
         radiance += weight * eval_environment(scene, ray.d);
@@ -1456,19 +2440,28 @@ static vec4f trace_eyelight(const trace_scene* scene, const trace_bvh* bvh,
     }
 
     // prepare shading point
-    auto outgoing = -ray.d;
-    auto instance = scene->instances[intersection.instance];
-    auto element  = intersection.element;
-    auto uv       = intersection.uv;
+    auto outgoing  = -ray.d;
+    auto copy      = trace_instance{};
+    auto instance  = get_instance(scene, bvh, intersection.instance, copy);
+    auto element   = intersection.element;
+    auto uv        = intersection.uv;
+    auto width     = cone.x + cone.y * intersection.distance;
+    auto footprint = params.mipmap
+                         ? eval_footprint(instance, element, ray.d, width)
+                         : 0.0f;
     auto position = eval_position(instance, element, uv);
-    auto normal   = eval_shading_normal(instance, element, uv, outgoing);
-    auto emission = eval_emission(instance, element, uv, normal, outgoing);
-    auto opacity  = eval_opacity(instance, element, uv, normal, outgoing);
-    auto bsdf     = eval_bsdf(instance, element, uv, normal, outgoing);
+    auto normal   = eval_shading_normal(
+        instance, element, uv, outgoing, footprint);
+    auto emission = eval_emission(
+        instance, element, uv, normal, outgoing, footprint);
+    auto opacity = eval_opacity(
+        instance, element, uv, normal, outgoing, footprint);
+    auto bsdf = eval_bsdf(instance, element, uv, normal, outgoing, footprint);
 
     // handle opacity
     if (opacity < 1 && rand1f(rng) >= opacity) {
-      ray = {position + ray.d * 1e-2f, ray.d};
+      ray  = {position + ray.d * 1e-2f, ray.d};
+      cone = {width, cone.y};
       bounce -= 1;
       continue;
     }
@@ -1489,7 +2482,8 @@ static vec4f trace_eyelight(const trace_scene* scene, const trace_bvh* bvh,
     if (weight == zero3f || !isfinite(weight)) break;
 
     // setup next iteration
-    ray = {position, incoming};
+    ray  = {position, incoming};
+    cone = {width, cone.y};
   }
 
   return {radiance.x, radiance.y, radiance.z, hit ? 1.0f : 0.0f};
@@ -1497,27 +2491,35 @@ static vec4f trace_eyelight(const trace_scene* scene, const trace_bvh* bvh,
 
 // False color rendering
 static vec4f trace_falsecolor(const trace_scene* scene, const trace_bvh* bvh,
-    const trace_lights* lights, const ray3f& ray, rng_state& rng,
+    const trace_lights* lights, const ray3f& ray, const vec2f& cone,
+    const bvh_intersection& intersection, rng_state& rng,
     const trace_params& params) {
-  // intersect next point
-  auto intersection = intersect_bvh(bvh, ray);
+  // check the camera ray intersection
   if (!intersection.hit) {
     return {0, 0, 0, 0};
   }
 
   // prepare shading point
-  auto outgoing = -ray.d;
-  auto instance = scene->instances[intersection.instance];
-  auto element  = intersection.element;
-  auto uv       = intersection.uv;
+  auto outgoing  = -ray.d;
+  auto copy      = trace_instance{};
+  auto instance  = get_instance(scene, bvh, intersection.instance, copy);
+  auto element   = intersection.element;
+  auto uv        = intersection.uv;
+  auto width     = cone.x + cone.y * intersection.distance;
+  auto footprint = params.mipmap
+                       ? eval_footprint(instance, element, ray.d, width)
+                       : 0.0f;
   auto position = eval_position(instance, element, uv);
-  auto normal   = eval_shading_normal(instance, element, uv, outgoing);
+  auto normal   = eval_shading_normal(
+      instance, element, uv, outgoing, footprint);
   auto gnormal  = eval_element_normal(instance, element);
   auto texcoord = eval_texcoord(instance, element, uv);
   auto color    = eval_color(instance, element, uv);
-  auto emission = eval_emission(instance, element, uv, normal, outgoing);
-  auto opacity  = eval_opacity(instance, element, uv, normal, outgoing);
-  auto bsdf     = eval_bsdf(instance, element, uv, normal, outgoing);
+  auto emission = eval_emission(
+      instance, element, uv, normal, outgoing, footprint);
+  auto opacity = eval_opacity(
+      instance, element, uv, normal, outgoing, footprint);
+  auto bsdf = eval_bsdf(instance, element, uv, normal, outgoing, footprint);
 
   // hash color
   auto hashed_color = [](int id) {
@@ -1573,59 +2575,70 @@ static vec4f trace_falsecolor(const trace_scene* scene, const trace_bvh* bvh,
 }
 
 static vec4f trace_albedo(const trace_scene* scene, const trace_bvh* bvh,
-    const trace_lights* lights, const ray3f& ray, rng_state& rng,
+    const trace_lights* lights, const ray3f& ray, const vec2f& cone,
+    const bvh_intersection& intersection, rng_state& rng,
     const trace_params& params, int bounce) {
-  auto intersection = intersect_bvh(bvh, ray);
   if (!intersection.hit) {
     auto radiance = eval_environment(scene, ray.d);
     return {radiance.x, radiance.y, radiance.z, 1};
   }
 
   // prepare shading point
-  auto outgoing = -ray.d;
-  auto instance = scene->instances[intersection.instance];
-  auto element  = intersection.element;
-  auto uv       = intersection.uv;
-  auto material = scene->instances[intersection.instance]->material;
+  auto outgoing  = -ray.d;
+  auto copy      = trace_instance{};
+  auto instance  = get_instance(scene, bvh, intersection.instance, copy);
+  auto element   = intersection.element;
+  auto uv        = intersection.uv;
+  auto material  = instance->material;
+  auto width     = cone.x + cone.y * intersection.distance;
+  auto footprint = params.mipmap
+                       ? eval_footprint(instance, element, ray.d, width)
+                       : 0.0f;
   auto position = eval_position(instance, element, uv);
-  auto normal   = eval_shading_normal(instance, element, uv, outgoing);
+  auto normal   = eval_shading_normal(
+      instance, element, uv, outgoing, footprint);
   auto texcoord = eval_texcoord(instance, element, uv);
   auto color    = eval_color(instance, element, uv);
-  auto emission = eval_emission(instance, element, uv, normal, outgoing);
-  auto opacity  = eval_opacity(instance, element, uv, normal, outgoing);
-  auto bsdf     = eval_bsdf(instance, element, uv, normal, outgoing);
+  auto emission = eval_emission(
+      instance, element, uv, normal, outgoing, footprint);
+  auto opacity = eval_opacity(
+      instance, element, uv, normal, outgoing, footprint);
+  auto bsdf = eval_bsdf(instance, element, uv, normal, outgoing, footprint);
 
   if (emission != zero3f) {
     return {emission.x, emission.y, emission.z, 1};
   }
 
   auto albedo = material->color * xyz(color) *
-                xyz(eval_texture(material->color_tex, texcoord, false));
+                xyz(eval_texture(material->color_tex, texcoord, false,
+                    false, false, footprint));
+
+  // trace secondary rays, only along delta directions that keep the spread
+  auto trace_next = [&](const ray3f& next_ray, int next_bounce) {
+    return trace_albedo(scene, bvh, lights, next_ray, {width, cone.y},
+        intersect_bvh(bvh, next_ray), rng, params, next_bounce);
+  };
 
   // handle opacity
   if (opacity < 1.0f) {
-    auto blend_albedo = trace_albedo(scene, bvh, lights,
-        ray3f{position + ray.d * 1e-2f, ray.d}, rng, params, bounce);
+    auto blend_albedo = trace_next({position + ray.d * 1e-2f, ray.d}, bounce);
     return lerp(blend_albedo, vec4f{albedo.x, albedo.y, albedo.z, 1}, opacity);
   }
 
   if (bsdf.roughness < 0.05 && bounce < 5) {
     if (bsdf.transmission != zero3f && material->thin) {
       auto incoming     = -outgoing;
-      auto trans_albedo = trace_albedo(scene, bvh, lights,
-          ray3f{position, incoming}, rng, params, bounce + 1);
+      auto trans_albedo = trace_next({position, incoming}, bounce + 1);
 
       incoming         = reflect(outgoing, normal);
-      auto spec_albedo = trace_albedo(scene, bvh, lights,
-          ray3f{position, incoming}, rng, params, bounce + 1);
+      auto spec_albedo = trace_next({position, incoming}, bounce + 1);
 
       auto fresnel = fresnel_dielectric(material->ior, outgoing, normal);
       auto dielectric_albedo = lerp(trans_albedo, spec_albedo, fresnel);
       return dielectric_albedo * vec4f{albedo.x, albedo.y, albedo.z, 1};
     } else if (bsdf.metal != zero3f) {
       auto incoming    = reflect(outgoing, normal);
-      auto refl_albedo = trace_albedo(scene, bvh, lights,
-          ray3f{position, incoming}, rng, params, bounce + 1);
+      auto refl_albedo = trace_next({position, incoming}, bounce + 1);
       return refl_albedo * vec4f{albedo.x, albedo.y, albedo.z, 1};
     }
   }
@@ -1634,54 +2647,65 @@ static vec4f trace_albedo(const trace_scene* scene, const trace_bvh* bvh,
 }
 
 static vec4f trace_albedo(const trace_scene* scene, const trace_bvh* bvh,
-    const trace_lights* lights, const ray3f& ray, rng_state& rng,
+    const trace_lights* lights, const ray3f& ray, const vec2f& cone,
+    const bvh_intersection& intersection, rng_state& rng,
     const trace_params& params) {
-  auto albedo = trace_albedo(scene, bvh, lights, ray, rng, params, 0);
+  auto albedo = trace_albedo(
+      scene, bvh, lights, ray, cone, intersection, rng, params, 0);
   return clamp(albedo, 0.0, 1.0);
 }
 
 static vec4f trace_normal(const trace_scene* scene, const trace_bvh* bvh,
-    const trace_lights* lights, const ray3f& ray, rng_state& rng,
+    const trace_lights* lights, const ray3f& ray, const vec2f& cone,
+    const bvh_intersection& intersection, rng_state& rng,
     const trace_params& params, int bounce) {
-  auto intersection = intersect_bvh(bvh, ray);
   if (!intersection.hit) {
     return {0, 0, 0, 1};
   }
 
   // prepare shading point
-  auto outgoing = -ray.d;
-  auto instance = scene->instances[intersection.instance];
-  auto element  = intersection.element;
-  auto uv       = intersection.uv;
-  auto material = scene->instances[intersection.instance]->material;
+  auto outgoing  = -ray.d;
+  auto copy      = trace_instance{};
+  auto instance  = get_instance(scene, bvh, intersection.instance, copy);
+  auto element   = intersection.element;
+  auto uv        = intersection.uv;
+  auto material  = instance->material;
+  auto width     = cone.x + cone.y * intersection.distance;
+  auto footprint = params.mipmap
+                       ? eval_footprint(instance, element, ray.d, width)
+                       : 0.0f;
   auto position = eval_position(instance, element, uv);
-  auto normal   = eval_shading_normal(instance, element, uv, outgoing);
-  auto opacity  = eval_opacity(instance, element, uv, normal, outgoing);
-  auto bsdf     = eval_bsdf(instance, element, uv, normal, outgoing);
+  auto normal   = eval_shading_normal(
+      instance, element, uv, outgoing, footprint);
+  auto opacity = eval_opacity(
+      instance, element, uv, normal, outgoing, footprint);
+  auto bsdf = eval_bsdf(instance, element, uv, normal, outgoing, footprint);
+
+  // trace secondary rays, only along delta directions that keep the spread
+  auto trace_next = [&](const ray3f& next_ray, int next_bounce) {
+    return trace_normal(scene, bvh, lights, next_ray, {width, cone.y},
+        intersect_bvh(bvh, next_ray), rng, params, next_bounce);
+  };
 
   // handle opacity
   if (opacity < 1.0f) {
-    auto normal = trace_normal(scene, bvh, lights,
-        ray3f{position + ray.d * 1e-2f, ray.d}, rng, params, bounce);
+    auto normal = trace_next({position + ray.d * 1e-2f, ray.d}, bounce);
     return lerp(normal, normal, opacity);
   }
 
   if (bsdf.roughness < 0.05f && bounce < 5) {
     if (bsdf.transmission != zero3f && material->thin) {
       auto incoming   = -outgoing;
-      auto trans_norm = trace_normal(scene, bvh, lights,
-          ray3f{position, incoming}, rng, params, bounce + 1);
+      auto trans_norm = trace_next({position, incoming}, bounce + 1);
 
       incoming       = reflect(outgoing, normal);
-      auto spec_norm = trace_normal(scene, bvh, lights,
-          ray3f{position, incoming}, rng, params, bounce + 1);
+      auto spec_norm = trace_next({position, incoming}, bounce + 1);
 
       auto fresnel = fresnel_dielectric(material->ior, outgoing, normal);
       return lerp(trans_norm, spec_norm, fresnel);
     } else if (bsdf.metal != zero3f) {
       auto incoming = reflect(outgoing, normal);
-      return trace_normal(scene, bvh, lights, ray3f{position, incoming}, rng,
-          params, bounce + 1);
+      return trace_next({position, incoming}, bounce + 1);
     }
   }
 
@@ -1689,27 +2713,34 @@ static vec4f trace_normal(const trace_scene* scene, const trace_bvh* bvh,
 }
 
 static vec4f trace_normal(const trace_scene* scene, const trace_bvh* bvh,
-    const trace_lights* lights, const ray3f& ray, rng_state& rng,
+    const trace_lights* lights, const ray3f& ray, const vec2f& cone,
+    const bvh_intersection& intersection, rng_state& rng,
     const trace_params& params) {
-  return trace_normal(scene, bvh, lights, ray, rng, params, 0);
+  return trace_normal(
+      scene, bvh, lights, ray, cone, intersection, rng, params, 0);
 }
 
-// Trace a single ray from the camera using the given algorithm.
-using sampler_func = vec4f (*)(const trace_scene* scene, const trace_bvh* bvh,
-    const trace_lights* lights, const ray3f& ray, rng_state& rng,
-    const trace_params& params);
-static sampler_func get_trace_sampler_func(const trace_params& params) {
+// Calls `func` with the sampler selected by the parameters. Samplers trace
+// a single ray from the camera, given the intersection of the camera ray.
+// Each sampler is passed as a callable of its own type, so that the code
+// instantiated for it calls the sampler directly.
+template <typename Func>
+static void dispatch_trace_sampler(const trace_params& params, Func&& func) {
   switch (params.sampler) {
-    case trace_sampler_type::path: return trace_path;
-    case trace_sampler_type::naive: return trace_naive;
-    case trace_sampler_type::eyelight: return trace_eyelight;
-    case trace_sampler_type::falsecolor: return trace_falsecolor;
-    case trace_sampler_type::albedo: return trace_albedo;
-    case trace_sampler_type::normal: return trace_normal;
-    default: {
-      throw std::runtime_error("sampler unknown");
-      return nullptr;
-    }
+    case trace_sampler_type::path:
+    case trace_sampler_type::wavefront:
+      return func([](auto&&... args) { return trace_path(args...); });
+    case trace_sampler_type::naive:
+      return func([](auto&&... args) { return trace_naive(args...); });
+    case trace_sampler_type::eyelight:
+      return func([](auto&&... args) { return trace_eyelight(args...); });
+    case trace_sampler_type::falsecolor:
+      return func([](auto&&... args) { return trace_falsecolor(args...); });
+    case trace_sampler_type::albedo:
+      return func([](auto&&... args) { return trace_albedo(args...); });
+    case trace_sampler_type::normal:
+      return func([](auto&&... args) { return trace_normal(args...); });
+    default: throw std::runtime_error("sampler unknown");
   }
 }
 
@@ -1717,6 +2748,7 @@ static sampler_func get_trace_sampler_func(const trace_params& params) {
 bool is_sampler_lit(const trace_params& params) {
   switch (params.sampler) {
     case trace_sampler_type::path: return true;
+    case trace_sampler_type::wavefront: return true;
     case trace_sampler_type::naive: return true;
     case trace_sampler_type::eyelight: return false;
     case trace_sampler_type::falsecolor: return false;
@@ -1729,26 +2761,319 @@ bool is_sampler_lit(const trace_params& params) {
   }
 }
 
-// Trace a block of samples
-void trace_sample(trace_state* state, const trace_scene* scene,
-    const trace_camera* camera, const trace_bvh* bvh,
-    const trace_lights* lights, const vec2i& ij, const trace_params& params) {
-  auto sampler = get_trace_sampler_func(params);
-  auto ray     = sample_camera(camera, ij, state->render.imsize(),
-      rand2f(state->rngs[ij]), rand2f(state->rngs[ij]), params.tentfilter);
-  auto sample  = sampler(scene, bvh, lights, ray, state->rngs[ij], params);
+// Accumulate a sample in a pixel. The render is updated by resolve_pixel().
+static void accumulate_sample(trace_state* state, const vec2i& ij,
+    const vec4f& sample_, const trace_params& params) {
+  auto sample = sample_;
   if (!isfinite(xyz(sample))) sample = {0, 0, 0, sample.w};
   if (max(sample) > params.clamp)
     sample = sample * (params.clamp / max(sample));
+  auto brightness = luminance(xyz(sample));
   state->accumulation[ij] += sample;
+  state->moments[ij] += brightness * brightness;
   state->samples[ij] += 1;
-  auto radiance = state->accumulation[ij].w != 0
-                      ? xyz(state->accumulation[ij]) / state->accumulation[ij].w
-                      : zero3f;
-  auto coverage     = state->accumulation[ij].w / state->samples[ij];
+}
+
+// Resolve a pixel of the render from its accumulated samples. Pixels with no
+// samples are left as they are.
+static void resolve_pixel(trace_state* state, const vec2i& ij) {
+  auto& accumulation = state->accumulation[ij];
+  auto  samples      = state->samples[ij];
+  if (samples == 0) return;
+  auto radiance = accumulation.w != 0 ? xyz(accumulation) / accumulation.w
+                                      : zero3f;
+  auto coverage     = accumulation.w / samples;
   state->render[ij] = {radiance.x, radiance.y, radiance.z, coverage};
 }
 
+// Resolve the whole render from the accumulated samples.
+static void resolve_render(trace_state* state, const trace_params& params) {
+  if (params.noparallel) {
+    for (auto j = 0; j < state->render.height(); j++) {
+      for (auto i = 0; i < state->render.width(); i++) {
+        resolve_pixel(state, {i, j});
+      }
+    }
+  } else {
+    parallel_for(state->render.width(), state->render.height(),
+        [state](int i, int j) { resolve_pixel(state, {i, j}); });
+  }
+}
+
+// Size of the square pixel tiles whose camera rays are intersected together.
+const auto trace_tile_size = 4;
+
+// Number of tiles that cover an image.
+static vec2i get_tiles(const image<vec4f>& render) {
+  return {(render.width() + trace_tile_size - 1) / trace_tile_size,
+      (render.height() + trace_tile_size - 1) / trace_tile_size};
+}
+
+// Luminance added to the mean of a pixel when computing its relative error,
+// so that dark pixels do not need many samples to converge.
+const auto trace_adaptive_bias = 0.01f;
+
+// Check whether a tile needs more samples with adaptive sampling.
+static bool is_tile_active(
+    const trace_state* state, const vec2i& tile, const trace_params& params) {
+  return params.target <= 0 || state->errors[tile] > params.target;
+}
+
+// Update the error of the tiles, as the largest relative standard error of
+// the mean of their pixels, estimated from the sample variance. Returns the
+// number of tiles whose error is above the target.
+static int update_tile_errors(trace_state* state, const trace_params& params) {
+  auto tiles  = get_tiles(state->render);
+  auto active = atomic<int>{0};
+  parallel_for(tiles.x, tiles.y, [state, &params, &active](int ti, int tj) {
+    auto tile  = vec2i{ti, tj};
+    auto error = 0.0f;
+    for (auto j = 0; j < trace_tile_size; j++) {
+      for (auto i = 0; i < trace_tile_size; i++) {
+        auto ij = tile * trace_tile_size + vec2i{i, j};
+        if (ij.x >= state->render.width() || ij.y >= state->render.height())
+          continue;
+        auto num = (float)state->samples[ij];
+        if (num < 2) {
+          error = flt_max;
+          continue;
+        }
+        auto mean     = luminance(xyz(state->accumulation[ij])) / num;
+        auto variance = max(state->moments[ij] / num - mean * mean, 0.0f) *
+                        num / (num - 1);
+        error = max(error, sqrt(variance / num) / (mean + trace_adaptive_bias));
+      }
+    }
+    state->errors[tile] = error;
+    if (error > params.target) active += 1;
+  });
+  return active;
+}
+
+// Trace a tile of samples. The camera rays of the tile are intersected as a
+// packet and each sample is then traced by the sampler. Packet entries
+// outside the image are empty rays.
+template <typename Sampler>
+static void trace_tile(trace_state* state, const trace_scene* scene,
+    const trace_camera* camera, const trace_bvh* bvh,
+    const trace_lights* lights, const vec2i& tile, const Sampler& sampler,
+    const trace_params& params) {
+  const auto size   = trace_tile_size * trace_tile_size;
+  auto       pixels = array<vec2i, size>{};
+  auto       rays   = array<ray3f, size>{};
+  auto       num    = 0;
+  for (auto j = 0; j < trace_tile_size; j++) {
+    for (auto i = 0; i < trace_tile_size; i++) {
+      auto ij = tile * trace_tile_size + vec2i{i, j};
+      if (ij.x >= state->render.width() || ij.y >= state->render.height())
+        continue;
+      pixels[num] = ij;
+      rays[num++] = sample_camera(camera, ij, state->render.imsize(),
+          rand2f(state->rngs[ij]), rand2f(state->rngs[ij]), params.tentfilter);
+    }
+  }
+  for (auto idx = num; idx < size; idx++)
+    rays[idx] = {zero3f, {0, 0, 1}, 1, 0};
+  auto intersections = intersect_bvh_packet(bvh, rays);
+  auto cone          = eval_camera_cone(camera, state->render.imsize());
+  for (auto idx = 0; idx < num; idx++) {
+    auto ij     = pixels[idx];
+    auto sample = sampler(scene, bvh, lights, rays[idx], cone,
+        intersections[idx], state->rngs[ij], params);
+    accumulate_sample(state, ij, sample, params);
+  }
+}
+
+// Resolve the pixels of a tile and report them to the callback.
+static void resolve_tile(trace_state* state, const vec2i& tile, int sample,
+    const trace_params& params, const async_callback& async_cb) {
+  for (auto j = 0; j < trace_tile_size; j++) {
+    for (auto i = 0; i < trace_tile_size; i++) {
+      auto ij = tile * trace_tile_size + vec2i{i, j};
+      if (ij.x >= state->render.width() || ij.y >= state->render.height())
+        continue;
+      resolve_pixel(state, ij);
+      async_cb(state->render, sample, params.samples, ij);
+    }
+  }
+}
+
+// Trace one sample for each pixel of the tiles that need samples.
+template <typename Sampler>
+static void trace_pass(trace_state* state, const trace_scene* scene,
+    const trace_camera* camera, const trace_bvh* bvh,
+    const trace_lights* lights, const Sampler& sampler,
+    const trace_params& params) {
+  auto tiles = get_tiles(state->render);
+  if (params.noparallel) {
+    for (auto j = 0; j < tiles.y; j++) {
+      for (auto i = 0; i < tiles.x; i++) {
+        if (!is_tile_active(state, {i, j}, params)) continue;
+        trace_tile(state, scene, camera, bvh, lights, {i, j}, sampler, params);
+      }
+    }
+  } else {
+    parallel_for(tiles.x, tiles.y, [&](int i, int j) {
+      if (!is_tile_active(state, {i, j}, params)) return;
+      trace_tile(state, scene, camera, bvh, lights, {i, j}, sampler, params);
+    });
+  }
+}
+
+// Number of pixels whose paths are traced together by the wavefront path
+// tracer.
+const auto trace_wavefront_size = 1 << 18;
+
+// Number of paths processed by each parallel task of the wavefront stages.
+const auto trace_wavefront_grain = 4096;
+
+// Path traced by the wavefront path tracer, with its pixel and the
+// intersection of its ray.
+struct trace_wavefront_path {
+  vec2i            ij           = {0, 0};
+  trace_path_state path         = {};
+  bvh_intersection intersection = {};
+};
+
+// Run `func(start, end)` over the paths in [0, num) split in chunks, that
+// are processed in parallel unless disabled.
+template <typename Func>
+static void parallel_paths(int num, const trace_params& params, Func&& func) {
+  auto chunks = (num + trace_wavefront_grain - 1) / trace_wavefront_grain;
+  auto chunk_func = [num, &func](int chunk) {
+    func(chunk * trace_wavefront_grain,
+        min(num, (chunk + 1) * trace_wavefront_grain));
+  };
+  if (params.noparallel) {
+    for (auto chunk = 0; chunk < chunks; chunk++) chunk_func(chunk);
+  } else {
+    parallel_for(chunks, chunk_func);
+  }
+}
+
+// Wavefront stage: generate the camera rays of the pixels in [start, end)
+// that still need samples.
+static void generate_paths(vector<trace_wavefront_path>& paths,
+    trace_state* state, const trace_scene* scene, const trace_camera* camera,
+    int start, int end, const trace_params& params) {
+  paths.clear();
+  for (auto idx = start; idx < end; idx++) {
+    auto ij = vec2i{idx % state->render.width(), idx / state->render.width()};
+    if (!is_tile_active(state, ij / trace_tile_size, params)) continue;
+    paths.push_back({ij, {}, {}});
+  }
+  auto cone = eval_camera_cone(camera, state->render.imsize());
+  parallel_paths((int)paths.size(), params, [&](int start_, int end_) {
+    for (auto idx = start_; idx < end_; idx++) {
+      auto ij  = paths[idx].ij;
+      auto ray = sample_camera(camera, ij, state->render.imsize(),
+          rand2f(state->rngs[ij]), rand2f(state->rngs[ij]), params.tentfilter);
+      paths[idx].path = init_path(scene, ray, cone, params);
+    }
+  });
+}
+
+// Wavefront stage: intersect the rays of all paths as ray streams.
+static void intersect_paths(vector<trace_wavefront_path>& paths,
+    const trace_bvh* bvh, const trace_params& params) {
+  parallel_paths((int)paths.size(), params, [&](int start, int end) {
+    auto rays = vector<ray3f>(end - start);
+    for (auto idx = start; idx < end; idx++) {
+      rays[idx - start] = paths[idx].path.ray;
+    }
+    auto intersections = intersect_bvh_stream(bvh, rays);
+    for (auto idx = start; idx < end; idx++) {
+      paths[idx].intersection = intersections[idx - start];
+    }
+  });
+}
+
+// Wavefront stage: sort paths by the material they hit and by direction,
+// so that shading works on one material at a time and that the rays
+// traced next are coherent. Paths that missed are first.
+static void sort_paths(vector<trace_wavefront_path>& paths,
+    const trace_bvh* bvh, const vector<int>& material_ids) {
+  auto keys = vector<pair<uint64_t, int>>(paths.size());
+  for (auto idx = 0; idx < (int)paths.size(); idx++) {
+    auto& path     = paths[idx];
+    auto  instance = get_instance_index(bvh, path.intersection.instance);
+    auto  material = path.intersection.hit ? material_ids[instance] + 1 : 0;
+    auto& d        = path.path.ray.d;
+    auto  octant   = (d.x < 0 ? 1 : 0) | (d.y < 0 ? 2 : 0) | (d.z < 0 ? 4 : 0);
+    keys[idx]      = {(uint64_t)material << 3 | octant, idx};
+  }
+  std::sort(keys.begin(), keys.end());
+  auto sorted = vector<trace_wavefront_path>(paths.size());
+  for (auto idx = 0; idx < (int)paths.size(); idx++) {
+    sorted[idx] = std::move(paths[keys[idx].second]);
+  }
+  paths = std::move(sorted);
+}
+
+// Wavefront stage: shade all paths, advancing them by one vertex.
+static void shade_paths(vector<trace_wavefront_path>& paths,
+    trace_state* state, const trace_scene* scene, const trace_bvh* bvh,
+    const trace_lights* lights, const trace_params& params) {
+  parallel_paths((int)paths.size(), params, [&](int start, int end) {
+    for (auto idx = start; idx < end; idx++) {
+      auto& path = paths[idx];
+      shade_path(scene, bvh, lights, path.path, path.intersection,
+          state->rngs[path.ij], params);
+    }
+  });
+}
+
+// Wavefront stage: accumulate the samples of the paths that are done and
+// remove them.
+static void accumulate_paths(vector<trace_wavefront_path>& paths,
+    trace_state* state, const trace_params& params) {
+  auto num = 0;
+  for (auto idx = 0; idx < (int)paths.size(); idx++) {
+    auto& path = paths[idx];
+    if (path.path.done) {
+      accumulate_sample(state, path.ij, get_path_sample(path.path), params);
+    } else {
+      if (num != idx) paths[num] = std::move(path);
+      num++;
+    }
+  }
+  paths.resize(num);
+}
+
+// Trace one sample per pixel with a wavefront path tracer. The paths of
+// trace_wavefront_size pixels at a time are advanced together, one vertex at
+// a time, by separate stages, that work on all paths and keep their code
+// and data in cache. Computes the same samples of the path sampler.
+void trace_wavefront(trace_state* state, const trace_scene* scene,
+    const trace_camera* camera, const trace_bvh* bvh,
+    const trace_lights* lights, const trace_params& params) {
+  // material indices of the instances
+  auto material_map = unordered_map<const trace_material*, int>{};
+  for (auto idx = 0; idx < (int)scene->materials.size(); idx++) {
+    material_map[scene->materials[idx]] = idx;
+  }
+  auto material_ids = vector<int>(scene->instances.size());
+  for (auto idx = 0; idx < (int)scene->instances.size(); idx++) {
+    material_ids[idx] = material_map.at(scene->instances[idx]->material);
+  }
+
+  // trace waves of paths
+  auto num_pixels = state->render.width() * state->render.height();
+  auto paths      = vector<trace_wavefront_path>{};
+  for (auto start = 0; start < num_pixels; start += trace_wavefront_size) {
+    if (state->stop) return;
+    auto end = min(start + trace_wavefront_size, num_pixels);
+    generate_paths(paths, state, scene, camera, start, end, params);
+    accumulate_paths(paths, state, params);
+    while (!paths.empty()) {
+      intersect_paths(paths, bvh, params);
+      sort_paths(paths, bvh, material_ids);
+      shade_paths(paths, state, scene, bvh, lights, params);
+      accumulate_paths(paths, state, params);
+    }
+  }
+}
+
 // Init a sequence of random number generators.
 void init_state(trace_state* state, const trace_scene* scene,
     const trace_camera* camera, const trace_params& params) {
@@ -1759,7 +3084,9 @@ void init_state(trace_state* state, const trace_scene* scene,
                               params.resolution};
   state->render.assign(image_size, zero4f);
   state->accumulation.assign(image_size, zero4f);
+  state->moments.assign(image_size, 0);
   state->samples.assign(image_size, 0);
+  state->errors.assign(get_tiles(state->render), flt_max);
   state->rngs.assign(image_size, {});
   auto rng_ = make_rng(1301081);
   for (auto& rng : state->rngs) {
@@ -1781,9 +3108,25 @@ void init_lights(trace_lights* lights, const trace_scene* scene,
 
   for (auto light : lights->lights) delete light;
   lights->lights.clear();
+  for (auto copy : lights->copies) delete copy;
+  lights->copies.clear();
 
+  // emissive instances, with copies of instance arrays made explicit
+  auto emissive = vector<trace_instance*>{};
   for (auto instance : scene->instances) {
     if (instance->material->emission == zero3f) continue;
+    if (instance->frames.empty()) {
+      emissive.push_back(instance);
+      continue;
+    }
+    for (auto& frame : instance->frames) {
+      emissive.push_back(lights->copies.emplace_back(
+          new trace_instance{frame * instance->frame, instance->shape,
+              instance->material, {}, instance->instance_id}));
+    }
+  }
+
+  for (auto instance : emissive) {
     auto shape = instance->shape;
     if (shape->triangles.empty() && shape->quads.empty()) continue;
     if (progress_cb) progress_cb("build light", progress.x++, ++progress.y);
@@ -1832,6 +3175,169 @@ void init_lights(trace_lights* lights, const trace_scene* scene,
     }
   }
 
+  // light powers
+  auto scene_bbox = invalidb3f;
+  for (auto instance : scene->instances) {
+    auto shape = instance->shape;
+    if (instance->frames.empty()) {
+      for (auto& position : shape->positions)
+        scene_bbox = merge(
+            scene_bbox, transform_point(instance->frame, position));
+    } else {
+      auto shape_bbox = invalidb3f;
+      for (auto& position : shape->positions)
+        shape_bbox = merge(shape_bbox, position);
+      for (auto& frame : instance->frames)
+        scene_bbox = merge(scene_bbox,
+            transform_bbox(frame * instance->frame, shape_bbox));
+    }
+  }
+  auto scene_radius = scene_bbox.min.x <= scene_bbox.max.x
+                          ? length(size(scene_bbox)) / 2
+                          : 1.0f;
+  lights->area_lights = 0;
+  lights->power       = 0;
+  lights->area_power  = 0;
+  for (auto light : lights->lights) {
+    if (light->instance != nullptr) {
+      auto emission = light->instance->material->emission;
+      light->power  = mean(emission) * light->elements_cdf.back();
+      lights->area_lights += 1;
+      lights->area_power += light->power;
+    } else if (light->environment != nullptr) {
+      auto emission = light->environment->emission;
+      auto texture  = light->environment->emission_tex;
+      if (texture != nullptr) {
+        auto size = texture_size(texture);
+        auto sum  = zero3f;
+        for (auto j = 0; j < size.y; j++)
+          for (auto i = 0; i < size.x; i++)
+            sum += xyz(lookup_texture(texture, {i, j}));
+        emission *= sum / max(size.x * size.y, 1);
+      }
+      light->power = mean(emission) * 4 * pif * pif * scene_radius *
+                     scene_radius;
+    }
+    lights->power += light->power;
+  }
+
+  // alias table, over all lights or only environments for light trees
+  lights->sampling = params.lights;
+  auto alias_start = params.lights == trace_light_sampling_type::tree &&
+                             lights->area_lights != 0
+                         ? lights->area_lights
+                         : 0;
+  auto alias_num   = (int)lights->lights.size() - alias_start;
+  auto alias_power = 0.0f;
+  for (auto idx = 0; idx < alias_num; idx++)
+    alias_power += lights->lights[alias_start + idx]->power;
+  lights->alias_probs = vector<float>(alias_num, 1);
+  lights->alias_ids   = vector<int>(alias_num, 0);
+  if (alias_power > 0) {
+    auto small = vector<int>{}, large = vector<int>{};
+    for (auto idx = 0; idx < alias_num; idx++) {
+      auto prob = lights->lights[alias_start + idx]->power * alias_num /
+                  alias_power;
+      lights->alias_probs[idx] = prob;
+      (prob < 1 ? small : large).push_back(idx);
+    }
+    while (!small.empty() && !large.empty()) {
+      auto less = small.back(), more = large.back();
+      small.pop_back();
+      lights->alias_ids[less] = more;
+      lights->alias_probs[more] -= 1 - lights->alias_probs[less];
+      if (lights->alias_probs[more] < 1) {
+        large.pop_back();
+        small.push_back(more);
+      }
+    }
+    for (auto idx : small) lights->alias_probs[idx] = 1;
+    for (auto idx : large) lights->alias_probs[idx] = 1;
+  } else {
+    for (auto idx = 0; idx < alias_num; idx++) lights->alias_ids[idx] = idx;
+  }
+
+  // light tree over the area lights, split at the median of the largest axis
+  lights->nodes.clear();
+  lights->leaves.clear();
+  if (params.lights == trace_light_sampling_type::tree &&
+      lights->area_lights != 0) {
+    auto bboxes = vector<bbox3f>(lights->area_lights, invalidb3f);
+    for (auto idx = 0; idx < lights->area_lights; idx++) {
+      auto instance = lights->lights[idx]->instance;
+      for (auto& position : instance->shape->positions)
+        bboxes[idx] = merge(
+            bboxes[idx], transform_point(instance->frame, position));
+    }
+    auto ids = vector<int>(lights->area_lights);
+    for (auto idx = 0; idx < lights->area_lights; idx++) ids[idx] = idx;
+    lights->leaves = vector<int>(lights->area_lights, 0);
+    lights->nodes.reserve(lights->area_lights * 2 - 1);
+    lights->nodes.emplace_back();
+    auto stack = vector<vec3i>{{0, 0, lights->area_lights}};
+    while (!stack.empty()) {
+      auto [nodeid, start, end] = stack.back();
+      stack.pop_back();
+      auto& node  = lights->nodes[nodeid];
+      auto  cbbox = invalidb3f;
+      for (auto i = start; i < end; i++) {
+        node.bbox = merge(node.bbox, bboxes[ids[i]]);
+        node.power += lights->lights[ids[i]]->power;
+        cbbox = merge(cbbox, center(bboxes[ids[i]]));
+      }
+      if (end - start == 1) {
+        node.start                 = ids[start];
+        lights->leaves[ids[start]] = nodeid;
+        continue;
+      }
+      auto csize = size(cbbox);
+      auto axis  = csize.x >= csize.y && csize.x >= csize.z
+                      ? 0
+                      : (csize.y >= csize.z ? 1 : 2);
+      auto mid = (start + end) / 2;
+      std::nth_element(ids.data() + start, ids.data() + mid, ids.data() + end,
+          [axis, &bboxes](auto a, auto b) {
+            return center(bboxes[a])[axis] < center(bboxes[b])[axis];
+          });
+      auto children = (int)lights->nodes.size();
+      lights->nodes[nodeid].internal = true;
+      lights->nodes[nodeid].start    = children;
+      lights->nodes.emplace_back().parent = nodeid;
+      lights->nodes.emplace_back().parent = nodeid;
+      stack.push_back({children, start, mid});
+      stack.push_back({children + 1, mid, end});
+    }
+  }
+
+  // bvh over the area lights, sharing the shape data with the scene
+  delete lights->bvh;
+  lights->bvh = nullptr;
+  if (lights->area_lights != 0) {
+    lights->bvh    = new bvh_scene{};
+    auto shape_ids = unordered_map<const trace_shape*, int>{};
+    auto light_shapes = vector<int>(lights->area_lights);
+    for (auto idx = 0; idx < lights->area_lights; idx++) {
+      auto shape = lights->lights[idx]->instance->shape;
+      auto it    = shape_ids.find(shape);
+      if (it == shape_ids.end()) {
+        it = shape_ids
+                 .insert({shape, add_shape(lights->bvh, shape->points,
+                                     shape->lines, shape->triangles,
+                                     shape->quads, shape->positions,
+                                     shape->radius, true)})
+                 .first;
+      }
+      light_shapes[idx] = it->second;
+    }
+    set_instances(lights->bvh, lights->area_lights,
+        [lights, light_shapes](int idx) {
+          return bvh_instance{
+              lights->lights[idx]->instance->frame, light_shapes[idx]};
+        });
+    init_bvh(lights->bvh,
+        bvh_params{(bvh_build_type)params.bvh, params.noparallel});
+  }
+
   // handle progress
   if (progress_cb) progress_cb("build light", progress.x++, progress.y);
 }
@@ -1851,7 +3357,21 @@ image<vec4f> trace_image(const trace_scene* scene, const trace_camera* camera,
   return trace_image(scene, camera, bvh, lights, params, progress_cb, image_cb);
 }
 
-// Progressively compute an image by calling trace_samples multiple times.
+// Check whether to stop sampling before a pass, since the time budget is
+// over or, with adaptive sampling, since all tiles reached the target error.
+static bool is_trace_done(trace_state* state,
+    const std::chrono::steady_clock::time_point& start, int sample,
+    const trace_params& params) {
+  if (params.budget > 0 &&
+      std::chrono::duration<float>(std::chrono::steady_clock::now() - start)
+              .count() >= params.budget)
+    return true;
+  if (params.target > 0 && sample >= max(params.minsamples, 2))
+    return update_tile_errors(state, params) == 0;
+  return false;
+}
+
+// Progressively compute an image by tracing one pass of samples at a time.
 image<vec4f> trace_image(const trace_scene* scene, const trace_camera* camera,
     const trace_bvh* bvh, const trace_lights* lights,
     const trace_params& params, const progress_callback& progress_cb,
@@ -1860,22 +3380,24 @@ image<vec4f> trace_image(const trace_scene* scene, const trace_camera* camera,
   auto state       = state_guard.get();
   init_state(state, scene, camera, params);
 
-  for (auto sample = 0; sample < params.samples; sample++) {
-    if (progress_cb) progress_cb("trace image", sample, params.samples);
-    if (params.noparallel) {
-      for (auto j = 0; j < state->render.height(); j++) {
-        for (auto i = 0; i < state->render.width(); i++) {
-          trace_sample(state, scene, camera, bvh, lights, {i, j}, params);
-        }
+  auto start = std::chrono::steady_clock::now();
+  dispatch_trace_sampler(params, [&](const auto& sampler) {
+    for (auto sample = 0; sample < params.samples; sample++) {
+      if (is_trace_done(state, start, sample, params)) break;
+      if (progress_cb) progress_cb("trace image", sample, params.samples);
+      if (params.sampler == trace_sampler_type::wavefront) {
+        trace_wavefront(state, scene, camera, bvh, lights, params);
+      } else {
+        trace_pass(state, scene, camera, bvh, lights, sampler, params);
+      }
+      trim_texture_cache(scene);
+      if (image_cb) {
+        resolve_render(state, params);
+        image_cb(state->render, sample + 1, params.samples);
       }
-    } else {
-      parallel_for(state->render.width(), state->render.height(),
-          [state, scene, camera, bvh, lights, &params](int i, int j) {
-            trace_sample(state, scene, camera, bvh, lights, {i, j}, params);
-          });
     }
-    if (image_cb) image_cb(state->render, sample + 1, params.samples);
-  }
+  });
+  resolve_render(state, params);
 
   if (progress_cb) progress_cb("trace image", params.samples, params.samples);
   return state->render;
@@ -1908,18 +3430,38 @@ void trace_start(trace_state* state, const trace_scene* scene,
 
   // start renderer
   state->worker = std::async(std::launch::async, [=]() {
-    for (auto sample = 0; sample < params.samples; sample++) {
-      if (state->stop) return;
-      if (progress_cb) progress_cb("trace image", sample, params.samples);
-      parallel_for(
-          state->render.width(), state->render.height(), [&](int i, int j) {
-            if (state->stop) return;
-            trace_sample(state, scene, camera, bvh, lights, {i, j}, params);
-            if (async_cb)
+    auto start = std::chrono::steady_clock::now();
+    dispatch_trace_sampler(params, [&](const auto& sampler) {
+      for (auto sample = 0; sample < params.samples; sample++) {
+        if (state->stop) return;
+        if (is_trace_done(state, start, sample, params)) break;
+        if (progress_cb) progress_cb("trace image", sample, params.samples);
+        if (params.sampler == trace_sampler_type::wavefront) {
+          trace_wavefront(state, scene, camera, bvh, lights, params);
+          if (async_cb || image_cb) resolve_render(state, params);
+          for (auto j = 0; j < state->render.height() && async_cb; j++) {
+            for (auto i = 0; i < state->render.width(); i++) {
               async_cb(state->render, sample, params.samples, {i, j});
+            }
+          }
+        } else {
+          auto tiles = get_tiles(state->render);
+          parallel_for(tiles.x, tiles.y, [&](int i, int j) {
+            if (state->stop || !is_tile_active(state, {i, j}, params)) return;
+            trace_tile(
+                state, scene, camera, bvh, lights, {i, j}, sampler, params);
+            if (async_cb) resolve_tile(state, {i, j}, sample, params, async_cb);
           });
-      if (image_cb) image_cb(state->render, sample + 1, params.samples);
-    }
+        }
+        trim_texture_cache(scene);
+        if (image_cb) {
+          resolve_render(state, params);
+          image_cb(state->render, sample + 1, params.samples);
+        }
+      }
+    });
+    if (state->stop) return;
+    resolve_render(state, params);
     if (progress_cb) progress_cb("trace image", params.samples, params.samples);
     if (image_cb) image_cb(state->render, params.samples, params.samples);
   });
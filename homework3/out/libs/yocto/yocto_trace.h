@@ -38,8 +38,10 @@
 // -----------------------------------------------------------------------------
 
 #include <atomic>
+#include <cstdio>
 #include <future>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <utility>
 #include <vector>
@@ -92,11 +94,70 @@ struct trace_camera {
   float   aperture     = 0;
 };
 
+// Tile of a texture MIP level, in the encoding of the texture image.
+struct trace_texture_tile {
+  vector<vec4f> hdr  = {};
+  vector<vec4b> ldr  = {};
+  atomic<int>   used = 0;  // clock of the texture cache at the last lookup
+};
+
+struct trace_texture;
+
+// Texture cache shared by the textures of a scene. It tracks the memory of
+// the texture tiles and, with a limit, evicts the least recently used ones
+// and pages the texture images from a temporary file. Lookups count
+// themselves as readers of the current phase. Evictions unlink tiles, then
+// flip the phase twice, waiting for the readers of the old phase each time,
+// before deleting them, so they can run while textures are evaluated.
+struct trace_texture_cache {
+  // readers counted in per-thread slots, on separate cache lines
+  struct alignas(64) trace_readers {
+    atomic<int> count = 0;
+  };
+
+  static const int num_slots = 16;
+
+  size_t                       limit    = 0;  // bytes, 0 disables eviction
+  atomic<size_t>               memory   = 0;
+  atomic<int>                  clock    = 0;
+  vector<const trace_texture*> textures = {};  // textures with tiles
+
+  // evictions
+  atomic<int>   phase                 = 0;
+  trace_readers readers[2][num_slots] = {};
+  std::mutex    trim_mutex            = {};
+
+  // paged images
+  FILE*      file       = nullptr;
+  std::mutex file_mutex = {};
+
+  // cleanup
+  ~trace_texture_cache();
+};
+
 // Texture containing either an LDR or HDR image. HdR images are encoded
-// in linear color space, while LDRs are encoded as sRGB.
+// in linear color space, while LDRs are encoded as sRGB. Filtered lookups
+// read a MIP pyramid whose levels, after the image itself, are stored in
+// tiles that are built on demand. Paged textures store also the image in
+// tiles, read from the file of the texture cache.
 struct trace_texture {
   image<vec4f> hdr = {};
   image<vec4b> ldr = {};
+
+  // mip pyramid, built while evaluating the texture
+  trace_texture_cache*                        cache  = nullptr;
+  mutable std::once_flag                      mipmap = {};
+  mutable vector<vec2i>                       levels = {};
+  mutable vector<int>                         starts = {};
+  mutable vector<atomic<trace_texture_tile*>> tiles  = {};
+
+  // image tiles paged from the cache file, set by init_texture_cache()
+  bool            paged     = false;
+  bool            paged_ldr = false;
+  vector<int64_t> offsets   = {};
+
+  // cleanup
+  ~trace_texture();
 };
 
 // Material for surfaces, lines and triangles.
@@ -173,11 +234,13 @@ struct trace_shape {
   int shape_id = -1;
 };
 
-// Object.
+// Object. Instance arrays place copies of the shape at frames[i] * frame,
+// without storing an object per copy.
 struct trace_instance {
   frame3f         frame    = identity3x4f;
   trace_shape*    shape    = nullptr;
   trace_material* material = nullptr;
+  vector<frame3f> frames   = {};  // copies, if not empty
 
   // instance id assigned at creation
   int instance_id = -1;
@@ -206,6 +269,10 @@ struct trace_scene {
   vector<trace_texture*>     textures     = {};
   vector<trace_material*>    materials    = {};
 
+  // texture cache
+  std::unique_ptr<trace_texture_cache> texture_cache =
+      std::make_unique<trace_texture_cache>();
+
   // cleanup
   ~trace_scene();
 };
@@ -228,6 +295,27 @@ trace_instance*    add_complete_instance(trace_scene* scene);
 
 }  // namespace yocto
 
+// -----------------------------------------------------------------------------
+// BINARY SCENES
+// -----------------------------------------------------------------------------
+namespace yocto {
+
+// Save and load a converted scene in a binary format, where each buffer is
+// stored as one block, so that loading is bound by disk reads. Scenes should
+// be saved after tesselation. MIP tiles are not stored, since they are built
+// on demand. Files store the camera used for rendering, the source files of
+// the scene and a key computed from them, and loads fail if the key does not
+// match. Sources are read first to compute the key.
+bool save_binary_scene(const string& filename, const trace_scene* scene,
+    const trace_camera* camera, const vector<string>& sources, uint64_t key,
+    string& error);
+bool load_binary_sources(
+    const string& filename, vector<string>& sources, string& error);
+bool load_binary_scene(const string& filename, trace_scene* scene,
+    trace_camera*& camera, uint64_t key, string& error);
+
+}  // namespace yocto
+
 // -----------------------------------------------------------------------------
 // EVALUATION OF SCENE PROPERTIES
 // -----------------------------------------------------------------------------
@@ -237,13 +325,20 @@ namespace yocto {
 ray3f eval_camera(
     const trace_camera* camera, const vec2f& image_uv, const vec2f& lens_uv);
 
-// Evaluates a texture
+// Evaluates a texture. Lookups with a footprint, that is the width of the
+// lookup in texture coordinates, are filtered with the MIP pyramid.
 vec2i texture_size(const trace_texture* texture);
 vec4f lookup_texture(
     const trace_texture* texture, const vec2i& ij, bool ldr_as_linear = false);
 vec4f eval_texture(const trace_texture* texture, const vec2f& uv,
     bool ldr_as_linear = false, bool no_interpolation = false,
-    bool clamp_to_edge = false);
+    bool clamp_to_edge = false, float footprint = 0);
+
+// Evicts the least recently used texture tiles until the texture cache is
+// within its limit and advances the cache clock. Lookups trim the cache when
+// they find it over the limit, and renders trim it after each pass. Should
+// not be called while evaluating a texture in the same thread.
+void trim_texture_cache(const trace_scene* scene);
 
 // Evaluate instance properties
 vec3f eval_position(
@@ -254,10 +349,10 @@ vec2f eval_texcoord(
     const trace_instance* instance, int element, const vec2f& uv);
 pair<vec3f, vec3f> eval_element_tangents(
     const trace_instance* instance, int element);
-vec3f eval_normalmap(
-    const trace_instance* instance, int element, const vec2f& uv);
+vec3f eval_normalmap(const trace_instance* instance, int element,
+    const vec2f& uv, float footprint = 0);
 vec3f eval_shading_normal(const trace_instance* instance, int element,
-    const vec2f& uv, const vec3f& outgoing);
+    const vec2f& uv, const vec3f& outgoing, float footprint = 0);
 vec4f eval_color(const trace_instance* instance, int element, const vec2f& uv);
 
 // Environment
@@ -286,8 +381,8 @@ struct trace_material_sample {
 };
 
 // Evaluates material and textures
-trace_material_sample eval_material(
-    const trace_material* material, const vec2f& texcoord);
+trace_material_sample eval_material(const trace_material* material,
+    const vec2f& texcoord, float footprint = 0);
 
 // Material Bsdf parameters
 struct trace_bsdf {
@@ -315,12 +410,14 @@ struct trace_bsdf {
 
 // Eval material to obtain emission, brdf and opacity.
 vec3f eval_emission(const trace_instance* instance, int element,
-    const vec2f& uv, const vec3f& normal, const vec3f& outgoing);
+    const vec2f& uv, const vec3f& normal, const vec3f& outgoing,
+    float footprint = 0);
 // Eval material to obatain emission, brdf and opacity.
 trace_bsdf eval_bsdf(const trace_instance* instance, int element,
-    const vec2f& uv, const vec3f& normal, const vec3f& outgoing);
+    const vec2f& uv, const vec3f& normal, const vec3f& outgoing,
+    float footprint = 0);
 float eval_opacity(const trace_instance* instance, int element, const vec2f& uv,
-    const vec3f& normal, const vec3f& outgoing);
+    const vec3f& normal, const vec3f& outgoing, float footprint = 0);
 // check if a brdf is a delta
 bool is_delta(const trace_bsdf& bsdf);
 
@@ -334,8 +431,8 @@ struct trace_vsdf {
 // check if we have a volume
 bool has_volume(const trace_instance* instance);
 // evaluate volume
-trace_vsdf eval_vsdf(
-    const trace_instance* instance, int element, const vec2f& uv);
+trace_vsdf eval_vsdf(const trace_instance* instance, int element,
+    const vec2f& uv, float footprint = 0);
 
 }  // namespace yocto
 
@@ -350,6 +447,9 @@ enum struct trace_bvh_type {
   highquality,
   middle,
   balanced,
+  wide4,
+  wide8,
+  compact,
 #ifdef YOCTO_EMBREE
   embree_default,
   embree_highquality,
@@ -365,6 +465,12 @@ enum struct trace_sampler_type {
   falsecolor,  // false color rendering
   albedo,      // renders the (approximate) albedo of objects for denoising
   normal,      // renders the normals of objects for denoising
+  wavefront,   // path tracing in wavefront stages over many paths
+};
+// Strategy used to pick the light sampled at each path vertex
+enum struct trace_light_sampling_type {
+  power,  // lights picked by power, in constant time
+  tree,   // lights picked by power and distance, with a light tree
 };
 // Type of false color visualization
 enum struct trace_falsecolor_type {
@@ -380,24 +486,33 @@ const auto trace_default_seed = 961748941ull;
 
 // Options for trace functions
 struct trace_params {
-  int                   resolution = 1280;
-  trace_sampler_type    sampler    = trace_sampler_type::path;
-  trace_falsecolor_type falsecolor = trace_falsecolor_type::diffuse;
-  int                   samples    = 512;
-  int                   bounces    = 8;
-  float                 clamp      = 100;
-  bool                  nocaustics = false;
-  bool                  envhidden  = false;
-  bool                  tentfilter = false;
-  uint64_t              seed       = trace_default_seed;
-  trace_bvh_type        bvh        = trace_bvh_type::default_;
-  bool                  noparallel = false;
-  int                   pratio     = 8;
-  float                 exposure   = 0;
+  int                       resolution = 1280;
+  trace_sampler_type        sampler    = trace_sampler_type::path;
+  trace_falsecolor_type     falsecolor = trace_falsecolor_type::diffuse;
+  trace_light_sampling_type lights     = trace_light_sampling_type::power;
+  int                       samples    = 512;
+  int                       bounces    = 8;
+  float                     clamp      = 100;
+  bool                      nocaustics = false;
+  bool                      envhidden  = false;
+  bool                      tentfilter = false;
+  uint64_t                  seed       = trace_default_seed;
+  trace_bvh_type            bvh        = trace_bvh_type::default_;
+  bool                      noparallel = false;
+  int                       pratio     = 8;
+  float                     exposure   = 0;
+  float                     target     = 0;      // relative error, 0 disables
+  int                       minsamples = 32;     // samples before adaptivity
+  float                     budget     = 0;      // seconds, 0 disables
+  bool                      mipmap     = false;  // filters textures
+  int                       texcache   = 0;      // megabytes, 0 disables
 };
 
 const auto trace_sampler_names = std::vector<std::string>{
-    "path", "naive", "eyelight", "falsecolor", "dalbedo", "dnormal"};
+    "path", "naive", "eyelight", "falsecolor", "dalbedo", "dnormal",
+    "wavefront"};
+
+const auto trace_light_sampling_names = vector<string>{"power", "tree"};
 
 const auto trace_falsecolor_names = vector<string>{"position", "normal",
     "frontfacing", "gnormal", "gfrontfacing", "texcoord", "color", "emission",
@@ -405,7 +520,8 @@ const auto trace_falsecolor_names = vector<string>{"position", "normal",
     "refraction", "roughness", "opacity", "ior", "instance", "element",
     "highlight"};
 const auto trace_bvh_names        = vector<string>{
-    "default", "highquality", "middle", "balanced",
+    "default", "highquality", "middle", "balanced", "wide4", "wide8",
+    "compact",
 #ifdef YOCTO_EMBREE
     "embree-default", "embree-highquality", "embree-compact"
 #endif
@@ -418,10 +534,14 @@ using progress_callback =
 using image_callback =
     function<void(const image<vec4f>& render, int current, int total)>;
 
-// Apply subdivision and displacement rules.
-void tesselate_shapes(
-    trace_scene* scene, const progress_callback& progress_cb = {});
-void tesselate_shape(trace_scene* shape);
+// Apply subdivision and displacement rules. Shapes are tesselated in
+// parallel. If a cache directory is given, subdivided and displaced shapes
+// are stored there, keyed by a hash of their data, and later runs load them
+// instead of tesselating again.
+void tesselate_shapes(trace_scene* scene,
+    const progress_callback& progress_cb = {}, const string& cachedir = "",
+    bool noparallel = false);
+void tesselate_shape(trace_shape* shape);
 
 // Progressively computes an image.
 image<vec4f> trace_image(const trace_scene* scene, const trace_camera* camera,
@@ -440,12 +560,41 @@ struct trace_light {
   trace_instance*    instance     = nullptr;
   trace_environment* environment  = nullptr;
   vector<float>      elements_cdf = {};
+  float              power        = 0;
+};
+
+// Node of a light tree over the area lights. Internal nodes have two
+// children, at start and start + 1, and leaves store the light at start.
+struct trace_light_node {
+  bbox3f bbox     = invalidb3f;
+  float  power    = 0;
+  int    start    = 0;
+  int    parent   = -1;
+  bool   internal = false;
 };
 
-// Scene lights
+// Scene lights. Area lights come first, followed by environments.
 struct trace_lights {
   // light elements
-  vector<trace_light*> lights = {};
+  vector<trace_light*> lights      = {};
+  int                  area_lights = 0;
+
+  // copies of emissive instance arrays, one for each light
+  vector<trace_instance*> copies = {};
+
+  // light selection by power, with an alias table over all lights
+  trace_light_sampling_type sampling    = trace_light_sampling_type::power;
+  float                     power       = 0;
+  vector<float>             alias_probs = {};
+  vector<int>               alias_ids   = {};
+
+  // light selection by power and distance, with a tree over the area lights
+  float                    area_power = 0;
+  vector<trace_light_node> nodes      = {};
+  vector<int>              leaves     = {};  // leaf node of each area light
+
+  // bvh of the area lights, used to find all lights along a direction
+  bvh_scene* bvh = nullptr;
 
   // cleanup
   ~trace_lights();
@@ -455,8 +604,19 @@ struct trace_lights {
 void init_lights(trace_lights* lights, const trace_scene* scene,
     const trace_params& params, const progress_callback& progress_cb = {});
 
-// Define BVH
-using trace_bvh = bvh_scene;
+// Sets the texture cache limit to params.texcache. With a limit, texture
+// images are moved to tiles paged from a temporary file, so that all MIP
+// levels are evicted when the cache is full. Should be called after the
+// scene is tesselated and its lights are built, and before rendering.
+bool init_texture_cache(
+    trace_scene* scene, const trace_params& params, string& error);
+
+// Define BVH. Copies of instance arrays are intersected as bvh instances,
+// numbered after the copies of the instances before them.
+struct trace_bvh : bvh_scene {
+  // bvh ids of the first copy of each instance, if the scene has arrays
+  vector<int> copy_ids = {};
+};
 
 // Build the bvh acceleration structure.
 void init_bvh(trace_bvh* bvh, const trace_scene* scene,
@@ -467,6 +627,14 @@ void update_bvh(trace_bvh* bvh, const trace_scene* scene,
     const vector<trace_instance*>& updated_instances,
     const vector<trace_shape*>& updated_shapes, const trace_params& params);
 
+// Save and load the bvh built by init_bvh(). Loading sets up the bvh for the
+// scene as init_bvh() does, and fails if the scene geometry or the bvh type
+// changed since saving. After a failed load, a new bvh should be built.
+bool save_bvh(const string& filename, const trace_bvh* bvh,
+    const trace_params& params, string& error);
+bool load_bvh(const string& filename, trace_bvh* bvh,
+    const trace_scene* scene, const trace_params& params, string& error);
+
 // Progressively computes an image.
 image<vec4f> trace_image(const trace_scene* scene, const trace_camera* camera,
     const trace_bvh* bvh, const trace_lights* lights,
@@ -476,11 +644,15 @@ image<vec4f> trace_image(const trace_scene* scene, const trace_camera* camera,
 // Check is a sampler requires lights
 bool is_sampler_lit(const trace_params& params);
 
-// [experimental] Asynchronous state
+// [experimental] Asynchronous state. With adaptive sampling, the sum of the
+// squared luminance of the samples of each pixel gives the pixel variance,
+// and tiles stop being sampled once their error is below the target.
 struct trace_state {
   image<vec4f>     render       = {};
   image<vec4f>     accumulation = {};
+  image<float>     moments      = {};  // adaptive, per pixel
   image<int>       samples      = {};
+  image<float>     errors       = {};  // adaptive, per tile
   image<rng_state> rngs         = {};
   future<void>     worker       = {};  // async
   atomic<bool>     stop         = {};  // async
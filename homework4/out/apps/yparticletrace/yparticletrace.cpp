@@ -37,7 +37,8 @@ using namespace yocto;
 #include <map>
 #include <memory>
 
-// construct a scene from io
+// construct a scene from io, moving shape and texture arrays out of the io
+// scene, that should not be used afterwards
 void init_scene(trace_scene* scene, sceneio_scene* ioscene,
     trace_camera*& camera, sceneio_camera* iocamera,
     progress_callback progress_cb = {}) {
@@ -67,8 +68,8 @@ void init_scene(trace_scene* scene, sceneio_scene* ioscene,
   for (auto iotexture : ioscene->textures) {
     if (progress_cb) progress_cb("convert texture", progress.x++, progress.y);
     auto texture           = add_texture(scene);
-    texture->hdr           = iotexture->hdr;
-    texture->ldr           = iotexture->ldr;
+    texture->hdr           = std::move(iotexture->hdr);
+    texture->ldr           = std::move(iotexture->ldr);
     texture_map[iotexture] = texture;
   }
 
@@ -112,19 +113,19 @@ void init_scene(trace_scene* scene, sceneio_scene* ioscene,
   for (auto ioshape : ioscene->shapes) {
     if (progress_cb) progress_cb("convert shape", progress.x++, progress.y);
     auto shape           = add_shape(scene);
-    shape->points        = ioshape->points;
-    shape->lines         = ioshape->lines;
-    shape->triangles     = ioshape->triangles;
-    shape->quads         = ioshape->quads;
-    shape->quadspos      = ioshape->quadspos;
-    shape->quadsnorm     = ioshape->quadsnorm;
-    shape->quadstexcoord = ioshape->quadstexcoord;
-    shape->positions     = ioshape->positions;
-    shape->normals       = ioshape->normals;
-    shape->texcoords     = ioshape->texcoords;
-    shape->colors        = ioshape->colors;
-    shape->radius        = ioshape->radius;
-    shape->tangents      = ioshape->tangents;
+    shape->points        = std::move(ioshape->points);
+    shape->lines         = std::move(ioshape->lines);
+    shape->triangles     = std::move(ioshape->triangles);
+    shape->quads         = std::move(ioshape->quads);
+    shape->quadspos      = std::move(ioshape->quadspos);
+    shape->quadsnorm     = std::move(ioshape->quadsnorm);
+    shape->quadstexcoord = std::move(ioshape->quadstexcoord);
+    shape->positions     = std::move(ioshape->positions);
+    shape->normals       = std::move(ioshape->normals);
+    shape->texcoords     = std::move(ioshape->texcoords);
+    shape->colors        = std::move(ioshape->colors);
+    shape->radius        = std::move(ioshape->radius);
+    shape->tangents      = std::move(ioshape->tangents);
     shape_map[ioshape]   = shape;
   }
 
@@ -183,7 +184,7 @@ void init_ptscene(particle_scene* ptscene, sceneio_scene* ioscene,
       auto nverts  = (int)ioshape->positions.size();
       auto ptshape = add_cloth(ptscene, ioshape->quads, ioshape->positions,
           ioshape->normals, ioshape->radius, 0.5, 1 / 8000.0,
-          {nverts - 1, nverts - (int)sqrt(nverts)});
+          {nverts - 1, nverts - (int)sqrt((float)nverts)});
       ptshapemap[ioshape] = ptshape;
     } else if (ioinstance->material->name == "collider") {
       add_collider(ptscene, ioshape->triangles, ioshape->quads,
@@ -221,6 +222,7 @@ int main(int argc, const char* argv[]) {
   add_option(cli, "--camera", camera_name, "Camera name.");
   add_option(cli, "--solver", ptparams.solver, "Solver", particle_solver_names);
   add_option(cli, "--frames", ptparams.frames, "Simulation frames.");
+  add_option(cli, "--bvhcache", ptparams.bvhcache, "Collider bvh cache dir.");
   add_option(cli, "--resolution", trparams.resolution, "Image resolution.");
   add_option(cli, "--samples", trparams.samples, "Number of samples.");
   add_option(
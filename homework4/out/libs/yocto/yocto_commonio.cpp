@@ -30,6 +30,7 @@
 #include "yocto_commonio.h"
 
 #include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <cstdio>
 #include <filesystem>
@@ -41,6 +42,12 @@
 #include <unordered_set>
 #include <vector>
 
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
 // -----------------------------------------------------------------------------
 // USING DIRECTIVES
 // -----------------------------------------------------------------------------
@@ -200,6 +207,46 @@ FILE* fopen_utf8(const char* filename, const char* mode) {
 #endif
 }
 
+// Write a file aside and rename it when complete
+bool save_atomic(const string& filename,
+    const function<bool(file_stream& fs)>& write, string& error) {
+  // unique name for concurrent writers, in the same and in other processes
+  static auto counter = std::atomic<uint64_t>{0};
+#ifdef _WIN32
+  auto pid = (int64_t)_getpid();
+#else
+  auto pid = (int64_t)getpid();
+#endif
+  auto tmpname = filename + "." + std::to_string(pid) + "." +
+                 std::to_string(counter++) + ".tmp";
+  auto tmppath = std::filesystem::u8path(tmpname);
+
+  // write
+  auto fs = open_file(tmpname, "wb");
+  if (!fs) {
+    error = filename + ": file not found";
+    return false;
+  }
+  auto written = write(fs);
+  if (written && fflush(fs.fs) != 0) written = false;
+  close_file(fs);
+  auto ec = std::error_code{};
+  if (!written) {
+    std::filesystem::remove(tmppath, ec);
+    error = filename + ": write error";
+    return false;
+  }
+
+  // rename, replacing the file if present
+  std::filesystem::rename(tmppath, std::filesystem::u8path(filename), ec);
+  if (ec) {
+    std::filesystem::remove(tmppath, ec);
+    error = filename + ": write error";
+    return false;
+  }
+  return true;
+}
+
 // Load a text file
 bool load_text(const string& filename, string& str, string& error) {
   // https://stackoverflow.com/questions/174531/how-to-read-the-content-of-a-file-to-a-string-in-c
@@ -269,6 +316,23 @@ bool save_binary(
 
 }  // namespace yocto
 
+// -----------------------------------------------------------------------------
+// HASHING
+// -----------------------------------------------------------------------------
+namespace yocto {
+
+// Add bytes to a hash
+void hash_data(fnv_hash& hash, const void* data, size_t count) {
+  auto bytes = (const unsigned char*)data;
+  auto value = hash.value;
+  for (auto i = (size_t)0; i < count; i++) {
+    value = (value ^ bytes[i]) * (uint64_t)1099511628211ull;
+  }
+  hash.value = value;
+}
+
+}  // namespace yocto
+
 // -----------------------------------------------------------------------------
 // PATH UTILITIES
 // -----------------------------------------------------------------------------
@@ -41,6 +41,7 @@
 // -----------------------------------------------------------------------------
 
 #include <array>
+#include <cstdint>
 #include <cstdio>
 #include <functional>
 #include <stdexcept>
@@ -315,6 +316,41 @@ inline bool write_value(file_stream& fs, const T& value_, bool big_endian) {
 // Opens a file with a utf8 file name
 FILE* fopen_utf8(const char* filename, const char* mode);
 
+// Write a file aside, under a name unique to this process and call, and
+// rename it to `filename` once `write` succeeds, so that readers never see
+// partial files. The temporary file is removed on failure.
+bool save_atomic(const string& filename,
+    const function<bool(file_stream& fs)>& write, string& error);
+
+}  // namespace yocto
+
+// -----------------------------------------------------------------------------
+// HASHING
+// -----------------------------------------------------------------------------
+namespace yocto {
+
+// 64 bit FNV-1a hash of the data added to it. Used as the key of files
+// cached on disk, since it does not change across platforms as std::hash.
+struct fnv_hash {
+  uint64_t value = 14695981039346656037ull;
+};
+
+// Add bytes to a hash
+void hash_data(fnv_hash& hash, const void* data, size_t count);
+
+// Add a value to a hash
+template <typename T>
+inline void hash_value(fnv_hash& hash, const T& value) {
+  hash_data(hash, &value, sizeof(T));
+}
+
+// Add an array to a hash, with its size
+template <typename T>
+inline void hash_values(fnv_hash& hash, const vector<T>& values) {
+  hash_value(hash, (uint64_t)values.size());
+  hash_data(hash, values.data(), values.size() * sizeof(T));
+}
+
 }  // namespace yocto
 
 // -----------------------------------------------------------------------------
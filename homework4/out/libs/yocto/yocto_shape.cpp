@@ -9,6 +9,7 @@
 #include "yocto_shape.h"
 
 #include <algorithm>
+#include <cstdio>
 #include <deque>
 #include <memory>
 #include <stdexcept>
@@ -925,6 +926,96 @@ void update_quads_bvh(shape_bvh& bvh, const vector<vec4i>& quads,
   update_bvh(bvh, bboxes);
 }
 
+// Hash of the geometry of a bvh
+uint64_t hash_shape_bvh(const vector<vec3i>& triangles,
+    const vector<vec4i>& quads, const vector<vec3f>& positions,
+    const vector<float>& radius) {
+  auto hash = fnv_hash{};
+  hash_values(hash, triangles);
+  hash_values(hash, quads);
+  hash_values(hash, positions);
+  hash_values(hash, radius);
+  return hash.value;
+}
+
+// Bvh file header
+static const auto shape_bvh_magic   = (uint64_t)0x4856424550414853ull;
+static const auto shape_bvh_version = 1;
+
+bool save_shape_bvh(const string& filename, const shape_bvh& bvh,
+    uint64_t hash, string& error) {
+  return save_atomic(
+      filename,
+      [&bvh, hash](file_stream& fs) {
+        // write header and arrays
+        auto nnodes      = (uint64_t)bvh.nodes.size();
+        auto nprimitives = (uint64_t)bvh.primitives.size();
+        if (!write_value(fs, shape_bvh_magic)) return false;
+        if (!write_value(fs, shape_bvh_version)) return false;
+        if (!write_value(fs, hash)) return false;
+        if (!write_value(fs, nnodes)) return false;
+        if (!write_value(fs, nprimitives)) return false;
+        if (!write_values(fs, bvh.nodes.data(), bvh.nodes.size()))
+          return false;
+        if (!write_values(fs, bvh.primitives.data(), bvh.primitives.size()))
+          return false;
+        return true;
+      },
+      error);
+}
+
+bool load_shape_bvh(const string& filename, shape_bvh& bvh, uint64_t hash,
+    string& error) {
+  auto read_error = [filename, &error]() {
+    error = filename + ": read error";
+    return false;
+  };
+  auto match_error = [filename, &error]() {
+    error = filename + ": out of date";
+    return false;
+  };
+
+  // open file
+  auto fs = open_file(filename, "rb");
+  if (!fs) {
+    error = filename + ": file not found";
+    return false;
+  }
+
+  // read header
+  auto magic       = (uint64_t)0;
+  auto version     = 0;
+  auto saved_hash  = (uint64_t)0;
+  auto nnodes      = (uint64_t)0;
+  auto nprimitives = (uint64_t)0;
+  if (!read_value(fs, magic)) return read_error();
+  if (!read_value(fs, version)) return read_error();
+  if (!read_value(fs, saved_hash)) return read_error();
+  if (!read_value(fs, nnodes)) return read_error();
+  if (!read_value(fs, nprimitives)) return read_error();
+  if (magic != shape_bvh_magic) return read_error();
+  if (version != shape_bvh_version || saved_hash != hash) return match_error();
+
+  // check sizes against the file length, then read arrays
+  auto offset = (uint64_t)ftell(fs.fs);
+  fseek(fs.fs, 0, SEEK_END);
+  auto length = (uint64_t)ftell(fs.fs) - offset;
+  fseek(fs.fs, (long)offset, SEEK_SET);
+  if (nnodes > length / sizeof(shape_bvh_node)) return read_error();
+  length -= nnodes * sizeof(shape_bvh_node);
+  if (nprimitives > length / sizeof(int)) return read_error();
+  auto nodes      = vector<shape_bvh_node>(nnodes);
+  auto primitives = vector<int>(nprimitives);
+  if (!read_values(fs, nodes.data(), nodes.size())) return read_error();
+  if (!read_values(fs, primitives.data(), primitives.size()))
+    return read_error();
+
+  // done
+  bvh.nodes      = std::move(nodes);
+  bvh.primitives = std::move(primitives);
+  return true;
+}
+
 // Intersect ray with a bvh.
 template <typename Intersect>
 static bool intersect_elements_bvh(const shape_bvh& bvh,
@@ -3533,32 +3624,69 @@ bool load_shape(const string& filename, vector<int>& points,
 
   auto ext = path_extension(filename);
   if (ext == ".ply" || ext == ".PLY") {
-    // open ply
-    auto ply_guard = std::make_unique<ply_model>();
-    auto ply       = ply_guard.get();
-    if (!load_ply(filename, ply, error)) return false;
-
-    if (!facevarying) {
-      // gets vertex
-      get_positions(ply, positions);
-      get_normals(ply, normals);
-      get_texcoords(ply, texcoords, flip_texcoord);
-      get_colors(ply, colors);
-      get_radius(ply, radius);
-
-      // get faces
-      if (has_quads(ply)) {
-        get_quads(ply, quads);
-      } else {
-        get_triangles(ply, triangles);
+    // stream ply, appending each block to the shape arrays
+    auto ply_guard  = std::make_unique<ply_model>();
+    auto ply        = ply_guard.get();
+    auto has_quads_ = false;
+    auto element_cb = [&](ply_model* ply, ply_element* element, size_t) {
+      auto append = [](auto& values, auto& block) {
+        if (values.empty()) {
+          std::swap(values, block);
+        } else {
+          values.insert(values.end(), block.begin(), block.end());
+        }
+      };
+      if (element->name == "vertex") {
+        auto positions_ = vector<vec3f>{}, normals_ = vector<vec3f>{};
+        auto texcoords_ = vector<vec2f>{};
+        get_positions(ply, positions_);
+        get_normals(ply, normals_);
+        get_texcoords(ply, texcoords_, flip_texcoord);
+        append(positions, positions_);
+        append(normals, normals_);
+        append(texcoords, texcoords_);
+        if (!facevarying) {
+          auto colors_ = vector<vec4f>{};
+          auto radius_ = vector<float>{};
+          get_colors(ply, colors_);
+          get_radius(ply, radius_);
+          append(colors, colors_);
+          append(radius, radius_);
+        }
+      } else if (element->name == "face" && !facevarying) {
+        // faces are read as triangles until the first quad, then as quads
+        if (!has_quads_ && has_quads(ply)) {
+          has_quads_ = true;
+          quads.reserve(triangles.size());
+          for (auto& t : triangles) quads.push_back({t.x, t.y, t.z, t.z});
+          triangles = {};
+        }
+        if (has_quads_) {
+          auto quads_ = vector<vec4i>{};
+          get_quads(ply, quads_);
+          append(quads, quads_);
+        } else {
+          auto triangles_ = vector<vec3i>{};
+          get_triangles(ply, triangles_);
+          append(triangles, triangles_);
+        }
+      } else if (element->name == "face" && facevarying) {
+        auto quads_ = vector<vec4i>{};
+        get_quads(ply, quads_);
+        append(quadspos, quads_);
+      } else if (element->name == "line" && !facevarying) {
+        auto lines_ = vector<vec2i>{};
+        get_lines(ply, lines_);
+        append(lines, lines_);
+      } else if (element->name == "point" && !facevarying) {
+        auto points_ = vector<int>{};
+        get_points(ply, points_);
+        append(points, points_);
       }
-      get_lines(ply, lines);
-      get_points(ply, points);
-    } else {
-      get_positions(ply, positions);
-      get_normals(ply, normals);
-      get_texcoords(ply, texcoords, flip_texcoord);
-      get_quads(ply, quadspos);
+      return true;
+    };
+    if (!stream_ply(filename, ply, element_cb, error)) return false;
+    if (facevarying) {
       if (!normals.empty()) quadsnorm = quadspos;
       if (!texcoords.empty()) quadstexcoord = quadspos;
     }
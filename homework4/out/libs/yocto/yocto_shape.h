@@ -283,6 +283,17 @@ void update_triangles_bvh(shape_bvh& bvh, const vector<vec3i>& triangles,
 void update_quads_bvh(
     shape_bvh& bvh, const vector<vec4i>& quads, const vector<vec3f>& positions);
 
+// Save and load a shape bvh. The file stores a hash of the geometry the tree
+// was built for, as computed by hash_shape_bvh(), and loading fails if it
+// does not match the hash passed in, in which case the bvh should be built.
+uint64_t hash_shape_bvh(const vector<vec3i>& triangles,
+    const vector<vec4i>& quads, const vector<vec3f>& positions,
+    const vector<float>& radius);
+bool save_shape_bvh(const string& filename, const shape_bvh& bvh,
+    uint64_t hash, string& error);
+bool load_shape_bvh(const string& filename, shape_bvh& bvh, uint64_t hash,
+    string& error);
+
 // Find a shape element or scene instances that intersects a ray,
 // returning either the closest or any overlap depending on `find_any`.
 // Returns the point distance, the instance id, the shape element index and
@@ -29,10 +29,12 @@
 
 #include "yocto_particle.h"
 
+#include <yocto/yocto_commonio.h>
 #include <yocto/yocto_geometry.h>
 #include <yocto/yocto_sampling.h>
 #include <yocto/yocto_shape.h>
 
+#include <cstdio>
 #include <stdexcept>
 #include <unordered_set>
 // -----------------------------------------------------------------------------
@@ -180,6 +182,18 @@ void init_simulation(particle_scene* scene, const particle_params& params) {
   // INITIALIZE COLLIDERS BVH
 
   for (auto& collider : scene->colliders) {
+    // colliders do not move, so their bvhs can be reused across runs
+    auto bvhname = string{};
+    auto hash    = (uint64_t)0;
+    auto error   = string{};
+    if (!params.bvhcache.empty()) {
+      hash = hash_shape_bvh(collider->triangles, collider->quads,
+          collider->positions, collider->radius);
+      char buffer[64];
+      snprintf(buffer, sizeof(buffer), "%016llx.bvh", (unsigned long long)hash);
+      bvhname = path_join(params.bvhcache, buffer);
+      if (load_shape_bvh(bvhname, collider->bvh, hash, error)) continue;
+    }
     if (!collider->quads.empty()) {
       collider->bvh = make_quads_bvh(
           collider->quads, collider->positions, collider->radius);
@@ -187,6 +201,8 @@ void init_simulation(particle_scene* scene, const particle_params& params) {
       collider->bvh = make_triangles_bvh(
           collider->triangles, collider->positions, collider->radius);
     }
+    if (!bvhname.empty() && make_directory(params.bvhcache, error))
+      save_shape_bvh(bvhname, collider->bvh, hash, error);
   }
 }
 
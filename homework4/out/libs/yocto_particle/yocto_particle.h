@@ -162,9 +162,11 @@ struct particle_params {
   float                minvelocity  = 0.01;
   vec2f                bounce       = {0.05f, 1};
   int                  seed         = 987121;
+  string               bvhcache     = "";
 };
 
-// Initialize the simulation state
+// Initialize the simulation state. If `bvhcache` is set, collider bvhs are
+// loaded from and saved to that directory, keyed by a hash of their geometry.
 void init_simulation(particle_scene* scene, const particle_params& params);
 
 // Simulate one frame